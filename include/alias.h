@@ -14,6 +14,10 @@ void alias_init(void);
 void alias_add(const char *name, const char *value);
 void alias_remove(const char *name);
 char *alias_get(const char *name);
+
+// Print aliases as "alias name=value" lines the shell can read back;
+// alias_print returns -1 if there is no such alias
+int alias_print(const char *name);
 void alias_print_all(void);
 
 #endif
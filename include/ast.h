@@ -5,6 +5,7 @@
 #define AST_H
 
 #include <stdlib.h>
+#include "lexer.h"
 
 typedef enum {
     NODE_COMMAND,
@@ -19,7 +20,9 @@ typedef enum {
     NODE_GROUP,
     NODE_FUNCTION,
     NODE_AND,
-    NODE_OR
+    NODE_OR,
+    NODE_NOT,   // ! pipeline
+    NODE_TIME   // time [-p] pipeline
 } NodeType;
 
 typedef struct CaseItem {
@@ -68,7 +71,8 @@ typedef struct {
 
 typedef struct ASTNode {
     NodeType type;
-    int lineno; // Line number from source
+    SourcePos pos; // Where the command starts (line 0 if unknown)
+    unsigned int cov; // First coverage counter, 0 if none (see coverage.h)
     union {
         CommandNode command;
         struct {
@@ -109,6 +113,10 @@ typedef struct ASTNode {
             char *name;
             struct ASTNode *body;
         } function;
+        struct {
+            struct ASTNode *pipeline; // NULL for time with nothing to time
+            int posix;                // time -p
+        } prefixed;
         CaseNode case_stmt;
     } data;
 } ASTNode;
@@ -128,9 +136,13 @@ ASTNode *ast_new_group(ASTNode *body);
 ASTNode *ast_new_function(const char *name, ASTNode *body);
 ASTNode *ast_new_case(const char *word, CaseItem *items, size_t item_count);
 ASTNode *ast_new_binary(NodeType type, ASTNode *left, ASTNode *right);
+// NODE_NOT or NODE_TIME
+ASTNode *ast_new_prefixed(NodeType type, ASTNode *pipeline, int posix);
 void ast_free(ASTNode *node);
 ASTNode *ast_copy(ASTNode *node);
 void ast_free_heap(ASTNode *node);
 ASTNode *ast_clone_to_heap(ASTNode *node);
+// 1 if both trees have the same shape and words; source positions are ignored
+int ast_equal(ASTNode *a, ASTNode *b);
 
 #endif
@@ -47,12 +47,8 @@
 /* Error handling mapping */
 /* FreeBSD sh uses error() for fatal errors (longjmp) and warn() for warnings */
 
-#include <setjmp.h>
-
-/* Global jump buffer for builtin error recovery */
-extern jmp_buf bltin_jmp;
-extern int bltin_error_status;
-
+/* Raises an exception with status 2, as FreeBSD test exits with 2 on error */
+__attribute__((noreturn))
 static inline void bltin_error(const char *fmt, ...) {
     /* Print shell name prefix */
     char *shell_name = posish_var_get_shell_name();
@@ -64,8 +60,7 @@ static inline void bltin_error(const char *fmt, ...) {
     error_vprintf(fmt, ap);
     va_end(ap);
     error_printf("\n");
-    bltin_error_status = 2; /* FreeBSD test exits with 2 on error */
-    longjmp(bltin_jmp, 1);
+    exception_raise(2);
 }
 
 static inline void bltin_warn(const char *fmt, ...) {
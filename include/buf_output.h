@@ -18,6 +18,16 @@ struct buf_out {
     size_t size;    // Buffer size
 };
 
+// fd of a buffer that collects a string instead of writing to a file;
+// it grows rather than flushing when full
+#define BUF_OUT_STRING (-2)
+
+// A buffer temporarily collecting a string (see buf_out_capture_begin)
+struct buf_capture {
+    struct buf_out *buf;
+    struct buf_out saved;
+};
+
 // Global stdout buffer
 extern struct buf_out buf_stdout;
 
@@ -37,12 +47,28 @@ void buf_out_reset(struct buf_out *buf);
 // Reset all registered buffers
 void buf_out_reset_all(void);
 
+// Send everything written to buf into a string until
+// buf_out_capture_end(), e.g. to run a builtin for $(...) without a pipe.
+// Output already buffered is flushed first; captures nest.
+void buf_out_capture_begin(struct buf_capture *cap, struct buf_out *buf);
+
+// Restore the buffer's target and return the captured text as a
+// NUL-terminated heap string; its length is stored in *len if non-NULL
+char *buf_out_capture_end(struct buf_capture *cap, size_t *len);
+
+// Drop a capture without looking at it (usable as a cleanup_fn)
+void buf_out_capture_abort(void *cap);
+
 // Slow path for character output (when buffer is full)
 void buf_out_putc_slow(int c, struct buf_out *buf);
 
 // Write string to buffer
 void buf_out_puts(const char *str, struct buf_out *buf);
 
+// Write a string so the shell reads it back as the same single word:
+// bare if it holds no special characters, otherwise in single quotes
+void buf_out_quoted(const char *str, struct buf_out *buf);
+
 // Formatted output to buffer
 void buf_out_printf(struct buf_out *buf, const char *fmt, ...);
 
@@ -59,6 +85,7 @@ void buf_out_printf(struct buf_out *buf, const char *fmt, ...);
 // Convenience macros for stdout
 #define OUT_PUTC(c) BUF_PUTC(c, &buf_stdout)
 #define OUT_PUTS(s) buf_out_puts(s, &buf_stdout)
+#define OUT_QUOTED(s) buf_out_quoted(s, &buf_stdout)
 #define OUT_PRINTF(...) buf_out_printf(&buf_stdout, __VA_ARGS__)
 #define OUT_FLUSH() buf_out_flush(&buf_stdout)
 
@@ -7,6 +7,11 @@
 int builtin_is_builtin(const char *name);
 int builtin_run(char **args);
 
+// command with the prefix assignments it was run with (X=1 command
+// prog): a program it runs gets them in its environment, as it would
+// without command; a builtin has them set in the shell
+int builtin_command_assigns(char **argv, char **assigns);
+
 // Individual builtins
 int builtin_cd(char **args);
 int builtin_echo(char **args);
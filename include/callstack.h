@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef CALLSTACK_H
+#define CALLSTACK_H
+
+#include <stdio.h>
+
+// The shell's own call stack: one frame for each function call, sourced
+// file, eval and trap action being run, with the place it was entered
+// from. It backs the caller builtin and the backtrace printed under
+// set -o backtrace when the shell exits on an error.
+
+struct call_frame {
+    const char *name; // Function name, or "source", "eval" or "trap"
+    int file;         // Call site, from input_file_id()
+    int line;
+    unsigned long id; // Frames are numbered in the order they are entered
+};
+
+extern struct call_frame *call_stack;
+extern int call_depth;
+
+// Where the command being run comes from. executor_execute() keeps it
+// current; it is plain stores so the cost per command stays nil.
+extern int call_file;
+extern int call_line;
+
+// Enter a frame called from the current position. name must outlive
+// the frame.
+void callstack_push(const char *name);
+
+// Leave the newest frame and go back to its call site. Takes an unused
+// argument so it can be registered with cleanup_push().
+void callstack_pop(void *unused);
+
+// Name of a file number as shown to the user, malloc'd; file 0 (-c,
+// standard input) is named after the shell as in diagnostics
+char *callstack_file_name(int file);
+
+// Print the stack as "  at FILE:LINE in NAME" lines, newest frame first.
+// With limit, only that many of the newest frames are listed before
+// main, the rest counted.
+#define CALLSTACK_BRIEF 10
+void callstack_print(FILE *out, int limit);
+
+// Print the stack to stderr under a heading if set -o backtrace is on
+void callstack_backtrace(void);
+
+#endif
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "ast.h"
+
+// Line and branch coverage of script files, written in lcov format.
+//
+// Each construct with a source position gets a block of counters when it
+// is parsed, and ASTNode.cov holds the index of the first one: the times
+// the node was run, then one counter per branch it can take. Sites are
+// keyed by position, so parsing the same text again (a function defined
+// in a loop, a sourced file read twice) lands on the same counters, and
+// running a node costs one increment.
+//
+// Branches: if has then/else, while and until have body/exit, && and ||
+// have right side run/skipped and case has one per arm and a last one
+// for no arm matching.
+
+// Counter blocks indexed by ASTNode.cov; NULL when coverage is off
+extern unsigned long *coverage_counts;
+
+#define COVERAGE_HIT(node) \
+    do { if ((node)->cov) coverage_counts[(node)->cov]++; } while (0)
+#define COVERAGE_BRANCH(node, n) \
+    do { if ((node)->cov) coverage_counts[(node)->cov + 1 + (n)]++; } while (0)
+
+// Start recording, to be written to path when the shell exits
+void coverage_start(const char *path);
+
+// Give every command in a script file counters before it runs, so lines
+// that are never reached are reported too. Done once per file.
+void coverage_register_file(int file);
+
+// Attach counters to a parsed tree from a registered file
+void coverage_instrument(ASTNode *node);
+
+// Called in a forked child that goes on running shell code: it reports
+// only what it runs itself
+void coverage_forked(void);
+
+// Merge the counts into the output file and reset them. The file is
+// locked while it is rewritten, so shells running at the same time
+// (subshells, pipelines, scripts starting scripts) add up correctly.
+void coverage_flush(void);
+
+#endif
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef CSTACK_H
+#define CSTACK_H
+
+// The C stack the shell runs on. Shell code recurses on it: function
+// calls, eval, ., $(...), traps and nested compound commands all come
+// back through executor_execute(), and the parser and arithmetic recurse
+// on nested input. The shell runs on a stack of its own, reserved large
+// but only given memory as it is used, so deep recursion does not depend
+// on the ulimit -s the shell was started with. What recurses checks for
+// the end of it and fails with an error instead of crashing.
+
+// Run main_fn on that stack and return what it returns
+int cstack_run(int (*main_fn)(int, char **), int argc, char **argv);
+
+extern char *cstack_limit;
+
+// Nonzero when the stack is nearly used up; one comparison
+#define CSTACK_LOW() ((char *)__builtin_frame_address(0) < cstack_limit)
+
+// Report that shell code nests too deeply, with the innermost calls, and
+// raise the error. The stack below the limit is kept for unwinding and
+// the EXIT trap.
+void cstack_overflow(void) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "ast.h"
+
+// posish --debug: an interactive debugger on the controlling terminal.
+// It stops before simple commands: the first one, then as the user
+// steps or when a breakpoint on a line or function is reached. Only the
+// shell process itself stops; subshells, pipelines and $(...) run on.
+
+// Set while the debugger is attached
+extern int debug_active;
+
+// The check executor_execute() makes for every node
+#define DEBUG_HOOK(node) \
+    do { if (debug_active) debugger_hook(node); } while (0)
+
+// Attach to /dev/tty and stop before the first command. Returns -1
+// with a message if there is no terminal to talk to.
+int debugger_start(void);
+
+void debugger_hook(ASTNode *node);
+
+#endif
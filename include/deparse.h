@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef DEPARSE_H
+#define DEPARSE_H
+
+#include "ast.h"
+#include "buf_output.h"
+
+// Turn parsed commands back into shell source. The output is canonical:
+// one command per line, bodies indented by four spaces, here-document
+// bodies after the line that uses them. Parsing it again gives a tree
+// ast_equal() to the original. Comments are not part of the tree and
+// are lost.
+
+// Write a command list, each command ending in a newline
+void deparse(ASTNode *node, struct buf_out *out);
+
+// Write a function definition as "name() body"
+void deparse_function(const char *name, ASTNode *body, struct buf_out *out);
+
+// posish --format: print each file (standard input if the NULL-terminated
+// list is empty) in canonical form. Returns 0 on success, 1 if a file
+// could not be read or would not parse back to the same commands and 2
+// on syntax errors.
+int format_files(char **paths);
+
+#endif
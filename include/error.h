@@ -4,8 +4,71 @@
 #ifndef ERROR_H
 #define ERROR_H
 
+#include <setjmp.h>
+#include "memalloc.h"
+#include "lexer.h"
+
 void error_msg(const char *fmt, ...);
 void error_sys(const char *fmt, ...);
 void error_fatal(const char *fmt, ...);
 
+// Diagnostics about the script itself (syntax errors and the like) name
+// the place they refer to. They are written as "file:line:col: message",
+// or with --diagnostics=json as one JSON object per line so editors and
+// CI can read them. Severity is "error", "warning" or "style"; code is a short
+// stable identifier such as "syntax".
+enum {
+    DIAG_TEXT,
+    DIAG_JSON
+};
+
+extern int diag_format;
+
+void diag_report(const SourcePos *pos, const char *severity, const char *code,
+                 const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+// Errors that abandon the command being run (a failed ${var?}, an
+// assignment to a readonly variable, ...) unwind to the innermost
+// handler, installed as:
+//
+//     struct jmploc jl;
+//     if (setjmp(jl.loc)) {
+//         status = exception_status;
+//     } else {
+//         exception_push(&jl);
+//         status = ...;
+//         exception_pop(&jl);
+//     }
+//
+// Unwinding runs the cleanups registered since the handler was pushed
+// and releases arena memory allocated since then. Without a handler the
+// shell runs its EXIT trap and exits, as POSIX requires of a
+// non-interactive shell.
+struct jmploc {
+    jmp_buf loc;
+    struct jmploc *prev;
+    size_t cleanup_depth;
+    struct stackmark mark;
+};
+
+extern struct jmploc *exception_handler;
+extern int exception_status;
+
+void exception_push(struct jmploc *jl);
+void exception_pop(struct jmploc *jl);
+void exception_raise(int status) __attribute__((noreturn));
+
+// Report an error like error_msg() and raise it with status
+void error_raise(int status, const char *fmt, ...) __attribute__((noreturn));
+
+// State saved for the duration of a command (descriptors, variable
+// scopes, positional parameters) registers its restore here. Both calls
+// only move the top of an array, so the normal path stays cheap.
+typedef void (*cleanup_fn)(void *arg);
+
+void cleanup_push(cleanup_fn fn, void *arg);
+
+// Drop the newest cleanup, running it first if run is set
+void cleanup_pop(int run);
+
 #endif
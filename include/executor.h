@@ -5,6 +5,7 @@
 #define EXECUTOR_H
 
 #include "ast.h"
+#include "input.h"
 
 #define EXIT_BREAK 100
 #define EXIT_CONTINUE 101
@@ -18,7 +19,11 @@ extern int executor_no_fork;
 int executor_execute(struct ASTNode *node);
 int executor_get_last_status(void);
 void executor_set_last_status(int status);
-char *find_executable(const char *command);
+int executor_run_source(InputSource *src);
+
+// Run body as the function argv[0] with the rest of argv as its
+// arguments, as for a command naming a function or stub
+int executor_call_function(struct ASTNode *body, char **argv);
 
 
 #endif
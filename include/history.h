@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// Command history. Every entry has an event number that increases by one
+// per command; only the newest HISTSIZE entries are kept. Entries may
+// span several lines.
+
+// Load history from a file and remember it for appending
+void history_init(const char *filename);
+
+// Add a command (a trailing newline is dropped)
+void history_add(const char *line);
+
+// Replace the newest entry, e.g. "fc" by the command it re-executed
+void history_replace_last(const char *line);
+
+// Number of entries kept
+int history_length(void);
+
+// Get an entry by position, 0 being the oldest kept
+// Returns NULL if index out of bounds
+const char *history_get(int index);
+
+// Event numbers of the oldest and newest entries (newest < oldest when
+// the history is empty)
+int history_first_event(void);
+int history_last_event(void);
+
+// Get an entry by event number, or NULL if it is not kept
+const char *history_get_event(int event);
+
+// Event number of the newest entry at or before event "before" that
+// starts with prefix, or -1
+int history_find_prefix(const char *prefix, int before);
+
+#endif
@@ -5,6 +5,22 @@
 #define INPUT_H
 
 #include <stdio.h>
+#include <sys/types.h>
+
+/* Where non-interactive commands come from: a script file or a string.
+ * Files are read with read(2) into a private buffer rather than through
+ * stdio, so forked children exiting cannot disturb the read position. */
+typedef struct {
+    int fd;              /* -1 for string sources */
+    const char *string;
+    size_t string_pos;
+    char *buf;
+    size_t buf_pos;
+    size_t buf_len;
+    int lineno;          /* Line number of the next line to be read */
+    size_t offset;       /* Byte offset of the next line to be read */
+    int file;            /* Name for diagnostics, from input_file_id() */
+} InputSource;
 
 /* Check if stdin is a TTY */
 int input_is_tty(void);
@@ -18,4 +34,35 @@ int input_read_char(char *c);
 /* Read from stdin using getline */
 ssize_t input_getline(char **lineptr, size_t *n);
 
+/* Set up a source reading from an open descriptor */
+void input_source_fd(InputSource *src, int fd);
+
+/* Set up a source reading from a string (for -c) */
+void input_source_string(InputSource *src, const char *string);
+
+/* Release the buffer and close the descriptor of a source */
+void input_source_close(InputSource *src);
+
+/* Open a script for reading, keeping its descriptor out of the way of
+ * redirections made by the script itself. Returns -1 on failure. */
+int input_open_script(const char *path);
+
+/* Read the next line including its newline; echoed to stderr under set -v.
+ * Returns a malloc'd string or NULL at end of input. */
+char *input_source_read_line(InputSource *src);
+
+/* Read the rest of a descriptor into a NUL-terminated malloc'd buffer,
+ * storing its length in *len. Returns NULL on a read error. */
+char *input_read_all(int fd, size_t *len);
+
+/* Number naming a script file in source positions; the same name always
+ * gets the same number. 0 stands for the shell itself (-c, stdin). */
+int input_file_id(const char *name);
+
+/* Name of a file number, or NULL for 0 */
+const char *input_file_name(int file);
+
+/* Echo a line of input to stderr if set -v is in effect */
+void input_echo_line(const char *line);
+
 #endif /* INPUT_H */
@@ -5,6 +5,7 @@
 #define JOBS_H
 
 #include <sys/types.h>
+#include <termios.h>
 
 typedef enum {
     JOB_RUNNING,
@@ -13,25 +14,118 @@ typedef enum {
     JOB_TERMINATED
 } JobStatus;
 
+// One process of a job; a pipeline has one per command
+typedef struct JobProcess {
+    pid_t pid;
+    JobStatus status;
+    int wait_status;   // Raw status from waitpid() once it changed
+    char *command;
+} JobProcess;
+
+// A job is a pipeline: its processes share the process group pgid,
+// which is the pid of the first one
 typedef struct Job {
     int id;
     pid_t pgid;
     char *command;
+    JobProcess *procs;
+    int nprocs;
     JobStatus status;
+    int exit_status;   // $?-style status once stopped or finished
+    int background;    // Started with & (reported when it changes state)
+    int changed;       // State changed since it was last reported
+    unsigned long used; // When it last became the current job
+    int has_tmodes;
+    struct termios tmodes; // Terminal modes saved when it was stopped
     struct Job *next;
 } Job;
 
 void job_init(void);
+
+// The shell's process ID, $$; subshells keep the one of the shell
+pid_t job_shell_pid(void);
+
+// Take control of the terminal for an interactive shell and turn on
+// job control (set -m)
+void job_control_init(void);
+
+// Whether commands run in this process get their own process groups:
+// set -m is on and this is the shell itself, not a subshell
+int job_control_active(void);
+
+// Start a job whose first process is pgid, then add the rest of a
+// pipeline with job_add_process(). The caller puts the processes into
+// the process group.
 Job *job_add(pid_t pgid, const char *command, JobStatus status);
+void job_add_process(Job *j, pid_t pid, const char *command);
+
+// In a child forked for a job under job control: join process group
+// pgid (0 starts a new one), take the terminal if it runs in the
+// foreground and restore default job control signals (see
+// signal_child_defaults()). Only makes
+// system calls, so it is safe after vfork().
+void job_child_init(pid_t pgid, int foreground);
+
+// Run a job in the foreground, continuing it first if cont is set, and
+// take the terminal back afterwards. Returns its $?-style status; the
+// job is released unless it stopped, and one killed by SIGINT
+// interrupts the shell (see signal_foreground_status()).
+int job_foreground(Job *j, int cont);
+
+// Continue a stopped job in the background
+void job_background(Job *j);
+
 void job_remove(int id);
-Job *job_find_by_pid(pid_t pgid);
+// Job with a process pid
+Job *job_find_by_pid(pid_t pid);
 Job *job_find_by_id(int id);
-void job_print_all(void);
-void job_update_status(pid_t pgid, JobStatus status);
+
+// Resolve a job spec (%n, %%, %+, %-, %string, %?string; a bare number
+// is taken as %n). NULL resolves to the current job. Reports errors
+// prefixed by caller and returns NULL.
+Job *job_find_spec(const char *spec, const char *caller);
 void job_update_status(pid_t pgid, JobStatus status);
 int job_get_next_id(void);
-pid_t job_resolve_spec(const char *spec);
 int job_wait(Job *j);
-int job_wait_all(void);
+
+// For the wait builtin: like job_wait(), but a signal the shell acts on
+// (one with a trap, or SIGINT without) ends the wait first. Returns its
+// number, leaving the job running, or 0 once the job is done with its
+// status in *status. job_wait_all() waits for every job that way.
+int job_wait_signal(Job *j, int *status);
+int job_wait_all(int *status);
+
+// Output styles of job_list()
+enum {
+    JOB_LIST_NORMAL,
+    JOB_LIST_LONG,     // jobs -l: one line per process with its pid
+    JOB_LIST_PGID      // jobs -p: process group ids only
+};
+
+// List one job (or all if j is NULL) to stdout for the jobs builtin
+void job_list(Job *j, int style);
+
+// Drop a job once its final status has been collected
+void job_release(Job *j);
+
+// Children are reaped by the SIGCHLD handler into a signal-safe queue;
+// job_reap() moves what it collected into the job table.
+void job_reap(void);
+
+// Wait for a child that is not in the job table; returns its raw
+// wait status
+int job_wait_pid(pid_t pid);
+
+// Exit status of a finished background job that has already been
+// reported and removed. Returns 0 if found.
+int job_saved_status(pid_t pid, int *status);
+
+// Report background jobs that changed state, removing finished ones
+void job_notify(void);
+int job_notify_pending(void);
+
+// Descriptor that becomes readable when a child changes state, so a
+// blocked reader can poll for it (set -b). Created on first use.
+int job_wakeup_fd(void);
 
 #endif
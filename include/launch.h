@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "ast.h"
+
+/*
+ * vfork() was removed from POSIX.1-2008, so _POSIX_C_SOURCE=200809L hides it.
+ * We explicitly declare it here because we want the performance benefits
+ * of vfork() on systems that support it (Linux, BSDs, QNX), even when compiling
+ * in strict POSIX mode.
+ *
+ * On QNX, vfork() is deprecated but still functional and faster than fork().
+ * We suppress the deprecation warning to maintain performance.
+ */
+#if defined(__QNX__)
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+extern pid_t vfork(void);
+#endif
+
+// Always use vfork for performance (safe because we control child execution)
+#define POSISH_FORK() vfork()
+
+// Starting programs. A simple command run in the foreground, as a
+// pipeline stage, asynchronously or in $(...), and the exec and command
+// builtins all come here, so every program gets the same lookup, the
+// shell's exported variables as its environment and the same signals.
+//
+// A process forked only to run one command (executor_no_fork) becomes
+// the program instead of forking again.
+
+// The file running name as a command would execute: name itself if it
+// contains a slash, else the first executable regular file of that name
+// in the directories of PATH. Paths found are remembered until PATH
+// changes (the hash builtin). search_path, if not NULL, is searched
+// instead of PATH and bypasses the table. Returns a mem_stack string, or
+// NULL if there is none.
+char *launch_find(const char *name, const char *search_path);
+
+// Run the program at path with argv, and wait for it as a foreground job
+// listed as command. Its environment is the exported variables with the
+// "name=value" strings of assigns (NULL, or NULL terminated) over them;
+// redirs are applied in the child. Returns its $?-style status.
+int launch_program(const char *path, char **argv, char **assigns,
+                   Redirection *redirs, size_t redir_count, const char *command);
+
+// Replace the shell with argv[0] (exec), with assigns over its
+// environment as for launch_program(). Returns only if that fails, with
+// the status to fail with, after reporting it.
+int launch_exec(char **argv, char **assigns);
+
+// The remembered paths: forget name's, or all of them if name is NULL;
+// print them, one per line
+void launch_hash_forget(const char *name);
+void launch_hash_print(void);
+
+#endif
@@ -16,10 +16,19 @@ typedef enum {
     TOKEN_ERROR
 } TokenType;
 
+// A place in shell source. Columns count bytes from 1; the offset is
+// from the start of the file (or string) the source was read from.
+typedef struct {
+    int file;       // See input_file_id(); 0 is the shell's own input
+    int line;
+    int column;
+    size_t offset;
+} SourcePos;
+
 typedef struct {
     TokenType type;
     char *value; // malloc'd string, caller must free
-    int lineno; // Line number where token starts
+    SourcePos pos; // Where the token starts
 } Token;
 
 typedef struct {
@@ -28,15 +37,63 @@ typedef struct {
     size_t len;
     int current_line; // Current line number
     TokenType last_token_type; // For alias expansion context
+    int no_alias; // Set to disable alias expansion
+    int quiet;    // Set to leave syntax errors unreported
+
+    // Positions are reported in terms of the original text even after
+    // alias expansion has replaced the input: text before splice_end
+    // came from an alias and is reported at the aliased word, anything
+    // after it sits at input offset pos + delta.
+    int file;
+    size_t base_offset; // Offset of the input within its file
+    size_t line_start;  // Original offset of the current line
+    size_t splice_end;
+    size_t splice_origin;
+    long delta;
 } Lexer;
 
+// Incremental completeness check over a buffer that grows a line at a
+// time. Each call only tokenizes the lines added since the last one.
+typedef struct {
+    size_t pos; // Start of the first line not yet scanned
+    int if_count;
+    int while_count; // Tracks while/until
+    int for_count;
+    int case_count;
+    int brace_count;
+    int paren_count;
+    int pipe_open; // Last token was |, && or || so the command goes on
+    struct {
+        char *delimiter;
+        int strip_tabs;
+    } *heredocs; // Here-documents still waiting for their bodies
+    size_t heredoc_count;
+    size_t heredoc_cap;
+} LexerScan;
+
 void lexer_init(Lexer *lexer, const char *input);
 Token lexer_next_token(Lexer *lexer);
+
+// Position of the next character the lexer will read
+SourcePos lexer_position(const Lexer *lexer);
 char *lexer_read_until_delimiter(Lexer *lexer, const char *delimiter, int strip_tabs);
 void free_token(Token token);
 
-// Check if input is incomplete (unclosed quotes, trailing backslash)
+// Check if input is incomplete (unclosed quotes, trailing backslash,
+// open compound commands, unterminated here-documents, a trailing
+// pipe or &&/||)
 // Returns 0 if complete, >0 if incomplete
 int lexer_check_incomplete(const char *input);
 
+void lexer_scan_init(LexerScan *scan);
+int lexer_scan_incomplete(LexerScan *scan, const char *input, size_t len);
+
+// What input that stopped short still lacks, by the value the checks
+// above returned, e.g. "fi"; NULL if there is nothing to name
+const char *lexer_incomplete_missing(int incomplete);
+void lexer_scan_free(LexerScan *scan);
+
+// Delimiter of a here-document after quote removal (caller must free)
+char *lexer_heredoc_delimiter(const char *word);
+
 #endif
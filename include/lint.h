@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef LINT_H
+#define LINT_H
+
+// posish --lint: parse scripts without running them and report common
+// defects through diag_report(). Every finding has a stable code that a
+// "# posish-lint: ignore=code" comment can suppress.
+
+// Lint each file in the NULL-terminated list, or standard input if it
+// is empty. Returns 0 if nothing was found, 1 if there were findings and
+// 2 if a file could not be read or had syntax errors.
+int lint_files(char **paths);
+
+#endif
@@ -7,7 +7,17 @@
 #include "lexer.h"
 #include "ast.h"
 
+// Parse a complete command. Syntax errors are reported through
+// diag_report() and make it return NULL.
 ASTNode *parser_parse(Lexer *lexer);
+
+// Parse all of the input without running it, reporting every syntax
+// error: after an error the parser resumes at the next line. Returns the
+// number of errors.
+int parser_check(Lexer *lexer);
+
+// Like parser_check(), handing every command that parsed to visit
+int parser_parse_all(Lexer *lexer, void (*visit)(ASTNode *node, void *arg), void *arg);
 int parser_try_fast_path(const char *cmd);
 
 #endif
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stddef.h>
+
+// Shell pattern matching and the character handling of expansions, in
+// characters of the locale's encoding (LC_CTYPE) rather than bytes. A
+// byte that does not start a valid character counts as a character of
+// its own, so malformed input is never lost or cut short.
+//
+// ASCII bytes are always whole characters (in UTF-8 and the single-byte
+// encodings), so every function here takes them one byte at a time and
+// decodes only when it meets a byte >= 0x80: pure ASCII strings cost
+// what a byte-wise loop would.
+
+// Does pattern match the first len bytes of string? The syntax is that
+// of fnmatch() without flags: *, ?, bracket expressions with ranges,
+// character classes and ! or ^, and backslash quoting the next character.
+int pattern_match(const char *pattern, const char *string, size_t len);
+
+// Byte length of the character at s (0 at the terminating NUL)
+size_t mb_len(const char *s);
+
+// Number of characters in s
+size_t mb_strlen(const char *s);
+
+// Byte length of the character at s if it is one of the characters of
+// set, else 0. For IFS, where a multibyte separator must not split a
+// character that shares some of its bytes.
+size_t mb_in_set(const char *s, const char *set);
+
+// Pathname expansion: the names matching pattern, sorted, in a NULL
+// terminated array for pattern_glob_free(). A period starting a name and
+// the slashes must be matched literally. If nothing matches, the pattern
+// itself is the one name, as with glob()'s GLOB_NOCHECK.
+char **pattern_glob(const char *pattern, size_t *count);
+void pattern_glob_free(char **names);
+
+#endif
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef RESTRICTED_H
+#define RESTRICTED_H
+
+#include "ast.h"
+#include "shell_options.h"
+
+// Restricted mode (posish -r, or a shell started as rposish) for running
+// commands that must not leave the environment they were given: no cd,
+// no changing PATH and the other variables below, no command named by a
+// path, no output redirection, no exec and no sourcing files from outside
+// PATH. It takes effect once the startup files have been read and cannot
+// be turned off.
+//
+// Every place that could break one of the rules calls the check for it
+// behind a test of shell_restricted. A check reports the refusal and
+// returns nonzero.
+
+// Assigning or unsetting name
+int restrict_variable(const char *name);
+
+// Running a command called name from the file system
+int restrict_command_name(const char *name);
+
+// Opening the target of a redirection
+int restrict_redirection(const Redirection *r);
+
+// A builtin refused outright (cd, exec with a command, command -p)
+int restrict_builtin(const char *what);
+
+// Sourcing a file given as path with ".", rather than found in PATH
+int restrict_source(const char *path);
+
+#endif
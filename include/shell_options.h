@@ -19,8 +19,13 @@ extern int shell_hash_all;        // set -h
 extern int shell_notify;          // set -b
 extern int shell_ignore_eof;      // set -o ignoreeof
 extern int shell_nolog;           // set -o nolog
+extern int shell_backtrace;        // set -o backtrace
+extern int shell_pipefail;        // set -o pipefail
 extern int shell_vi_mode;         // set -o vi
+extern int shell_emacs_mode;      // set -o emacs
 extern int shell_ignore_errexit;  // Internal flag to ignore -e
+extern int shell_interactive;     // Set once at startup (-i or a terminal)
+extern int shell_restricted;      // posish -r, see restricted.h
 
 void shell_options_init(void);
 
@@ -24,19 +24,56 @@ int signal_trap(int signum, const char *command);
 // Reset a signal to its default behavior
 int signal_reset(int signum);
 
-// Reset all signals (e.g. in child process)
+// Reset all signals (e.g. in child process); ignored ones stay ignored
 void signal_reset_all(void);
 
 // Ignore a signal
 int signal_ignore(int signum);
 
-// List all current traps in POSIX format
+// In a child about to run a program: put back the default action of
+// the signals the shell ignores for job control or catches, except
+// those ignored by trap "" or ignored when the shell started, which
+// the program inherits ignored. Only makes system calls, so it is safe
+// after vfork().
+void signal_child_defaults(void);
+
+// Whether an EXIT trap is set, so the process must not end by exec
+int signal_exit_trap_set(void);
+
+// List all current traps in POSIX format, quoted for reinput. A
+// subshell lists its parent's traps until it sets one of its own.
 void signal_list_traps(void);
 
 // Check for pending signals and execute their trap commands
 // Should be called frequently (e.g. before prompt, before command execution)
+// An untrapped SIGINT abandons what the shell is doing: it is raised as an
+// error with status 130 (see error.h), which takes an interactive shell
+// back to its prompt and ends a script.
 void signal_check_pending(void);
 
+// Set by the signal handler whenever a signal waits to be acted on
+extern volatile sig_atomic_t any_pending_signal;
+
+// A pending signal that signal_check_pending() would act on: one with a
+// trap, or SIGINT without one. Returns its number, or 0.
+int signal_pending_action(void);
+
+// The check made between commands, at loop back-edges and in long
+// builtin loops: one branch on one flag until a signal arrives
+#define SIGNAL_POLL() \
+    do { \
+        if (any_pending_signal) signal_check_pending(); \
+    } while (0)
+
+// Account for the wait status of a foreground job. A job killed by
+// SIGINT interrupts the shell as well; a job that caught SIGINT and
+// exited normally, even with status 130, dealt with it, and the shell
+// carries on.
+void signal_foreground_status(int wait_status);
+
+// Mark a signal as pending from another handler (async-signal-safe)
+void signal_note(int signum);
+
 // Trigger an exit trap if one is set for SIGTERM or SIGINT
 void signal_trigger_exit(void);
 
@@ -47,8 +84,9 @@ int signal_get_number(const char *name);
 // Get signal name from number
 const char *signal_get_name(int signum);
 
-// For interactive mode SIGINT handling
+// Set while an untrapped SIGINT is pending. Loops that cannot unwind
+// (a write or read being retried) give up when they see it and leave
+// the rest to the next SIGNAL_POLL().
 extern volatile sig_atomic_t got_sigint;
-int signal_check_sigint(void);
 
 #endif // SIGNALS_H
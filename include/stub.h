@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#ifndef STUB_H
+#define STUB_H
+
+#include "ast.h"
+
+// Stubs stand in for external commands while shell code is tested (the
+// stub builtin). A stub is found after functions and builtins, ahead of
+// the PATH search, and its body runs as a function would.
+//
+// Each call is recorded with its arguments in an unlinked temporary file
+// that subshells share, so calls made in $(...) or a pipeline are seen
+// by the shell that defined the stub. A stub defined in a function is
+// removed when the function returns, uncovering any stub it shadowed;
+// one defined in a subshell goes with the subshell.
+
+// Number of stubs defined; the command path looks no further when 0
+extern int stub_count;
+
+// Define name to run body, which the stub takes ownership of.
+// definition is the stub command that made it, shown by stub_print_all().
+void stub_define(const char *name, ASTNode *body, const char *definition);
+
+// Remove the newest stub for name. Returns -1 if there is none.
+int stub_remove(const char *name);
+
+// The body of the stub for name, or NULL
+ASTNode *stub_lookup(const char *name);
+
+// stub_lookup(argv[0]) that also records the call
+ASTNode *stub_call(char **argv);
+
+// Entering and leaving a function
+void stub_push_scope(void);
+void stub_pop_scope(void);
+
+// Print the definitions of the stubs in effect, for reinput
+void stub_print_all(void);
+
+// Print the calls recorded for name's stub (all stubs if NULL), one
+// quoted command line each, or only their number. Returns -1 if name
+// is not a stub.
+int stub_print_calls(const char *name, int count_only);
+
+#endif
@@ -45,14 +45,20 @@ void posish_var_init(char **envp);
 int posish_var_set(const char *name, const char *value);
 char *posish_var_get(const char *name);
 const char *posish_var_get_value(const char *name);
-void posish_var_unset(const char *name);
+int posish_var_unset(const char *name); // 1 if the variable may not be unset
 void posish_var_export(const char *name);
 char **posish_var_get_environ(void);
-char **posish_var_get_all(void);
 int posish_var_is_valid_name(const char *name);
 void posish_var_set_readonly(const char *name);
 int posish_var_is_readonly(const char *name);
-char **posish_var_get_all_readonly(void);
+// Report and return nonzero if name may not be assigned (readonly, or
+// restricted mode), as posish_var_set() would
+int posish_var_check_assign(const char *name);
+
+// Print the set variables having all of the given flags (0 for every
+// variable) as "prefix NAME=value" lines sorted by name, quoted so the
+// shell can read them back
+void posish_var_list(int flags, const char *prefix);
 
 void posish_var_set_positional(int argc, char **argv);
 char *posish_var_get_positional(int index);
@@ -62,9 +68,12 @@ char **posish_var_get_all_positional(void);
 int posish_var_shift_positional(int n);
 char **posish_var_get_positional_params(size_t *count);
 
+// The saved parameters are detached, so the next set starts afresh and
+// cannot overwrite them; restoring frees whatever was set in between
 typedef struct {
     char **args;
     int count;
+    size_t capacity;
 } PositionalSave;
 
 PositionalSave posish_var_save_positional_fast(void);
@@ -78,7 +87,14 @@ char *posish_var_get_shell_name(void);
 
 void posish_var_push_scope(void);
 void posish_var_pop_scope(void);
-void posish_var_declare_local(const char *name, const char *value);
+// Returns nonzero if name may not be assigned (restricted mode)
+int posish_var_declare_local(const char *name, const char *value);
 void posish_var_set_lineno(int lineno);
+// FUNCNEST as a number: how deep functions may call each other, 0 for
+// no limit
+extern int var_funcnest;
+// The statuses of the commands of the last foreground pipeline, for
+// PIPESTATUS
+void posish_var_set_pipestatus(const int *statuses, size_t count);
 
 #endif
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "buf_output.h"
 #include "memalloc.h"
 
 static Alias *aliases = NULL;
@@ -65,12 +66,40 @@ char *alias_get(const char *name) {
     return NULL;
 }
 
-void alias_print_all(void) {
-    Alias *a = aliases;
-    while (a) {
-        // Print in format alias name='value'
-        // Need to quote value properly? For now simple quoting.
-        printf("alias %s='%s'\n", a->name, a->value);
-        a = a->next;
+static void print_alias(const Alias *a) {
+    OUT_PUTS("alias ");
+    OUT_PUTS(a->name);
+    OUT_PUTC('=');
+    OUT_QUOTED(a->value);
+    OUT_PUTC('\n');
+}
+
+static int compare_aliases(const void *a, const void *b) {
+    const Alias *aa = *(const Alias *const *)a;
+    const Alias *ab = *(const Alias *const *)b;
+    return strcoll(aa->name, ab->name);
+}
+
+int alias_print(const char *name) {
+    for (Alias *a = aliases; a; a = a->next) {
+        if (strcmp(a->name, name) == 0) {
+            print_alias(a);
+            return 0;
+        }
     }
+    return -1;
+}
+
+void alias_print_all(void) {
+    size_t count = 0;
+    for (Alias *a = aliases; a; a = a->next) count++;
+
+    struct stackmark mark;
+    mem_stack_push_mark(&mark);
+    Alias **list = mem_stack_alloc((count + 1) * sizeof(*list));
+    size_t i = 0;
+    for (Alias *a = aliases; a; a = a->next) list[i++] = a;
+    qsort(list, count, sizeof(*list), compare_aliases);
+    for (i = 0; i < count; i++) print_alias(list[i]);
+    mem_stack_pop_mark(&mark);
 }
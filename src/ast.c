@@ -113,6 +113,17 @@ ASTNode *ast_new_binary(NodeType type, ASTNode *left, ASTNode *right) {
     return node;
 }
 
+ASTNode *ast_new_prefixed(NodeType type, ASTNode *pipeline, int posix) {
+    ASTNode *node = mem_stack_alloc(sizeof(ASTNode));
+
+    *node = (ASTNode){
+        .type = type,
+        .data.prefixed = {.pipeline = pipeline, .posix = posix},
+    };
+
+    return node;
+}
+
 ASTNode *ast_new_if(ASTNode *cond, ASTNode *then_branch, ASTNode *else_branch) {
     ASTNode *node = mem_stack_alloc(sizeof(ASTNode));
 
@@ -333,6 +344,8 @@ static ASTNode *clone_node(ASTNode *node, const Allocator *a) {
 
     ASTNode *n = a->alloc(sizeof(ASTNode));
     n->type = node->type;
+    n->pos = node->pos;
+    n->cov = node->cov;
 
     switch (node->type) {
     case NODE_COMMAND:
@@ -346,6 +359,12 @@ static ASTNode *clone_node(ASTNode *node, const Allocator *a) {
         n->data.pipeline.right = clone_node(node->data.pipeline.right, a);
         break;
 
+    case NODE_NOT:
+    case NODE_TIME:
+        n->data.prefixed.pipeline = clone_node(node->data.prefixed.pipeline, a);
+        n->data.prefixed.posix    = node->data.prefixed.posix;
+        break;
+
     case NODE_LIST:
         n->data.list.left  = clone_node(node->data.list.left, a);
         n->data.list.right = clone_node(node->data.list.right, a);
@@ -464,6 +483,11 @@ void ast_free_heap(ASTNode *node) {
         ast_free_heap(node->data.pipeline.right);
         break;
 
+    case NODE_NOT:
+    case NODE_TIME:
+        ast_free_heap(node->data.prefixed.pipeline);
+        break;
+
     case NODE_LIST:
         ast_free_heap(node->data.list.left);
         ast_free_heap(node->data.list.right);
@@ -511,3 +535,120 @@ void ast_free_heap(ASTNode *node) {
 
     free(node);
 }
+
+/* ============================================================================
+ * Comparison
+ * ============================================================================ */
+
+static int str_equal(const char *a, const char *b) {
+    if (!a || !b) return a == b;
+    return strcmp(a, b) == 0;
+}
+
+static int str_array_equal(char **a, char **b, size_t count) {
+    if (!a || !b) return a == b;
+    for (size_t i = 0; i < count; i++) {
+        if (!str_equal(a[i], b[i])) return 0;
+    }
+    return 1;
+}
+
+static int command_equal(const CommandNode *a, const CommandNode *b) {
+    if (a->arg_count != b->arg_count ||
+        a->redirection_count != b->redirection_count ||
+        a->assignment_count != b->assignment_count) return 0;
+    if (!str_array_equal(a->args, b->args, a->arg_count)) return 0;
+
+    for (size_t i = 0; i < a->redirection_count; i++) {
+        const Redirection *ra = &a->redirections[i];
+        const Redirection *rb = &b->redirections[i];
+        if (ra->type != rb->type || ra->io_number != rb->io_number ||
+            !str_equal(ra->filename, rb->filename) ||
+            !str_equal(ra->here_doc_content, rb->here_doc_content)) return 0;
+    }
+    for (size_t i = 0; i < a->assignment_count; i++) {
+        if (!str_equal(a->assignments[i].name, b->assignments[i].name) ||
+            !str_equal(a->assignments[i].value, b->assignments[i].value)) return 0;
+    }
+    return 1;
+}
+
+static int case_equal(const CaseNode *a, const CaseNode *b) {
+    if (!str_equal(a->word, b->word) || a->item_count != b->item_count) return 0;
+    for (size_t i = 0; i < a->item_count; i++) {
+        char **pa = a->items[i].patterns;
+        char **pb = b->items[i].patterns;
+        size_t j = 0;
+        for (; pa && pb && pa[j] && pb[j]; j++) {
+            if (strcmp(pa[j], pb[j]) != 0) return 0;
+        }
+        if ((pa && pa[j]) || (pb && pb[j])) return 0;
+        if (!ast_equal(a->items[i].commands, b->items[i].commands)) return 0;
+    }
+    return 1;
+}
+
+int ast_equal(ASTNode *a, ASTNode *b) {
+    // Lists are followed in a loop so long scripts compare in constant stack
+    while (a && b && a->type == NODE_LIST && b->type == NODE_LIST) {
+        if (a->data.list.async != b->data.list.async ||
+            !ast_equal(a->data.list.left, b->data.list.left)) return 0;
+        a = a->data.list.right;
+        b = b->data.list.right;
+    }
+    if (!a || !b) return a == b;
+    if (a->type != b->type) return 0;
+
+    switch (a->type) {
+    case NODE_COMMAND:
+        return command_equal(&a->data.command, &b->data.command);
+
+    case NODE_PIPELINE:
+    case NODE_AND:
+    case NODE_OR:
+        return ast_equal(a->data.pipeline.left, b->data.pipeline.left) &&
+               ast_equal(a->data.pipeline.right, b->data.pipeline.right);
+
+    case NODE_NOT:
+    case NODE_TIME:
+        return a->data.prefixed.posix == b->data.prefixed.posix &&
+               ast_equal(a->data.prefixed.pipeline, b->data.prefixed.pipeline);
+
+    case NODE_LIST:
+        return 0; // Handled above
+
+    case NODE_IF:
+        return ast_equal(a->data.if_stmt.condition, b->data.if_stmt.condition) &&
+               ast_equal(a->data.if_stmt.then_branch, b->data.if_stmt.then_branch) &&
+               ast_equal(a->data.if_stmt.else_branch, b->data.if_stmt.else_branch);
+
+    case NODE_WHILE:
+        return ast_equal(a->data.while_loop.condition, b->data.while_loop.condition) &&
+               ast_equal(a->data.while_loop.body, b->data.while_loop.body);
+
+    case NODE_UNTIL:
+        return ast_equal(a->data.until_loop.condition, b->data.until_loop.condition) &&
+               ast_equal(a->data.until_loop.body, b->data.until_loop.body);
+
+    case NODE_FOR:
+        return str_equal(a->data.for_loop.var_name, b->data.for_loop.var_name) &&
+               a->data.for_loop.word_count == b->data.for_loop.word_count &&
+               str_array_equal(a->data.for_loop.word_list, b->data.for_loop.word_list,
+                               a->data.for_loop.word_count) &&
+               ast_equal(a->data.for_loop.body, b->data.for_loop.body);
+
+    case NODE_SUBSHELL:
+        return ast_equal(a->data.subshell.body, b->data.subshell.body);
+
+    case NODE_GROUP:
+        return ast_equal(a->data.group.body, b->data.group.body);
+
+    case NODE_FUNCTION:
+        return str_equal(a->data.function.name, b->data.function.name) &&
+               ast_equal(a->data.function.body, b->data.function.body);
+
+    case NODE_CASE:
+        return case_equal(&a->data.case_stmt, &b->data.case_stmt);
+    }
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include "buf_output.h"
 #include "memalloc.h"
 #include "signals.h"
+#include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -70,25 +71,92 @@ void buf_out_reset_all(void) {
     buf_out_reset(&buf_stdout);
 }
 
+static void buf_out_grow(struct buf_out *buf, size_t need) {
+    size_t used = buf->next - buf->start;
+    size_t size = buf->size;
+    while (size - used < need) size *= 2;
+    buf->start = xrealloc(buf->start, size);
+    buf->next = buf->start + used;
+    buf->end = buf->start + size;
+    buf->size = size;
+}
+
 void buf_out_putc_slow(int c, struct buf_out *buf) {
-    buf_out_flush(buf);
+    if (buf->fd == BUF_OUT_STRING) {
+        buf_out_grow(buf, 1);
+    } else {
+        buf_out_flush(buf);
+    }
     *(buf)->next++ = c;
 }
 
+#define CAPTURE_SIZE 256
+
+void buf_out_capture_begin(struct buf_capture *cap, struct buf_out *buf) {
+    buf_out_flush(buf);
+    cap->buf = buf;
+    cap->saved = *buf;
+    buf->size = CAPTURE_SIZE;
+    buf->start = xmalloc(CAPTURE_SIZE);
+    buf->next = buf->start;
+    buf->end = buf->start + CAPTURE_SIZE;
+    buf->fd = BUF_OUT_STRING;
+}
+
+char *buf_out_capture_end(struct buf_capture *cap, size_t *len) {
+    struct buf_out *buf = cap->buf;
+    BUF_PUTC('\0', buf);
+    char *text = buf->start;
+    if (len) *len = buf->next - buf->start - 1;
+    *buf = cap->saved;
+    return text;
+}
+
+void buf_out_capture_abort(void *arg) {
+    free(buf_out_capture_end(arg, NULL));
+}
+
 void buf_out_puts(const char *str, struct buf_out *buf) {
     while (*str) {
         BUF_PUTC(*str++, buf);
     }
 }
 
+void buf_out_quoted(const char *str, struct buf_out *buf) {
+    const char *p = str;
+    while (*p && (isalnum((unsigned char)*p) || strchr("_-+=%@,./:", *p))) p++;
+    if (*str && !*p) {
+        buf_out_puts(str, buf);
+        return;
+    }
+
+    BUF_PUTC('\'', buf);
+    for (p = str; *p; p++) {
+        if (*p == '\'') {
+            buf_out_puts("'\\''", buf);
+        } else {
+            BUF_PUTC(*p, buf);
+        }
+    }
+    BUF_PUTC('\'', buf);
+}
+
 void buf_out_printf(struct buf_out *buf, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
+    va_list again;
+    va_copy(again, args);
     char tmp[4096]; // Large enough for most shell outputs
     int len = vsnprintf(tmp, sizeof(tmp), fmt, args);
     va_end(args);
     
-    if (len > 0) {
+    if (len >= (int)sizeof(tmp)) {
+        char *big = xmalloc(len + 1);
+        vsnprintf(big, len + 1, fmt, again);
+        buf_out_puts(big, buf);
+        free(big);
+    } else if (len > 0) {
         buf_out_puts(tmp, buf);
     }
+    va_end(again);
 }
@@ -21,11 +21,7 @@ int builtin_alias(char **args) {
             alias_add(arg, eq + 1);
             *eq = '='; // Restore
         } else {
-            char *val = alias_get(arg);
-            if (val) {
-                printf("alias %s='%s'\n", arg, val);
-                free(val);
-            } else {
+            if (alias_print(arg) != 0) {
                 fprintf(stderr, "alias: %s: not found\n", arg);
                 return 1;
             }
@@ -2,38 +2,30 @@
 
 
 #include "builtins.h"
+#include "buf_output.h"
+#include "error.h"
 #include "jobs.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <signal.h>
 
-int builtin_bg(char **args) {
-    int job_id = -1;
-    if (args[1]) {
-        if (args[1][0] == '%') {
-            job_id = atoi(args[1] + 1);
-        } else {
-            job_id = atoi(args[1]);
-        }
-    } else {
-        fprintf(stderr, "bg: job id required (e.g. %%1)\n");
-        return 1;
-    }
-
-    Job *j = job_find_by_id(job_id);
-    if (!j) {
-        fprintf(stderr, "bg: %d: no such job\n", job_id);
-        return 1;
-    }
+static int bg_job(const char *spec) {
+    Job *j = job_find_spec(spec, "bg");
+    if (!j) return 1;
 
     if (j->status == JOB_RUNNING) {
-        fprintf(stderr, "bg: job %d already running\n", job_id);
+        error_msg("bg: job %d already in background", j->id);
         return 0;
     }
 
-    printf("[%d]+ %s &\n", j->id, j->command);
-    kill(-j->pgid, SIGCONT);
-    j->status = JOB_RUNNING;
-
+    job_background(j);
+    OUT_PRINTF("[%d] %s &\n", j->id, j->command);
     return 0;
 }
+
+int builtin_bg(char **args) {
+    if (!args[1]) return bg_job(NULL);
+
+    int status = 0;
+    for (int i = 1; args[i]; i++) {
+        if (bg_job(args[i]) != 0) status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdlib.h>
+#include <ctype.h>
+#include "builtins.h"
+#include "buf_output.h"
+#include "callstack.h"
+#include "error.h"
+
+// caller [n]: where the current function (or sourced file, eval or trap
+// action) was called from, as "line file"; with n, the call n frames
+// further out as "line name file", where name is the function making
+// that call ("main" outside any). Fails once n passes the outermost
+// frame, so "while caller $i; do i=$((i + 1)); done" prints the stack.
+int builtin_caller(char **argv) {
+    long n = 0;
+    if (argv[1]) {
+        char *end;
+        n = strtol(argv[1], &end, 10);
+        if (!isdigit((unsigned char)argv[1][0]) || *end) {
+            error_msg("caller: %s: invalid number", argv[1]);
+            return 2;
+        }
+        if (argv[2]) {
+            error_msg("caller: too many arguments");
+            return 2;
+        }
+    }
+    if (n >= call_depth) return 1;
+
+    int i = call_depth - 1 - (int)n;
+    char *file = callstack_file_name(call_stack[i].file);
+    if (argv[1]) {
+        const char *name = i > 0 ? call_stack[i - 1].name : "main";
+        OUT_PRINTF("%d %s %s\n", call_stack[i].line, name, file);
+    } else {
+        OUT_PRINTF("%d %s\n", call_stack[i].line, file);
+    }
+    free(file);
+    return 0;
+}
@@ -7,11 +7,14 @@
 #include <unistd.h>
 #include <errno.h>
 #include "error.h"
+#include "restricted.h"
 #include "variables.h"
 #include <string.h> // Required for strcmp
 #include <limits.h> // Required for PATH_MAX
 
 int builtin_cd(char **argv) {
+    if (shell_restricted) return restrict_builtin("cd");
+
     const char *new_dir = argv[1];
     char cwd[PATH_MAX];
     
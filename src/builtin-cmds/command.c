@@ -5,19 +5,50 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <errno.h>
-#include <sys/wait.h>
 #include "builtins.h"
+#include "error.h"
+#include "executor.h"
+#include "functions.h"
+#include "launch.h"
+#include "memalloc.h"
+#include "restricted.h"
+#include "stub.h"
 #include "variables.h"
 
+// The PATH that finds the standard utilities, for -p
+static const char *default_path(void) {
+    size_t len = confstr(_CS_PATH, NULL, 0);
+    if (len == 0) return "/usr/bin:/bin";
+    char *path = mem_stack_alloc(len);
+    confstr(_CS_PATH, path, len);
+    return path;
+}
+
+// Set the prefix assignments in the shell, as for a builtin run without
+// command; with check set only make sure they could be
+static void set_assigns(char **assigns, int check) {
+    for (size_t i = 0; assigns && assigns[i]; i++) {
+        char *eq = strchr(assigns[i], '=');
+        *eq = '\0';
+        int failed = check ? posish_var_check_assign(assigns[i])
+                           : posish_var_set(assigns[i], eq + 1);
+        *eq = '=';
+        if (failed) exception_raise(1);
+    }
+}
+
+int builtin_command(char **argv) {
+    return builtin_command_assigns(argv, NULL);
+}
+
 // Simple implementation of command builtin
 // POSIX: Execute command bypassing function lookup
-int builtin_command(char **argv) {
+int builtin_command_assigns(char **argv, char **assigns) {
     int verbose = 0;
     int very_verbose = 0;
     int use_default_path = 0;
     int arg_idx = 1;
-    
+
     // Parse options
     while (argv[arg_idx] && argv[arg_idx][0] == '-') {
         if (strcmp(argv[arg_idx], "-v") == 0) {
@@ -36,115 +67,103 @@ int builtin_command(char **argv) {
             break;
         }
     }
-    
+
     if (!argv[arg_idx]) {
         fprintf(stderr, "command: missing command name\n");
         return 1;
     }
-    
+
     const char *cmd_name = argv[arg_idx];
-    
+    const char *search_path = use_default_path ? default_path() : NULL;
+
     // -v: Print pathname of command
     if (verbose || very_verbose) {
-        // Check if builtin
+        const char *kind = NULL;
         if (builtin_is_builtin(cmd_name)) {
+            kind = "a shell builtin";
+        } else if (func_lookup(cmd_name)) {
+            kind = "a function";
+        } else if (stub_count && stub_lookup(cmd_name)) {
+            kind = "a stub";
+        }
+        if (kind) {
             if (very_verbose) {
-                printf("%s is a shell builtin\n", cmd_name);
+                printf("%s is %s\n", cmd_name, kind);
             } else {
                 printf("%s\n", cmd_name);
             }
             fflush(stdout);
             return 0;
         }
-        
+
         // Search in PATH
-        char *path = use_default_path ? "/usr/bin:/bin" : (char*)pathval();
+        char *path = launch_find(cmd_name, search_path);
         if (!path) {
             return 1;
         }
-        
-        char *path_copy = strdup(path);
-        char *dir = strtok(path_copy, ":");
-        
-        while (dir) {
-            char full_path[1024];
-            snprintf(full_path, sizeof(full_path), "%s/%s", dir, cmd_name);
-            
-            if (access(full_path, X_OK) == 0) {
-                if (very_verbose) {
-                    printf("%s is %s\n", cmd_name, full_path);
-                } else {
-                    printf("%s\n", full_path);
-                }
-                fflush(stdout); // Ensure output goes to redirected FD
-                free(path_copy);
-                return 0;
-            }
-            
-            dir = strtok(NULL, ":");
+        if (very_verbose) {
+            printf("%s is %s\n", cmd_name, path);
+        } else {
+            printf("%s\n", path);
         }
-        
-        free(path_copy);
-        return 1;
+        fflush(stdout); // Ensure output goes to redirected FD
+        return 0;
     }
-    
+
     // Execute command (bypassing functions)
+    if (shell_restricted) {
+        if (use_default_path) return restrict_builtin("command -p");
+        if (restrict_command_name(cmd_name)) return 1;
+    }
+
+    // exec replaces the shell with a program, which gets the assignments
+    // like any other
+    if (assigns && strcmp(cmd_name, "exec") == 0) {
+        if (!argv[arg_idx + 1]) {
+            set_assigns(assigns, 0);
+            return 0;
+        }
+        if (shell_restricted) return restrict_builtin("exec");
+        set_assigns(assigns, 1);
+        return launch_exec(argv + arg_idx + 1, assigns);
+    }
+
     // First check if it's a builtin
     if (builtin_is_builtin(cmd_name)) {
         // Execute the builtin directly
+        set_assigns(assigns, 0);
         return builtin_run(argv + arg_idx);
     }
-    
-    // Not a builtin, search for external command
-    char *path = use_default_path ? "/usr/bin:/bin" : (char*)pathval();
-    if (!path) {
-        fprintf(stderr, "command: %s: not found\n", cmd_name);
-        return 127;
+
+    // A stub stands in for the external command
+    ASTNode *stub_body = stub_count ? stub_call(argv + arg_idx) : NULL;
+    if (stub_body) {
+        set_assigns(assigns, 0);
+        return executor_call_function(stub_body, argv + arg_idx);
     }
-    
-    char *executable = NULL;
-    char *path_copy = strdup(path);
-    char *dir = strtok(path_copy, ":");
-    
-    while (dir) {
-        char full_path[1024];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir, cmd_name);
-        
-        if (access(full_path, X_OK) == 0) {
-            executable = strdup(full_path);
-            break;
-        }
-        
-        dir = strtok(NULL, ":");
+
+    // Not a builtin, search for external command; the program keeps the
+    // assignments to itself, a PATH among them included
+    set_assigns(assigns, 1);
+    for (size_t i = 0; !use_default_path && assigns && assigns[i]; i++) {
+        if (strncmp(assigns[i], "PATH=", 5) == 0) search_path = assigns[i] + 5;
     }
-    
-    free(path_copy);
-    
+    char *executable = launch_find(cmd_name, search_path);
     if (!executable) {
         fprintf(stderr, "command: %s: not found\n", cmd_name);
         return 127;
     }
-    
-    // Execute the external command
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        execv(executable, argv + arg_idx);
-        fprintf(stderr, "command: %s: %s\n", executable, strerror(errno));
-        exit(126);
-    } else if (pid > 0) {
-        // Parent process  
-        int status;
-        waitpid(pid, &status, 0);
-        free(executable);
-        if (WIFEXITED(status)) {
-            return WEXITSTATUS(status);
-        }
-        return 1;
-    } else {
-        // Fork failed
-        free(executable);
-        fprintf(stderr, "command: fork failed\n");
-        return 1;
+
+    // Listed as a job by the words it runs
+    size_t len = 1;
+    for (int i = arg_idx; argv[i]; i++) len += strlen(argv[i]) + 1;
+    char *description = mem_stack_alloc(len);
+    description[0] = '\0';
+    for (int i = arg_idx; argv[i]; i++) {
+        if (i > arg_idx) strcat(description, " ");
+        strcat(description, argv[i]);
     }
+
+    fflush(stdout);
+    return launch_program(executable, argv + arg_idx, assigns, NULL, 0, description);
 }
@@ -1,14 +1,11 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
 #include "builtins.h"
+#include "error.h"
 #include <string.h>
 #include <stdlib.h>
 #include <setjmp.h>
 
-/* Global jump buffer for builtin error recovery (used by bltin.h error()) */
-jmp_buf bltin_jmp;
-int bltin_error_status;
-
 typedef struct {
     const char *name;
     int (*func)(char **);
@@ -17,6 +14,8 @@ typedef struct {
 int builtin_wait(char **argv);
 int builtin_trap(char **argv);
 int builtin_umask(char **argv);
+int builtin_ulimit(char **argv);
+int builtin_caller(char **argv);
 int builtin_times(char **argv);
 int builtin_command(char **argv);
 int builtin_readonly(char **argv);
@@ -25,17 +24,34 @@ int builtin_true(char **argv);
 int builtin_false(char **argv);
 int builtin_colon(char **argv);
 int builtin_local(char **argv);
+int builtin_fc(char **argv);
+int builtin_stub(char **argv);
+int builtin_hash(char **argv);
 
 int testcmd(char **argv);
 
+/* test reports bad operands through error(), which raises; that is a
+ * failure of the command (status 2), not an error of the shell */
+int builtin_test(char **argv) {
+    struct jmploc jl;
+    if (setjmp(jl.loc)) {
+        return exception_status;
+    }
+    exception_push(&jl);
+    int status = testcmd(argv);
+    exception_pop(&jl);
+    return status;
+}
+
 /* Sorted array of builtins for binary search */
 static const Builtin builtins[] = {
     {".", builtin_dot},
     {":", builtin_colon},
-    {"[", testcmd},
+    {"[", builtin_test},
     {"alias", builtin_alias},
     {"bg", builtin_bg},
     {"break", builtin_break},
+    {"caller", builtin_caller},
     {"cd", builtin_cd},
     {"command", builtin_command},
     {"continue", builtin_continue},
@@ -45,8 +61,10 @@ static const Builtin builtins[] = {
     {"exit", builtin_exit},
     {"export", builtin_export},
     {"false", builtin_false},
+    {"fc", builtin_fc},
     {"fg", builtin_fg},
     {"getopts", builtin_getopts},
+    {"hash", builtin_hash},
     {"jobs", builtin_jobs},
     {"kill", builtin_kill},
     {"local", builtin_local},
@@ -57,12 +75,14 @@ static const Builtin builtins[] = {
     {"return", builtin_return},
     {"set", builtin_set},
     {"shift", builtin_shift},
-    {"test", testcmd},
+    {"stub", builtin_stub},
+    {"test", builtin_test},
     {"times", builtin_times},
     {"trap", builtin_trap},
     {"true", builtin_true},
     {"type", builtin_type},
 
+    {"ulimit", builtin_ulimit},
     {"umask", builtin_umask},
     {"unalias", builtin_unalias},
     {"unset", builtin_unset},
@@ -82,12 +102,6 @@ int builtin_is_builtin(const char *name) {
 int builtin_run(char **args) {
     Builtin *entry = bsearch(args[0], builtins, sizeof(builtins) / sizeof(Builtin), sizeof(Builtin), compare_builtins);
     if (entry) {
-        /* Use setjmp to catch errors from builtins (like test's error()) */
-        bltin_error_status = 0;
-        if (setjmp(bltin_jmp) != 0) {
-            /* Returned here via longjmp from bltin_error */
-            return bltin_error_status;
-        }
         return entry->func(args);
     }
     return 127; // Should not happen if checked with builtin_is_builtin
@@ -10,9 +10,12 @@
 #include "memalloc.h"
 #include "memalloc.h"
 #include "builtins.h"
+#include "callstack.h"
 #include "lexer.h"
 #include "parser.h"
 #include "executor.h"
+#include "input.h"
+#include "restricted.h"
 #include "variables.h"
 
 // Find file in PATH
@@ -41,6 +44,10 @@ static char *find_in_path(const char *filename) {
     return NULL;
 }
 
+static void close_source(void *arg) {
+    input_source_close(arg);
+}
+
 int builtin_dot(char **args) {
     if (!args[1]) {
         error_msg(".: filename argument required");
@@ -49,6 +56,7 @@ int builtin_dot(char **args) {
     
     char *filename = args[1];
     char *filepath = NULL;
+    if (shell_restricted && restrict_source(filename)) return 1;
     
     // If filename contains '/', use it directly
     if (strchr(filename, '/')) {
@@ -69,48 +77,29 @@ int builtin_dot(char **args) {
         return 1;
     }
     
-    // Read file contents
-    FILE *file = fopen(filepath, "r");
-    if (!file) {
+    int fd = input_open_script(filepath);
+    if (fd < 0) {
         error_sys(".: %s: cannot open file", filepath);
         free(filepath);
         return 1;
     }
     
-    // Read entire file into buffer
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    char *content = mem_stack_alloc(file_size + 1);
-    if (!content) {
-        fclose(file);
-        free(filepath);
-        return 1;
-    }
-    
-    size_t bytes_read = fread(content, 1, file_size, file);
-    content[bytes_read] = '\0';
-    fclose(file);
+    // Read and execute one command at a time; an error in the file
+    // still closes it
+    InputSource src;
+    input_source_fd(&src, fd);
+    src.file = input_file_id(filepath);
     free(filepath);
-    
-    // Parse and execute
-    Lexer lexer;
-    lexer_init(&lexer, content);
-    
-    struct stackmark smark;
-    mem_stack_push_mark(&smark);
-    
-    ASTNode *ast = parser_parse(&lexer);
-    
-    int status = 0;
-    if (ast) {
-        status = executor_execute(ast);
-        // ast_free(ast); // No-op
+    cleanup_push(close_source, &src);
+    callstack_push("source");
+    cleanup_push(callstack_pop, NULL);
+    int status = executor_run_source(&src);
+    cleanup_pop(1);
+    if (status == EXIT_RETURN) {
+        // "return" in a sourced file ends the file, not the caller
+        status = func_return_status;
     }
     
-    mem_stack_pop_mark(&smark);
-    
-    // No free needed for content
+    cleanup_pop(1);
     return status;
 }
@@ -7,6 +7,9 @@
 #include "builtins.h"
 #include "memalloc.h"
 #include "memalloc.h"
+#include "callstack.h"
+#include "coverage.h"
+#include "error.h"
 #include "lexer.h"
 #include "parser.h"
 #include "executor.h"
@@ -47,21 +50,26 @@ int builtin_eval(char **argv) {
         return 0;
     }
 
-    // Parse the command
+    // Parse the command; its lines are counted from the eval itself
     Lexer lexer;
     lexer_init(&lexer, command);
+    lexer.file = call_file;
+    if (call_line > 0) lexer.current_line = call_line;
     
     ASTNode *ast = parser_parse(&lexer);
     
     int status = 0;
     if (ast) {
+        if (coverage_counts) coverage_instrument(ast);
         // Execute the command
+        callstack_push("eval");
+        cleanup_push(callstack_pop, NULL);
         status = executor_execute(ast);
+        cleanup_pop(1);
         // ast_free(ast); // No-op
     } else {
-        // Parse error - in interactive mode, don't abort
-        fprintf(stderr, "eval: parse error\n");
-        status = 1;
+        // The parser has reported the syntax error
+        status = 2;
     }
     
     mem_stack_pop_mark(&smark);
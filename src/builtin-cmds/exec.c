@@ -1,22 +1,18 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
 
-#include <stdio.h>
-#include <unistd.h>
-#include <errno.h>
-#include "error.h"
+#include "builtins.h"
+#include "launch.h"
+#include "restricted.h"
 
+// exec run as a command of its own reaches here (command exec ...); the
+// executor runs "exec" itself so that its redirections stay
 int builtin_exec(char **args) {
-    // If no arguments (just "exec"), return 0.
-    // Redirections are handled by the caller (executor).
     if (!args[1]) {
         return 0;
     }
 
     // Replace the shell process
-    execvp(args[1], &args[1]);
-    
-    // If execvp returns, it failed
-    error_sys("exec: %s", args[1]);
-    return 126; // Command invoked cannot execute
+    if (shell_restricted) return restrict_builtin("exec");
+    return launch_exec(&args[1], NULL);
 }
@@ -8,43 +8,36 @@
 #include <string.h>
 
 int builtin_export(char **args) {
-    if (!args[1]) {
-        // List exported variables
-        char **env = posish_var_get_environ();
-        for (char **e = env; *e != NULL; e++) {
-            char *eq = strchr(*e, '=');
-            if (eq) {
-                *eq = '\0';
-                printf("export %s=\"", *e);
-                for (char *p = eq + 1; *p; p++) {
-                    if (*p == '\\' || *p == '"' || *p == '$' || *p == '`') {
-                        putchar('\\');
-                    }
-                    putchar(*p);
-                }
-                printf("\"\n");
-                *eq = '='; // Restore for safety, though we free *e next
-            } else {
-                // Should not happen for environ entries, but just in case
-                printf("export %s\n", *e);
-            }
-            free(*e);
+    // -p only asks for the listing, which is also what no operands give
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
         }
-        free(env);
+        if (strcmp(args[i], "-p") != 0) {
+            fprintf(stderr, "export: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+
+    if (!args[i]) {
+        posish_var_list(VEXPORT, "export");
         return 0;
     }
 
-    for (int i = 1; args[i] != NULL; i++) {
+    int status = 0;
+    for (; args[i] != NULL; i++) {
         char *arg = args[i];
         char *eq = strchr(arg, '=');
         if (eq) {
             *eq = '\0';
-            posish_var_set(arg, eq + 1);
+            if (posish_var_set(arg, eq + 1) != 0) status = 1;
             posish_var_export(arg);
             *eq = '='; // Restore
         } else {
             posish_var_export(arg);
         }
     }
-    return 0;
+    return status;
 }
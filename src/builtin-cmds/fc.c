@@ -0,0 +1,264 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "builtins.h"
+#include "buf_output.h"
+#include "error.h"
+#include "executor.h"
+#include "history.h"
+#include "input.h"
+#include "memalloc.h"
+#include "shell_options.h"
+#include "variables.h"
+
+#define FC_LIST_DEFAULT 16
+
+static void fc_usage(void) {
+    error_msg("usage: fc [-r] [-e editor] [first [last]]\n"
+              "       fc -l [-nr] [first [last]]\n"
+              "       fc -s [old=new] [first]");
+}
+
+// Turn a first/last operand into an event number. Numbers are event
+// numbers, negative numbers count back from the newest entry, anything
+// else selects the newest entry starting with that string.
+static int fc_resolve(const char *spec, int newest, int *event) {
+    char *end;
+    long n = strtol(spec, &end, 10);
+    if (*spec && *end == '\0') {
+        if (n < 0) n = newest + 1 + n;
+        else if (n == 0) n = newest;
+        if (n < history_first_event()) n = history_first_event();
+        if (n > newest) n = newest;
+        *event = (int)n;
+        return 0;
+    }
+
+    int found = history_find_prefix(spec, newest);
+    if (found < 0) {
+        error_msg("fc: %s: no command found", spec);
+        return -1;
+    }
+    *event = found;
+    return 0;
+}
+
+// Run commands as if typed, recording them in place of the fc command
+static int fc_execute(const char *commands, int replace_self) {
+    fputs(commands, stderr);
+    size_t len = strlen(commands);
+    if (len == 0 || commands[len - 1] != '\n') fputc('\n', stderr);
+    fflush(stderr);
+
+    if (replace_self) history_replace_last(commands);
+
+    InputSource src;
+    input_source_string(&src, commands);
+    return executor_run_source(&src);
+}
+
+// Replace the first occurrence of old in command with new
+static char *fc_substitute(const char *command, const char *pair) {
+    const char *eq = strchr(pair, '=');
+    size_t old_len = eq - pair;
+    const char *found = NULL;
+    for (const char *p = command; old_len && *p; p++) {
+        if (strncmp(p, pair, old_len) == 0) {
+            found = p;
+            break;
+        }
+    }
+    if (!found) return xstrdup(command);
+
+    const char *repl = eq + 1;
+    size_t repl_len = strlen(repl);
+    size_t len = strlen(command) - old_len + repl_len;
+    char *result = xmalloc(len + 1);
+    size_t prefix = found - command;
+    memcpy(result, command, prefix);
+    memcpy(result + prefix, repl, repl_len);
+    strcpy(result + prefix + repl_len, found + old_len);
+    return result;
+}
+
+static int fc_edit(const char *editor, int first, int last, int replace_self) {
+    char *tmpdir = posish_var_get("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/posish-fcXXXXXX",
+             tmpdir && *tmpdir ? tmpdir : "/tmp");
+    free(tmpdir);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        error_sys("fc: cannot create temporary file");
+        return 1;
+    }
+    FILE *f = fdopen(fd, "w");
+    int step = first <= last ? 1 : -1;
+    for (int event = first; ; event += step) {
+        const char *text = history_get_event(event);
+        if (text) fprintf(f, "%s\n", text);
+        if (event == last) break;
+    }
+    fclose(f);
+
+    // The editor is run as a shell command so it may carry arguments.
+    // TMPDIR may hold any character, so the path is quoted with '\''.
+    char *cmd = xmalloc(strlen(editor) + 4 * strlen(path) + 8);
+    char *p = cmd + sprintf(cmd, "%s '", editor);
+    for (const char *s = path; *s; s++) {
+        if (*s == '\'') {
+            memcpy(p, "'\\''", 4);
+            p += 4;
+        } else {
+            *p++ = *s;
+        }
+    }
+    strcpy(p, "'\n");
+    InputSource src;
+    input_source_string(&src, cmd);
+    int status = executor_run_source(&src);
+    free(cmd);
+
+    if (status != 0) {
+        unlink(path);
+        return status;
+    }
+
+    // Read back the edited commands
+    f = fopen(path, "r");
+    unlink(path);
+    if (!f) {
+        error_sys("fc: %s", path);
+        return 1;
+    }
+    char *commands = NULL;
+    size_t len = 0;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        commands = xrealloc(commands, len + n + 1);
+        memcpy(commands + len, chunk, n);
+        len += n;
+    }
+    fclose(f);
+    if (!commands) return 0;
+    commands[len] = '\0';
+
+    status = fc_execute(commands, replace_self);
+    free(commands);
+    return status;
+}
+
+int builtin_fc(char **argv) {
+    int list = 0, no_numbers = 0, reverse = 0, substitute = 0;
+    const char *editor = NULL;
+    int i = 1;
+
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        // "-5" is an operand, not an option
+        if (isdigit((unsigned char)argv[i][1])) break;
+
+        for (const char *p = argv[i] + 1; *p; p++) {
+            if (*p == 'l') list = 1;
+            else if (*p == 'n') no_numbers = 1;
+            else if (*p == 'r') reverse = 1;
+            else if (*p == 's') substitute = 1;
+            else if (*p == 'e') {
+                if (p[1]) {
+                    editor = p + 1;
+                } else if (argv[i + 1]) {
+                    editor = argv[++i];
+                } else {
+                    error_msg("fc: -e: option requires an argument");
+                    return 2;
+                }
+                break;
+            } else {
+                error_msg("fc: -%c: invalid option", *p);
+                fc_usage();
+                return 2;
+            }
+        }
+    }
+
+    // Historical "fc -e -" is the same as "fc -s"
+    if (editor && strcmp(editor, "-") == 0) substitute = 1;
+
+    // In an interactive shell the fc command itself is the newest entry
+    int replace_self = shell_interactive && history_length() > 0;
+    int newest = history_last_event() - (replace_self ? 1 : 0);
+    if (newest < history_first_event()) {
+        error_msg("fc: history is empty");
+        return 1;
+    }
+
+    if (substitute) {
+        const char *pair = NULL;
+        if (argv[i] && strchr(argv[i], '=')) pair = argv[i++];
+        int event = newest;
+        if (argv[i] && fc_resolve(argv[i], newest, &event) != 0) return 1;
+
+        const char *command = history_get_event(event);
+        char *text = pair ? fc_substitute(command, pair) : xstrdup(command);
+        int status = fc_execute(text, replace_self);
+        free(text);
+        return status;
+    }
+
+    int first, last;
+    if (argv[i]) {
+        if (fc_resolve(argv[i], newest, &first) != 0) return 1;
+        if (argv[i + 1]) {
+            if (fc_resolve(argv[i + 1], newest, &last) != 0) return 1;
+        } else {
+            last = list ? newest : first;
+        }
+    } else if (list) {
+        first = newest - (FC_LIST_DEFAULT - 1);
+        if (first < history_first_event()) first = history_first_event();
+        last = newest;
+    } else {
+        first = last = newest;
+    }
+
+    if (reverse) {
+        int tmp = first;
+        first = last;
+        last = tmp;
+    }
+
+    if (!list) {
+        char *fcedit = NULL;
+        if (!editor) {
+            fcedit = posish_var_get("FCEDIT");
+            editor = fcedit && *fcedit ? fcedit : "ed";
+        }
+        int status = fc_edit(editor, first, last, replace_self);
+        free(fcedit);
+        return status;
+    }
+
+    int step = first <= last ? 1 : -1;
+    for (int event = first; ; event += step) {
+        const char *text = history_get_event(event);
+        if (text) {
+            if (no_numbers) {
+                OUT_PRINTF("\t%s\n", text);
+            } else {
+                OUT_PRINTF("%d\t%s\n", event, text);
+            }
+        }
+        if (event == last) break;
+    }
+    return 0;
+}
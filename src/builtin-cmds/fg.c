@@ -2,61 +2,17 @@
 
 
 #include "builtins.h"
+#include "buf_output.h"
 #include "jobs.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <signal.h>
-#include <sys/wait.h>
-#include <unistd.h>
-#include <termios.h>
 
 int builtin_fg(char **args) {
-    int job_id = -1;
-    if (args[1]) {
-        if (args[1][0] == '%') {
-            job_id = atoi(args[1] + 1);
-        } else {
-            job_id = atoi(args[1]);
-        }
-    } else {
-        // Default to last job (not implemented tracking of 'current' job yet, so just take max ID)
-        // For now, error if no args
-        fprintf(stderr, "fg: job id required (e.g. %%1)\n");
-        return 1;
-    }
+    Job *j = job_find_spec(args[1], "fg");
+    if (!j) return 1;
 
-    Job *j = job_find_by_id(job_id);
-    if (!j) {
-        fprintf(stderr, "fg: %d: no such job\n", job_id);
-        return 1;
-    }
+    OUT_PRINTF("%s\n", j->command);
+    OUT_FLUSH();
 
-    printf("%s\n", j->command);
-
-    // Give terminal to job
-    tcsetpgrp(STDIN_FILENO, j->pgid);
-
-    // Continue job if stopped
-    if (j->status == JOB_STOPPED) {
-        kill(-j->pgid, SIGCONT);
-    }
-    
-    j->status = JOB_RUNNING;
-
-    // Wait for job
-    int status;
-    waitpid(-j->pgid, &status, WUNTRACED);
-
-    // Restore terminal to shell
-    tcsetpgrp(STDIN_FILENO, getpgrp());
-
-    if (WIFSTOPPED(status)) {
-        j->status = JOB_STOPPED;
-        printf("\n[%d]+  Stopped                 %s\n", j->id, j->command);
-    } else {
-        // Job done
-        job_remove(j->id);
-    }
-
-    return 0;
+    // Hands the terminal to the job and takes it back when it stops or
+    // finishes
+    return job_foreground(j, 1);
 }
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <string.h>
+#include "builtins.h"
+#include "error.h"
+#include "functions.h"
+#include "launch.h"
+
+// hash [-r] [name...]: remember where commands are in PATH. With no
+// names the remembered paths are listed; -r forgets them first.
+int builtin_hash(char **argv) {
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-r") != 0) {
+            error_msg("hash: %s: invalid option\nusage: hash [-r] [name...]", argv[i]);
+            return 2;
+        }
+        launch_hash_forget(NULL);
+    }
+    if (!argv[i]) {
+        if (i == 1) launch_hash_print();
+        return 0;
+    }
+
+    int status = 0;
+    for (; argv[i]; i++) {
+        // Builtins and functions are found without a search
+        if (builtin_is_builtin(argv[i]) || func_lookup(argv[i])) continue;
+        launch_hash_forget(argv[i]);
+        if (!launch_find(argv[i], NULL)) {
+            error_msg("hash: %s: not found", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -1,11 +1,46 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
 
+#include <string.h>
 #include "builtins.h"
+#include "error.h"
 #include "jobs.h"
 
 int builtin_jobs(char **args) {
-    (void)args;
-    job_print_all();
-    return 0;
+    int style = JOB_LIST_NORMAL;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *p = args[i] + 1; *p; p++) {
+            if (*p == 'l') {
+                style = JOB_LIST_LONG;
+            } else if (*p == 'p') {
+                style = JOB_LIST_PGID;
+            } else {
+                error_msg("jobs: -%c: invalid option", *p);
+                error_msg("usage: jobs [-l | -p] [job_id...]");
+                return 2;
+            }
+        }
+    }
+
+    if (!args[i]) {
+        job_list(NULL, style);
+        return 0;
+    }
+
+    int status = 0;
+    for (; args[i]; i++) {
+        Job *j = job_find_spec(args[i], "jobs");
+        if (j) {
+            job_list(j, style);
+        } else {
+            status = 1;
+        }
+    }
+    return status;
 }
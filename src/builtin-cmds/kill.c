@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <ctype.h>
+#include <unistd.h>
 #include "builtins.h"
 #include "error.h"
 #include "jobs.h"
@@ -184,12 +185,13 @@ int builtin_kill(char **args) {
         pid_t pid;
 
         if (target[0] == '%') {
-            pid = job_resolve_spec(target);
-            if (pid == -1) {
-                error_msg("kill: %s: no such job", target);
+            Job *j = job_find_spec(target, "kill");
+            if (!j) {
                 status = 1;
                 continue;
             }
+            // Signal the whole pipeline when it has its own process group
+            pid = getpgid(j->pgid) == j->pgid ? -j->pgid : j->pgid;
         } else {
             pid = atoi(target);
         }
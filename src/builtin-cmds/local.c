@@ -8,18 +8,19 @@
 
 int builtin_local(char **argv) {
     // local var1 var2=value var3
+    int status = 0;
     for (int i = 1; argv[i]; i++) {
         char *eq = strchr(argv[i], '=');
         if (eq) {
             // Has assignment: local var=value
             *eq = '\0';
-            posish_var_declare_local(argv[i], eq + 1);
+            if (posish_var_declare_local(argv[i], eq + 1)) status = 1;
             *eq = '='; // Restore for potential reuse
         } else {
             // Just declaration: local var
-            posish_var_declare_local(argv[i], "");
+            if (posish_var_declare_local(argv[i], "")) status = 1;
         }
     }
-    return 0;
+    return status;
 }
 
@@ -13,6 +13,8 @@
 #include "memalloc.h"
 #include "buf_output.h"
 #include "error.h"
+#include "signals.h"
+#include "variables.h"
 
 static int has_error = 0;
 
@@ -106,7 +108,7 @@ static long parse_int_arg(const char *arg) {
     return val;
 }
 
-int builtin_printf(char **argv) {
+static int printf_format(char **argv) {
     if (!argv[1]) {
         error_msg("printf: missing format string");
         return 1;
@@ -124,6 +126,7 @@ int builtin_printf(char **argv) {
     
     // Loop until all arguments are consumed or format string is exhausted
     do {
+        SIGNAL_POLL();
         int fmt_idx = 0;
         int had_conversion = 0;
         
@@ -244,3 +247,32 @@ int builtin_printf(char **argv) {
 
     return has_error ? 1 : 0;
 }
+
+int builtin_printf(char **argv) {
+    // Other arguments starting with '-' are formats, as in most shells
+    if (argv[1] && strcmp(argv[1], "--") == 0) return printf_format(argv + 1);
+    if (!argv[1] || strcmp(argv[1], "-v") != 0) return printf_format(argv);
+
+    // printf -v name: format straight into the variable, no fd involved
+    const char *name = argv[2];
+    if (!name) {
+        error_msg("printf: -v: option requires an argument");
+        return 2;
+    }
+    if (!posish_var_is_valid_name(name)) {
+        error_msg("printf: %s: invalid variable name", name);
+        return 2;
+    }
+    argv += 2;
+    if (argv[1] && strcmp(argv[1], "--") == 0) argv++;
+
+    struct buf_capture cap;
+    buf_out_capture_begin(&cap, &buf_stdout);
+    cleanup_push(buf_out_capture_abort, &cap);
+    int status = printf_format(argv);
+    cleanup_pop(0);
+    char *value = buf_out_capture_end(&cap, NULL);
+    if (posish_var_set(name, value) != 0) status = 1;
+    free(value);
+    return status;
+}
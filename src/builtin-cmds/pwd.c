@@ -2,6 +2,7 @@
 
 
 #include "builtins.h"
+#include "buf_output.h"
 #include "error.h"
 #include "variables.h"
 #include <stdio.h>
@@ -36,7 +37,7 @@ int builtin_pwd(char **args) {
     if (logical) {
         char *pwd = posish_var_get("PWD");
         if (pwd) {
-            printf("%s\n", pwd);
+            OUT_PRINTF("%s\n", pwd);
             free(pwd);
             return 0;
         }
@@ -44,7 +45,7 @@ int builtin_pwd(char **args) {
     
     char cwd[PATH_MAX];
     if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        printf("%s\n", cwd);
+        OUT_PRINTF("%s\n", cwd);
         return 0;
     } else {
         error_sys("pwd");
@@ -6,18 +6,30 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <wchar.h>
+#include <sys/stat.h>
 #include "builtins.h"
 #include "variables.h"
 #include "memalloc.h"
 #include "buf_output.h"
+#include "error.h"
+#include "signals.h"
+#include "pattern.h"
 
-// Helper to check if a char is in IFS
-static int is_ifs(char c, const char *ifs) {
+#define READ_CHUNK 65536
+
+// Status when -t expires, as if killed by SIGALRM
+#define READ_TIMEOUT_STATUS 142
+// Byte length of the IFS character at p, or 0
+static size_t is_ifs(const char *p, const char *ifs) {
     if (!ifs) {
         // Default IFS: space, tab, newline
-        return c == ' ' || c == '\t' || c == '\n';
+        return *p == ' ' || *p == '\t' || *p == '\n';
     }
-    return strchr(ifs, c) != NULL;
+    return mb_in_set(p, ifs);
 }
 
 // Helper to check if char is IFS whitespace
@@ -28,15 +40,133 @@ static int is_ifs_whitespace(char c, const char *ifs) {
     return strchr(ifs, c) && isspace((unsigned char)c);
 }
 
+// Input is read straight from the descriptor, never through stdio, and
+// nothing past the delimiter may be consumed: the rest belongs to
+// whatever reads the descriptor next. Regular files are read a chunk at
+// a time and the unused part is given back with lseek(); anything else
+// has to be read a byte at a time.
+struct reader {
+    int fd;
+    int seekable;
+    int timeout_ms;         // -1 without -t
+    struct timespec deadline;
+    int timed_out;
+    char *buf;
+    size_t pos;
+    size_t len;
+};
+
+static int remaining_ms(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+              (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return ms > 0 ? (int)ms : 0;
+}
+
+// Refill the buffer; returns 0 at end of input, timeout or error
+static int reader_fill(struct reader *r) {
+    if (r->timeout_ms >= 0) {
+        struct pollfd pfd = {r->fd, POLLIN, 0};
+        int n;
+        while ((n = poll(&pfd, 1, remaining_ms(&r->deadline))) < 0 && errno == EINTR) {
+            if (got_sigint) return 0;
+        }
+        if (n == 0) {
+            r->timed_out = 1;
+            return 0;
+        }
+    }
+
+    ssize_t n;
+    while ((n = read(r->fd, r->buf, r->seekable ? READ_CHUNK : 1)) < 0 && errno == EINTR) {
+        if (got_sigint) return 0;
+    }
+    if (n < 0) {
+        error_sys("read");
+        return 0;
+    }
+    r->pos = 0;
+    r->len = n;
+    return n > 0;
+}
+
+static int reader_getc(struct reader *r) {
+    if (r->pos == r->len && !reader_fill(r)) return EOF;
+    return (unsigned char)r->buf[r->pos++];
+}
+
+// Give back what was read ahead of the delimiter
+static void reader_finish(struct reader *r) {
+    if (r->seekable && r->pos < r->len) {
+        lseek(r->fd, -(off_t)(r->len - r->pos), SEEK_CUR);
+    }
+}
+
+// Parse a -t operand: seconds, possibly fractional
+static int parse_timeout(const char *arg, int *ms) {
+    char *end;
+    errno = 0;
+    double secs = strtod(arg, &end);
+    if (errno || end == arg || *end || secs < 0 || secs > 86400.0 * 365) return -1;
+    *ms = (int)(secs * 1000 + 0.5);
+    if (*ms == 0 && secs > 0) *ms = 1;
+    return 0;
+}
+
+static void append(char **line, size_t *len, size_t *capacity, const char *s, size_t n) {
+    if (*len + n + 1 > *capacity) {
+        *capacity = (*len + n + 1) * 2;
+        *line = xrealloc(*line, *capacity);
+    }
+    memcpy(*line + *len, s, n);
+    *len += n;
+}
+
 int builtin_read(char **argv) {
     int raw_mode = 0;
-    (void)raw_mode; // Suppress unused warning until implemented
+    int delim = '\n';
+    long max_chars = -1;
+    int timeout_ms = -1;
     int arg_idx = 1;
 
     // Parse options
-    if (argv[1] && strcmp(argv[1], "-r") == 0) {
-        raw_mode = 1;
-        arg_idx++;
+    for (; argv[arg_idx] && argv[arg_idx][0] == '-' && argv[arg_idx][1]; arg_idx++) {
+        if (strcmp(argv[arg_idx], "--") == 0) {
+            arg_idx++;
+            break;
+        }
+        for (const char *p = argv[arg_idx] + 1; *p; p++) {
+            if (*p == 'r') {
+                raw_mode = 1;
+                continue;
+            }
+            if (*p != 'd' && *p != 'n' && *p != 't') {
+                error_msg("read: -%c: invalid option", *p);
+                return 2;
+            }
+
+            // The operand is the rest of this word or the next one
+            const char *value = p[1] ? p + 1 : argv[++arg_idx];
+            if (!value) {
+                error_msg("read: -%c: option requires an argument", *p);
+                return 2;
+            }
+            if (*p == 'd') {
+                delim = (unsigned char)value[0];  // "" selects NUL
+            } else if (*p == 'n') {
+                char *end;
+                max_chars = strtol(value, &end, 10);
+                if (end == value || *end || max_chars < 0) {
+                    error_msg("read: %s: invalid count", value);
+                    return 2;
+                }
+            } else if (parse_timeout(value, &timeout_ms) != 0) {
+                error_msg("read: %s: invalid timeout", value);
+                return 2;
+            }
+            break;
+        }
     }
 
     // Get variable names
@@ -51,79 +181,89 @@ int builtin_read(char **argv) {
         var_count = 1;
     }
 
-    // Read line from stdin with backslash processing
-    char *line = NULL;
-    size_t capacity = 0;
-    size_t len = 0;
-    int continuation = 0;
-
     // Flush stdout before reading to ensure prompts are visible
     OUT_FLUSH();
 
-    do {
-        char *buf = NULL;
-        size_t buf_len = 0;
-        ssize_t n = getline(&buf, &buf_len, stdin);
-        
-        if (n == -1) {
-            free(buf);
-            if (len == 0) {
-                free(line);
-                return 1; // EOF or error
-            }
-            break; // EOF after some content
-        }
+    // -t 0 only reports whether input is waiting
+    if (timeout_ms == 0) {
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        return poll(&pfd, 1, 0) > 0 ? 0 : 1;
+    }
 
-        // Remove trailing newline
-        if (n > 0 && buf[n - 1] == '\n') {
-            buf[n - 1] = '\0';
-            n--;
+    struct reader r = {0};
+    r.fd = STDIN_FILENO;
+    struct stat st;
+    r.seekable = fstat(r.fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                 lseek(r.fd, 0, SEEK_CUR) >= 0;
+    r.timeout_ms = timeout_ms;
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &r.deadline);
+        r.deadline.tv_sec += timeout_ms / 1000;
+        r.deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (r.deadline.tv_nsec >= 1000000000) {
+            r.deadline.tv_sec++;
+            r.deadline.tv_nsec -= 1000000000;
         }
+    }
+    char small[1];
+    r.buf = r.seekable ? xmalloc(READ_CHUNK) : small;
 
-        // Check for line continuation if not raw mode
-        continuation = 0;
-        if (!raw_mode && n > 0 && buf[n - 1] == '\\') {
-            continuation = 1;
-            buf[n - 1] = '\0'; // Remove backslash
-            n--;
-        }
+    // Read up to the delimiter with backslash processing
+    size_t capacity = 128;
+    size_t len = 0;
+    char *line = xmalloc(capacity);
+    int got_delim = 0;
+    long nchars = 0;
+    mbstate_t mbs;
+    memset(&mbs, 0, sizeof(mbs));
 
-        // Append to line
-        size_t needed = len + n + 1; // +1 for null terminator
-        if (needed > capacity) {
-            capacity = needed + 128; // Add extra buffer space
-            line = xrealloc(line, capacity);
-            if (!line) {
-                free(buf);
-                return 1;
+    while (max_chars < 0 || nchars < max_chars) {
+        // Raw reads without a count take whole runs of the buffer
+        if (raw_mode && max_chars < 0 && r.pos < r.len) {
+            char *start = r.buf + r.pos;
+            char *end = memchr(start, delim, r.len - r.pos);
+            size_t n = end ? (size_t)(end - start) : r.len - r.pos;
+            append(&line, &len, &capacity, start, n);
+            r.pos += n + (end ? 1 : 0);
+            if (end) {
+                got_delim = 1;
+                break;
             }
+            continue;
         }
-        
-        // Process backslashes in the buffer if not raw mode
-        if (!raw_mode) {
-            size_t j = 0;
-            for (size_t i = 0; i < (size_t)n; i++) {
-                if (buf[i] == '\\' && i + 1 < (size_t)n) {
-                    // Escape next char
-                    line[len + j++] = buf[++i];
-                } else {
-                    line[len + j++] = buf[i];
-                }
-            }
-            len += j;
-        } else {
-            if (line && n > 0) {
-                memcpy(line + len, buf, n);
-            }
-            len += n;
+
+        int c = reader_getc(&r);
+        if (c == EOF) break;
+        if (c == delim) {
+            got_delim = 1;
+            break;
         }
-        if (line) line[len] = '\0';
-        
-        free(buf);
-        
-        // If continuation, prompt if interactive (PS2) - strictly speaking optional for builtin
-        // but we should loop to read more
-    } while (continuation);
+        if (!raw_mode && c == '\\') {
+            c = reader_getc(&r);
+            if (c == EOF) break;
+            // Backslash-newline continues the line
+            if (c == '\n') continue;
+        }
+        char ch = (char)c;
+        append(&line, &len, &capacity, &ch, 1);
+        // -n counts characters: a multibyte one once it is complete
+        if (max_chars >= 0 && (c >= 0x80 || !mbsinit(&mbs))) {
+            size_t n = mbrlen(&ch, 1, &mbs);
+            if (n == (size_t)-2) continue;
+            if (n == (size_t)-1) memset(&mbs, 0, sizeof(mbs));
+        }
+        nchars++;
+    }
+    line[len] = '\0';
+
+    reader_finish(&r);
+    if (r.seekable) free(r.buf);
+
+    if (len == 0 && !got_delim && !(max_chars >= 0 && nchars == max_chars)) {
+        free(line);
+        if (r.timed_out) return READ_TIMEOUT_STATUS;
+        return 1; // EOF or error
+    }
 
     // Get IFS
     char *ifs_val = posish_var_get("IFS");
@@ -158,8 +298,8 @@ int builtin_read(char **argv) {
         }
 
         // Find end of field
-        while (*cursor && !is_ifs(*cursor, ifs)) {
-            cursor++;
+        while (*cursor && !is_ifs(cursor, ifs)) {
+            cursor += mb_len(cursor);
         }
         
         value_end = cursor;
@@ -173,7 +313,7 @@ int builtin_read(char **argv) {
                 }
             } else {
                 // Non-whitespace IFS char: just skip it, then skip subsequent whitespace
-                cursor++;
+                cursor += is_ifs(cursor, ifs);
                 while (*cursor && is_ifs_whitespace(*cursor, ifs)) {
                     cursor++;
                 }
@@ -189,5 +329,5 @@ int builtin_read(char **argv) {
 
     if (ifs_val) free(ifs_val);
     free(line);
-    return 0;
+    return r.timed_out ? READ_TIMEOUT_STATUS : 0;
 }
@@ -8,19 +8,26 @@
 #include "variables.h"
 
 int builtin_readonly(char **argv) {
-    // No arguments: list all readonly variables
-    if (!argv[1]) {
-        char **readonly_vars = posish_var_get_all_readonly();
-        for (int i = 0; readonly_vars[i]; i++) {
-            printf("readonly %s\n", readonly_vars[i]);
-            free(readonly_vars[i]);
+    // -p only asks for the listing, which is also what no operands give
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
         }
-        free(readonly_vars);
+        if (strcmp(argv[i], "-p") != 0) {
+            fprintf(stderr, "readonly: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (!argv[i]) {
+        posish_var_list(VREADONLY, "readonly");
         return 0;
     }
     
     // Mark variables as readonly
-    for (int i = 1; argv[i]; i++) {
+    for (; argv[i]; i++) {
         char *eq = strchr(argv[i], '=');
         
         if (eq) {
@@ -39,15 +46,8 @@ int builtin_readonly(char **argv) {
             posish_var_set_readonly(name);
             *eq = '='; // Restore
         } else {
-            // readonly VAR (mark existing as readonly)
-            const char *name = argv[i];
-            
-            if (!posish_var_get(name)) {
-                fprintf(stderr, "readonly: %s: not found\n", name);
-                continue;
-            }
-            
-            posish_var_set_readonly(name);
+            // readonly VAR: an unset one stays unset for good
+            posish_var_set_readonly(argv[i]);
         }
     }
     
@@ -2,8 +2,12 @@
 
 
 #include "builtins.h"
+#include "deparse.h"
+#include "functions.h"
+#include "memalloc.h"
 #include "variables.h"
 #include "shell_options.h"
+#include "buf_output.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +19,8 @@ static const struct {
     char short_opt;  // '\0' if no single-letter equivalent
 } option_map[] = {
     {"allexport", &shell_all_export, 'a'},
+    {"backtrace", &shell_backtrace, '\0'},
+    {"emacs", &shell_emacs_mode, '\0'},
     {"errexit", &shell_exit_on_error, 'e'},
     {"ignoreeof", &shell_ignore_eof, '\0'},
     {"monitor", &shell_monitor, 'm'},
@@ -24,6 +30,7 @@ static const struct {
     {"nolog", &shell_nolog, '\0'},
     {"notify", &shell_notify, 'b'},
     {"nounset", &shell_no_unset, 'u'},
+    {"pipefail", &shell_pipefail, '\0'},
     {"verbose", &shell_verbose, 'v'},
     {"vi", &shell_vi_mode, '\0'},
     {"xtrace", &shell_trace_mode, 'x'},
@@ -36,22 +43,56 @@ static void print_options(int reinput_format) {
         // +o format: suitable for reinput to shell
         for (int i = 0; option_map[i].name; i++) {
             const char *state = *option_map[i].flag_ptr ? "-o" : "+o";
-            printf("set %s %s\n", state, option_map[i].name);
+            OUT_PRINTF("set %s %s\n", state, option_map[i].name);
         }
     } else {
         // -o format: human-readable
         for (int i = 0; option_map[i].name; i++) {
             const char *state = *option_map[i].flag_ptr ? "on" : "off";
-            printf("%-12s\t%s\n", option_map[i].name, state);
+            OUT_PRINTF("%-12s\t%s\n", option_map[i].name, state);
         }
     }
 }
 
+struct func_entry {
+    const char *name;
+    ASTNode *body;
+};
+
+struct func_entries {
+    struct func_entry *list;
+    size_t count;
+};
+
+static void collect_function(const char *name, ASTNode *body, void *ctx) {
+    struct func_entries *e = ctx;
+    e->list = mem_stack_realloc_array(e->list, e->count, e->count + 1, sizeof(*e->list));
+    e->list[e->count++] = (struct func_entry){name, body};
+}
+
+static int compare_functions(const void *a, const void *b) {
+    return strcoll(((const struct func_entry *)a)->name, ((const struct func_entry *)b)->name);
+}
+
+// Function definitions sorted by name, in a form the shell reads back
+static void print_functions(void) {
+    struct stackmark mark;
+    mem_stack_push_mark(&mark);
+    struct func_entries e = {0};
+    func_foreach(collect_function, &e);
+    if (e.count > 1) qsort(e.list, e.count, sizeof(*e.list), compare_functions);
+    for (size_t i = 0; i < e.count; i++) deparse_function(e.list[i].name, e.list[i].body, &buf_stdout);
+    mem_stack_pop_mark(&mark);
+}
+
 // Set or unset a named option
 static int set_named_option(const char *name, int enable) {
     for (int i = 0; option_map[i].name; i++) {
         if (strcmp(name, option_map[i].name) == 0) {
             *option_map[i].flag_ptr = enable;
+            // The editing modes are mutually exclusive
+            if (enable && option_map[i].flag_ptr == &shell_vi_mode) shell_emacs_mode = 0;
+            if (enable && option_map[i].flag_ptr == &shell_emacs_mode) shell_vi_mode = 0;
             return 0;
         }
     }
@@ -61,13 +102,9 @@ static int set_named_option(const char *name, int enable) {
 
 int builtin_set(char **args) {
     if (!args[1]) {
-        // List all variables
-        char **vars = posish_var_get_all();
-        for (char **v = vars; *v != NULL; v++) {
-            printf("%s\n", *v);
-            free(*v);
-        }
-        free(vars);
+        // List all variables, then the functions
+        posish_var_list(0, NULL);
+        print_functions();
         return 0;
     }
 
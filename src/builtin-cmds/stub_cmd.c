@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "builtins.h"
+#include "buf_output.h"
+#include "error.h"
+#include "lexer.h"
+#include "memalloc.h"
+#include "parser.h"
+#include "stub.h"
+
+#define STUB_USAGE "usage: stub [-o output] [-s status] name [body] | stub -d name... | stub -l|-c [name]"
+
+// Build the quoted text of a stub command in a string
+static void put_word(struct buf_out *buf, const char *word) {
+    if (buf->next > buf->start) BUF_PUTC(' ', buf);
+    buf_out_quoted(word, buf);
+}
+
+static int define_stub(const char *name, const char *body, const char *output, const char *status) {
+    if (!*name || strchr(name, '/')) {
+        error_msg("stub: %s: invalid name", name);
+        return 2;
+    }
+    // Builtins are found first, so a stub for one would never run
+    if (builtin_is_builtin(name)) {
+        error_msg("stub: %s: is a shell builtin", name);
+        return 1;
+    }
+    if (status) {
+        char *end;
+        long n = strtol(status, &end, 10);
+        if (end == status || *end || n < 0 || n > 255) {
+            error_msg("stub: %s: invalid status", status);
+            return 2;
+        }
+    }
+
+    // A canned reply is made into a body, and the stub command that
+    // made it is kept for listing
+    struct buf_out code = {0};
+    struct buf_capture code_cap;
+    buf_out_capture_begin(&code_cap, &code);
+    struct buf_out def = {0};
+    struct buf_capture def_cap;
+    buf_out_capture_begin(&def_cap, &def);
+
+    buf_out_puts("stub", &def);
+    if (body) {
+        buf_out_puts(body, &code);
+    } else {
+        if (output) {
+            buf_out_puts("printf '%s\\n' ", &code);
+            buf_out_quoted(output, &code);
+            buf_out_puts("; ", &code);
+            put_word(&def, "-o");
+            put_word(&def, output);
+        }
+        if (status) {
+            buf_out_printf(&code, "return %s", status);
+            put_word(&def, "-s");
+            put_word(&def, status);
+        }
+    }
+    put_word(&def, name);
+    if (body) put_word(&def, body);
+
+    char *text = buf_out_capture_end(&code_cap, NULL);
+    char *definition = buf_out_capture_end(&def_cap, NULL);
+    if (!text[strspn(text, " \t\n;")]) {
+        free(text);
+        text = xstrdup(":");
+    }
+
+    struct stackmark smark;
+    mem_stack_push_mark(&smark);
+    Lexer lexer;
+    lexer_init(&lexer, text);
+    ASTNode *ast = parser_parse(&lexer);
+    int result = 2;  // The parser has reported a syntax error
+    if (ast) {
+        stub_define(name, ast_clone_to_heap(ast), definition);
+        result = 0;
+    }
+    mem_stack_pop_mark(&smark);
+    free(text);
+    free(definition);
+    return result;
+}
+
+int builtin_stub(char **argv) {
+    const char *output = NULL;
+    const char *status = NULL;
+    int mode = 0;  // 'd', 'l' or 'c'; 0 to define
+    int i = 1;
+
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *p = argv[i] + 1; *p; p++) {
+            if (*p == 'd' || *p == 'l' || *p == 'c') {
+                mode = *p;
+                continue;
+            }
+            if (*p != 'o' && *p != 's') {
+                error_msg("stub: -%c: invalid option\n" STUB_USAGE, *p);
+                return 2;
+            }
+            const char *value = p[1] ? p + 1 : argv[++i];
+            if (!value) {
+                error_msg("stub: -%c: option requires an argument", *p);
+                return 2;
+            }
+            if (*p == 'o') output = value;
+            else status = value;
+            break;
+        }
+    }
+    char **names = argv + i;
+
+    if (mode == 'd') {
+        int result = 0;
+        for (; *names; names++) {
+            if (stub_remove(*names) != 0) {
+                error_msg("stub: %s: not a stub", *names);
+                result = 1;
+            }
+        }
+        return result;
+    }
+    if (mode == 'l' || mode == 'c') {
+        if (names[0] && names[1]) {
+            error_msg(STUB_USAGE);
+            return 2;
+        }
+        if (stub_print_calls(names[0], mode == 'c') != 0) {
+            error_msg("stub: %s: not a stub", names[0]);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!names[0]) {
+        if (output || status) {
+            error_msg(STUB_USAGE);
+            return 2;
+        }
+        stub_print_all();
+        return 0;
+    }
+    if ((names[1] && names[2]) || (names[1] && (output || status))) {
+        error_msg(STUB_USAGE);
+        return 2;
+    }
+    return define_stub(names[0], names[1], output, status);
+}
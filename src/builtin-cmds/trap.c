@@ -13,12 +13,15 @@ int builtin_trap(char **argv) {
     int argc = 0;
     while (argv[argc]) argc++;
 
-    if (argc == 1) {
+    // "trap -- action cond" is how the listing writes traps back
+    int arg_idx = 1;
+    if (argv[1] && strcmp(argv[1], "--") == 0) arg_idx++;
+
+    if (arg_idx >= argc) {
         signal_list_traps();
         return 0;
     }
 
-    int arg_idx = 1;
     const char *action = NULL;
     int reset = 0;
 
@@ -2,10 +2,14 @@
 
 
 #include "builtins.h"
+#include "buf_output.h"
+#include "deparse.h"
 #include "executor.h"
 #include "error.h"
 #include "alias.h"
 #include "functions.h"
+#include "launch.h"
+#include "stub.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -22,28 +26,35 @@ int builtin_type(char **args) {
         // Check alias
         char *alias = alias_get(name);
         if (alias) {
-            printf("%s is an alias for %s\n", name, alias);
+            OUT_PRINTF("%s is an alias for %s\n", name, alias);
             free(alias);
             continue;
         }
         
         // Check builtin
         if (builtin_is_builtin(name)) {
-            printf("%s is a shell builtin\n", name);
+            OUT_PRINTF("%s is a shell builtin\n", name);
             continue;
         }
         
         // Check function
-        if (func_lookup(name)) {
-            printf("%s is a function\n", name);
+        ASTNode *body = func_lookup(name);
+        if (body) {
+            OUT_PRINTF("%s is a function\n", name);
+            deparse_function(name, body, &buf_stdout);
+            continue;
+        }
+
+        // Check stub
+        if (stub_count && stub_lookup(name)) {
+            OUT_PRINTF("%s is a stub\n", name);
             continue;
         }
         
         // Check path
-        char *path = find_executable(name);
+        char *path = launch_find(name, NULL);
         if (path) {
-            printf("%s is %s\n", name, path);
-            free(path);
+            OUT_PRINTF("%s is %s\n", name, path);
             continue;
         }
         
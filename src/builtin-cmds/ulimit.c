@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include "builtins.h"
+#include "buf_output.h"
+#include "error.h"
+
+// ulimit changes the limits of the process it runs in. It is not on the
+// list of builtins the executor may run in-process for a subshell or
+// command substitution, so "(ulimit -v N; exec cmd)" always forks and
+// never touches the parent shell's limits.
+
+struct limit {
+    char option;
+    int resource;
+    rlim_t factor;      // Bytes per unit shown to the user
+    const char *name;
+    const char *unit;
+};
+
+static const struct limit limits[] = {
+    {'c', RLIMIT_CORE,   512,  "core file size", "blocks"},
+    {'d', RLIMIT_DATA,   1024, "data seg size",  "kbytes"},
+    {'f', RLIMIT_FSIZE,  512,  "file size",      "blocks"},
+    {'n', RLIMIT_NOFILE, 1,    "open files",     NULL},
+    {'s', RLIMIT_STACK,  1024, "stack size",     "kbytes"},
+    {'t', RLIMIT_CPU,    1,    "cpu time",       "seconds"},
+#ifdef RLIMIT_AS
+    {'v', RLIMIT_AS,     1024, "virtual memory", "kbytes"},
+#endif
+};
+
+#define LIMIT_COUNT (sizeof(limits) / sizeof(limits[0]))
+
+enum {
+    LIMIT_SOFT = 1,
+    LIMIT_HARD = 2
+};
+
+static const struct limit *find_limit(char option) {
+    for (size_t i = 0; i < LIMIT_COUNT; i++) {
+        if (limits[i].option == option) return &limits[i];
+    }
+    return NULL;
+}
+
+static void print_limit(const struct limit *l, int which, int verbose) {
+    struct rlimit rl;
+    if (getrlimit(l->resource, &rl) < 0) {
+        error_sys("ulimit: %s", l->name);
+        return;
+    }
+    rlim_t value = (which & LIMIT_HARD) && !(which & LIMIT_SOFT) ? rl.rlim_max : rl.rlim_cur;
+
+    if (verbose) {
+        char label[64];
+        if (l->unit) {
+            snprintf(label, sizeof(label), "(%s, -%c)", l->unit, l->option);
+        } else {
+            snprintf(label, sizeof(label), "(-%c)", l->option);
+        }
+        OUT_PRINTF("%-20s %-16s ", l->name, label);
+    }
+    if (value == RLIM_INFINITY) {
+        OUT_PUTS("unlimited\n");
+    } else {
+        OUT_PRINTF("%llu\n", (unsigned long long)(value / l->factor));
+    }
+}
+
+static int parse_value(const char *arg, const struct limit *l, rlim_t *value) {
+    if (strcmp(arg, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (errno || end == arg || *end || arg[0] == '-') return -1;
+    if (n > (unsigned long long)(RLIM_INFINITY - 1) / l->factor) return -1;
+    *value = (rlim_t)n * l->factor;
+    return 0;
+}
+
+static int set_limit(const struct limit *l, int which, const char *arg) {
+    rlim_t value;
+    if (parse_value(arg, l, &value) != 0) {
+        error_msg("ulimit: %s: bad number", arg);
+        return 1;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(l->resource, &rl) < 0) {
+        error_sys("ulimit: %s", l->name);
+        return 1;
+    }
+    if (which & LIMIT_HARD) rl.rlim_max = value;
+    if (which & LIMIT_SOFT) rl.rlim_cur = value;
+
+    if (setrlimit(l->resource, &rl) < 0) {
+        error_sys("ulimit: %s", l->name);
+        return 1;
+    }
+    return 0;
+}
+
+int builtin_ulimit(char **argv) {
+    const struct limit *selected[LIMIT_COUNT];
+    size_t nselected = 0;
+    int which = 0;
+    int all = 0;
+    int i = 1;
+
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *p = argv[i] + 1; *p; p++) {
+            if (*p == 'H') {
+                which |= LIMIT_HARD;
+            } else if (*p == 'S') {
+                which |= LIMIT_SOFT;
+            } else if (*p == 'a') {
+                all = 1;
+            } else {
+                const struct limit *l = find_limit(*p);
+                if (!l) {
+                    error_msg("ulimit: -%c: invalid option", *p);
+                    return 2;
+                }
+                if (nselected < LIMIT_COUNT) selected[nselected++] = l;
+            }
+        }
+    }
+
+    if (all) {
+        if (argv[i]) {
+            error_msg("ulimit: too many arguments");
+            return 2;
+        }
+        for (size_t k = 0; k < LIMIT_COUNT; k++) {
+            print_limit(&limits[k], which ? which : LIMIT_SOFT, 1);
+        }
+        return 0;
+    }
+
+    // POSIX: -f is the default resource
+    if (nselected == 0) selected[nselected++] = find_limit('f');
+
+    if (!argv[i]) {
+        for (size_t k = 0; k < nselected; k++) {
+            print_limit(selected[k], which ? which : LIMIT_SOFT, nselected > 1);
+        }
+        return 0;
+    }
+    if (argv[i + 1]) {
+        error_msg("ulimit: too many arguments");
+        return 2;
+    }
+
+    // Without -H or -S both limits are set
+    if (!which) which = LIMIT_SOFT | LIMIT_HARD;
+    int status = 0;
+    for (size_t k = 0; k < nselected; k++) {
+        if (set_limit(selected[k], which, argv[i]) != 0) status = 1;
+    }
+    return status;
+}
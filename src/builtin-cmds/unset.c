@@ -11,8 +11,9 @@ int builtin_unset(char **args) {
         return 0;
     }
 
+    int status = 0;
     for (int i = 1; args[i] != NULL; i++) {
-        posish_var_unset(args[i]);
+        if (posish_var_unset(args[i]) != 0) status = 1;
     }
-    return 0;
+    return status;
 }
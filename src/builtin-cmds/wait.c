@@ -4,37 +4,51 @@
 #include "builtins.h"
 #include "jobs.h"
 #include "error.h"
+#include "signals.h"
 #include <stdlib.h>
-#include <sys/wait.h>
+
+// A trapped signal ends the wait at once with a status above 128, and
+// its trap runs right after (POSIX "Signals and Error Handling")
+static int interrupted(int signo) {
+    signal_check_pending();
+    return 128 + signo;
+}
 
 int builtin_wait(char **args) {
     if (!args[1]) {
-        return job_wait_all();
+        int status;
+        int signo = job_wait_all(&status);
+        return signo ? interrupted(signo) : status;
     }
     
     int status = 0;
     for (int i = 1; args[i]; i++) {
         pid_t pid = -1;
+        Job *j;
         if (args[i][0] == '%') {
-            pid = job_resolve_spec(args[i]);
+            j = job_find_spec(args[i], "wait");
+            if (!j) {
+                status = 127;
+                continue;
+            }
         } else {
             pid = atoi(args[i]);
+            if (pid <= 0) {
+                error_msg("wait: %s: invalid job spec or pid", args[i]);
+                status = 127;
+                continue;
+            }
+            j = job_find_by_pid(pid);
         }
-        
-        if (pid <= 0) {
-            error_msg("wait: %s: invalid job spec or pid", args[i]);
-            status = 127;
-            continue;
-        }
-        
-        Job *j = job_find_by_pid(pid);
+
         if (j) {
-            status = job_wait(j);
-        } else {
-            // If not found, maybe it's already done?
-            // POSIX says if pid is not a child of this shell, return 127.
-            // But we don't track all history.
-            // For now, assume 127.
+            int signo = job_wait_signal(j, &status);
+            if (signo) return interrupted(signo);
+            j->changed = 0;
+            job_release(j);
+        } else if (job_saved_status(pid, &status) != 0) {
+            // Already reported jobs keep their status for a while;
+            // anything else is not a child of this shell.
             error_msg("wait: pid %d is not a child of this shell", pid);
             status = 127;
         }
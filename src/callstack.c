@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdlib.h>
+#include "callstack.h"
+#include "input.h"
+#include "memalloc.h"
+#include "output.h"
+#include "shell_options.h"
+#include "variables.h"
+
+struct call_frame *call_stack = NULL;
+int call_depth = 0;
+static int call_cap = 0;
+static unsigned long call_count = 0;
+
+int call_file = 0;
+int call_line = 0;
+
+void callstack_push(const char *name) {
+    if (call_depth == call_cap) {
+        call_cap = call_cap ? call_cap * 2 : 16;
+        call_stack = xrealloc(call_stack, call_cap * sizeof(*call_stack));
+    }
+    call_stack[call_depth++] = (struct call_frame){name, call_file, call_line, ++call_count};
+}
+
+void callstack_pop(void *unused) {
+    (void)unused;
+    struct call_frame *f = &call_stack[--call_depth];
+    call_file = f->file;
+    call_line = f->line;
+}
+
+char *callstack_file_name(int file) {
+    const char *name = input_file_name(file);
+    if (name) return xstrdup(name);
+    char *shell_name = posish_var_get_shell_name();
+    return shell_name ? shell_name : xstrdup("posish");
+}
+
+static void print_frame(FILE *out, int file, int line, const char *name) {
+    char *file_name = callstack_file_name(file);
+    fprintf(out, "  at %s:%d in %s\n", file_name, line, name);
+    free(file_name);
+}
+
+// Each frame is shown at the line it has reached: the innermost at the
+// command being run, the others at the call they are waiting on
+void callstack_print(FILE *out, int limit) {
+    int file = call_file;
+    int line = call_line;
+    for (int i = call_depth - 1; i >= 0; i--) {
+        if (limit && call_depth - 1 - i == limit) {
+            fprintf(out, "  ... %d more\n", i + 1);
+            file = call_stack[0].file;
+            line = call_stack[0].line;
+            break;
+        }
+        print_frame(out, file, line, call_stack[i].name);
+        file = call_stack[i].file;
+        line = call_stack[i].line;
+    }
+    print_frame(out, file, line, "main");
+}
+
+void callstack_backtrace(void) {
+    if (!shell_backtrace || call_depth == 0) return;
+
+    error_printf("backtrace:\n");
+    callstack_print(stderr, 0);
+}
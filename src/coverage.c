@@ -0,0 +1,431 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "coverage.h"
+#include "error.h"
+#include "input.h"
+#include "lexer.h"
+#include "memalloc.h"
+#include "parser.h"
+
+unsigned long *coverage_counts = NULL;
+static size_t count_used;
+static size_t count_cap;
+
+static char *output_path;
+static pid_t owner_pid;
+
+// A construct that has counters
+struct site {
+    int file;
+    int line;
+    int column;
+    NodeType type;
+    unsigned int base;     // Index of its run counter
+    unsigned int branches; // Branch counters following it
+};
+
+static struct site *sites;
+static size_t site_count;
+static size_t site_cap;
+
+// Open addressing over sites: slot holds index + 1, 0 is empty
+static unsigned int *site_table;
+static size_t table_size;
+
+// Absolute path of each registered file number, NULL for the others
+static char **file_paths;
+static int file_count;
+
+static int file_registered(int file) {
+    return file > 0 && file < file_count && file_paths[file];
+}
+
+static size_t site_hash(int file, int line, int column, NodeType type) {
+    size_t h = (size_t)file;
+    h = h * 31 + (size_t)line;
+    h = h * 31 + (size_t)column;
+    h = h * 31 + (size_t)type;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
+
+static void table_insert(size_t index) {
+    const struct site *s = &sites[index];
+    size_t mask = table_size - 1;
+    size_t i = site_hash(s->file, s->line, s->column, s->type) & mask;
+    while (site_table[i]) i = (i + 1) & mask;
+    site_table[i] = index + 1;
+}
+
+static void table_grow(void) {
+    free(site_table);
+    table_size = table_size ? table_size * 2 : 256;
+    site_table = xmalloc(table_size * sizeof(*site_table));
+    memset(site_table, 0, table_size * sizeof(*site_table));
+    for (size_t i = 0; i < site_count; i++) table_insert(i);
+}
+
+// Counters of the construct of this type at pos, made on first sight
+static unsigned int site_counters(const SourcePos *pos, NodeType type, unsigned int branches) {
+    if (pos->line <= 0 || !file_registered(pos->file)) return 0;
+
+    if ((site_count + 1) * 2 > table_size) table_grow();
+    size_t mask = table_size - 1;
+    for (size_t i = site_hash(pos->file, pos->line, pos->column, type) & mask;
+         site_table[i]; i = (i + 1) & mask) {
+        const struct site *s = &sites[site_table[i] - 1];
+        if (s->file == pos->file && s->line == pos->line && s->column == pos->column &&
+            s->type == type && s->branches == branches) {
+            return s->base;
+        }
+    }
+
+    size_t need = count_used + 1 + branches;
+    if (need > count_cap) {
+        size_t cap = count_cap * 2;
+        while (cap < need) cap *= 2;
+        coverage_counts = xrealloc(coverage_counts, cap * sizeof(*coverage_counts));
+        memset(coverage_counts + count_cap, 0, (cap - count_cap) * sizeof(*coverage_counts));
+        count_cap = cap;
+    }
+    if (site_count == site_cap) {
+        site_cap = site_cap ? site_cap * 2 : 256;
+        sites = xrealloc(sites, site_cap * sizeof(*sites));
+    }
+    sites[site_count] = (struct site){pos->file, pos->line, pos->column, type,
+                                      (unsigned int)count_used, branches};
+    table_insert(site_count++);
+    count_used = need;
+    return sites[site_count - 1].base;
+}
+
+// Where the right side of && or || starts, which is where its branch
+// is reported
+static const SourcePos *leftmost_pos(ASTNode *node) {
+    while (node->type == NODE_PIPELINE || node->type == NODE_AND ||
+           node->type == NODE_OR || node->type == NODE_LIST) {
+        node = node->type == NODE_LIST ? node->data.list.left : node->data.pipeline.left;
+    }
+    return &node->pos;
+}
+
+void coverage_instrument(ASTNode *node) {
+    while (node) {
+        switch (node->type) {
+        case NODE_COMMAND:
+            node->cov = site_counters(&node->pos, node->type, 0);
+            return;
+
+        case NODE_LIST:
+            coverage_instrument(node->data.list.left);
+            node = node->data.list.right;
+            continue;
+
+        case NODE_PIPELINE:
+            coverage_instrument(node->data.pipeline.left);
+            node = node->data.pipeline.right;
+            continue;
+
+        case NODE_NOT:
+        case NODE_TIME:
+            node = node->data.prefixed.pipeline;
+            continue;
+
+        case NODE_AND:
+        case NODE_OR:
+            node->cov = site_counters(leftmost_pos(node->data.pipeline.right), node->type, 2);
+            coverage_instrument(node->data.pipeline.left);
+            node = node->data.pipeline.right;
+            continue;
+
+        case NODE_IF:
+            node->cov = site_counters(&node->pos, node->type, 2);
+            coverage_instrument(node->data.if_stmt.condition);
+            coverage_instrument(node->data.if_stmt.then_branch);
+            node = node->data.if_stmt.else_branch;
+            continue;
+
+        case NODE_WHILE:
+            node->cov = site_counters(&node->pos, node->type, 2);
+            coverage_instrument(node->data.while_loop.condition);
+            node = node->data.while_loop.body;
+            continue;
+
+        case NODE_UNTIL:
+            node->cov = site_counters(&node->pos, node->type, 2);
+            coverage_instrument(node->data.until_loop.condition);
+            node = node->data.until_loop.body;
+            continue;
+
+        case NODE_FOR:
+            node->cov = site_counters(&node->pos, node->type, 0);
+            node = node->data.for_loop.body;
+            continue;
+
+        case NODE_SUBSHELL:
+            node->cov = site_counters(&node->pos, node->type, 0);
+            node = node->data.subshell.body;
+            continue;
+
+        case NODE_GROUP:
+            node->cov = site_counters(&node->pos, node->type, 0);
+            node = node->data.group.body;
+            continue;
+
+        case NODE_FUNCTION:
+            node->cov = site_counters(&node->pos, node->type, 0);
+            node = node->data.function.body;
+            continue;
+
+        case NODE_CASE: {
+            CaseNode *c = &node->data.case_stmt;
+            node->cov = site_counters(&node->pos, node->type, (unsigned int)c->item_count + 1);
+            for (size_t i = 0; i < c->item_count; i++) coverage_instrument(c->items[i].commands);
+            return;
+        }
+        }
+        return;
+    }
+}
+
+static void instrument_visit(ASTNode *node, void *arg) {
+    (void)arg;
+    coverage_instrument(node);
+}
+
+void coverage_register_file(int file) {
+    if (!coverage_counts || file <= 0 || file_registered(file)) return;
+
+    const char *name = input_file_name(file);
+    char *path = name ? realpath(name, NULL) : NULL;
+    if (!path) return;
+    if (file >= file_count) {
+        int count = file + 16;
+        file_paths = xrealloc(file_paths, count * sizeof(*file_paths));
+        memset(file_paths + file_count, 0, (count - file_count) * sizeof(*file_paths));
+        file_count = count;
+    }
+    file_paths[file] = path;
+
+    // Parse the whole file up front; syntax errors are reported when
+    // the script gets to them
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    size_t len;
+    char *text = input_read_all(fd, &len);
+    close(fd);
+    if (!text) return;
+
+    struct stackmark smark;
+    mem_stack_push_mark(&smark);
+    Lexer lexer;
+    lexer_init(&lexer, text);
+    lexer.file = file;
+    lexer.no_alias = 1;
+    lexer.quiet = 1;
+    parser_parse_all(&lexer, instrument_visit, NULL);
+    mem_stack_pop_mark(&smark);
+    free(text);
+}
+
+void coverage_start(const char *path) {
+    output_path = xstrdup(path);
+    owner_pid = getpid();
+    count_cap = 1024;
+    coverage_counts = xmalloc(count_cap * sizeof(*coverage_counts));
+    memset(coverage_counts, 0, count_cap * sizeof(*coverage_counts));
+    count_used = 1; // cov 0 means no counters
+    atexit(coverage_flush);
+}
+
+void coverage_forked(void) {
+    if (!coverage_counts) return;
+    owner_pid = getpid();
+    memset(coverage_counts, 0, count_used * sizeof(*coverage_counts));
+}
+
+// ---------------------------------------------------------------------------
+// Writing the lcov file
+
+enum { REC_BRDA, REC_DA };
+
+struct record {
+    const char *file;
+    int kind;
+    int line;
+    int block;
+    int branch;
+    long count; // -1 for a branch whose construct never ran
+};
+
+struct records {
+    struct record *items;
+    size_t count;
+    size_t cap;
+};
+
+static void add_record(struct records *r, struct record rec) {
+    if (r->count == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 256;
+        r->items = xrealloc(r->items, r->cap * sizeof(*r->items));
+    }
+    r->items[r->count++] = rec;
+}
+
+static int compare_records(const void *pa, const void *pb) {
+    const struct record *a = pa;
+    const struct record *b = pb;
+    int c = strcmp(a->file, b->file);
+    if (c) return c;
+    if (a->kind != b->kind) return a->kind - b->kind;
+    if (a->line != b->line) return a->line < b->line ? -1 : 1;
+    if (a->block != b->block) return a->block < b->block ? -1 : 1;
+    if (a->branch != b->branch) return a->branch < b->branch ? -1 : 1;
+    return 0;
+}
+
+// Sort and fold records with the same key into one, adding the counts
+// or keeping the largest
+static void fold_records(struct records *r, int add) {
+    if (r->count == 0) return;
+    qsort(r->items, r->count, sizeof(*r->items), compare_records);
+    size_t out = 0;
+    for (size_t i = 1; i < r->count; i++) {
+        struct record *last = &r->items[out];
+        struct record *rec = &r->items[i];
+        if (compare_records(last, rec) != 0) {
+            r->items[++out] = *rec;
+        } else if (last->count < 0 || rec->count < 0) {
+            if (rec->count > last->count) last->count = rec->count;
+        } else if (add) {
+            last->count += rec->count;
+        } else if (rec->count > last->count) {
+            last->count = rec->count;
+        }
+    }
+    r->count = out + 1;
+}
+
+// Lines are reported at the busiest command on them; && and || only
+// have branches, as running them says nothing about their right side
+static void collect_counts(struct records *r) {
+    for (size_t i = 0; i < site_count; i++) {
+        const struct site *s = &sites[i];
+        const char *file = file_paths[s->file];
+        unsigned long runs = coverage_counts[s->base];
+        if (s->type != NODE_AND && s->type != NODE_OR) {
+            add_record(r, (struct record){file, REC_DA, s->line, 0, 0, (long)runs});
+        }
+        int block = (s->column << 4) | (int)s->type;
+        for (unsigned int b = 0; b < s->branches; b++) {
+            long taken = runs ? (long)coverage_counts[s->base + 1 + b] : -1;
+            add_record(r, (struct record){file, REC_BRDA, s->line, block, (int)b, taken});
+        }
+    }
+    fold_records(r, 0);
+}
+
+// Read back what earlier shells wrote; text is cut up in place and the
+// records point into it
+static void parse_records(struct records *r, char *text) {
+    const char *file = NULL;
+    char *line = text;
+    while (line) {
+        char *end = strchr(line, '\n');
+        if (end) *end++ = '\0';
+
+        int n, block, branch;
+        long count;
+        char taken[32];
+        if (strncmp(line, "SF:", 3) == 0) {
+            file = line + 3;
+        } else if (!file) {
+            // Nothing before the first file means anything
+        } else if (sscanf(line, "DA:%d,%ld", &n, &count) == 2) {
+            add_record(r, (struct record){file, REC_DA, n, 0, 0, count});
+        } else if (sscanf(line, "BRDA:%d,%d,%d,%31s", &n, &block, &branch, taken) == 4) {
+            count = strcmp(taken, "-") == 0 ? -1 : strtol(taken, NULL, 10);
+            add_record(r, (struct record){file, REC_BRDA, n, block, branch, count});
+        }
+        line = end;
+    }
+}
+
+static void write_records(FILE *f, const struct records *r) {
+    size_t i = 0;
+    while (i < r->count) {
+        const char *file = r->items[i].file;
+        fprintf(f, "TN:\nSF:%s\n", file);
+
+        int found = 0, hit = 0;
+        for (; i < r->count && strcmp(r->items[i].file, file) == 0 &&
+               r->items[i].kind == REC_BRDA; i++) {
+            const struct record *rec = &r->items[i];
+            if (rec->count < 0) {
+                fprintf(f, "BRDA:%d,%d,%d,-\n", rec->line, rec->block, rec->branch);
+            } else {
+                fprintf(f, "BRDA:%d,%d,%d,%ld\n", rec->line, rec->block, rec->branch, rec->count);
+            }
+            found++;
+            if (rec->count > 0) hit++;
+        }
+        fprintf(f, "BRF:%d\nBRH:%d\n", found, hit);
+
+        found = hit = 0;
+        for (; i < r->count && strcmp(r->items[i].file, file) == 0; i++) {
+            const struct record *rec = &r->items[i];
+            fprintf(f, "DA:%d,%ld\n", rec->line, rec->count);
+            found++;
+            if (rec->count > 0) hit++;
+        }
+        fprintf(f, "LF:%d\nLH:%d\nend_of_record\n", found, hit);
+    }
+}
+
+void coverage_flush(void) {
+    if (!coverage_counts || getpid() != owner_pid) return;
+
+    int fd = open(output_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        error_sys("--coverage: %s", output_path);
+        return;
+    }
+    struct flock lock = {.l_type = F_WRLCK, .l_whence = SEEK_SET};
+    while (fcntl(fd, F_SETLKW, &lock) < 0) {
+        if (errno != EINTR) {
+            error_sys("--coverage: %s", output_path);
+            close(fd);
+            return;
+        }
+    }
+
+    struct records records = {0};
+    collect_counts(&records);
+    size_t len;
+    char *old = input_read_all(fd, &len);
+    if (old) parse_records(&records, old);
+    fold_records(&records, 1);
+
+    FILE *f = NULL;
+    if (lseek(fd, 0, SEEK_SET) == 0 && ftruncate(fd, 0) == 0) f = fdopen(fd, "w");
+    if (f) {
+        write_records(f, &records);
+        if (fclose(f) != 0) error_sys("--coverage: %s", output_path);
+    } else {
+        error_sys("--coverage: %s", output_path);
+        close(fd);
+    }
+
+    free(records.items);
+    free(old);
+    memset(coverage_counts, 0, count_used * sizeof(*coverage_counts));
+}
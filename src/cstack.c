@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "buf_output.h"
+#include "callstack.h"
+#include "cstack.h"
+#include "error.h"
+
+// AddressSanitizer cannot follow the shell onto a stack of its own
+#if defined(__SANITIZE_ADDRESS__)
+#define SANITIZE_ADDRESS 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define SANITIZE_ADDRESS 1
+#endif
+#endif
+
+// makecontext() left POSIX with vfork(), but the systems that have it
+// still do; elsewhere, and under the sanitizer, the shell stays on the
+// process stack
+#if (defined(__GLIBC__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+     defined(__OpenBSD__)) && !defined(SANITIZE_ADDRESS)
+#define HAVE_MAKECONTEXT 1
+#include <ucontext.h>
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+
+// Address space reserved for the stack. Pages are only backed as they
+// are touched, so what is not used costs nothing.
+#define STACK_SIZE (sizeof(void *) >= 8 ? (size_t)256 << 20 : (size_t)64 << 20)
+
+// Below the limit: room for a builtin or expansion started just above
+// it, and under that, for reporting the error and the EXIT trap
+#define STACK_MARGIN (512 * 1024)
+#define STACK_RESERVE (64 * 1024)
+
+char *cstack_limit = NULL;
+static char *stack_base;
+
+static void restore_limit(void *unused) {
+    (void)unused;
+    cstack_limit = stack_base + STACK_MARGIN;
+}
+
+void cstack_overflow(void) {
+    if (cstack_limit == stack_base + STACK_RESERVE) {
+        // Overflowed again while handling it
+        error_fatal("maximum nesting depth exceeded");
+    }
+    cstack_limit = stack_base + STACK_RESERVE;
+    cleanup_push(restore_limit, NULL);
+    buf_out_flush_all();
+    error_msg("maximum nesting depth exceeded");
+    callstack_print(stderr, CALLSTACK_BRIEF);
+    exception_raise(2);
+}
+
+// Without a stack of its own the shell has what the process stack can
+// grow to below main's frame
+static void use_process_stack(void) {
+    struct rlimit rl;
+    size_t size = (size_t)8 << 20;
+    if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        size = rl.rlim_cur;
+    }
+    uintptr_t top = (uintptr_t)__builtin_frame_address(0);
+    // Leave room for what sits above main: arguments and the environment
+    stack_base = (char *)(top > size ? top - size + 64 * 1024 : 0);
+    restore_limit(NULL);
+}
+
+#ifdef HAVE_MAKECONTEXT
+static ucontext_t caller_context, shell_context;
+static int (*shell_main)(int, char **);
+static int shell_argc;
+static char **shell_argv;
+static int shell_status;
+
+static void run_shell(void) {
+    shell_status = shell_main(shell_argc, shell_argv);
+}
+#endif
+
+int cstack_run(int (*main_fn)(int, char **), int argc, char **argv) {
+#ifdef HAVE_MAKECONTEXT
+    void *stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack != MAP_FAILED && getcontext(&shell_context) == 0) {
+        stack_base = stack;
+        restore_limit(NULL);
+        shell_main = main_fn;
+        shell_argc = argc;
+        shell_argv = argv;
+        shell_context.uc_stack.ss_sp = stack;
+        shell_context.uc_stack.ss_size = STACK_SIZE;
+        shell_context.uc_link = &caller_context;
+        makecontext(&shell_context, run_shell, 0);
+        if (swapcontext(&caller_context, &shell_context) == 0) return shell_status;
+        munmap(stack, STACK_SIZE);
+    } else if (stack != MAP_FAILED) {
+        munmap(stack, STACK_SIZE);
+    }
+#endif
+    use_process_stack();
+    return main_fn(argc, argv);
+}
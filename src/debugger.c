@@ -0,0 +1,460 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buf_output.h"
+#include "callstack.h"
+#include "debugger.h"
+#include "error.h"
+#include "executor.h"
+#include "input.h"
+#include "lexer.h"
+#include "memalloc.h"
+#include "parser.h"
+#include "shell_options.h"
+#include "variables.h"
+
+int debug_active = 0;
+
+static FILE *tty_in;
+static FILE *tty_out;
+static pid_t debug_pid;
+
+// How to run on after a stop
+enum run_mode {
+    RUN_STEP,     // Stop at the next command
+    RUN_NEXT,     // ... that is not inside a call made from here
+    RUN_FINISH,   // ... after the current call returns
+    RUN_CONTINUE, // Only at breakpoints
+};
+
+static enum run_mode mode = RUN_STEP;
+static int mode_depth; // Call depth of the stop the mode was chosen at
+
+// The previous command, to tell when a new line or frame is entered
+static int last_file;
+static int last_line;
+static int last_depth;
+static unsigned long last_frame_id;
+
+struct breakpoint {
+    int number;
+    char *file;     // As given, "" for the -c string; NULL for a function
+    int line;
+    char *function;
+};
+
+static struct breakpoint *breakpoints;
+static size_t breakpoint_count;
+static int next_number = 1;
+
+// Lines of the file shown last
+static struct {
+    int file;
+    char *text;
+    char **lines;
+    int count;
+} source;
+
+// ---------------------------------------------------------------------------
+// Source positions
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// A file given without a directory matches a script of that name anywhere
+static int file_matches(const char *spec, int file) {
+    const char *name = input_file_name(file);
+    if (!name) return *spec == '\0';
+    if (strcmp(spec, name) == 0) return 1;
+    return !strchr(spec, '/') && strcmp(spec, base_name(name)) == 0;
+}
+
+static const char *source_line(int file, int line) {
+    if (file != source.file) {
+        free(source.text);
+        free(source.lines);
+        memset(&source, 0, sizeof(source));
+        source.file = file;
+
+        const char *name = input_file_name(file);
+        int fd = name ? open(name, O_RDONLY | O_CLOEXEC) : -1;
+        if (fd >= 0) {
+            size_t len;
+            source.text = input_read_all(fd, &len);
+            close(fd);
+        }
+        if (source.text) {
+            int cap = 64;
+            source.lines = xmalloc(cap * sizeof(*source.lines));
+            for (char *p = source.text; *p;) {
+                if (source.count == cap) {
+                    cap *= 2;
+                    source.lines = xrealloc(source.lines, cap * sizeof(*source.lines));
+                }
+                source.lines[source.count++] = p;
+                char *end = strchr(p, '\n');
+                if (!end) break;
+                *end = '\0';
+                p = end + 1;
+            }
+        }
+    }
+    return line >= 1 && line <= source.count ? source.lines[line - 1] : NULL;
+}
+
+static void show_stop(const char *what) {
+    char *file_name = callstack_file_name(call_file);
+    const char *function = call_depth ? call_stack[call_depth - 1].name : "main";
+    fprintf(tty_out, "%s %s:%d in %s\n", what, file_name, call_line, function);
+    free(file_name);
+
+    const char *text = source_line(call_file, call_line);
+    if (text) fprintf(tty_out, "%d\t%s\n", call_line, text);
+}
+
+static void list_source(void) {
+    int first = call_line > 5 ? call_line - 5 : 1;
+    int shown = 0;
+    for (int n = first; n <= call_line + 5; n++) {
+        const char *text = source_line(call_file, n);
+        if (!text) break;
+        fprintf(tty_out, "%c%d\t%s\n", n == call_line ? '>' : ' ', n, text);
+        shown = 1;
+    }
+    if (!shown) fprintf(tty_out, "no source for this position\n");
+}
+
+// ---------------------------------------------------------------------------
+// Breakpoints
+
+static struct breakpoint *add_breakpoint(void) {
+    breakpoints = xrealloc(breakpoints, (breakpoint_count + 1) * sizeof(*breakpoints));
+    struct breakpoint *bp = &breakpoints[breakpoint_count++];
+    *bp = (struct breakpoint){.number = next_number++};
+    return bp;
+}
+
+static int parse_line(const char *s) {
+    if (!*s) return 0;
+    for (const char *p = s; *p; p++) {
+        if (!isdigit((unsigned char)*p)) return 0;
+    }
+    return atoi(s);
+}
+
+static void show_breakpoint(const struct breakpoint *bp) {
+    if (bp->function) {
+        fprintf(tty_out, "breakpoint %d in function %s\n", bp->number, bp->function);
+    } else {
+        fprintf(tty_out, "breakpoint %d at %s:%d\n", bp->number, bp->file, bp->line);
+    }
+}
+
+// LINE (in the current file), FILE:LINE or a function name
+static void set_breakpoint(const char *where) {
+    const char *colon = strrchr(where, ':');
+    int line = parse_line(where);
+    struct breakpoint *bp;
+    if (line > 0) {
+        const char *name = input_file_name(call_file);
+        bp = add_breakpoint();
+        bp->file = xstrdup(name ? name : "");
+        bp->line = line;
+    } else if (colon && (line = parse_line(colon + 1)) > 0) {
+        bp = add_breakpoint();
+        bp->file = xmalloc(colon - where + 1);
+        memcpy(bp->file, where, colon - where);
+        bp->file[colon - where] = '\0';
+        bp->line = line;
+    } else {
+        bp = add_breakpoint();
+        bp->function = xstrdup(where);
+    }
+    show_breakpoint(bp);
+}
+
+static void delete_breakpoint(const char *which) {
+    size_t keep = 0;
+    int number = parse_line(which);
+    int found = 0;
+    for (size_t i = 0; i < breakpoint_count; i++) {
+        struct breakpoint *bp = &breakpoints[i];
+        if (*which && bp->number != number) {
+            breakpoints[keep++] = *bp;
+            continue;
+        }
+        free(bp->file);
+        free(bp->function);
+        found = 1;
+    }
+    breakpoint_count = keep;
+    if (*which && !found) fprintf(tty_out, "no breakpoint %s\n", which);
+}
+
+// A line breakpoint is reached on entering its line, a function
+// breakpoint at the first command of a new call
+static struct breakpoint *breakpoint_reached(ASTNode *node, int depth) {
+    int new_line = node->pos.line != last_line || node->pos.file != last_file ||
+                   depth != last_depth;
+    for (size_t i = 0; i < breakpoint_count; i++) {
+        struct breakpoint *bp = &breakpoints[i];
+        if (bp->function) {
+            for (int f = depth - 1; f >= 0 && call_stack[f].id > last_frame_id; f--) {
+                if (strcmp(call_stack[f].name, bp->function) == 0) return bp;
+            }
+        } else if (new_line && bp->line == node->pos.line &&
+                   file_matches(bp->file, node->pos.file)) {
+            return bp;
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Commands
+
+static void print_variable(const char *name) {
+    const char *value;
+    char number[32];
+    if (strcmp(name, "#") == 0) {
+        snprintf(number, sizeof(number), "%d", posish_var_get_positional_count());
+        value = number;
+    } else if (strcmp(name, "?") == 0) {
+        snprintf(number, sizeof(number), "%d", executor_get_last_status());
+        value = number;
+    } else if (parse_line(name) > 0) {
+        value = posish_var_get_positional_value(parse_line(name));
+    } else {
+        value = posish_var_get_value(name);
+    }
+    if (value) {
+        fprintf(tty_out, "%s=%s\n", name, value);
+    } else {
+        fprintf(tty_out, "%s is not set\n", name);
+    }
+}
+
+static void set_variable(const char *assignment) {
+    const char *eq = strchr(assignment, '=');
+    if (!eq || eq == assignment) {
+        fprintf(tty_out, "usage: set NAME=VALUE\n");
+        return;
+    }
+    char *name = xmalloc(eq - assignment + 1);
+    memcpy(name, assignment, eq - assignment);
+    name[eq - assignment] = '\0';
+    posish_var_set(name, eq + 1);
+    free(name);
+}
+
+// Run code as if it were the next command of the script, in the frame
+// the script stopped in. An error in it only ends the code.
+static void debug_eval(const char *code) {
+    int file = call_file;
+    int line = call_line;
+    int status = executor_get_last_status();
+    int ignore_errexit = shell_ignore_errexit;
+    debug_active = 0;
+    shell_ignore_errexit = 1;
+    int no_fork = executor_no_fork;
+    executor_no_fork = 0;
+
+    struct jmploc jl;
+    if (!setjmp(jl.loc)) {
+        exception_push(&jl);
+        struct stackmark smark;
+        mem_stack_push_mark(&smark);
+        Lexer lexer;
+        lexer_init(&lexer, code);
+        lexer.file = file;
+        lexer.current_line = line;
+        ASTNode *ast = parser_parse(&lexer);
+        if (ast) executor_execute(ast);
+        mem_stack_pop_mark(&smark);
+        exception_pop(&jl);
+    }
+    buf_out_flush_all();
+
+    call_file = file;
+    call_line = line;
+    posish_var_set_lineno(line);
+    executor_set_last_status(status);
+    shell_ignore_errexit = ignore_errexit;
+    executor_no_fork = no_fork;
+    debug_active = 1;
+}
+
+static const char help_text[] =
+    "step, s          run to the next command\n"
+    "next, n          run to the next command, stepping over calls\n"
+    "finish           run until the current function returns\n"
+    "continue, c      run until a breakpoint\n"
+    "break, b [WHERE] stop at LINE, FILE:LINE or a function; list breakpoints\n"
+    "delete, d [N]    delete breakpoint N, or all of them\n"
+    "print, p NAME... show variables\n"
+    "set NAME=VALUE   assign a variable\n"
+    "eval, e CODE     run shell code here\n"
+    "backtrace, bt    show the call stack\n"
+    "list, l          show the source around the current line\n"
+    "quit, q          end the script\n";
+
+static int is_command(const char *word, const char *name, const char *abbrev) {
+    return strcmp(word, name) == 0 || (abbrev && strcmp(word, abbrev) == 0);
+}
+
+// Carry out a command; returns 1 when the script should run on
+static int debug_command(const char *word, const char *arg) {
+    if (is_command(word, "step", "s")) {
+        mode = RUN_STEP;
+        return 1;
+    }
+    if (is_command(word, "next", "n")) {
+        mode = RUN_NEXT;
+        mode_depth = call_depth;
+        return 1;
+    }
+    if (is_command(word, "finish", NULL)) {
+        if (call_depth == 0) {
+            fprintf(tty_out, "finish: not in a function\n");
+            return 0;
+        }
+        mode = RUN_FINISH;
+        mode_depth = call_depth;
+        return 1;
+    }
+    if (is_command(word, "continue", "c")) {
+        mode = RUN_CONTINUE;
+        return 1;
+    }
+    if (is_command(word, "quit", "q")) {
+        exit(1);
+    }
+
+    if (is_command(word, "break", "b")) {
+        if (*arg) {
+            set_breakpoint(arg);
+        } else if (breakpoint_count == 0) {
+            fprintf(tty_out, "no breakpoints\n");
+        }
+        for (size_t i = 0; !*arg && i < breakpoint_count; i++) show_breakpoint(&breakpoints[i]);
+    } else if (is_command(word, "delete", "d")) {
+        delete_breakpoint(arg);
+    } else if (is_command(word, "print", "p")) {
+        if (!*arg) fprintf(tty_out, "usage: print NAME...\n");
+        char *names = xstrdup(arg);
+        char *save;
+        for (char *name = strtok_r(names, " \t", &save); name; name = strtok_r(NULL, " \t", &save)) {
+            print_variable(name);
+        }
+        free(names);
+    } else if (is_command(word, "set", NULL)) {
+        set_variable(arg);
+    } else if (is_command(word, "eval", "e")) {
+        debug_eval(arg);
+    } else if (is_command(word, "backtrace", "bt")) {
+        callstack_print(tty_out, 0);
+    } else if (is_command(word, "list", "l")) {
+        list_source();
+    } else if (is_command(word, "help", "h")) {
+        fputs(help_text, tty_out);
+    } else {
+        fprintf(tty_out, "unknown command `%s'; try `help'\n", word);
+    }
+    return 0;
+}
+
+static void command_loop(void) {
+    static char previous[1024]; // An empty line repeats it
+    char line[1024];
+
+    while (1) {
+        fputs("(debug) ", tty_out);
+        fflush(tty_out);
+        if (!fgets(line, sizeof(line), tty_in)) {
+            // The terminal has gone: let the script finish on its own
+            fputc('\n', tty_out);
+            debug_active = 0;
+            return;
+        }
+        line[strcspn(line, "\n")] = '\0';
+
+        char *cmd = line + strspn(line, " \t");
+        if (*cmd) {
+            memmove(previous, cmd, strlen(cmd) + 1);
+        } else if (*previous) {
+            strcpy(line, previous);
+            cmd = line;
+        } else {
+            continue;
+        }
+
+        char *arg = cmd + strcspn(cmd, " \t");
+        if (*arg) *arg++ = '\0';
+        arg += strspn(arg, " \t");
+        int resume = debug_command(cmd, arg);
+        fflush(tty_out);
+        if (resume) return;
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+void debugger_hook(ASTNode *node) {
+    if (node->type != NODE_COMMAND || node->pos.line <= 0 || getpid() != debug_pid) return;
+
+    int depth = call_depth;
+    int stop = mode == RUN_STEP || (mode == RUN_NEXT && depth <= mode_depth) ||
+               (mode == RUN_FINISH && depth < mode_depth);
+    struct breakpoint *bp = breakpoint_reached(node, depth);
+
+    last_file = node->pos.file;
+    last_line = node->pos.line;
+    last_depth = depth;
+    if (depth && call_stack[depth - 1].id > last_frame_id) last_frame_id = call_stack[depth - 1].id;
+
+    // What the script wrote so far comes before the stop
+    if (bp || stop) buf_out_flush_all();
+    if (bp) {
+        char what[48];
+        snprintf(what, sizeof(what), "breakpoint %d at", bp->number);
+        show_stop(what);
+    } else if (stop) {
+        show_stop("stopped at");
+    } else {
+        return;
+    }
+    command_loop();
+}
+
+int debugger_start(void) {
+    int fd = open("/dev/tty", O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        error_sys("--debug: /dev/tty");
+        return -1;
+    }
+    // Keep the terminal out of the way of the script's redirections
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    if (high >= 0) {
+        close(fd);
+        fd = high;
+    }
+    tty_in = fdopen(fd, "r");
+    tty_out = fdopen(fcntl(fd, F_DUPFD_CLOEXEC, 10), "w");
+    if (!tty_in || !tty_out) {
+        error_sys("--debug: /dev/tty");
+        return -1;
+    }
+
+    debug_pid = getpid();
+    mode = RUN_STEP;
+    debug_active = 1;
+    return 0;
+}
@@ -0,0 +1,426 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "deparse.h"
+#include "error.h"
+#include "input.h"
+#include "lexer.h"
+#include "memalloc.h"
+#include "parser.h"
+
+// Words are kept in the tree exactly as written, quotes and all, so they
+// are printed unchanged; only the layout between them is decided here.
+// Lists are walked in a loop, so a body of any length needs no more
+// stack than its deepest nesting of compound commands.
+
+#define INDENT_WIDTH 4
+
+struct deparser {
+    struct buf_out *out;
+    int indent;
+    int at_line_start;
+    int after_async;            // Last thing written was a background "&"
+    const Redirection **heredocs; // Bodies to write after the current line
+    size_t heredoc_count;
+    size_t heredoc_cap;
+};
+
+static void render_and_or(struct deparser *d, ASTNode *node);
+static void render_block(struct deparser *d, ASTNode *node);
+
+static void put(struct deparser *d, const char *s) {
+    if (d->at_line_start) {
+        for (int i = 0; i < d->indent * INDENT_WIDTH; i++) BUF_PUTC(' ', d->out);
+        d->at_line_start = 0;
+    }
+    buf_out_puts(s, d->out);
+    d->after_async = 0;
+}
+
+// End the line, then write the here-documents it started
+static void newline(struct deparser *d) {
+    BUF_PUTC('\n', d->out);
+    for (size_t i = 0; i < d->heredoc_count; i++) {
+        const Redirection *r = d->heredocs[i];
+        const char *body = r->here_doc_content ? r->here_doc_content : "";
+        buf_out_puts(body, d->out);
+        if (*body && body[strlen(body) - 1] != '\n') BUF_PUTC('\n', d->out);
+        char *delim = lexer_heredoc_delimiter(r->filename);
+        buf_out_puts(delim, d->out);
+        BUF_PUTC('\n', d->out);
+        free(delim);
+    }
+    d->heredoc_count = 0;
+    d->at_line_start = 1;
+    d->after_async = 0;
+}
+
+static void queue_heredoc(struct deparser *d, const Redirection *r) {
+    if (d->heredoc_count == d->heredoc_cap) {
+        d->heredoc_cap = d->heredoc_cap ? d->heredoc_cap * 2 : 4;
+        d->heredocs = xrealloc(d->heredocs, d->heredoc_cap * sizeof(*d->heredocs));
+    }
+    d->heredocs[d->heredoc_count++] = r;
+}
+
+static void render_redirection(struct deparser *d, const Redirection *r) {
+    static const char *const ops[] = {
+        [REDIR_IN] = "<",          [REDIR_OUT] = ">",
+        [REDIR_OUT_CLOBBER] = ">|", [REDIR_APPEND] = ">>",
+        [REDIR_IN_DUP] = "<&",     [REDIR_OUT_DUP] = ">&",
+        [REDIR_RDWR] = "<>",       [REDIR_HEREDOC] = "<<",
+        [REDIR_HEREDOC_DASH] = "<<-",
+    };
+    int input = r->type == REDIR_IN || r->type == REDIR_IN_DUP || r->type == REDIR_RDWR ||
+                r->type == REDIR_HEREDOC || r->type == REDIR_HEREDOC_DASH;
+
+    // The descriptor is only written when it is not the operator's default
+    if (r->io_number != (input ? 0 : 1)) {
+        char num[16];
+        snprintf(num, sizeof(num), "%d", r->io_number);
+        put(d, num);
+    }
+    put(d, ops[r->type]);
+    put(d, r->filename);
+    if (r->type == REDIR_HEREDOC || r->type == REDIR_HEREDOC_DASH) queue_heredoc(d, r);
+}
+
+static void render_command(struct deparser *d, const CommandNode *cmd) {
+    const char *sep = "";
+    for (size_t i = 0; i < cmd->assignment_count; i++) {
+        put(d, sep);
+        put(d, cmd->assignments[i].name);
+        put(d, "=");
+        put(d, cmd->assignments[i].value);
+        sep = " ";
+    }
+    for (size_t i = 0; i < cmd->arg_count; i++) {
+        put(d, sep);
+        put(d, cmd->args[i]);
+        sep = " ";
+    }
+    for (size_t i = 0; i < cmd->redirection_count; i++) {
+        put(d, sep);
+        render_redirection(d, &cmd->redirections[i]);
+        sep = " ";
+    }
+}
+
+// A list on one line, as in a condition: "a; b & c"
+static void render_inline(struct deparser *d, ASTNode *node) {
+    while (node) {
+        ASTNode *item = node;
+        ASTNode *next = NULL;
+        int async = 0;
+        if (node->type == NODE_LIST) {
+            item = node->data.list.left;
+            next = node->data.list.right;
+            async = node->data.list.async;
+        }
+        render_and_or(d, item);
+        if (async) {
+            put(d, " &");
+            d->after_async = 1;
+        }
+        if (next) put(d, async ? " " : "; ");
+        node = next;
+    }
+}
+
+// A condition followed by the keyword that ends it
+static void render_condition(struct deparser *d, ASTNode *cond, const char *keyword) {
+    render_inline(d, cond);
+    put(d, d->after_async ? " " : "; ");
+    put(d, keyword);
+    newline(d);
+}
+
+// One command per line, one level further in
+static void render_body(struct deparser *d, ASTNode *node) {
+    d->indent++;
+    render_block(d, node);
+    d->indent--;
+}
+
+static void render_if(struct deparser *d, ASTNode *node) {
+    put(d, "if ");
+    while (1) {
+        render_condition(d, node->data.if_stmt.condition, "then");
+        render_body(d, node->data.if_stmt.then_branch);
+
+        // An if alone in an else branch is an elif
+        ASTNode *rest = node->data.if_stmt.else_branch;
+        if (rest && rest->type == NODE_IF) {
+            put(d, "elif ");
+            node = rest;
+            continue;
+        }
+        if (rest) {
+            put(d, "else");
+            newline(d);
+            render_body(d, rest);
+        }
+        put(d, "fi");
+        return;
+    }
+}
+
+static void render_case(struct deparser *d, const CaseNode *c) {
+    put(d, "case ");
+    put(d, c->word);
+    put(d, " in");
+    newline(d);
+    d->indent++;
+    for (size_t i = 0; i < c->item_count; i++) {
+        const CaseItem *item = &c->items[i];
+        for (size_t j = 0; item->patterns && item->patterns[j]; j++) {
+            if (j > 0) put(d, " | ");
+            put(d, item->patterns[j]);
+        }
+        put(d, ")");
+        newline(d);
+        d->indent++;
+        render_block(d, item->commands);
+        put(d, ";;");
+        newline(d);
+        d->indent--;
+    }
+    d->indent--;
+    put(d, "esac");
+}
+
+static void render_node(struct deparser *d, ASTNode *node) {
+    switch (node->type) {
+    case NODE_COMMAND:
+        render_command(d, &node->data.command);
+        break;
+
+    case NODE_PIPELINE:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_LIST:
+        render_and_or(d, node);
+        break;
+
+    case NODE_IF:
+        render_if(d, node);
+        break;
+
+    case NODE_WHILE:
+        put(d, "while ");
+        render_condition(d, node->data.while_loop.condition, "do");
+        render_body(d, node->data.while_loop.body);
+        put(d, "done");
+        break;
+
+    case NODE_UNTIL:
+        put(d, "until ");
+        render_condition(d, node->data.until_loop.condition, "do");
+        render_body(d, node->data.until_loop.body);
+        put(d, "done");
+        break;
+
+    case NODE_FOR:
+        put(d, "for ");
+        put(d, node->data.for_loop.var_name);
+        if (node->data.for_loop.word_list) {
+            put(d, " in");
+            for (size_t i = 0; i < node->data.for_loop.word_count; i++) {
+                put(d, " ");
+                put(d, node->data.for_loop.word_list[i]);
+            }
+        }
+        put(d, "; do");
+        newline(d);
+        render_body(d, node->data.for_loop.body);
+        put(d, "done");
+        break;
+
+    case NODE_SUBSHELL:
+        put(d, "(");
+        newline(d);
+        render_body(d, node->data.subshell.body);
+        put(d, ")");
+        break;
+
+    case NODE_GROUP:
+        put(d, "{");
+        newline(d);
+        render_body(d, node->data.group.body);
+        put(d, "}");
+        break;
+
+    case NODE_FUNCTION:
+        put(d, node->data.function.name);
+        put(d, "() ");
+        render_node(d, node->data.function.body);
+        break;
+
+    case NODE_CASE:
+        render_case(d, &node->data.case_stmt);
+        break;
+
+    case NODE_NOT:
+        put(d, "! ");
+        render_and_or(d, node->data.prefixed.pipeline);
+        break;
+
+    case NODE_TIME:
+        put(d, node->data.prefixed.posix ? "time -p" : "time");
+        if (node->data.prefixed.pipeline) {
+            put(d, " ");
+            render_and_or(d, node->data.prefixed.pipeline);
+        }
+        break;
+    }
+}
+
+static void render_and_or(struct deparser *d, ASTNode *node) {
+    switch (node->type) {
+    case NODE_PIPELINE:
+        render_and_or(d, node->data.pipeline.left);
+        put(d, " | ");
+        render_and_or(d, node->data.pipeline.right);
+        break;
+
+    case NODE_AND:
+    case NODE_OR:
+        render_and_or(d, node->data.pipeline.left);
+        put(d, node->type == NODE_AND ? " && " : " || ");
+        render_and_or(d, node->data.pipeline.right);
+        break;
+
+    case NODE_LIST:
+        render_inline(d, node);
+        break;
+
+    default:
+        render_node(d, node);
+        break;
+    }
+}
+
+static void render_block(struct deparser *d, ASTNode *node) {
+    while (node) {
+        ASTNode *item = node;
+        int async = 0;
+        if (node->type == NODE_LIST) {
+            item = node->data.list.left;
+            async = node->data.list.async;
+            node = node->data.list.right;
+        } else {
+            node = NULL;
+        }
+        render_and_or(d, item);
+        if (async) put(d, " &");
+        newline(d);
+    }
+}
+
+void deparse(ASTNode *node, struct buf_out *out) {
+    struct deparser d = {.out = out, .at_line_start = 1};
+    render_block(&d, node);
+    free(d.heredocs);
+}
+
+void deparse_function(const char *name, ASTNode *body, struct buf_out *out) {
+    struct deparser d = {.out = out, .at_line_start = 1};
+    put(&d, name);
+    put(&d, "() ");
+    render_node(&d, body);
+    newline(&d);
+    free(d.heredocs);
+}
+
+// ---------------------------------------------------------------------------
+// posish --format
+
+struct node_list {
+    ASTNode **nodes;
+    size_t count;
+};
+
+static void collect_node(ASTNode *node, void *arg) {
+    struct node_list *list = arg;
+    list->nodes = mem_stack_realloc_array(list->nodes, list->count, list->count + 1,
+                                          sizeof(*list->nodes));
+    list->nodes[list->count++] = node;
+}
+
+static int parse_text(const char *text, int file, struct node_list *list) {
+    Lexer lexer;
+    lexer_init(&lexer, text);
+    lexer.file = file;
+    lexer.no_alias = 1;
+    return parser_parse_all(&lexer, collect_node, list);
+}
+
+// Deparse the parsed commands and print the result if it parses back
+// to the same trees. Like a compiler checking its own output, nothing is
+// printed unless it means exactly what the input did.
+static int format_nodes(struct node_list *original, int file, const char *name) {
+    struct buf_capture cap;
+    buf_out_capture_begin(&cap, &buf_stdout);
+    for (size_t i = 0; i < original->count; i++) deparse(original->nodes[i], &buf_stdout);
+    char *formatted = buf_out_capture_end(&cap, NULL);
+
+    struct node_list again = {0};
+    int same = parse_text(formatted, file, &again) == 0 && again.count == original->count;
+    for (size_t i = 0; same && i < original->count; i++) {
+        same = ast_equal(original->nodes[i], again.nodes[i]);
+    }
+
+    if (same) OUT_PUTS(formatted);
+    free(formatted);
+    if (!same) {
+        error_msg("--format: %s: formatted output does not parse back to the same commands",
+                  name);
+        return 1;
+    }
+    return 0;
+}
+
+static int format_one(const char *path) {
+    int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        error_sys("%s", path);
+        return 1;
+    }
+    size_t len;
+    char *text = input_read_all(fd, &len);
+    if (path) close(fd);
+    if (!text) {
+        error_sys("%s", path ? path : "standard input");
+        return 1;
+    }
+
+    int file = input_file_id(path ? path : "-");
+    struct stackmark smark;
+    mem_stack_push_mark(&smark);
+
+    struct node_list original = {0};
+    int status = 2;
+    if (parse_text(text, file, &original) == 0) {
+        status = format_nodes(&original, file, path ? path : "standard input");
+    }
+
+    mem_stack_pop_mark(&smark);
+    free(text);
+    return status;
+}
+
+int format_files(char **paths) {
+    if (!paths[0]) return format_one(NULL);
+
+    int status = 0;
+    for (char **p = paths; *p; p++) {
+        int s = format_one(*p);
+        if (s > status) status = s;
+    }
+    return status;
+}
@@ -7,8 +7,23 @@
 #include <string.h>
 #include <errno.h>
 #include "buf_output.h"
+#include "signals.h"
 
 #include "variables.h"
+#include "input.h"
+#include "callstack.h"
+
+int diag_format = DIAG_TEXT;
+
+struct jmploc *exception_handler = NULL;
+int exception_status = 0;
+
+static struct {
+    cleanup_fn fn;
+    void *arg;
+} *cleanups = NULL;
+static size_t cleanup_depth = 0;
+static size_t cleanup_cap = 0;
 
 static void print_prefix(void) {
     char *name = posish_var_get_shell_name();
@@ -38,6 +53,110 @@ void error_sys(const char *fmt, ...) {
     error_printf(": %s\n", strerror(errno));
 }
 
+static void json_string(const char *s) {
+    error_printf("\"");
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') error_printf("\\%c", c);
+        else if (c == '\n') error_printf("\\n");
+        else if (c == '\t') error_printf("\\t");
+        else if (c < 0x20) error_printf("\\u%04x", c);
+        else error_printf("%c", c);
+    }
+    error_printf("\"");
+}
+
+void diag_report(const SourcePos *pos, const char *severity, const char *code,
+                 const char *fmt, ...) {
+    char message[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+
+    char *shell_name = NULL;
+    const char *file = input_file_name(pos->file);
+    if (!file) {
+        shell_name = posish_var_get_shell_name();
+        file = shell_name ? shell_name : "posish";
+    }
+
+    if (diag_format == DIAG_JSON) {
+        error_printf("{\"file\":");
+        json_string(file);
+        error_printf(",\"line\":%d,\"column\":%d,\"offset\":%zu,\"severity\":",
+                     pos->line, pos->column, pos->offset);
+        json_string(severity);
+        error_printf(",\"code\":");
+        json_string(code);
+        error_printf(",\"message\":");
+        json_string(message);
+        error_printf("}\n");
+    } else if (strcmp(severity, "error") == 0) {
+        error_printf("%s:%d:%d: %s\n", file, pos->line, pos->column, message);
+    } else {
+        error_printf("%s:%d:%d: %s: %s [%s]\n", file, pos->line, pos->column,
+                     severity, message, code);
+    }
+    free(shell_name);
+}
+
+void error_raise(int status, const char *fmt, ...) {
+    print_prefix();
+    va_list ap;
+    va_start(ap, fmt);
+    error_vprintf(fmt, ap);
+    va_end(ap);
+    error_printf("\n");
+    exception_raise(status);
+}
+
+void exception_push(struct jmploc *jl) {
+    jl->prev = exception_handler;
+    jl->cleanup_depth = cleanup_depth;
+    mem_stack_push_mark(&jl->mark);
+    exception_handler = jl;
+}
+
+void exception_pop(struct jmploc *jl) {
+    exception_handler = jl->prev;
+}
+
+void exception_raise(int status) {
+    exception_status = status;
+
+    struct jmploc *jl = exception_handler;
+    if (!jl) {
+        // The shell exits, running its EXIT trap first
+        callstack_backtrace();
+        signal_trigger_exit();
+        buf_out_flush_all();
+        exit(status);
+    }
+
+    while (cleanup_depth > jl->cleanup_depth) {
+        cleanup_pop(1);
+    }
+    exception_handler = jl->prev;
+    mem_stack_pop_mark(&jl->mark);
+    longjmp(jl->loc, 1);
+}
+
+void cleanup_push(cleanup_fn fn, void *arg) {
+    if (cleanup_depth == cleanup_cap) {
+        cleanup_cap = cleanup_cap ? cleanup_cap * 2 : 16;
+        cleanups = xrealloc(cleanups, cleanup_cap * sizeof(*cleanups));
+    }
+    cleanups[cleanup_depth].fn = fn;
+    cleanups[cleanup_depth].arg = arg;
+    cleanup_depth++;
+}
+
+void cleanup_pop(int run) {
+    cleanup_depth--;
+    if (run) cleanups[cleanup_depth].fn(cleanups[cleanup_depth].arg);
+}
+
 void error_fatal(const char *fmt, ...) {
     print_prefix();
     va_list ap;
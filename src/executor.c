@@ -18,32 +18,22 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <fnmatch.h>
-#include <glob.h>
 #include <pwd.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "functions.h"
 #include "signals.h"
 #include "redirection.h"
 #include "buf_output.h"
-
-/* 
- * vfork() was removed from POSIX.1-2008, so _POSIX_C_SOURCE=200809L hides it.
- * We explicitly declare it here because we want the performance benefits
- * of vfork() on systems that support it (Linux, BSDs, QNX), even when compiling
- * in strict POSIX mode.
- * 
- * On QNX, vfork() is deprecated but still functional and faster than fork().
- * We suppress the deprecation warning to maintain performance.
- */
-#if defined(__QNX__)
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-#endif
-#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
-extern pid_t vfork(void);
-#endif
-
-// Always use vfork for performance (safe because we control child execution)
-#define POSISH_FORK() vfork()
+#include "input.h"
+#include "callstack.h"
+#include "coverage.h"
+#include "debugger.h"
+#include "restricted.h"
+#include "pattern.h"
+#include "stub.h"
+#include "launch.h"
+#include "cstack.h"
 
 extern char **environ;
 
@@ -63,99 +53,80 @@ void executor_set_last_status(int status) {
     last_exit_status = status;
 }
 
-// Helper to find executable in PATH
-char *find_executable(const char *command) {
-    if (strchr(command, '/')) {
-        return mem_stack_strdup(command);
-    }
-
-    const char *path_env = pathval();
-    if (!path_env) return NULL;
 
-    char *path_copy = mem_stack_strdup(path_env);
-    char *dir = strtok(path_copy, ":");
-    char *result = NULL;
 
-    while (dir) {
-        size_t len = strlen(dir) + strlen(command) + 2;
-        char *full_path = mem_stack_alloc(len);
-        snprintf(full_path, len, "%s/%s", dir, command);
+#include "parser.h"
 
-        if (access(full_path, X_OK) == 0) {
-            result = full_path;
-            break;
-        }
+static int is_safe_for_vfork(ASTNode *node);
+static int call_function(ASTNode *body, char **argv, size_t argc);
+static char **word_list_add(char **list, size_t *count, size_t *cap, char *word);
+char **expand_word_split(const char *word);
 
-        // No free needed for full_path
-        dir = strtok(NULL, ":");
+// Run an output-only builtin, or with function set a call to a function
+// made of one, with its output sent to a string, so the capture needs
+// neither a pipe nor any fd shuffling
+static char *execute_builtin_capture(ASTNode *function, char **argv) {
+    struct buf_capture cap;
+    buf_out_capture_begin(&cap, &buf_stdout);
+    cleanup_push(buf_out_capture_abort, &cap);
+    if (function) {
+        call_function(function, argv, 1);
+    } else {
+        builtin_run(argv);
     }
+    cleanup_pop(0);
 
-    // No free needed for path_copy
-    return result;
-}
-
+    size_t size;
+    char *text = buf_out_capture_end(&cap, &size);
 
+    // Strip trailing newlines
+    while (size > 0 && text[size - 1] == '\n') size--;
 
-#include "parser.h"
+    char *buffer = mem_stack_alloc(size + 1);
+    memcpy(buffer, text, size);
+    buffer[size] = '\0';
+    free(text);
+    return buffer;
+}
 
-static int is_safe_for_vfork(ASTNode *node);
-char **expand_word_split(const char *word);
+// Builtins that only write to stdout and may run in the shell itself
+// for $(...). printf qualifies unless it is given -v.
+static int is_capture_builtin(ASTNode *cmd) {
+    const char *name = cmd->data.command.args[0];
+    if (strcmp(name, "echo") == 0 || strcmp(name, "pwd") == 0) return 1;
+    if (strcmp(name, "printf") != 0) return 0;
+    const char *first = cmd->data.command.arg_count > 1 ? cmd->data.command.args[1] : NULL;
+    return !first || (first[0] != '-' && !strchr(first, '$'));
+}
 
-static char *execute_builtin_capture(char **argv) {
-    // Create a pipe to capture stdout
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
-        return mem_stack_strdup("");
-    }
-    
-    // Save original stdout
-    int saved_stdout = dup(STDOUT_FILENO);
-    if (saved_stdout < 0) {
-        close(pipefd[0]);
-        close(pipefd[1]);
-        return mem_stack_strdup("");
-    }
-    
-    // Redirect stdout to pipe
-    if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-        close(saved_stdout);
-        close(pipefd[0]);
-        close(pipefd[1]);
-        return mem_stack_strdup("");
-    }
-    close(pipefd[1]);
-    
-    // Execute builtin in-process
-    builtin_run(argv);
-    
-    // Restore stdout
-    buf_out_flush_all();
-    dup2(saved_stdout, STDOUT_FILENO);
-    close(saved_stdout);
-    
-    // Read captured output from pipe
-    size_t size = 0;
-    size_t capacity = 128;
-    char *buffer = mem_stack_alloc(capacity);
-    
-    ssize_t n;
-    while ((n = read(pipefd[0], buffer + size, capacity - size - 1)) > 0) {
-        size += n;
-        if (size >= capacity - 1) {
-            size_t new_capacity = capacity * 2;
-            buffer = mem_stack_realloc_array(buffer, capacity, new_capacity, 1);
-            capacity = new_capacity;
+// Expanding a word in the shell rather than in a subshell must not
+// change any state: no ${x=...}, ${x?...} or arithmetic
+static int word_expands_purely(const char *word) {
+    for (const char *p = word; *p; p++) {
+        if (p[0] == '$' && p[1] == '(' && p[2] == '(') return 0;
+        if (p[0] == '$' && p[1] == '{') {
+            const char *end = strchr(p, '}');
+            for (const char *q = p + 2; q && q < end; q++) {
+                if (*q == '=' || *q == '?') return 0;
+            }
         }
     }
-    close(pipefd[0]);
-    buffer[size] = '\0';
-    
-    // Strip trailing newlines
-    while (size > 0 && buffer[size - 1] == '\n') {
-        buffer[--size] = '\0';
+    return 1;
+}
+
+// Whether expanding a word may assign a variable: ${x=...}, ${x:=...}
+// or arithmetic
+static int word_assigns(const char *word) {
+    for (const char *p = word; *p; p++) {
+        if (p[0] == '$' && p[1] == '(' && p[2] == '(') return 1;
+        if (p[0] == '$' && p[1] == '{') {
+            const char *end = strchr(p, '}');
+            for (const char *q = p + 2; q && q < end; q++) {
+                if (*q == '=') return 1;
+            }
+        }
     }
-    
-    return buffer;
+    return 0;
 }
 
 static char *execute_subshell_capture(const char *cmd_str) {
@@ -182,40 +153,45 @@ static char *execute_subshell_capture(const char *cmd_str) {
     lexer_init(&lexer, cmd_str);
     ASTNode *node = parser_parse(&lexer);
     
-    // Fast path: simple builtin with no args or redirections
-    if (node && node->type == NODE_COMMAND && 
-        node->data.command.arg_count == 1 &&  // Just the command name
+    // Fast path: simple builtin with no redirections or assignments
+    if (node && node->type == NODE_COMMAND &&
         node->data.command.redirection_count == 0 &&
+        node->data.command.assignment_count == 0 &&
         builtin_is_builtin(node->data.command.args[0])) {
         
         const char *cmd_name = node->data.command.args[0];
         
         // ULTRA-FAST path: builtins that never produce output
-        if (strcmp(cmd_name, "true") == 0 || 
-            strcmp(cmd_name, "false") == 0 || 
-            strcmp(cmd_name, ":") == 0) {
+        if (node->data.command.arg_count == 1 &&
+            (strcmp(cmd_name, "true") == 0 ||
+             strcmp(cmd_name, "false") == 0 ||
+             strcmp(cmd_name, ":") == 0)) {
             // Execute directly, no pipe needed
             char *argv[2] = {(char *)cmd_name, NULL};
             builtin_run(argv);
             return mem_stack_strdup("");
         }
 
-        // Check for other safe builtins (echo, printf, pwd)
-        // Unsafe builtins (cd, exit, export, etc.) must fork to avoid polluting parent state
-        int is_safe = (strcmp(cmd_name, "echo") == 0 || 
-                       strcmp(cmd_name, "printf") == 0 || 
-                       strcmp(cmd_name, "pwd") == 0);
-                       
-        if (!is_safe) {
+        // Output-only builtins (echo, printf, pwd) are captured in a
+        // string. Anything else (cd, exit, export, ...) must fork to
+        // avoid polluting parent state.
+        if (!is_capture_builtin(node)) {
             goto slow_path;
         }
-        
-        if (!is_safe) {
-            goto slow_path;
+        for (size_t i = 1; i < node->data.command.arg_count; i++) {
+            if (!word_expands_purely(node->data.command.args[i])) goto slow_path;
         }
-        
-        char *argv[2] = {(char *)cmd_name, NULL};
-        return execute_builtin_capture(argv);
+
+        char **argv = NULL;
+        size_t argc = 0, argv_cap = 0;
+        for (size_t i = 0; i < node->data.command.arg_count; i++) {
+            char **expanded = expand_word_split(node->data.command.args[i]);
+            for (int k = 0; expanded && expanded[k]; k++) {
+                argv = word_list_add(argv, &argc, &argv_cap, expanded[k]);
+            }
+        }
+        argv[argc] = NULL;
+        return execute_builtin_capture(NULL, argv);
     }
     
     // OPTIMIZATION: Check for simple functions that wrap safe builtins
@@ -225,9 +201,10 @@ static char *execute_subshell_capture(const char *cmd_str) {
         node->data.command.redirection_count == 0 &&
         !builtin_is_builtin(node->data.command.args[0])) {
             
-        ASTNode *body = func_lookup(node->data.command.args[0]);
-        if (body) {
+        ASTNode *function = func_lookup(node->data.command.args[0]);
+        if (function) {
             // Unwrap group { ... }
+            ASTNode *body = function;
             if (body->type == NODE_GROUP) body = body->data.group.body;
             
             // Check if body is a simple command
@@ -238,106 +215,24 @@ static char *execute_subshell_capture(const char *cmd_str) {
                 const char *inner_cmd = body->data.command.args[0];
                 
                 // Check if inner command is a safe builtin
-                int is_safe = (strcmp(inner_cmd, "echo") == 0 || 
-                               strcmp(inner_cmd, "printf") == 0 || 
-                               strcmp(inner_cmd, "pwd") == 0 ||
+                int is_safe = (is_capture_builtin(body) ||
                                strcmp(inner_cmd, "true") == 0 ||
                                strcmp(inner_cmd, "false") == 0 ||
                                strcmp(inner_cmd, ":") == 0);
+                for (size_t i = 1; is_safe && i < body->data.command.arg_count; i++) {
+                    is_safe = word_expands_purely(body->data.command.args[i]);
+                }
                                
                 if (is_safe) {
-                    // Expand arguments
-                    char **argv = NULL;
-                    size_t argc = 0;
-                    
-                    for (size_t i = 0; i < body->data.command.arg_count; i++) {
-                        char **expanded = expand_word_split(body->data.command.args[i]);
-                        if (expanded) {
-                            for (int k = 0; expanded[k]; k++) {
-                                argv = mem_stack_realloc_array(argv, argc, argc + 1, sizeof(char*));
-                                argv[argc++] = expanded[k];
-                            }
-                        }
-                    }
-                    argv = mem_stack_realloc_array(argv, argc, argc + 1, sizeof(char*));
-                    argv[argc] = NULL;
-                    
-                    return execute_builtin_capture(argv);
+                    // Called like any function, so that $1, $# and $@
+                    // are its own, empty ones
+                    char *argv[] = {node->data.command.args[0], NULL};
+                    return execute_builtin_capture(function, argv);
                 }
             }
         }
     }
     
-    // OPTIMIZATION: In-Process Capture
-    // If the command is safe to run in the parent process (because it forks its own children),
-    // we can avoid the extra fork for the capture process.
-    // Safe nodes:
-    // - NODE_PIPELINE: Always forks children.
-    // - NODE_COMMAND (External): Forks child (unless NO_FORK, but we are parent here).
-    // - NODE_SUBSHELL: Forks child.
-    // Unsafe:
-    // - NODE_COMMAND (Builtin): Might modify parent state (cd, exit, etc).
-    
-    int can_run_in_process = 0;
-    if (node->type == NODE_PIPELINE || node->type == NODE_SUBSHELL) {
-        can_run_in_process = 1;
-    } else if (node->type == NODE_COMMAND) {
-        // Check if external
-        if (!builtin_is_builtin(node->data.command.args[0])) {
-            can_run_in_process = 1;
-        }
-    }
-
-    if (can_run_in_process) {
-        int pipefd[2];
-        if (pipe(pipefd) < 0) {
-            error_sys("pipe");
-            return mem_stack_strdup("");
-        }
-
-        // Flush buffers before redirecting stdout
-        buf_out_flush_all();
-
-        int saved_stdout = dup(STDOUT_FILENO);
-        if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-            perror("dup2");
-            close(pipefd[0]);
-            close(pipefd[1]);
-            close(saved_stdout);
-            return mem_stack_strdup("");
-        }
-        close(pipefd[1]);
-
-        // Execute directly
-        int status = executor_execute(node);
-        (void)status; // We don't use exit status for capture usually
-
-        // Restore stdout
-        buf_out_flush_all(); // Flush output to pipe
-        dup2(saved_stdout, STDOUT_FILENO);
-        close(saved_stdout);
-
-        // Read output
-        size_t size = 0;
-        size_t capacity = 128;
-        char *buffer = mem_stack_alloc(capacity);
-        
-        ssize_t n;
-        while ((n = read(pipefd[0], buffer + size, capacity - size - 1)) > 0) {
-            size += n;
-            if (size >= capacity - 1) {
-                size_t new_capacity = capacity * 2;
-                buffer = mem_stack_realloc_array(buffer, capacity, new_capacity, 1);
-                capacity = new_capacity;
-            }
-        }
-        close(pipefd[0]);
-        buffer[size] = '\0';
-        
-        // ast_free(node); // No-op
-        return buffer;
-    }
-
     slow_path:;
     // Slow path: fork required
     int pipefd[2];
@@ -357,6 +252,7 @@ static char *execute_subshell_capture(const char *cmd_str) {
     pid_t pid = fork();
     if (pid == 0) {
         buf_out_reset_all(); // Reset buffer in child
+        coverage_forked();
         // Restore default signal handling in child
         signal_reset_all();
         close(pipefd[0]);
@@ -364,9 +260,11 @@ static char *execute_subshell_capture(const char *cmd_str) {
         close(pipefd[1]);
         
         executor_no_fork = 1; // Optimize: exec directly
+        exception_handler = NULL; // Errors end the child, not the parent's command
         int status = executor_execute(node);
         // CRITICAL: Flush buffered output before _exit() so it goes to pipe
         buf_out_flush_all();
+        coverage_flush();
         // ast_free(node); // No-op
         _exit(status);  // CRITICAL: use _exit() not exit() with vfork()
     } else if (pid < 0) {
@@ -396,8 +294,8 @@ static char *execute_subshell_capture(const char *cmd_str) {
     close(pipefd[0]);
     buffer[size] = '\0';
     
-    waitpid(pid, NULL, 0);
-    signal_check_pending(); // Check for pending signals after wait
+    job_wait_pid(pid);
+    SIGNAL_POLL(); // Check for pending signals after wait
     
     while (size > 0 && buffer[size - 1] == '\n') {
         buffer[--size] = '\0';
@@ -449,15 +347,14 @@ static char *expand_tilde(const char *word) {
 static long eval_expression(const char **str);
 
 // Pattern removal functions
-static char *remove_suffix_shortest(const char *str, const char *pattern);
-static char *remove_suffix_longest(const char *str, const char *pattern);
-static char *remove_prefix_shortest(const char *str, const char *pattern);
-static char *remove_prefix_longest(const char *str, const char *pattern);
+static char *remove_suffix(const char *str, const char *pattern, int longest);
+static char *remove_prefix(const char *str, const char *pattern, int longest);
 
 static long eval_factor(const char **str) {
     while (isspace(**str)) (*str)++;
     
     if (**str == '(') {
+        if (CSTACK_LOW()) cstack_overflow();
         (*str)++;
         long val = eval_expression(str);
         while (isspace(**str)) (*str)++;
@@ -500,16 +397,14 @@ static long eval_term(const char **str) {
             (*str)++;
             long divisor = eval_factor(str);
             if (divisor == 0) {
-                error_msg("division by 0");
-                exit(1);
+                error_raise(1, "division by 0");
             }
             val /= divisor;
         } else if (**str == '%') {
             (*str)++;
             long divisor = eval_factor(str);
             if (divisor == 0) {
-                error_msg("division by 0");
-                exit(1);
+                error_raise(1, "division by 0");
             }
             val %= divisor;
         } else {
@@ -541,11 +436,12 @@ static long evaluate_arithmetic(const char *expr) {
     return eval_expression(&str);
 }
 
-static int is_ifs(char c, const char *ifs) {
+// Byte length of the IFS character at p, or 0
+static size_t is_ifs(const char *p, const char *ifs) {
     if (!ifs) {
-        return c == ' ' || c == '\t' || c == '\n';
+        return *p == ' ' || *p == '\t' || *p == '\n';
     }
-    return strchr(ifs, c) != NULL;
+    return mb_in_set(p, ifs);
 }
 
 static int is_ifs_whitespace(char c, const char *ifs) {
@@ -597,6 +493,19 @@ static char *sb_finish(StringBuilder *sb) {
     return sb->data; // Transfer ownership (stack allocated)
 }
 
+// Append a word to a list on the stack allocator, leaving room for the
+// NULL terminator. The capacity doubles, so a list of n words costs O(n)
+// arena memory instead of a new copy of the list per word.
+static char **word_list_add(char **list, size_t *count, size_t *cap, char *word) {
+    if (*count + 2 > *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 8;
+        list = mem_stack_realloc_array(list, *cap, new_cap, sizeof(char *));
+        *cap = new_cap;
+    }
+    list[(*count)++] = word;
+    return list;
+}
+
 
 
 char *expand_word(const char *word);
@@ -609,6 +518,7 @@ static char **expand_word_internal(const char *word, int allow_split) {
     
     char **results = NULL;
     size_t result_count = 0;
+    size_t result_cap = 0;
     
     StringBuilder sb;
     sb_init(&sb);
@@ -721,26 +631,25 @@ static char **expand_word_internal(const char *word, int allow_split) {
                     if (allow_split && in_quote == 0) {
                         const char *p = val_str;
                         while (*p) {
-                            if (is_ifs(*p, ifs)) {
+                            if (is_ifs(p, ifs)) {
                                 if (is_ifs_whitespace(*p, ifs) && result_count == 0 && sb.len == 0) {
                                      p++;
                                      while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                      continue;
                                 }
                                 
-                                results = xrealloc(results, (result_count + 2) * sizeof(char *));
-                                results[result_count++] = sb_finish(&sb);
+                                results = word_list_add(results, &result_count, &result_cap, sb_finish(&sb));
                                 sb_init(&sb);
                                 
                                 if (is_ifs_whitespace(*p, ifs)) {
                                     while (*p && is_ifs_whitespace(*p, ifs)) p++;
-                                    if (*p && is_ifs(*p, ifs) && !is_ifs_whitespace(*p, ifs)) {
-                                        p++;
+                                    if (*p && is_ifs(p, ifs) && !is_ifs_whitespace(*p, ifs)) {
+                                        p += is_ifs(p, ifs);
                                         while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                     }
                                     push_empty_at_end = 0;
                                 } else {
-                                    p++;
+                                    p += is_ifs(p, ifs);
                                     while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                     push_empty_at_end = 1;
                                 }
@@ -776,26 +685,25 @@ static char **expand_word_internal(const char *word, int allow_split) {
                     if (allow_split && in_quote == 0) {
                          const char *p = output;
                         while (*p) {
-                            if (is_ifs(*p, ifs)) {
+                            if (is_ifs(p, ifs)) {
                                 if (is_ifs_whitespace(*p, ifs) && result_count == 0 && sb.len == 0) {
                                      p++;
                                      while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                      continue;
                                 }
 
-                                results = xrealloc(results, (result_count + 2) * sizeof(char *));
-                                results[result_count++] = sb_finish(&sb);
+                                results = word_list_add(results, &result_count, &result_cap, sb_finish(&sb));
                                 sb_init(&sb);
                                 
                                 if (is_ifs_whitespace(*p, ifs)) {
                                     while (*p && is_ifs_whitespace(*p, ifs)) p++;
-                                    if (*p && is_ifs(*p, ifs) && !is_ifs_whitespace(*p, ifs)) {
-                                        p++;
+                                    if (*p && is_ifs(p, ifs) && !is_ifs_whitespace(*p, ifs)) {
+                                        p += is_ifs(p, ifs);
                                         while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                     }
                                     push_empty_at_end = 0;
                                 } else {
-                                    p++;
+                                    p += is_ifs(p, ifs);
                                     while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                     push_empty_at_end = 1;
                                 }
@@ -832,25 +740,28 @@ static char **expand_word_internal(const char *word, int allow_split) {
                         while (i < len && input[i] != '}') {
                             i++;
                         }
+                    } else if (i < len && isdigit((unsigned char)input[i])) {
+                        while (i < len && isdigit((unsigned char)input[i])) i++;
+                    } else if (i < len && strchr("?$!@*-#", input[i])) {
+                        i++; // A special parameter
                     } else {
-                        while (i < len && input[i] != '}' && input[i] != ':' && input[i] != '%' && input[i] != '#') {
+                        while (i < len && (isalnum((unsigned char)input[i]) || input[i] == '_')) {
                             i++;
                         }
                     }
                     
                     var_len = i - start;
-                    var_name = xmalloc(var_len + 1);
+                    var_name = mem_stack_alloc(var_len + 1);
                     memcpy(var_name, input + start, var_len);
                     var_name[var_len] = '\0';
                     
                     // If it's a length operation, get the value and append its length
                     if (is_length) {
                         const char *val = posish_var_get_value(var_name);
-                        int length = val ? strlen(val) : 0;
+                        int length = val ? mb_strlen(val) : 0;
                         char len_buf[32];
                         snprintf(len_buf, sizeof(len_buf), "%d", length);
                         sb_append_str(&sb, len_buf);
-                        free(var_name);
                         if (i < len && input[i] == '}') i++; // Skip closing }
                         continue;
                     }
@@ -858,12 +769,17 @@ static char **expand_word_internal(const char *word, int allow_split) {
                     
                     // Check for parameter expansion modifiers
                     char *default_value = NULL;
-                    int colon_op = 0; // 0=none, 1=:-, 2=:+, 3=:=, 4=:?
+                    int colon_op = 0; // 0=none, 1=-, 2=+, 3==, 4=?
+                    int null_is_unset = 0; // The : forms treat null as unset
                     char *pattern = NULL;
                     int pattern_op = 0; // 0=none, 1=%, 2=%%, 3=#, 4=##
                     
-                    if (i < len && input[i] == ':') {
-                        i++; // Skip ':'
+                    if (i < len && (input[i] == ':' || input[i] == '-' || input[i] == '+' ||
+                                    input[i] == '=' || input[i] == '?')) {
+                        if (input[i] == ':') {
+                            null_is_unset = 1;
+                            i++; // Skip ':'
+                        }
                         if (i < len && (input[i] == '-' || input[i] == '+' || input[i] == '=' || input[i] == '?')) {
                             char op_char = input[i];
                             i++; // Skip operator char
@@ -883,8 +799,7 @@ static char **expand_word_internal(const char *word, int allow_split) {
                             default_value[val_len] = '\0';
                         } else {
                             // Invalid syntax like ${var:2} (ksh/bash substring not supported)
-                            error_msg("Bad substitution");
-                            exit(2);
+                            error_raise(2, "Bad substitution");
                         }
                     } else if (i < len && (input[i] == '%' || input[i] == '#')) {
                         char op_char = input[i];
@@ -918,7 +833,7 @@ static char **expand_word_internal(const char *word, int allow_split) {
                         static char buf[32]; snprintf(buf, sizeof(buf), "%d", executor_get_last_status());
                         var_value = buf;
                     } else if (strcmp(var_name, "$") == 0) {
-                        static char buf[32]; snprintf(buf, sizeof(buf), "%d", getpid());
+                        static char buf[32]; snprintf(buf, sizeof(buf), "%d", (int)job_shell_pid());
                         var_value = buf;
                     } else if (strcmp(var_name, "-") == 0) {
                         var_value = "im";
@@ -928,9 +843,9 @@ static char **expand_word_internal(const char *word, int allow_split) {
                         var_value = posish_var_get_value(var_name);
                     }
                     
-                    // Handle colon operators
+                    // Handle the -, +, = and ? operators, with or without :
                     if (colon_op) {
-                        int is_unset_or_null = (!var_value || var_value[0] == '\0');
+                        int is_unset_or_null = !var_value || (null_is_unset && var_value[0] == '\0');
                         
                         switch (colon_op) {
                             case 1: // :- Use default if unset or null
@@ -956,9 +871,9 @@ static char **expand_word_internal(const char *word, int allow_split) {
                                 break;
                             case 4: // :? Error if unset or null
                                 if (is_unset_or_null) {
-                                    char *msg = default_value && default_value[0] ? default_value : "parameter null or not set";
-                                    error_msg("%s: %s", var_name, msg);
-                                    exit(1);
+                                    char *msg = default_value && default_value[0] ? default_value :
+                                                null_is_unset ? "parameter null or not set" : "parameter not set";
+                                    error_raise(1, "%s: %s", var_name, msg);
                                 }
                                 break;
                         }
@@ -969,16 +884,16 @@ static char **expand_word_internal(const char *word, int allow_split) {
                         char *result = NULL;
                         switch (pattern_op) {
                             case 1: // % - remove shortest suffix
-                                result = remove_suffix_shortest(var_value, pattern);
+                                result = remove_suffix(var_value, pattern, 0);
                                 break;
                             case 2: // %% - remove longest suffix
-                                result = remove_suffix_longest(var_value, pattern);
+                                result = remove_suffix(var_value, pattern, 1);
                                 break;
                             case 3: // # - remove shortest prefix
-                                result = remove_prefix_shortest(var_value, pattern);
+                                result = remove_prefix(var_value, pattern, 0);
                                 break;
                             case 4: // ## - remove longest prefix
-                                result = remove_prefix_longest(var_value, pattern);
+                                result = remove_prefix(var_value, pattern, 1);
                                 break;
                         }
                         if (result) {
@@ -991,7 +906,6 @@ static char **expand_word_internal(const char *word, int allow_split) {
                     }
                     // if (pattern) free(pattern); // No free needed
                     // if (default_value) free(default_value); // No free needed
-                    free(var_name); // Free xmalloc'd var_name
                     var_name = NULL;
                     continue;
                 } else {
@@ -1006,12 +920,11 @@ static char **expand_word_internal(const char *word, int allow_split) {
                     // If variable name is empty, treat $ as literal
                     if (var_len == 0) {
                         sb_append(&sb, '$');
-                        free(var_name);
                         var_name = NULL;
                         continue;
                     }
                     
-                    var_name = xmalloc(var_len + 1);
+                    var_name = mem_stack_alloc(var_len + 1);
                     memcpy(var_name, input + start, var_len);
                     var_name[var_len] = '\0';
                 }
@@ -1023,7 +936,7 @@ static char **expand_word_internal(const char *word, int allow_split) {
                         static char buf[32]; snprintf(buf, sizeof(buf), "%d", executor_get_last_status());
                         val = buf;
                     } else if (strcmp(var_name, "$") == 0) {
-                        static char buf[32]; snprintf(buf, sizeof(buf), "%d", getpid());
+                        static char buf[32]; snprintf(buf, sizeof(buf), "%d", (int)job_shell_pid());
                         val = buf;
                     } else if (strcmp(var_name, "-") == 0) {
                         val = "im";
@@ -1062,26 +975,25 @@ static char **expand_word_internal(const char *word, int allow_split) {
                         if (allow_split && in_quote == 0) {
                             const char *p = val;
                             while (*p) {
-                                if (is_ifs(*p, ifs)) {
+                                if (is_ifs(p, ifs)) {
                                     if (is_ifs_whitespace(*p, ifs) && result_count == 0 && sb.len == 0) {
                                          p++;
                                          while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                          continue;
                                     }
 
-                                    results = mem_stack_realloc_array(results, result_count * sizeof(char*), (result_count + 2) * sizeof(char *), 1);
-                                    results[result_count++] = sb_finish(&sb);
+                                    results = word_list_add(results, &result_count, &result_cap, sb_finish(&sb));
                                     sb_init(&sb);
                                     
                                     if (is_ifs_whitespace(*p, ifs)) {
                                         while (*p && is_ifs_whitespace(*p, ifs)) p++;
-                                        if (*p && is_ifs(*p, ifs) && !is_ifs_whitespace(*p, ifs)) {
-                                            p++;
+                                        if (*p && is_ifs(p, ifs) && !is_ifs_whitespace(*p, ifs)) {
+                                            p += is_ifs(p, ifs);
                                             while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                         }
                                         push_empty_at_end = 0;
                                     } else {
-                                        p++;
+                                        p += is_ifs(p, ifs);
                                         while (*p && is_ifs_whitespace(*p, ifs)) p++;
                                         push_empty_at_end = 1;
                                     }
@@ -1094,7 +1006,6 @@ static char **expand_word_internal(const char *word, int allow_split) {
                             sb_append_str(&sb, val);
                         }
                     }
-                    free(var_name); // Free xmalloc'd var_name
                     var_name = NULL;
                 }
             }
@@ -1116,26 +1027,25 @@ static char **expand_word_internal(const char *word, int allow_split) {
              if (allow_split && in_quote == 0) {
                  const char *p = output;
                 while (*p) {
-                    if (is_ifs(*p, ifs)) {
+                    if (is_ifs(p, ifs)) {
                         if (is_ifs_whitespace(*p, ifs) && result_count == 0 && sb.len == 0) {
                              p++;
                              while (*p && is_ifs_whitespace(*p, ifs)) p++;
                              continue;
                         }
 
-                        results = mem_stack_realloc_array(results, result_count * sizeof(char*), (result_count + 2) * sizeof(char *), 1);
-                        results[result_count++] = sb_finish(&sb);
+                        results = word_list_add(results, &result_count, &result_cap, sb_finish(&sb));
                         sb_init(&sb);
                         
                         if (is_ifs_whitespace(*p, ifs)) {
                             while (*p && is_ifs_whitespace(*p, ifs)) p++;
-                            if (*p && is_ifs(*p, ifs) && !is_ifs_whitespace(*p, ifs)) {
-                                p++;
+                            if (*p && is_ifs(p, ifs) && !is_ifs_whitespace(*p, ifs)) {
+                                p += is_ifs(p, ifs);
                                 while (*p && is_ifs_whitespace(*p, ifs)) p++;
                             }
                             push_empty_at_end = 0;
                         } else {
-                            p++;
+                            p += is_ifs(p, ifs);
                             while (*p && is_ifs_whitespace(*p, ifs)) p++;
                             push_empty_at_end = 1;
                         }
@@ -1150,21 +1060,20 @@ static char **expand_word_internal(const char *word, int allow_split) {
              // free(cmd); // No free needed
              // free(output); // No free needed
         } else {
-            if (allow_split && in_quote == 0 && is_ifs(input[i], ifs)) {
-                results = mem_stack_realloc_array(results, result_count * sizeof(char*), (result_count + 2) * sizeof(char *), 1);
-                results[result_count++] = sb_finish(&sb);
+            if (allow_split && in_quote == 0 && is_ifs(input + i, ifs)) {
+                results = word_list_add(results, &result_count, &result_cap, sb_finish(&sb));
                 sb_init(&sb);
                 
                 if (is_ifs_whitespace(input[i], ifs)) {
                     i++;
                     while (i < len && is_ifs_whitespace(input[i], ifs)) i++;
-                    if (i < len && is_ifs(input[i], ifs) && !is_ifs_whitespace(input[i], ifs)) {
-                        i++;
+                    if (i < len && is_ifs(input + i, ifs) && !is_ifs_whitespace(input[i], ifs)) {
+                        i += is_ifs(input + i, ifs);
                         while (i < len && is_ifs_whitespace(input[i], ifs)) i++;
                     }
                     push_empty_at_end = 0;
                 } else {
-                    i++;
+                    i += is_ifs(input + i, ifs);
                     while (i < len && is_ifs_whitespace(input[i], ifs)) i++;
                     push_empty_at_end = 1;
                 }
@@ -1181,8 +1090,7 @@ static char **expand_word_internal(const char *word, int allow_split) {
     // This ensures unquoted ${VAR:-} that expands to empty produces zero args, not one empty arg
     // But quoted "" produces one empty arg
     if (push_empty_at_end && (!allow_split || sb.len > 0 || result_count > 0 || saw_quotes)) {
-        results = mem_stack_realloc_array(results, result_count * sizeof(char*), (result_count + 2) * sizeof(char *), 1);
-        results[result_count++] = sb_finish(&sb);
+        results = word_list_add(results, &result_count, &result_cap, sb_finish(&sb));
     } else {
         // free(sb.data); // No free needed
     }
@@ -1220,6 +1128,15 @@ static char **expand_simple_var(const char *word) {
                     break;
                 }
             }
+            // "$1" is a positional parameter, and "$10" is "${1}0"
+            if (isdigit((unsigned char)word[2])) {
+                if (len != 4) return NULL;
+                const char *val = posish_var_get_positional_value(word[2] - '0');
+                char **res = mem_stack_alloc(2 * sizeof(char*));
+                res[0] = mem_stack_strdup(val ? val : "");
+                res[1] = NULL;
+                return res;
+            }
             if (is_simple) {
                 // Extract var name
                 char var_name[256];
@@ -1360,35 +1277,205 @@ static int try_test_fast_path(int argc, char **argv) {
 
 static int execute_simple_command(ASTNode *node);
 static int execute_pipeline(ASTNode *node);
+static int execute_job(ASTNode *node, int background);
+static void job_describe(ASTNode *node, StringBuilder *sb);
 static int execute_list(ASTNode *node);
 static int execute_if(ASTNode *node);
 static int execute_while(ASTNode *node);
 static int execute_and_or(ASTNode *node);
 static int execute_for(ASTNode *node);
 
-static int execute_simple_command(ASTNode *node) {
-    if (!node || node->type != NODE_COMMAND) return 1;
+// Descriptors replaced by the redirections of a builtin or function.
+// The copies live at 10 and above, out of the way of the redirections
+// themselves, and are closed on exec.
+typedef struct {
+    size_t count;
+    struct saved_fd {
+        int fd;
+        int copy;   // -1 if fd was not open
+    } *fds;
+} SavedFds;
+
+static void restore_fds(void *arg) {
+    SavedFds *save = arg;
+    buf_out_flush_all();
+    for (size_t i = save->count; i-- > 0;) {
+        struct saved_fd *s = &save->fds[i];
+        if (s->copy >= 0) {
+            dup2(s->copy, s->fd);
+            close(s->copy);
+        } else {
+            close(s->fd);
+        }
+    }
+    free(save->fds);
+}
 
+// Save what redirs will replace; restored by cleanup_pop(1) or when an
+// error unwinds past the command
+static void save_fds(SavedFds *save, Redirection *redirs, size_t count) {
+    save->fds = xmalloc(count * sizeof(struct saved_fd));
+    save->count = 0;
+    for (size_t i = 0; i < count; i++) {
+        int fd = redirs[i].io_number;
+        size_t k;
+        for (k = 0; k < save->count && save->fds[k].fd != fd; k++) {
+            // Only the first redirection of a descriptor saves it
+        }
+        if (k < save->count) continue;
+        save->fds[save->count].fd = fd;
+        save->fds[save->count].copy = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+        save->count++;
+    }
+    cleanup_push(restore_fds, save);
+}
 
+static void restore_positional(void *arg) {
+    posish_var_restore_positional_fast(*(PositionalSave *)arg);
+}
 
+// Functions being run, for FUNCNEST
+static int function_depth = 0;
 
-    
-    for (size_t i = 0; i < node->data.command.assignment_count; i++) {
-        char *expanded_val = expand_word(node->data.command.assignments[i].value);
-        if (!expanded_val) {
-            // Expansion failed (e.g. unbound variable)
-            return 1;
-        }
-        if (posish_var_set(node->data.command.assignments[i].name, expanded_val) != 0) {
+static void pop_scope(void *arg) {
+    (void)arg;
+    posish_var_pop_scope();
+    stub_pop_scope();
+    function_depth--;
+}
+
+static void free_argv(void *arg) {
+    char **argv = arg;
+    for (size_t i = 0; argv[i]; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+}
+
+// Run body as the function argv[0], with the other words of argv as its
+// positional parameters
+static int call_function(ASTNode *body, char **argv, size_t argc) {
+    if (var_funcnest && function_depth >= var_funcnest) {
+        buf_out_flush_all();
+        error_msg("%s: maximum function nesting level exceeded (%d)", argv[0], var_funcnest);
+        callstack_print(stderr, CALLSTACK_BRIEF);
+        exception_raise(1);
+    }
+
+    // Zero-copy save (just swap pointers)
+    PositionalSave saved_params = posish_var_save_positional_fast();
+    cleanup_push(restore_positional, &saved_params);
+
+    if (argc > 1) {
+        posish_var_set_positional(argc - 1, argv + 1);
+    } else {
+        posish_var_set_positional(0, NULL);
+    }
+
+    // Push scope for function-local variables (and stubs)
+    posish_var_push_scope();
+    stub_push_scope();
+    function_depth++;
+    cleanup_push(pop_scope, NULL);
+    callstack_push(argv[0]);
+    cleanup_push(callstack_pop, NULL);
+
+    int status = executor_execute(body);
+
+    // Leave the call frame, pop scope to cleanup local variables,
+    // then swap the positional parameters back
+    cleanup_pop(1);
+    cleanup_pop(1);
+    cleanup_pop(1);
+
+    if (status == EXIT_RETURN) {
+        status = func_return_status;
+    }
+    return status;
+}
+
+int executor_call_function(ASTNode *body, char **argv) {
+    size_t argc = 0;
+    while (argv[argc]) argc++;
+    return call_function(body, argv, argc);
+}
+
+// Set the assignments of a command that runs in the shell, from the
+// expanded "name=value" strings
+static void set_assignments(ASTNode *node, char **assigns) {
+    for (size_t i = 0; assigns[i]; i++) {
+        const char *name = node->data.command.assignments[i].name;
+        if (posish_var_set(name, assigns[i] + strlen(name) + 1) != 0) {
             // Assignment failed (readonly variable)
+            exception_raise(1);
+        }
+    }
+}
+
+// exec: its redirections are made for good, and the program it runs
+// replaces the shell with the assignments in its environment, which as
+// for any special builtin also stay set
+static int execute_exec(ASTNode *node, char **argv, char **assigns) {
+    if (argv[1] && shell_restricted) return restrict_builtin("exec");
+    if (assigns) set_assignments(node, assigns);
+    if (handle_redirections(node->data.command.redirections, node->data.command.redirection_count) != 0) {
+        return 1;
+    }
+    if (!argv[1]) return 0;
+    return launch_exec(argv + 1, assigns);
+}
+
+// A function call with the command's redirections around it
+static int run_function(ASTNode *node, ASTNode *body, char **argv, size_t argc) {
+    int has_redirections = (node->data.command.redirection_count > 0);
+    SavedFds saved_fds;
+
+    // Only save FDs if we have redirections
+    if (has_redirections) {
+        save_fds(&saved_fds, node->data.command.redirections, node->data.command.redirection_count);
+        if (handle_redirections(node->data.command.redirections, node->data.command.redirection_count) != 0) {
+            cleanup_pop(1);
             return 1;
         }
-        // No free needed for expanded_val
     }
-    
 
+    int status = call_function(body, argv, argc);
+
+    // Only restore FDs if we saved them
+    if (has_redirections) cleanup_pop(1);
+
+    return status;
+}
+
+static int execute_simple_command(ASTNode *node) {
+    if (!node || node->type != NODE_COMMAND) return 1;
+
+    // Assignments are expanded first, as "name=value" strings. A program
+    // gets them in its environment only; before anything run by the shell
+    // itself they are set (see set_assignments()).
+    size_t assign_count = node->data.command.assignment_count;
+    char **assigns = NULL;
+    if (assign_count > 0) {
+        assigns = mem_stack_alloc((assign_count + 1) * sizeof(char *));
+        for (size_t i = 0; i < assign_count; i++) {
+            char *expanded_val = expand_word(node->data.command.assignments[i].value);
+            if (!expanded_val) {
+                // Expansion failed (e.g. unbound variable)
+                return 1;
+            }
+            const char *name = node->data.command.assignments[i].name;
+            size_t name_len = strlen(name);
+            size_t value_len = strlen(expanded_val);
+            assigns[i] = mem_stack_alloc(name_len + value_len + 2);
+            memcpy(assigns[i], name, name_len);
+            assigns[i][name_len] = '=';
+            memcpy(assigns[i] + name_len + 1, expanded_val, value_len + 1);
+        }
+        assigns[assign_count] = NULL;
+    }
 
     if (node->data.command.arg_count == 0) {
+        if (assigns) set_assignments(node, assigns);
         return 0;
     }
 
@@ -1402,31 +1489,21 @@ static int execute_simple_command(ASTNode *node) {
         
         for (int k = 0; expanded_list[k]; k++) {
             char *expanded = expanded_list[k];
+            SIGNAL_POLL();
             
             if (has_glob_chars(expanded)) {
                 char *pattern = prepare_glob_pattern(expanded);
-                glob_t glob_result;
-                int flags = GLOB_NOCHECK; 
-                
-                if (glob(pattern, flags, NULL, &glob_result) == 0) {
-                    if (argc + glob_result.gl_pathc + 1 >= argv_cap) {
-                        size_t new_cap = argv_cap * 2 + glob_result.gl_pathc;
-                        argv = mem_stack_realloc_array(argv, argv_cap * sizeof(char*), new_cap * sizeof(char*), 1);
-                        argv_cap = new_cap;
-                    }
-                    for (size_t j = 0; j < glob_result.gl_pathc; j++) {
-                        argv[argc++] = mem_stack_strdup(glob_result.gl_pathv[j]);
-                    }
-                    globfree(&glob_result);
-                } else {
-                    if (argc + 2 >= argv_cap) {
-                        size_t new_cap = argv_cap * 2;
-                        argv = mem_stack_realloc_array(argv, argv_cap * sizeof(char*), new_cap * sizeof(char*), 1);
-                        argv_cap = new_cap;
-                    }
-                    argv[argc++] = expanded;
-                    expanded = NULL;
+                size_t name_count;
+                char **names = pattern_glob(pattern, &name_count);
+                if (argc + name_count + 1 >= argv_cap) {
+                    size_t new_cap = argv_cap * 2 + name_count;
+                    argv = mem_stack_realloc_array(argv, argv_cap * sizeof(char*), new_cap * sizeof(char*), 1);
+                    argv_cap = new_cap;
+                }
+                for (size_t j = 0; j < name_count; j++) {
+                    argv[argc++] = mem_stack_strdup(names[j]);
                 }
+                pattern_glob_free(names);
                 // No free needed for pattern
             } else {
                 if (argc + 2 >= argv_cap) {
@@ -1445,6 +1522,7 @@ static int execute_simple_command(ASTNode *node) {
 
     // Empty command after expansion (all words expanded to nothing)
     if (argc == 0) {
+        if (assigns) set_assignments(node, assigns);
         return 0;
     }
 
@@ -1462,67 +1540,27 @@ static int execute_simple_command(ASTNode *node) {
     }
 
     ASTNode *func_body = func_lookup(argv[0]);
-    if (func_body) {
-        int has_redirections = (node->data.command.redirection_count > 0);
-        int saved_stdin = -1, saved_stdout = -1, saved_stderr = -1;
-
-        // Only save FDs if we have redirections
-        if (has_redirections) {
-            saved_stdin = dup(STDIN_FILENO);
-            saved_stdout = dup(STDOUT_FILENO);
-            saved_stderr = dup(STDERR_FILENO);
-        }
-
-        if (has_redirections && handle_redirections(node->data.command.redirections, node->data.command.redirection_count) != 0) {
-            // No free needed for argv
-            buf_out_flush_all();
-            dup2(saved_stdin, STDIN_FILENO);
-            dup2(saved_stdout, STDOUT_FILENO);
-            dup2(saved_stderr, STDERR_FILENO);
-            close(saved_stdin);
-            close(saved_stdout);
-            close(saved_stderr);
-            return 1;
-        }
-
-        // Zero-copy save (just swap pointers)
-        PositionalSave saved_params = posish_var_save_positional_fast();
-
-        if (argc > 1) {
-            posish_var_set_positional(argc - 1, argv + 1);
+    if (assigns) {
+        if (!func_body && strcmp(argv[0], "exec") == 0) {
+            return execute_exec(node, argv, assigns);
+        }
+        // Only a program keeps them to itself; command passes them on to
+        // what it runs
+        if (!func_body && strcmp(argv[0], "command") == 0) {
+            // Left for builtin_command_assigns()
+        } else if (func_body || builtin_is_builtin(argv[0]) || (stub_count && stub_lookup(argv[0]))) {
+            set_assignments(node, assigns);
+            assigns = NULL;
         } else {
-            posish_var_set_positional(0, NULL);
-        }
-        
-        // Push scope for function-local variables
-        posish_var_push_scope();
-        
-        int status = executor_execute(func_body);
-        
-        // Pop scope to cleanup local variables
-        posish_var_pop_scope();
-        
-        if (status == EXIT_RETURN) {
-            status = func_return_status;
-        }
-        
-        // Zero-copy restore (just swap back)
-        posish_var_restore_positional_fast(saved_params);
-
-        // Only restore FDs if we saved them
-        if (has_redirections) {
-            buf_out_flush_all();
-            dup2(saved_stdin, STDIN_FILENO);
-            dup2(saved_stdout, STDOUT_FILENO);
-            dup2(saved_stderr, STDERR_FILENO);
-            close(saved_stdin);
-            close(saved_stdout);
-            close(saved_stderr);
+            for (size_t i = 0; i < assign_count; i++) {
+                if (posish_var_check_assign(node->data.command.assignments[i].name) != 0) {
+                    exception_raise(1);
+                }
+            }
         }
-
-        // for (size_t i = 0; i < argc; i++) free(argv[i]);
-        // free(argv);
-        return status;
+    }
+    if (func_body) {
+        return run_function(node, func_body, argv, argc);
     }
 
 
@@ -1546,6 +1584,10 @@ static int execute_simple_command(ASTNode *node) {
     int test_res = try_test_fast_path(argc, argv);
     if (test_res != -1) return test_res;
 
+    if (cmd[0] == 'e' && strcmp(cmd, "exec") == 0) {
+        return execute_exec(node, argv, NULL);
+    }
+
     // Builtin execution with robust argument handling
     if (builtin_is_builtin(argv[0])) {
         // CRITICAL FIX: Copy all argv strings to heap to isolate from mem_stack
@@ -1556,196 +1598,190 @@ static int execute_simple_command(ASTNode *node) {
             heap_argv[i] = xstrdup(argv[i]);
         }
         heap_argv[argc] = NULL;
+        cleanup_push(free_argv, heap_argv);
 
         int has_redirections = (node->data.command.redirection_count > 0);
-        int saved_stdin = -1, saved_stdout = -1, saved_stderr = -1;
+        SavedFds saved_fds;
 
         if (has_redirections) {
-            saved_stdin = dup(STDIN_FILENO);
-            saved_stdout = dup(STDOUT_FILENO);
-            saved_stderr = dup(STDERR_FILENO);
-        }
-
-        if (has_redirections && handle_redirections(node->data.command.redirections, node->data.command.redirection_count) != 0) {
-            if (has_redirections) {
-                buf_out_flush_all();
-                dup2(saved_stdin, STDIN_FILENO);
-                dup2(saved_stdout, STDOUT_FILENO);
-                dup2(saved_stderr, STDERR_FILENO);
-                close(saved_stdin);
-                close(saved_stdout);
-                close(saved_stderr);
-            }
-            // Free heap copy
-            for (size_t i = 0; i < argc; i++) {
-                free(heap_argv[i]);
+            save_fds(&saved_fds, node->data.command.redirections, node->data.command.redirection_count);
+            if (handle_redirections(node->data.command.redirections, node->data.command.redirection_count) != 0) {
+                cleanup_pop(1);
+                cleanup_pop(1);
+                return 1;
             }
-            free(heap_argv);
-            return 1;
         }
 
-        int status = builtin_run(heap_argv);
+        int status = assigns ? builtin_command_assigns(heap_argv, assigns)
+                             : builtin_run(heap_argv);
         
-        if (has_redirections) {
-            buf_out_flush_all();
-            dup2(saved_stdin, STDIN_FILENO);
-            dup2(saved_stdout, STDOUT_FILENO);
-            dup2(saved_stderr, STDERR_FILENO);
-            close(saved_stdin);
-            close(saved_stdout);
-            close(saved_stderr);
-        }
+        if (has_redirections) cleanup_pop(1);
 
         // Free heap copy
-        for (size_t i = 0; i < argc; i++) {
-            free(heap_argv[i]);
-        }
-        free(heap_argv);
-        
+        cleanup_pop(1);
+
+        // A builtin cut short by ^C is interrupted now
+        SIGNAL_POLL();
         return status;
     }
 
+    // Stubs stand in for external commands (see stub.h)
+    ASTNode *stub_body = stub_count ? stub_call(argv) : NULL;
+    if (stub_body) {
+        return run_function(node, stub_body, argv, argc);
+    }
+
     // External command execution
-    char *executable = find_executable(argv[0]);
+    if (shell_restricted && restrict_command_name(argv[0])) return 1;
+    // PATH=dir cmd looks for cmd in dir
+    const char *search_path = NULL;
+    for (size_t i = 0; assigns && i < assign_count; i++) {
+        if (strcmp(node->data.command.assignments[i].name, "PATH") == 0) {
+            search_path = assigns[i] + sizeof("PATH");
+        }
+    }
+    char *executable = launch_find(argv[0], search_path);
     if (!executable) {
         error_msg("%s: command not found", argv[0]);
         return 127;
     }
 
-    // Block SIGCHLD to prevent race condition where signal handler reaps process
-    // before job_wait() can.
-    sigset_t mask, oldmask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+    StringBuilder desc;
+    sb_init(&desc);
+    job_describe(node, &desc);
+    return launch_program(executable, argv, assigns, node->data.command.redirections,
+                          node->data.command.redirection_count, sb_finish(&desc));
+}
 
-    // Prepare environment in parent to avoid heap allocation in child (vfork safety)
-    char **env = posish_var_get_environ();
+static int execute_pipeline(ASTNode *node) {
+    return execute_job(node, 0);
+}
 
-    // Use vfork() if safe (no state modification), otherwise fork()
-    // CRITICAL: Must check safety because vfork shares memory with parent!
-    // Use fork() instead of vfork() to prevent memory corruption
-    // vfork() shares address space, and child modifying stack/heap can corrupt parent
-    //
-    // UPDATE: We verified that handle_redirections and execve are safe.
-    // posish_var_get_environ() is called in parent.
-    // So we restore vfork() for performance.
-    pid_t pid;
-    
-    if (executor_no_fork) {
-        // OPTIMIZATION: We are already in a child process dedicated to this command.
-        // Skip fork and exec directly.
-        // fprintf(stderr, "DEBUG: NO_FORK optimization triggered for %s\n", argv[0]);
-        pid = 0;
-    } else {
-        pid = POSISH_FORK();
-    }
-    
-    if (pid == 0) {
-        // Child process - restore signal mask
-        sigprocmask(SIG_SETMASK, &oldmask, NULL);
-        
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        
-        if (handle_redirections(node->data.command.redirections, 
-                              node->data.command.redirection_count) != 0) {
-            _exit(1);
-        }
-
-        execve(executable, argv, env);
-        // execve failed - print appropriate error
-        if (errno == ENOENT) {
-            dprintf(STDERR_FILENO, "%s: %s: not found\n", "posish", executable);
-            _exit(127);
-        } else if (errno == EACCES) {
-            dprintf(STDERR_FILENO, "%s: %s: Permission denied\n", "posish", executable);
-            _exit(126);
-        } else {
-            dprintf(STDERR_FILENO, "%s: %s: %s\n", "posish", executable, strerror(errno));
-            _exit(126);
+// Run a pipeline (or a single command that needs a process of its own)
+// as one job. The shell forks every command itself so that all of them
+// are its children: under job control they share one process group,
+// which gets the terminal in the foreground and is stopped and
+// continued as a whole. Background jobs always get a process group.
+static int execute_job(ASTNode *node, int background) {
+    // CRITICAL: Flush buffers before fork to prevent duplication
+    buf_out_flush_all();
+
+    // The parser nests "a | b | c" as a | (b | c)
+    size_t count = 1;
+    for (ASTNode *n = node; n->type == NODE_PIPELINE; n = n->data.pipeline.right) {
+        count++;
+    }
+    ASTNode **stages = xmalloc(count * sizeof(ASTNode *));
+    ASTNode *rest = node;
+    for (size_t i = 0; i < count - 1; i++) {
+        stages[i] = rest->data.pipeline.left;
+        rest = rest->data.pipeline.right;
+    }
+    stages[count - 1] = rest;
+
+    int monitor = job_control_active();
+    Job *j = NULL;
+    pid_t pgid = 0;
+    pid_t last_pid = 0;
+    int prev_read = -1;
+
+    for (size_t i = 0; i < count; i++) {
+        int pipefd[2] = { -1, -1 };
+        if (i + 1 < count && pipe(pipefd) < 0) {
+            perror("posish: pipe failed");
+            break;
         }
-    } else if (pid < 0) {
-        sigprocmask(SIG_SETMASK, &oldmask, NULL); // Restore mask on error
-        error_sys("fork");
-        // Free env
-        for (int i = 0; env[i]; i++) free(env[i]);
-        free(env);
-        return 1;
-    }
 
-    // Parent process
-    
-    // Free environment array (deep free)
-    for (int i = 0; env[i]; i++) free(env[i]);
-    free(env);
+        pid_t pid = fork();
+        if (pid == 0) {
+            coverage_forked();
+            if (monitor) {
+                job_child_init(pgid, !background);
+            } else if (background) {
+                setpgid(0, pgid);
+            }
+            if (prev_read >= 0) {
+                dup2(prev_read, STDIN_FILENO);
+                close(prev_read);
+            }
+            if (pipefd[1] >= 0) {
+                close(pipefd[0]);
+                dup2(pipefd[1], STDOUT_FILENO);
+                close(pipefd[1]);
+            }
+            executor_no_fork = 1; // Optimize: exec directly
+            exception_handler = NULL; // Errors end the child
 
-    // Only set process group if job control is enabled
-    // Otherwise external commands should share the shell's PGID
-    if (shell_monitor) {
-        setpgid(pid, pid);
-    }
-    
-    Job *j = job_add(pid, argv[0], JOB_RUNNING);
-    posish_var_set_last_bg_pid(pid);
-    
-    int status = job_wait(j);
-    signal_check_pending(); // Check for pending signals after wait
-    
-    // Restore signal mask
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
-    
-    // If child was interrupted by SIGINT, propagate it
-    if (status == 128 + SIGINT) {
-        got_sigint = 1;
-    }
-    
-    return status;
-}
+            // The process already is the subshell
+            ASTNode *body = stages[i];
+            if (body->type == NODE_SUBSHELL) body = body->data.subshell.body;
+            exit(executor_execute(body));
+        }
 
-static int execute_pipeline(ASTNode *node) {
-    // CRITICAL: Flush buffers before fork to prevent duplication
-    buf_out_flush_all();
+        if (pid < 0) {
+            perror("posish: fork failed");
+            if (pipefd[0] >= 0) {
+                close(pipefd[0]);
+                close(pipefd[1]);
+            }
+            break;
+        }
 
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
-        perror("posish: pipe failed");
-        return 1;
-    }
+        // Both sides set the group so neither can run ahead of it
+        if (monitor || background) setpgid(pid, pgid ? pgid : pid);
 
-    pid_t pid1 = fork();
-    if (pid1 == 0) {
-        close(pipefd[0]);
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[1]);
-        executor_no_fork = 1; // Optimize: exec directly
-        exit(executor_execute(node->data.pipeline.left));
-    }
+        StringBuilder desc;
+        sb_init(&desc);
+        job_describe(stages[i], &desc);
+        char *command = sb_finish(&desc);
+        if (!j) {
+            pgid = pid;
+            j = job_add(pid, command, JOB_RUNNING);
+        } else {
+            job_add_process(j, pid, command);
+        }
+        last_pid = pid;
 
-    pid_t pid2 = fork();
-    if (pid2 == 0) {
-        close(pipefd[1]);
-        dup2(pipefd[0], STDIN_FILENO);
-        close(pipefd[0]);
-        executor_no_fork = 1; // Optimize: exec directly
-        exit(executor_execute(node->data.pipeline.right));
+        if (prev_read >= 0) close(prev_read);
+        if (pipefd[1] >= 0) close(pipefd[1]);
+        prev_read = pipefd[0];
     }
+    if (prev_read >= 0) close(prev_read);
+    free(stages);
 
-    close(pipefd[0]);
-    close(pipefd[1]);
+    if (!j) return 1;
 
-    int status1, status2;
-    waitpid(pid1, &status1, 0);
-    waitpid(pid2, &status2, 0);
-    signal_check_pending(); // Check for pending signals after wait
+    if (background) {
+        j->background = 1;
+        if (shell_interactive) {
+            fprintf(stderr, "[%d] %d\n", j->id, (int)last_pid);
+        }
+        posish_var_set_last_bg_pid(last_pid);
+        return 0;
+    }
+
+    int status = job_foreground(j, 0);
+    SIGNAL_POLL(); // Check for pending signals after wait
+    return status;
+}
 
-    if (WIFEXITED(status2)) {
-        return WEXITSTATUS(status2);
+// Short description of a background job for job listings
+static void job_describe(ASTNode *node, StringBuilder *sb) {
+    if (!node) return;
+    if (node->type == NODE_COMMAND && node->data.command.arg_count > 0) {
+        for (size_t i = 0; i < node->data.command.arg_count; i++) {
+            if (i > 0) sb_append(sb, ' ');
+            sb_append_str(sb, node->data.command.args[i]);
+        }
+    } else if (node->type == NODE_PIPELINE) {
+        job_describe(node->data.pipeline.left, sb);
+        sb_append_str(sb, " | ");
+        job_describe(node->data.pipeline.right, sb);
+    } else if (node->type == NODE_SUBSHELL) {
+        sb_append_str(sb, "( ... )");
+    } else {
+        sb_append_str(sb, "...");
     }
-    return 1;
 }
 
 static int execute_list(ASTNode *node) {
@@ -1755,25 +1791,14 @@ static int execute_list(ASTNode *node) {
 
     if (node->data.list.left) {
         if (node->data.list.async) {
-            // CRITICAL: Flush buffers before fork
-            buf_out_flush_all();
-            
-            pid_t pid = fork();
-            if (pid == 0) {
-                setpgid(0, 0);
-                executor_no_fork = 1; // Optimize: exec directly
-                exit(executor_execute(node->data.list.left));
-            } else if (pid < 0) {
-                perror("posish: fork failed");
-            } else {
-                setpgid(pid, pid);
-                Job *j = job_add(pid, "background task", JOB_RUNNING);
-                printf("[%d] %d\n", j->id, pid);
-                posish_var_set_last_bg_pid(pid);
-                status = 0;
-            }
+            status = execute_job(node->data.list.left, 1);
         } else {
+            // Only the last command of a process forked to run the list
+            // may end it by exec (see executor_no_fork)
+            int tail = executor_no_fork;
+            if (node->data.list.right) executor_no_fork = 0;
             status = executor_execute(node->data.list.left);
+            executor_no_fork = tail;
             if (status == EXIT_BREAK || status == EXIT_CONTINUE || status == EXIT_RETURN) {
                 return status;
             }
@@ -1793,6 +1818,7 @@ static int execute_list(ASTNode *node) {
 static int execute_for(ASTNode *node) {
     char **items = NULL;
     size_t item_count = 0;
+    size_t item_cap = 0;
     
     if (node->data.for_loop.word_list) {
         for (size_t i = 0; i < node->data.for_loop.word_count; i++) {
@@ -1804,24 +1830,15 @@ static int execute_for(ASTNode *node) {
                     
                     if (has_glob_chars(expanded)) {
                         char *pattern = prepare_glob_pattern(expanded);
-                        glob_t glob_result;
-                        int flags = GLOB_NOCHECK;
-                        
-                        if (glob(pattern, flags, NULL, &glob_result) == 0) {
-                            items = mem_stack_realloc_array(items, item_count * sizeof(char*), (item_count + glob_result.gl_pathc) * sizeof(char *), 1);
-                            for (size_t j = 0; j < glob_result.gl_pathc; j++) {
-                                items[item_count++] = mem_stack_strdup(glob_result.gl_pathv[j]);
-                            }
-                            globfree(&glob_result);
-                        } else {
-                            items = mem_stack_realloc_array(items, item_count * sizeof(char*), (item_count + 1) * sizeof(char *), 1);
-                            items[item_count++] = expanded;
-                            expanded = NULL;
+                        size_t name_count;
+                        char **names = pattern_glob(pattern, &name_count);
+                        for (size_t j = 0; j < name_count; j++) {
+                            items = word_list_add(items, &item_count, &item_cap, mem_stack_strdup(names[j]));
                         }
+                        pattern_glob_free(names);
                         // No free needed for pattern
                     } else {
-                        items = mem_stack_realloc_array(items, item_count * sizeof(char*), (item_count + 1) * sizeof(char *), 1);
-                        items[item_count++] = expanded;
+                        items = word_list_add(items, &item_count, &item_cap, expanded);
                         expanded = NULL;
                     }
                     // No free needed for expanded
@@ -1833,8 +1850,7 @@ static int execute_for(ASTNode *node) {
         char **args = posish_var_get_all_positional();
         if (args) {
             for (int i = 0; args[i] != NULL; i++) {
-                items = mem_stack_realloc_array(items, item_count * sizeof(char*), (item_count + 1) * sizeof(char *), 1);
-                items[item_count++] = mem_stack_strdup(args[i]);
+                items = word_list_add(items, &item_count, &item_cap, mem_stack_strdup(args[i]));
                 free(args[i]);
             }
             free(args);
@@ -1846,18 +1862,12 @@ static int execute_for(ASTNode *node) {
         struct stackmark smark;
         mem_stack_push_mark(&smark);
         
-        // Check for Ctrl+C interruption
-        if (signal_check_sigint()) {
-            fprintf(stderr, "\n");
-            mem_stack_pop_mark(&smark);
-            return 130;  // 128 + SIGINT
-        }
+        // Loop back-edge: traps and Ctrl+C are acted on here
+        SIGNAL_POLL();
         
         if (posish_var_set(node->data.for_loop.var_name, items[i]) != 0) {
             // Assignment failed (readonly variable)
-            status = 1;
-            mem_stack_pop_mark(&smark);
-            break;
+            exception_raise(1);
         }
         if (node->data.for_loop.body) {
             status = executor_execute(node->data.for_loop.body);
@@ -1892,15 +1902,81 @@ static int execute_for(ASTNode *node) {
     return status;
 }
 
+// ! pipeline: its status inverted. Like an if condition, it is exempt
+// from set -e.
+static int execute_not(ASTNode *node) {
+    int old_ignore = shell_ignore_errexit;
+    int tail = executor_no_fork;
+    shell_ignore_errexit = 1;
+    executor_no_fork = 0;
+    int status = executor_execute(node->data.prefixed.pipeline);
+    shell_ignore_errexit = old_ignore;
+    executor_no_fork = tail;
+    if (status >= EXIT_BREAK && status <= EXIT_RETURN) return status;
+    return status == 0;
+}
+
+static long timeval_usec(struct timeval tv) {
+    return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+static void print_time(const char *name, long usec, int posix) {
+    if (posix) {
+        fprintf(stderr, "%s %ld.%02ld\n", name, usec / 1000000, usec % 1000000 / 10000);
+    } else {
+        fprintf(stderr, "%s\t%ldm%ld.%03lds\n", name, usec / 60000000, usec / 1000000 % 60,
+                usec % 1000000 / 1000);
+    }
+}
+
+// time [-p] pipeline: the elapsed time, and the CPU time of the shell and
+// of the processes it waited for meanwhile, which covers builtins,
+// subshells and every stage of a pipeline
+static int execute_time(ASTNode *node) {
+    struct timespec start, end;
+    struct rusage self_start, self_end, children_start, children_end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &self_start);
+    getrusage(RUSAGE_CHILDREN, &children_start);
+
+    // Forked or not, the shell has to be there to report
+    int tail = executor_no_fork;
+    executor_no_fork = 0;
+    int status = executor_execute(node->data.prefixed.pipeline);
+    executor_no_fork = tail;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self_end);
+    getrusage(RUSAGE_CHILDREN, &children_end);
+    long real = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+    long user = timeval_usec(self_end.ru_utime) - timeval_usec(self_start.ru_utime) +
+                timeval_usec(children_end.ru_utime) - timeval_usec(children_start.ru_utime);
+    long sys = timeval_usec(self_end.ru_stime) - timeval_usec(self_start.ru_stime) +
+               timeval_usec(children_end.ru_stime) - timeval_usec(children_start.ru_stime);
+
+    int posix = node->data.prefixed.posix;
+    buf_out_flush_all();
+    if (!posix) fputc('\n', stderr);
+    print_time("real", real, posix);
+    print_time("user", user, posix);
+    print_time("sys", sys, posix);
+    return status;
+}
+
 static int execute_if(ASTNode *node) {
     int old_ignore = shell_ignore_errexit;
+    int tail = executor_no_fork;
     shell_ignore_errexit = 1;
+    executor_no_fork = 0;
     int status = executor_execute(node->data.if_stmt.condition);
     shell_ignore_errexit = old_ignore;
+    executor_no_fork = tail;
     
     if (status == 0) {
+        COVERAGE_BRANCH(node, 0);
         return executor_execute(node->data.if_stmt.then_branch);
     } else {
+        COVERAGE_BRANCH(node, 1);
         if (node->data.if_stmt.else_branch) {
             return executor_execute(node->data.if_stmt.else_branch);
         }
@@ -1914,12 +1990,8 @@ static int execute_while(ASTNode *node) {
         struct stackmark smark;
         mem_stack_push_mark(&smark);
 
-        // Check for Ctrl+C interruption
-        if (signal_check_sigint()) {
-            fprintf(stderr, "\n");
-            mem_stack_pop_mark(&smark);
-            return 130;  // 128 + SIGINT
-        }
+        // Loop back-edge: traps and Ctrl+C are acted on here
+        SIGNAL_POLL();
 
         int old_ignore = shell_ignore_errexit;
         shell_ignore_errexit = 1;
@@ -1927,10 +1999,12 @@ static int execute_while(ASTNode *node) {
         shell_ignore_errexit = old_ignore;
         
         if (cond_status != 0) {
+            COVERAGE_BRANCH(node, 1);
             mem_stack_pop_mark(&smark);
             break;
         }
         
+        COVERAGE_BRANCH(node, 0);
         status = executor_execute(node->data.while_loop.body);
         if (status == EXIT_BREAK) {
             if (executor_break_count > 1) {
@@ -1965,12 +2039,8 @@ static int execute_until(ASTNode *node) {
         struct stackmark smark;
         mem_stack_push_mark(&smark);
 
-        // Check for Ctrl+C interruption
-        if (signal_check_sigint()) {
-            fprintf(stderr, "\n");
-            mem_stack_pop_mark(&smark);
-            return 130;  // 128 + SIGINT
-        }
+        // Loop back-edge: traps and Ctrl+C are acted on here
+        SIGNAL_POLL();
 
         int old_ignore = shell_ignore_errexit;
         shell_ignore_errexit = 1;
@@ -1978,10 +2048,12 @@ static int execute_until(ASTNode *node) {
         shell_ignore_errexit = old_ignore;
         
         if (cond_status == 0) {
+            COVERAGE_BRANCH(node, 1);
             mem_stack_pop_mark(&smark);
             break;
         }
         
+        COVERAGE_BRANCH(node, 0);
         status = executor_execute(node->data.until_loop.body);
         if (status == EXIT_BREAK) {
             if (executor_break_count > 1) {
@@ -2018,6 +2090,17 @@ static int is_safe_for_vfork(ASTNode *node) {
         case NODE_COMMAND: {
             // Assignments are unsafe (modify state)
             if (node->data.command.assignment_count > 0) return 0;
+
+            // So are words that assign as they expand, even for an
+            // external command: the child expands them in our memory
+            for (size_t i = 0; i < node->data.command.arg_count; i++) {
+                if (word_assigns(node->data.command.args[i])) return 0;
+            }
+            for (size_t i = 0; i < node->data.command.redirection_count; i++) {
+                Redirection *r = &node->data.command.redirections[i];
+                if (r->filename && word_assigns(r->filename)) return 0;
+                if (r->here_doc_content && word_assigns(r->here_doc_content)) return 0;
+            }
             
             // Empty command is safe
             if (node->data.command.arg_count == 0) return 1;
@@ -2029,10 +2112,9 @@ static int is_safe_for_vfork(ASTNode *node) {
             if (strcmp(cmd, ":") == 0 ||
                 strcmp(cmd, "true") == 0 ||
                 strcmp(cmd, "false") == 0 ||
-                strcmp(cmd, "echo") == 0 ||
-                strcmp(cmd, "printf") == 0 ||
                 strcmp(cmd, "test") == 0 ||
-                strcmp(cmd, "[") == 0) {
+                strcmp(cmd, "[") == 0 ||
+                is_capture_builtin(node)) {
                 return 1;
             }
             
@@ -2077,27 +2159,60 @@ static int is_safe_for_vfork(ASTNode *node) {
 }
 
 static int execute_subshell(ASTNode *node) {
+    // CRITICAL: Flush buffers before fork so the child cannot repeat them
+    buf_out_flush_all();
+
     // Use vfork() if safe (no state modification), otherwise fork()
+    // A vfork child shares our memory, so anything it sets must be undone.
+    // It may run one command, which ends it by exec, but not several: the
+    // ones before the last would fork and record jobs in our tables.
+    int saved_no_fork = executor_no_fork;
+    struct jmploc *saved_handler = exception_handler;
     pid_t pid;
-    if (is_safe_for_vfork(node->data.subshell.body)) {
+    int forked = 0;
+    ASTNode *body = node->data.subshell.body;
+    if (body->type == NODE_COMMAND && is_safe_for_vfork(body)) {
         pid = vfork();
     } else {
         pid = fork();
+        forked = 1;
     }
     
     if (pid == 0) {
         // Child process
         executor_no_fork = 1; // Optimize: exec directly
-        int status = executor_execute(node->data.subshell.body);
-        exit(status);  // Use exit() (or _exit)
-    } else if (pid > 0) {
+        if (forked) {
+            coverage_forked();
+            exception_handler = NULL; // Errors end the subshell
+            exit(executor_execute(body));
+        }
+        // A vfork child ends by _exit(): exit() would run, and use up,
+        // the parent's atexit handlers, coverage_flush() among them. Its
+        // errors are caught to end it the same way.
+        struct jmploc jl;
         int status;
-        waitpid(pid, &status, 0);
-        signal_check_pending(); // Check for pending signals after wait
-        if (WIFEXITED(status)) {
-            return WEXITSTATUS(status);
+        if (setjmp(jl.loc)) {
+            status = exception_status;
+        } else {
+            exception_handler = NULL;
+            exception_push(&jl);
+            status = executor_execute(body);
         }
-        return 1;
+        buf_out_flush_all();
+        _exit(status);
+    } else if (pid > 0) {
+        executor_no_fork = saved_no_fork;
+        exception_handler = saved_handler;
+        int wstatus = job_wait_pid(pid);
+        int status = 1;
+        if (WIFEXITED(wstatus)) {
+            status = WEXITSTATUS(wstatus);
+        } else if (WIFSIGNALED(wstatus)) {
+            status = 128 + WTERMSIG(wstatus);
+        }
+        signal_foreground_status(wstatus);
+        SIGNAL_POLL(); // Check for pending signals after wait
+        return status;
     } else {
         perror("fork");
         return 1;
@@ -2116,7 +2231,7 @@ static int execute_case(ASTNode *node) {
             for (int j = 0; item->patterns[j]; j++) {
                 char *pattern = expand_word(item->patterns[j]);
                 
-                if (fnmatch(pattern, word, 0) == 0) {
+                if (pattern_match(pattern, word, strlen(word))) {
                     matched = 1;
                     // free(pattern); // No free needed
                     break;
@@ -2126,6 +2241,7 @@ static int execute_case(ASTNode *node) {
         }
         
         if (matched) {
+            COVERAGE_BRANCH(node, i);
             if (item->commands) {
                 status = executor_execute(item->commands);
             }
@@ -2133,6 +2249,7 @@ static int execute_case(ASTNode *node) {
         }
     }
     
+    if (!matched) COVERAGE_BRANCH(node, node->data.case_stmt.item_count);
     // free(word); // No free needed
     return status;
 }
@@ -2149,20 +2266,27 @@ static int execute_function_def(ASTNode *node) {
 
 static int execute_and_or(ASTNode *node) {
     int old_ignore = shell_ignore_errexit;
+    int tail = executor_no_fork;
     shell_ignore_errexit = 1;
+    executor_no_fork = 0;
     int status = executor_execute(node->data.pipeline.left);
     shell_ignore_errexit = old_ignore;
+    executor_no_fork = tail;
     
     if (node->type == NODE_AND) {
         if (status == 0) {
+            COVERAGE_BRANCH(node, 0);
             return executor_execute(node->data.pipeline.right);
         } else {
+            COVERAGE_BRANCH(node, 1);
             return status;
         }
     } else if (node->type == NODE_OR) {
         if (status != 0) {
+            COVERAGE_BRANCH(node, 0);
             return executor_execute(node->data.pipeline.right);
         } else {
+            COVERAGE_BRANCH(node, 1);
             return status;
         }
     }
@@ -2172,30 +2296,45 @@ static int execute_and_or(ASTNode *node) {
 int executor_execute(ASTNode *node) {
     if (!node) return 0;
 
-    signal_check_pending();
+    SIGNAL_POLL();
+    if (CSTACK_LOW()) cstack_overflow();
 
-    // Update LINENO
-    if (node->lineno > 0) {
-        posish_var_set_lineno(node->lineno);
+    // Update LINENO and the position the call stack reports
+    if (node->pos.line > 0) {
+        posish_var_set_lineno(node->pos.line);
+        call_file = node->pos.file;
+        call_line = node->pos.line;
     }
+    COVERAGE_HIT(node);
+    DEBUG_HOOK(node);
 
     int status = 0;
     if (node->type == NODE_COMMAND) {
         status = execute_simple_command(node);
+        // A pipeline of one; break, continue and return are not statuses
+        if (status < EXIT_BREAK || status > EXIT_RETURN) posish_var_set_pipestatus(&status, 1);
     } else if (node->type == NODE_PIPELINE) {
         status = execute_pipeline(node);
     } else if (node->type == NODE_LIST) {
         status = execute_list(node);
     } else if (node->type == NODE_IF) {
         status = execute_if(node);
-    } else if (node->type == NODE_WHILE) {
-        status = execute_while(node);
-    } else if (node->type == NODE_UNTIL) {
-        status = execute_until(node);
-    } else if (node->type == NODE_FOR) {
-        status = execute_for(node);
+    } else if (node->type == NODE_WHILE || node->type == NODE_UNTIL || node->type == NODE_FOR) {
+        // Nothing in a loop is the last command: it may run again
+        int tail = executor_no_fork;
+        executor_no_fork = 0;
+        if (node->type == NODE_WHILE) {
+            status = execute_while(node);
+        } else if (node->type == NODE_UNTIL) {
+            status = execute_until(node);
+        } else {
+            status = execute_for(node);
+        }
+        executor_no_fork = tail;
     } else if (node->type == NODE_SUBSHELL) {
-        status = execute_subshell(node);
+        // Under job control a subshell is a job of its own
+        status = job_control_active() ? execute_job(node, 0) : execute_subshell(node);
+        posish_var_set_pipestatus(&status, 1);
     } else if (node->type == NODE_CASE) {
         status = execute_case(node);
     } else if (node->type == NODE_GROUP) {
@@ -2204,11 +2343,15 @@ int executor_execute(ASTNode *node) {
         status = execute_function_def(node);
     } else if (node->type == NODE_AND || node->type == NODE_OR) {
         status = execute_and_or(node);
+    } else if (node->type == NODE_NOT) {
+        status = execute_not(node);
+    } else if (node->type == NODE_TIME) {
+        status = execute_time(node);
     }
 
     last_exit_status = status;
 
-    if (shell_exit_on_error && status != 0) {
+    if (shell_exit_on_error && status != 0 && node->type != NODE_NOT) {
         // Check if we should ignore error
         // -e is ignored if:
         // 1. command is part of while/until condition
@@ -2235,76 +2378,186 @@ int executor_execute(ASTNode *node) {
         
         extern int shell_ignore_errexit;
         if (!shell_ignore_errexit) {
+             callstack_backtrace();
              exit(status);
         }
     }
     return status;
 }
-// Pattern removal helper functions
-// Remove shortest matching suffix
-static char *remove_suffix_shortest(const char *str, const char *pattern) {
-    if (!str || !pattern) return xstrdup(str ? str : "");
-    
-    size_t len = strlen(str);
-    // Try matching from end backwards (shortest match first)
-    for (size_t i = len; i > 0; i--) {
-        if (fnmatch(pattern, str + i, 0) == 0) {
-            char *result = xmalloc(i + 1);
-            strncpy(result, str, i);
-            result[i] = '\0';
-            return result;
-        }
-    }
-    return xstrdup(str);
+// Read, parse and run commands from src one complete command at a time,
+// so that each line is consumed (and echoed under set -v) only once
+// everything before it has run.
+static void free_buffer(void *arg) {
+    free(*(char **)arg);
 }
 
-// Remove longest matching suffix
-static char *remove_suffix_longest(const char *str, const char *pattern) {
-    if (!str || !pattern) return xstrdup(str ? str : "");
-    
-    size_t len = strlen(str);
-    // Try matching from start forwards (longest match first)
-    for (size_t i = 0; i <= len; i++) {
-        if (fnmatch(pattern, str + i, 0) == 0) {
-            char *result = xmalloc(i + 1);
-            strncpy(result, str, i);
-            result[i] = '\0';
-            return result;
+static void free_scan(void *arg) {
+    lexer_scan_free(arg);
+}
+
+int executor_run_source(InputSource *src) {
+    LexerScan scan;
+    char *buffer = NULL;
+    size_t len = 0;
+    int start_line = src->lineno;
+    size_t start_offset = src->offset;
+    int incomplete = 0;
+    int check_failed = 0;
+    int status = 0;
+    // Commands are read one at a time, so none is known to be the last
+    int tail = executor_no_fork;
+    executor_no_fork = 0;
+
+    lexer_scan_init(&scan);
+    if (coverage_counts && src->fd >= 0) coverage_register_file(src->file);
+    cleanup_push(free_scan, &scan);
+    cleanup_push(free_buffer, &buffer);
+
+    while (1) {
+        SIGNAL_POLL();
+
+        char *line = input_source_read_line(src);
+        if (!line) {
+            if (buffer) {
+                // Reported where the unfinished command starts
+                SourcePos pos = {src->file, start_line, 1, start_offset};
+                const char *missing = lexer_incomplete_missing(incomplete);
+                if (missing) {
+                    diag_report(&pos, "error", "syntax",
+                                "syntax error: unexpected end of file (expected `%s')", missing);
+                } else {
+                    diag_report(&pos, "error", "syntax", "syntax error: unexpected end of file");
+                }
+                status = 2;
+            }
+            break;
+        }
+
+        size_t line_len = strlen(line);
+        if (!buffer) {
+            buffer = line;
+            len = line_len;
+        } else {
+            buffer = xrealloc(buffer, len + line_len + 1);
+            memcpy(buffer + len, line, line_len + 1);
+            len += line_len;
+            free(line);
+        }
+
+        incomplete = lexer_scan_incomplete(&scan, buffer, len);
+        if (incomplete) continue;
+
+        struct stackmark smark;
+        mem_stack_push_mark(&smark);
+
+        if (shell_no_exec && !shell_interactive) {
+            // set -n: read and check every command, running none of them
+            Lexer lexer;
+            lexer_init(&lexer, buffer);
+            lexer.current_line = start_line;
+            lexer.file = src->file;
+            lexer.base_offset = start_offset;
+            if (parser_check(&lexer) > 0) check_failed = 1;
+            status = 0;
+        } else if (!coverage_counts && parser_try_fast_path(buffer)) {
+            // Assignments run here have no tree to count them
+            status = 0;
+        } else {
+            Lexer lexer;
+            lexer_init(&lexer, buffer);
+            lexer.current_line = start_line;
+            lexer.file = src->file;
+            lexer.base_offset = start_offset;
+
+            ASTNode *ast = parser_parse(&lexer);
+            if (!ast) {
+                // The parser has already reported the syntax error
+                mem_stack_pop_mark(&smark);
+                status = 2;
+                break;
+            }
+            if (coverage_counts) coverage_instrument(ast);
+            status = executor_execute(ast);
+        }
+
+        mem_stack_pop_mark(&smark);
+        free(buffer);
+        buffer = NULL;
+        len = 0;
+        start_line = src->lineno;
+        start_offset = src->offset;
+        lexer_scan_free(&scan);
+        lexer_scan_init(&scan);
+
+        if (status == EXIT_BREAK || status == EXIT_CONTINUE || status == EXIT_RETURN) {
+            break;
         }
     }
-    return xstrdup(str);
+
+    cleanup_pop(1);
+    cleanup_pop(1);
+    executor_no_fork = tail;
+    return check_failed ? 2 : status;
 }
 
-// Remove shortest matching prefix
-static char *remove_prefix_shortest(const char *str, const char *pattern) {
+// Pattern removal helper functions. The pattern is tried against
+// prefixes and suffixes that start and end on character boundaries.
+// In a string without multibyte characters every byte offset is one,
+// which spares building the table of offsets.
+static size_t *char_offsets(const char *str, size_t len, size_t *count) {
+    size_t i = 0;
+    while (i < len && (unsigned char)str[i] < 0x80) i++;
+    if (i == len) {
+        *count = len;
+        return NULL;
+    }
+    size_t *offsets = xmalloc((len + 1) * sizeof(size_t));
+    size_t n = 0;
+    for (i = 0; i < len; i += mb_len(str + i)) offsets[n++] = i;
+    offsets[n] = len;
+    *count = n;
+    return offsets;
+}
+
+#define CHAR_OFFSET(offsets, k) ((offsets) ? (offsets)[k] : (k))
+
+// Remove the shortest or longest suffix matching pattern
+static char *remove_suffix(const char *str, const char *pattern, int longest) {
     if (!str || !pattern) return xstrdup(str ? str : "");
-    
+
     size_t len = strlen(str);
-    // Try matching from start (shortest match first)
-    for (size_t i = 0; i <= len; i++) {
-        char temp[i + 1];
-        strncpy(temp, str, i);
-        temp[i] = '\0';
-        if (fnmatch(pattern, temp, 0) == 0) {
-            return xstrdup(str + i);
+    size_t count;
+    size_t *offsets = char_offsets(str, len, &count);
+    char *result = NULL;
+    for (size_t j = 0; j <= count && !result; j++) {
+        SIGNAL_POLL();
+        // Shortest: from the end backwards; longest: from the start
+        size_t i = CHAR_OFFSET(offsets, longest ? j : count - j);
+        if (pattern_match(pattern, str + i, len - i)) {
+            result = xmalloc(i + 1);
+            memcpy(result, str, i);
+            result[i] = '\0';
         }
     }
-    return xstrdup(str);
+    free(offsets);
+    return result ? result : xstrdup(str);
 }
 
-// Remove longest matching prefix
-static char *remove_prefix_longest(const char *str, const char *pattern) {
+// Remove the shortest or longest prefix matching pattern
+static char *remove_prefix(const char *str, const char *pattern, int longest) {
     if (!str || !pattern) return xstrdup(str ? str : "");
-    
+
     size_t len = strlen(str);
-    // Try matching from end backwards (longest match first)
-    for (size_t i = len; i > 0; i--) {
-        char temp[i + 1];
-        strncpy(temp, str, i);
-        temp[i] = '\0';
-        if (fnmatch(pattern, temp, 0) == 0) {
-            return xstrdup(str + i);
+    size_t count;
+    size_t *offsets = char_offsets(str, len, &count);
+    char *result = NULL;
+    for (size_t j = 0; j <= count && !result; j++) {
+        SIGNAL_POLL();
+        size_t i = CHAR_OFFSET(offsets, longest ? count - j : j);
+        if (pattern_match(pattern, str, i)) {
+            result = xstrdup(str + i);
         }
     }
-    return xstrdup(str);
+    free(offsets);
+    return result ? result : xstrdup(str);
 }
@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "history.h"
+#include "memalloc.h"
+#include "variables.h"
+
+#define HISTSIZE_DEFAULT 128
+
+// Prefixes are indexed this deep; longer ones are checked against the
+// entries directly
+#define TRIE_DEPTH 64
+
+// Entries live in a ring buffer; the oldest is at ring[start] and has
+// event number first_event, so lookups by number are O(1).
+static char **ring = NULL;
+static int capacity = 0;
+static int start = 0;
+static int count = 0;
+static int first_event = 1;
+static char *history_file = NULL;
+
+// Prefix trie over the first TRIE_DEPTH bytes of every entry. Each node
+// holds the newest event whose text passes through it. Evicted entries
+// are never removed: a node whose event is older than first_event simply
+// has no live entry below it. The trie is rebuilt when it grows too big.
+struct trie_node {
+    unsigned char c;
+    int event;
+    struct trie_node *child;
+    struct trie_node *sibling;
+};
+
+static struct trie_node trie_root;
+static size_t trie_nodes = 0;
+
+static void history_alloc(void) {
+    if (ring) return;
+    capacity = HISTSIZE_DEFAULT;
+    char *size = posish_var_get("HISTSIZE");
+    if (size) {
+        int n = atoi(size);
+        if (n > 0) capacity = n;
+        free(size);
+    }
+    ring = xmalloc(capacity * sizeof(char *));
+}
+
+static void trie_free(struct trie_node *node) {
+    while (node) {
+        struct trie_node *next = node->sibling;
+        trie_free(node->child);
+        free(node);
+        node = next;
+    }
+}
+
+static void trie_insert(const char *text, int event) {
+    struct trie_node *node = &trie_root;
+    node->event = event;
+    for (int depth = 0; text[depth] && depth < TRIE_DEPTH; depth++) {
+        unsigned char c = (unsigned char)text[depth];
+        struct trie_node *child = node->child;
+        while (child && child->c != c) child = child->sibling;
+        if (!child) {
+            child = xmalloc(sizeof(*child));
+            child->c = c;
+            child->child = NULL;
+            child->sibling = node->child;
+            node->child = child;
+            trie_nodes++;
+        }
+        child->event = event;
+        node = child;
+    }
+}
+
+static void trie_rebuild(void) {
+    trie_free(trie_root.child);
+    trie_root.child = NULL;
+    trie_nodes = 0;
+    for (int i = 0; i < count; i++) {
+        trie_insert(ring[(start + i) % capacity], first_event + i);
+    }
+}
+
+// Entries spanning several lines (or that would be mistaken for a
+// header) are written as "#\t<lines>" followed by their lines.
+static void write_entry(FILE *f, const char *text) {
+    if (strchr(text, '\n') || strncmp(text, "#\t", 2) == 0) {
+        int lines = 1;
+        for (const char *p = text; *p; p++) {
+            if (*p == '\n') lines++;
+        }
+        fprintf(f, "#\t%d\n", lines);
+    }
+    fprintf(f, "%s\n", text);
+}
+
+static void save_all(void) {
+    if (!history_file) return;
+    FILE *f = fopen(history_file, "w");
+    if (!f) return;
+    for (int i = 0; i < count; i++) {
+        write_entry(f, ring[(start + i) % capacity]);
+    }
+    fclose(f);
+}
+
+static void store(char *text) {
+    history_alloc();
+    if (count == capacity) {
+        free(ring[start]);
+        start = (start + 1) % capacity;
+        count--;
+        first_event++;
+    }
+    ring[(start + count) % capacity] = text;
+    count++;
+    trie_insert(text, first_event + count - 1);
+
+    if (trie_nodes > (size_t)capacity * TRIE_DEPTH * 2) {
+        trie_rebuild();
+    }
+}
+
+static void chomp(char *line) {
+    size_t l = strlen(line);
+    if (l > 0 && line[l - 1] == '\n') line[l - 1] = '\0';
+}
+
+void history_init(const char *filename) {
+    if (history_file) free(history_file);
+    history_file = xstrdup(filename);
+    history_alloc();
+
+    FILE *f = fopen(history_file, "r");
+    if (!f) return;
+
+    char *line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, f) != -1) {
+        chomp(line);
+
+        int lines = 0;
+        if (line[0] == '#' && line[1] == '\t' && isdigit((unsigned char)line[2])) {
+            lines = atoi(line + 2);
+        }
+        if (lines <= 0) {
+            store(xstrdup(line));
+            continue;
+        }
+
+        // Multi-line entry: join the next <lines> lines
+        char *text = NULL;
+        size_t text_len = 0;
+        for (int i = 0; i < lines && getline(&line, &len, f) != -1; i++) {
+            chomp(line);
+            size_t l = strlen(line);
+            text = xrealloc(text, text_len + l + 2);
+            if (i > 0) text[text_len++] = '\n';
+            memcpy(text + text_len, line, l + 1);
+            text_len += l;
+        }
+        if (text) store(text);
+    }
+    free(line);
+    fclose(f);
+}
+
+void history_add(const char *line) {
+    if (!line || !*line) return;
+
+    // Create a copy to strip newline
+    char *line_copy = xstrdup(line);
+    chomp(line_copy);
+
+    if (line_copy[0] == '\0') {
+        free(line_copy);
+        return;
+    }
+
+    // Don't add duplicates of the last command
+    if (count > 0 && strcmp(ring[(start + count - 1) % capacity], line_copy) == 0) {
+        free(line_copy);
+        return;
+    }
+
+    store(line_copy);
+
+    if (history_file) {
+        FILE *f = fopen(history_file, "a");
+        if (f) {
+            write_entry(f, line_copy);
+            fclose(f);
+        }
+    }
+}
+
+void history_replace_last(const char *line) {
+    if (count == 0) {
+        history_add(line);
+        return;
+    }
+    char *line_copy = xstrdup(line);
+    chomp(line_copy);
+
+    int last = (start + count - 1) % capacity;
+    free(ring[last]);
+    ring[last] = line_copy;
+    trie_insert(line_copy, history_last_event());
+    save_all();
+}
+
+int history_length(void) {
+    return count;
+}
+
+const char *history_get(int index) {
+    if (index < 0 || index >= count) return NULL;
+    return ring[(start + index) % capacity];
+}
+
+int history_first_event(void) {
+    return first_event;
+}
+
+int history_last_event(void) {
+    return first_event + count - 1;
+}
+
+const char *history_get_event(int event) {
+    return history_get(event - first_event);
+}
+
+int history_find_prefix(const char *prefix, int before) {
+    if (count == 0) return -1;
+
+    size_t len = strlen(prefix);
+    struct trie_node *node = &trie_root;
+    for (size_t depth = 0; depth < len && depth < TRIE_DEPTH; depth++) {
+        struct trie_node *child = node->child;
+        while (child && child->c != (unsigned char)prefix[depth]) child = child->sibling;
+        if (!child) return -1;
+        node = child;
+    }
+
+    // The newest event under the node is the answer unless that entry was
+    // replaced since, or the prefix is longer than the trie is deep
+    int event = node->event < before ? node->event : before;
+    for (; event >= first_event; event--) {
+        const char *text = history_get_event(event);
+        if (text && strncmp(text, prefix, len) == 0) return event;
+    }
+    return -1;
+}
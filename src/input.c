@@ -2,8 +2,25 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include "input.h"
+#include "memalloc.h"
+#include "shell_options.h"
+#include "buf_output.h"
+
+/* Scripts keep their descriptor at or above this so that "exec 3<file"
+ * and friends in the script cannot clobber it */
+#define SCRIPT_FD_MIN 10
+
+#define INPUT_BUF_SIZE 8192
+
+/* Names of the files source positions refer to, indexed by file number */
+static char **file_names = NULL;
+static int file_count = 1;
 
 /* Check if stdin is a TTY */
 int input_is_tty(void) {
@@ -25,3 +42,144 @@ int input_read_char(char *c) {
 ssize_t input_getline(char **lineptr, size_t *n) {
     return getline(lineptr, n, stdin);
 }
+
+/* Set up a source reading from an open descriptor */
+void input_source_fd(InputSource *src, int fd) {
+    src->fd = fd;
+    src->string = NULL;
+    src->string_pos = 0;
+    src->buf = xmalloc(INPUT_BUF_SIZE);
+    src->buf_pos = 0;
+    src->buf_len = 0;
+    src->lineno = 1;
+    src->offset = 0;
+    src->file = 0;
+}
+
+/* Set up a source reading from a string (for -c) */
+void input_source_string(InputSource *src, const char *string) {
+    src->fd = -1;
+    src->string = string;
+    src->string_pos = 0;
+    src->buf = NULL;
+    src->buf_pos = 0;
+    src->buf_len = 0;
+    src->lineno = 1;
+    src->offset = 0;
+    src->file = 0;
+}
+
+/* Release the buffer and close the descriptor of a source */
+void input_source_close(InputSource *src) {
+    if (src->fd >= 0) close(src->fd);
+    free(src->buf);
+    src->fd = -1;
+    src->buf = NULL;
+}
+
+/* Open a script, moving its descriptor out of the low range */
+int input_open_script(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, SCRIPT_FD_MIN);
+    if (high >= 0) {
+        close(fd);
+        fd = high;
+    }
+    return fd;
+}
+
+char *input_read_all(int fd, size_t *len) {
+    size_t cap = 8192;
+    size_t n = 0;
+    char *buf = xmalloc(cap);
+    while (1) {
+        if (n + 1 == cap) {
+            cap *= 2;
+            buf = xrealloc(buf, cap);
+        }
+        ssize_t got = read(fd, buf + n, cap - n - 1);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            free(buf);
+            return NULL;
+        }
+        if (got == 0) break;
+        n += (size_t)got;
+    }
+    buf[n] = '\0';
+    *len = n;
+    return buf;
+}
+
+int input_file_id(const char *name) {
+    for (int i = 1; i < file_count; i++) {
+        if (strcmp(file_names[i], name) == 0) return i;
+    }
+    file_names = xrealloc(file_names, (file_count + 1) * sizeof(char *));
+    file_names[file_count] = xstrdup(name);
+    return file_count++;
+}
+
+const char *input_file_name(int file) {
+    return (file > 0 && file < file_count) ? file_names[file] : NULL;
+}
+
+/* Echo a line of input to stderr if set -v is in effect */
+void input_echo_line(const char *line) {
+    if (!shell_verbose || !line) return;
+    // Keep the echo in order with output of the commands before it
+    buf_out_flush(&buf_stdout);
+    size_t len = strlen(line);
+    fputs(line, stderr);
+    if (len == 0 || line[len - 1] != '\n') fputc('\n', stderr);
+    fflush(stderr);
+}
+
+/* Read the next line including its newline */
+char *input_source_read_line(InputSource *src) {
+    char *line = NULL;
+
+    if (src->fd >= 0) {
+        size_t len = 0;
+        size_t cap = 0;
+        while (1) {
+            if (src->buf_pos == src->buf_len) {
+                ssize_t n = read(src->fd, src->buf, INPUT_BUF_SIZE);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                src->buf_pos = 0;
+                src->buf_len = (size_t)n;
+            }
+            char *start = src->buf + src->buf_pos;
+            size_t avail = src->buf_len - src->buf_pos;
+            char *nl = memchr(start, '\n', avail);
+            size_t take = nl ? (size_t)(nl - start) + 1 : avail;
+            if (len + take + 1 > cap) {
+                cap = (len + take + 1) * 2;
+                line = xrealloc(line, cap);
+            }
+            memcpy(line + len, start, take);
+            len += take;
+            src->buf_pos += take;
+            if (nl) break;
+        }
+        if (!line) return NULL;
+        line[len] = '\0';
+    } else {
+        const char *start = src->string + src->string_pos;
+        if (!*start) return NULL;
+        const char *nl = strchr(start, '\n');
+        size_t len = nl ? (size_t)(nl - start) + 1 : strlen(start);
+        line = xmalloc(len + 1);
+        memcpy(line, start, len);
+        line[len] = '\0';
+        src->string_pos += len;
+    }
+
+    src->lineno++;
+    src->offset += strlen(line);
+    input_echo_line(line);
+    return line;
+}
@@ -2,27 +2,295 @@
 
 
 #include "jobs.h"
+#include "buf_output.h"
+#include "error.h"
+#include "shell_options.h"
+#include "signals.h"
+#include "variables.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
 
+#ifndef SA_RESTART
+#define SA_RESTART 0
+#endif
+
+#ifdef WCONTINUED
+#define REAP_FLAGS (WNOHANG | WUNTRACED | WCONTINUED)
+#else
+#define REAP_FLAGS (WNOHANG | WUNTRACED)
+#define WIFCONTINUED(status) 0
+#endif
+
 static Job *jobs = NULL;
 static int next_job_id = 1;
 
+// Counter ordering jobs by when they were last started, stopped or
+// resumed; the current job (%+) is the latest stopped one, or the latest
+// of all if none is stopped
+static unsigned long use_counter = 0;
+
+// Terminal of an interactive shell with job control, or -1
+static int tty_fd = -1;
+static pid_t shell_pgid;
+static pid_t shell_pid;
+static struct termios shell_tmodes;
+
+// Statuses collected by the SIGCHLD handler. The handler only appends
+// at reap_head; the main flow consumes from reap_tail with SIGCHLD
+// blocked. When the queue is full the handler leaves children unreaped
+// and job_reap() picks them up after draining.
+#define REAP_QUEUE_SIZE 64
+
+static struct {
+    pid_t pid;
+    int status;
+} reap_queue[REAP_QUEUE_SIZE];
+static volatile sig_atomic_t reap_head = 0;
+static volatile sig_atomic_t reap_tail = 0;
+
+// Children that changed state but are not in the job table (command
+// substitutions, pipeline stages, ...), kept until job_wait_pid()
+// claims them
+static struct {
+    pid_t pid;
+    int status;
+} *unclaimed = NULL;
+static size_t unclaimed_count = 0;
+static size_t unclaimed_cap = 0;
+
+// Finished background jobs that were reported, for a later "wait pid"
+#define SAVED_STATUS_SIZE 32
+
+static struct {
+    pid_t pgid;
+    pid_t last;        // $! of a pipeline is its last process
+    int status;
+} saved_statuses[SAVED_STATUS_SIZE];
+static size_t saved_next = 0;
+
+static int wakeup_pipe[2] = { -1, -1 };
+
+static void reap_children(void) {
+    for (;;) {
+        int next = (reap_head + 1) % REAP_QUEUE_SIZE;
+        if (next == reap_tail) return; // Full: retry after draining
+
+        int status;
+        pid_t pid = waitpid(-1, &status, REAP_FLAGS);
+        if (pid <= 0) return;
+
+        reap_queue[reap_head].pid = pid;
+        reap_queue[reap_head].status = status;
+        reap_head = next;
+    }
+}
+
+static void sigchld_handler(int sig) {
+    int saved_errno = errno;
+
+    reap_children();
+    if (wakeup_pipe[1] >= 0) {
+        char c = 0;
+        ssize_t n = write(wakeup_pipe[1], &c, 1);
+        (void)n; // A full pipe already means "wake up"
+    }
+    signal_note(sig);
+
+    errno = saved_errno;
+}
+
 void job_init(void) {
     jobs = NULL;
     next_job_id = 1;
+    shell_pid = getpid();
+
+    struct sigaction sa;
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+void job_control_init(void) {
+    if (!isatty(STDIN_FILENO)) return;
+
+    // Wait until we are in the foreground
+    while (tcgetpgrp(STDIN_FILENO) != getpgrp()) {
+        kill(-getpgrp(), SIGTTIN);
+    }
+
+    // SIGINT keeps the handler from signal_init(): it interrupts what
+    // the shell is running (the line editor reads ^C as a key)
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Put the shell in its own process group
+    shell_pgid = getpid();
+    setpgid(shell_pgid, shell_pgid);
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+    // Keep the terminal even if stdin is redirected later
+    tty_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (tty_fd < 0) return;
+    tcgetattr(tty_fd, &shell_tmodes);
+    shell_monitor = 1;
+}
+
+pid_t job_shell_pid(void) {
+    return shell_pid;
+}
+
+int job_control_active(void) {
+    return shell_monitor && getpid() == shell_pid;
+}
+
+void job_child_init(pid_t pgid, int foreground) {
+    if (pgid == 0) pgid = getpid();
+    setpgid(0, pgid);
+    if (foreground && tty_fd >= 0) tcsetpgrp(tty_fd, pgid);
+
+    signal_child_defaults();
+}
+
+static int wait_status_to_exit(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+static JobStatus process_state(int status) {
+    if (WIFCONTINUED(status)) return JOB_RUNNING;
+    if (WIFSTOPPED(status)) return JOB_STOPPED;
+    if (WIFSIGNALED(status)) return JOB_TERMINATED;
+    return JOB_DONE;
+}
+
+// Derive a job's state from its processes: running while any runs,
+// stopped while any is stopped, otherwise finished with the status of
+// the last one (under set -o pipefail, the last one that failed)
+static void update_job_state(Job *j) {
+    JobProcess *stopped = NULL;
+    for (int i = 0; i < j->nprocs; i++) {
+        if (j->procs[i].status == JOB_RUNNING) {
+            if (j->status != JOB_RUNNING) j->changed = 1;
+            j->status = JOB_RUNNING;
+            return;
+        }
+        if (j->procs[i].status == JOB_STOPPED) stopped = &j->procs[i];
+    }
+
+    JobProcess *last = stopped ? stopped : &j->procs[j->nprocs - 1];
+    JobStatus old = j->status;
+    j->status = last->status;
+    j->exit_status = wait_status_to_exit(last->wait_status);
+    if (shell_pipefail && !stopped) {
+        for (int i = j->nprocs - 1; i >= 0; i--) {
+            int status = wait_status_to_exit(j->procs[i].wait_status);
+            if (status != 0) {
+                j->exit_status = status;
+                break;
+            }
+        }
+    }
+    if (j->status != old) {
+        j->changed = 1;
+        if (j->status == JOB_STOPPED) j->used = ++use_counter;
+    }
+}
+
+static JobProcess *find_process(pid_t pid, Job **job) {
+    for (Job *j = jobs; j; j = j->next) {
+        for (int i = 0; i < j->nprocs; i++) {
+            if (j->procs[i].pid == pid) {
+                *job = j;
+                return &j->procs[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+static void record_status(pid_t pid, int status) {
+    Job *j;
+    JobProcess *p = find_process(pid, &j);
+    if (!p) {
+        if (WIFSTOPPED(status) || WIFCONTINUED(status)) return;
+        if (unclaimed_count == unclaimed_cap) {
+            unclaimed_cap = unclaimed_cap ? unclaimed_cap * 2 : 8;
+            unclaimed = realloc(unclaimed, unclaimed_cap * sizeof(*unclaimed));
+        }
+        unclaimed[unclaimed_count].pid = pid;
+        unclaimed[unclaimed_count].status = status;
+        unclaimed_count++;
+        return;
+    }
+
+    p->status = process_state(status);
+    p->wait_status = status;
+    update_job_state(j);
+}
+
+// Move queued statuses into the job table. SIGCHLD must be blocked.
+static void drain_queue(void) {
+    do {
+        while (reap_tail != reap_head) {
+            record_status(reap_queue[reap_tail].pid, reap_queue[reap_tail].status);
+            reap_tail = (reap_tail + 1) % REAP_QUEUE_SIZE;
+        }
+        reap_children();
+    } while (reap_tail != reap_head);
+
+    if (wakeup_pipe[0] >= 0) {
+        char buf[64];
+        while (read(wakeup_pipe[0], buf, sizeof(buf)) > 0) {
+            // Discard
+        }
+    }
+}
+
+static void block_sigchld(sigset_t *oldmask) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, oldmask);
+}
+
+void job_reap(void) {
+    sigset_t oldmask;
+    block_sigchld(&oldmask);
+    drain_queue();
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
 }
 
 Job *job_add(pid_t pgid, const char *command, JobStatus status) {
+    // Numbers are reused once the jobs holding them are gone
+    next_job_id = 1;
+    for (Job *k = jobs; k; k = k->next) {
+        if (k->id >= next_job_id) next_job_id = k->id + 1;
+    }
+
     Job *j = malloc(sizeof(Job));
     j->id = next_job_id++;
     j->pgid = pgid;
     j->command = strdup(command);
+    j->procs = NULL;
+    j->nprocs = 0;
     j->status = status;
+    j->exit_status = 0;
+    j->background = 0;
+    j->changed = 0;
+    j->used = ++use_counter;
+    j->has_tmodes = 0;
     j->next = NULL;
 
     if (!jobs) {
@@ -34,9 +302,41 @@ Job *job_add(pid_t pgid, const char *command, JobStatus status) {
         }
         last->next = j;
     }
+
+    job_add_process(j, pgid, command);
     return j;
 }
 
+void job_add_process(Job *j, pid_t pid, const char *command) {
+    j->procs = realloc(j->procs, (j->nprocs + 1) * sizeof(JobProcess));
+    JobProcess *p = &j->procs[j->nprocs++];
+    p->pid = pid;
+    p->status = JOB_RUNNING;
+    p->wait_status = 0;
+    p->command = strdup(command);
+
+    if (j->nprocs > 1) {
+        size_t len = strlen(j->command) + strlen(command) + 4;
+        char *joined = malloc(len);
+        snprintf(joined, len, "%s | %s", j->command, command);
+        free(j->command);
+        j->command = joined;
+    }
+
+    // The child may have been reaped before it was added
+    sigset_t oldmask;
+    block_sigchld(&oldmask);
+    for (size_t i = 0; i < unclaimed_count; i++) {
+        if (unclaimed[i].pid == pid) {
+            int raw = unclaimed[i].status;
+            unclaimed[i] = unclaimed[--unclaimed_count];
+            record_status(pid, raw);
+            break;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+}
+
 void job_remove(int id) {
     Job *curr = jobs;
     Job *prev = NULL;
@@ -47,6 +347,10 @@ void job_remove(int id) {
             } else {
                 jobs = curr->next;
             }
+            for (int i = 0; i < curr->nprocs; i++) {
+                free(curr->procs[i].command);
+            }
+            free(curr->procs);
             free(curr->command);
             free(curr);
             return;
@@ -56,13 +360,9 @@ void job_remove(int id) {
     }
 }
 
-Job *job_find_by_pid(pid_t pgid) {
-    Job *j = jobs;
-    while (j) {
-        if (j->pgid == pgid) return j;
-        j = j->next;
-    }
-    return NULL;
+Job *job_find_by_pid(pid_t pid) {
+    Job *j;
+    return find_process(pid, &j) ? j : NULL;
 }
 
 Job *job_find_by_id(int id) {
@@ -74,21 +374,155 @@ Job *job_find_by_id(int id) {
     return NULL;
 }
 
-void job_print_all(void) {
+static const char *state_name(JobStatus status, int exit_status, char *buf, size_t size) {
+    switch (status) {
+        case JOB_RUNNING: return "Running";
+        case JOB_STOPPED: return "Stopped";
+        case JOB_TERMINATED: return "Terminated";
+        case JOB_DONE:
+            if (exit_status == 0) return "Done";
+            snprintf(buf, size, "Done(%d)", exit_status);
+            return buf;
+    }
+    return "Unknown";
+}
+
+// Whether a ranks before b for %+ and %-
+static int job_precedes(Job *a, Job *b) {
+    int a_stopped = a->status == JOB_STOPPED;
+    int b_stopped = b->status == JOB_STOPPED;
+    if (a_stopped != b_stopped) return a_stopped;
+    return a->used > b->used;
+}
+
+// The current job, or with except set the best job other than it
+static Job *job_current(Job *except) {
+    Job *best = NULL;
+    for (Job *j = jobs; j; j = j->next) {
+        if (j != except && (!best || job_precedes(j, best))) best = j;
+    }
+    return best;
+}
+
+static char job_mark(Job *j) {
+    Job *current = job_current(NULL);
+    if (j == current) return '+';
+    if (current && j == job_current(current)) return '-';
+    return ' ';
+}
+
+static void job_format(Job *j, char *line, size_t size) {
+    char buf[32];
+    snprintf(line, size, "[%d]%c %-22s %s\n", j->id, job_mark(j),
+             state_name(j->status, j->exit_status, buf, sizeof(buf)), j->command);
+}
+
+static void job_save_status(Job *j) {
+    saved_statuses[saved_next].pgid = j->pgid;
+    saved_statuses[saved_next].last = j->procs[j->nprocs - 1].pid;
+    saved_statuses[saved_next].status = j->exit_status;
+    saved_next = (saved_next + 1) % SAVED_STATUS_SIZE;
+}
+
+int job_saved_status(pid_t pid, int *status) {
+    for (size_t i = 0; i < SAVED_STATUS_SIZE; i++) {
+        if (pid > 0 && (saved_statuses[i].pgid == pid || saved_statuses[i].last == pid)) {
+            *status = saved_statuses[i].status;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Forget finished background jobs once the user has seen them
+static void remove_reported(void) {
     Job *j = jobs;
     while (j) {
-        const char *status_str = "Unknown";
-        switch (j->status) {
-            case JOB_RUNNING: status_str = "Running"; break;
-            case JOB_STOPPED: status_str = "Stopped"; break;
-            case JOB_DONE: status_str = "Done"; break;
-            case JOB_TERMINATED: status_str = "Terminated"; break;
-        }
-        printf("[%d] %s %s\n", j->id, status_str, j->command);
-        j = j->next;
+        Job *next = j->next;
+        if (!j->changed && (j->status == JOB_DONE || j->status == JOB_TERMINATED)) {
+            job_save_status(j);
+            job_remove(j->id);
+        }
+        j = next;
     }
 }
 
+static void job_list_one(Job *j, int style) {
+    char line[4096];
+    if (style == JOB_LIST_PGID) {
+        OUT_PRINTF("%d\n", (int)j->pgid);
+    } else if (style == JOB_LIST_NORMAL) {
+        job_format(j, line, sizeof(line));
+        OUT_PUTS(line);
+    } else {
+        // Continuation lines line up under the first process
+        int indent = snprintf(line, sizeof(line), "[%d]%c ", j->id, job_mark(j));
+        for (int i = 0; i < j->nprocs; i++) {
+            JobProcess *p = &j->procs[i];
+            char buf[32];
+            const char *state = state_name(p->status, wait_status_to_exit(p->wait_status),
+                                           buf, sizeof(buf));
+            if (i == 0) {
+                OUT_PRINTF("%s%-6d %-22s %s\n", line, (int)p->pid, state, p->command);
+            } else {
+                OUT_PRINTF("%*s%-6d %-22s | %s\n", indent, "", (int)p->pid, state, p->command);
+            }
+        }
+    }
+    j->changed = 0;
+}
+
+void job_list(Job *j, int style) {
+    job_reap();
+    if (j) {
+        job_list_one(j, style);
+    } else {
+        for (j = jobs; j; j = j->next) job_list_one(j, style);
+    }
+    remove_reported();
+}
+
+int job_notify_pending(void) {
+    job_reap();
+    for (Job *j = jobs; j; j = j->next) {
+        if (j->background && j->changed) return 1;
+    }
+    return 0;
+}
+
+void job_notify(void) {
+    job_reap();
+    for (Job *j = jobs; j; j = j->next) {
+        if (j->background && j->changed) {
+            char line[4096];
+            job_format(j, line, sizeof(line));
+            fputs(line, stderr);
+            j->changed = 0;
+        }
+    }
+    fflush(stderr);
+    remove_reported();
+}
+
+int job_wakeup_fd(void) {
+    if (wakeup_pipe[0] < 0) {
+        int fds[2];
+        if (pipe(fds) < 0) return -1;
+        // Keep the pipe out of the range scripts redirect
+        for (int i = 0; i < 2; i++) {
+            int high = fcntl(fds[i], F_DUPFD_CLOEXEC, 10);
+            if (high >= 0) {
+                close(fds[i]);
+                fds[i] = high;
+            }
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        }
+        wakeup_pipe[0] = fds[0];
+        wakeup_pipe[1] = fds[1];
+    }
+    return wakeup_pipe[0];
+}
+
 void job_update_status(pid_t pgid, JobStatus status) {
     Job *j = job_find_by_pid(pgid);
     if (j) {
@@ -100,75 +534,182 @@ int job_get_next_id(void) {
     return next_job_id;
 }
 
-pid_t job_resolve_spec(const char *spec) {
-    if (!spec || *spec != '%') return -1;
-    
-    spec++; // Skip '%'
-    
-    if (*spec == '\0' || (*spec == '%' && spec[1] == '\0') || (*spec == '+' && spec[1] == '\0')) {
-        // Current job (%% or %+)
-        // For now, just return the last job added or updated
-        // Ideally we should track "current" and "previous" jobs
-        if (jobs) {
-            Job *j = jobs;
-            while (j->next) j = j->next;
-            return j->pgid;
-        }
-        return -1;
-    }
-    
-    if (isdigit(*spec)) {
-        int id = atoi(spec);
-        Job *j = job_find_by_id(id);
-        if (j) return j->pgid;
-    }
-    
-    // TODO: Handle string search (?string)
-    
-    return -1;
+Job *job_find_spec(const char *spec, const char *caller) {
+    job_reap();
+
+    Job *j = NULL;
+    if (!spec || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 ||
+        strcmp(spec, "%+") == 0) {
+        j = job_current(NULL);
+    } else if (strcmp(spec, "%-") == 0) {
+        Job *current = job_current(NULL);
+        if (current) j = job_current(current);
+    } else if (isdigit((unsigned char)spec[spec[0] == '%'])) {
+        char *end;
+        long id = strtol(spec + (spec[0] == '%'), &end, 10);
+        if (*end == '\0') j = job_find_by_id((int)id);
+    } else if (spec[0] == '%') {
+        // %string names the job whose command starts with string,
+        // %?string the one whose command contains it
+        const char *text = spec + 1;
+        int contains = *text == '?';
+        if (contains) text++;
+        for (Job *k = jobs; k; k = k->next) {
+            int match = contains ? strstr(k->command, text) != NULL
+                                 : strncmp(k->command, text, strlen(text)) == 0;
+            if (!match) continue;
+            if (j) {
+                error_msg("%s: %s: ambiguous job spec", caller, spec);
+                return NULL;
+            }
+            j = k;
+        }
+    }
+
+    if (!j) error_msg("%s: %s: no such job", caller, spec ? spec : "current");
+    return j;
+}
+
+// Suspend until SIGCHLD arrives; called with SIGCHLD blocked
+static void wait_for_sigchld(const sigset_t *oldmask) {
+    sigset_t mask = *oldmask;
+    sigdelset(&mask, SIGCHLD);
+    sigsuspend(&mask);
+}
+
+// Wait until j is no longer running. With interruptible set, every
+// signal is blocked between looking for one the shell must act on and
+// sleeping, so one that arrives in between still wakes the wait; the
+// number of such a signal is returned, with j still running.
+static int wait_job(Job *j, int interruptible) {
+    sigset_t oldmask;
+    if (interruptible) {
+        sigset_t all;
+        sigfillset(&all);
+        sigprocmask(SIG_BLOCK, &all, &oldmask);
+    } else {
+        block_sigchld(&oldmask);
+    }
+    int signo = 0;
+    for (;;) {
+        drain_queue();
+        if (j->status != JOB_RUNNING) break;
+        if (interruptible && (signo = signal_pending_action()) != 0) break;
+        wait_for_sigchld(&oldmask);
+    }
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    return signo;
 }
 
 int job_wait(Job *j) {
     if (!j) return -1;
-    
+    wait_job(j, 0);
+    return j->exit_status;
+}
+
+int job_wait_signal(Job *j, int *status) {
+    int signo = wait_job(j, 1);
+    if (!signo) *status = j->exit_status;
+    return signo;
+}
+
+int job_wait_pid(pid_t pid) {
     int status = 0;
-    pid_t pid;
-    
-    // Wait for the process group
-    while ((pid = waitpid(-j->pgid, &status, 0)) < 0) {
-        if (errno == EINTR) continue;
-        
-        // Try waiting for the process itself if pgid fails
-        while ((pid = waitpid(j->pgid, &status, 0)) < 0) {
-            if (errno == EINTR) continue;
-            perror("waitpid");
-            return -1;
-        }
-        break;
-    }
-    
-    if (WIFEXITED(status)) {
-        j->status = JOB_DONE;
-        return WEXITSTATUS(status);
-    } else if (WIFSIGNALED(status)) {
-        j->status = JOB_TERMINATED;
-        return 128 + WTERMSIG(status);
-    } else if (WIFSTOPPED(status)) {
-        j->status = JOB_STOPPED;
-        return 128 + WSTOPSIG(status);
-    }
-    
-    return 0;
+    sigset_t oldmask;
+    block_sigchld(&oldmask);
+    for (;;) {
+        drain_queue();
+        size_t i;
+        for (i = 0; i < unclaimed_count; i++) {
+            if (unclaimed[i].pid == pid) break;
+        }
+        if (i < unclaimed_count) {
+            status = unclaimed[i].status;
+            unclaimed[i] = unclaimed[--unclaimed_count];
+            break;
+        }
+        wait_for_sigchld(&oldmask);
+    }
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    return status;
+}
+
+void job_release(Job *j) {
+    if (j->status != JOB_DONE && j->status != JOB_TERMINATED) return;
+    if (j->background) job_save_status(j);
+    job_remove(j->id);
+}
+
+// Mark stopped processes running again and send SIGCONT to the group
+static void job_continue(Job *j) {
+    for (int i = 0; i < j->nprocs; i++) {
+        if (j->procs[i].status == JOB_STOPPED) j->procs[i].status = JOB_RUNNING;
+    }
+    j->status = JOB_RUNNING;
+    j->used = ++use_counter;
+    kill(-j->pgid, SIGCONT);
+}
+
+int job_foreground(Job *j, int cont) {
+    int terminal = tty_fd >= 0 && job_control_active();
+    if (terminal) {
+        tcsetpgrp(tty_fd, j->pgid);
+        if (cont && j->has_tmodes) tcsetattr(tty_fd, TCSADRAIN, &j->tmodes);
+    }
+    j->background = 0;
+    if (cont) job_continue(j);
+
+    int status = job_wait(j);
+
+    if (terminal) {
+        tcsetpgrp(tty_fd, shell_pgid);
+        if (j->status == JOB_STOPPED) {
+            j->has_tmodes = tcgetattr(tty_fd, &j->tmodes) == 0;
+        }
+        tcsetattr(tty_fd, TCSADRAIN, &shell_tmodes);
+    }
+
+    if (j->status == JOB_STOPPED) {
+        // Suspended: report it now, below the ^Z, and keep it around
+        // like a background job
+        char line[4096];
+        job_format(j, line, sizeof(line));
+        fprintf(stderr, "\n%s", line);
+        fflush(stderr);
+        j->changed = 0;
+        j->background = 1;
+    } else {
+        // Any process killed by SIGINT counts as the job's
+        int statuses[j->nprocs];
+        int interrupt = j->procs[j->nprocs - 1].wait_status;
+        for (int i = 0; i < j->nprocs; i++) {
+            int ws = j->procs[i].wait_status;
+            statuses[i] = wait_status_to_exit(ws);
+            if (WIFSIGNALED(ws) && WTERMSIG(ws) == SIGINT) interrupt = ws;
+        }
+        posish_var_set_pipestatus(statuses, j->nprocs);
+        signal_foreground_status(interrupt);
+        job_release(j);
+    }
+    return status;
+}
+
+void job_background(Job *j) {
+    j->background = 1;
+    job_continue(j);
 }
 
-int job_wait_all(void) {
+int job_wait_all(int *status) {
     Job *j = jobs;
-    int last_status = 0;
+    *status = 0;
     while (j) {
+        Job *next = j->next;
         if (j->status == JOB_RUNNING) {
-            last_status = job_wait(j);
+            int signo = job_wait_signal(j, status);
+            if (signo) return signo;
         }
-        j = j->next;
+        job_release(j);
+        j = next;
     }
-    return last_status;
+    return 0;
 }
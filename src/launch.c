@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "buf_output.h"
+#include "coverage.h"
+#include "error.h"
+#include "executor.h"
+#include "jobs.h"
+#include "launch.h"
+#include "memalloc.h"
+#include "redirection.h"
+#include "signals.h"
+#include "variables.h"
+
+// Commands found in PATH, by name
+typedef struct HashedCommand {
+    char *name;
+    char *path;
+    struct HashedCommand *next;
+} HashedCommand;
+
+#define HASH_BUCKETS 64
+static HashedCommand *hashed[HASH_BUCKETS];
+
+// The link that points at name's entry, or at the NULL ending its bucket
+static HashedCommand **hash_slot(const char *name) {
+    unsigned long h = 5381;
+    for (const char *p = name; *p; p++) h = h * 33 + (unsigned char)*p;
+    HashedCommand **slot = &hashed[h % HASH_BUCKETS];
+    while (*slot && strcmp((*slot)->name, name) != 0) slot = &(*slot)->next;
+    return slot;
+}
+
+static void hash_remove(HashedCommand **slot) {
+    HashedCommand *entry = *slot;
+    *slot = entry->next;
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
+
+void launch_hash_forget(const char *name) {
+    if (name) {
+        HashedCommand **slot = hash_slot(name);
+        if (*slot) hash_remove(slot);
+        return;
+    }
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        while (hashed[i]) hash_remove(&hashed[i]);
+    }
+}
+
+void launch_hash_print(void) {
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        for (HashedCommand *entry = hashed[i]; entry; entry = entry->next) {
+            OUT_PUTS(entry->path);
+            OUT_PUTC('\n');
+        }
+    }
+}
+
+static int is_program(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// The first program called name in the directories of path, an empty one
+// being the current directory
+static char *search(const char *name, const char *path) {
+    size_t name_len = strlen(name);
+    for (const char *dir = path;; dir++) {
+        const char *end = strchr(dir, ':');
+        if (!end) end = dir + strlen(dir);
+        size_t dir_len = end - dir;
+        char *full = mem_stack_alloc(dir_len + name_len + 3);
+        if (dir_len) {
+            memcpy(full, dir, dir_len);
+        } else {
+            full[0] = '.';
+            dir_len = 1;
+        }
+        full[dir_len] = '/';
+        memcpy(full + dir_len + 1, name, name_len + 1);
+        if (is_program(full)) return full;
+        if (!*end) return NULL;
+        dir = end;
+    }
+}
+
+char *launch_find(const char *name, const char *search_path) {
+    if (strchr(name, '/')) return mem_stack_strdup(name);
+    if (search_path) return search(name, search_path);
+
+    HashedCommand **slot = hash_slot(name);
+    if (*slot) {
+        if (access((*slot)->path, X_OK) == 0) return mem_stack_strdup((*slot)->path);
+        // Gone since: look again
+        hash_remove(slot);
+    }
+
+    char *path = search(name, pathval());
+    // What a relative directory holds changes with cd
+    if (path && path[0] == '/') {
+        HashedCommand *entry = xmalloc(sizeof(HashedCommand));
+        entry->name = xstrdup(name);
+        entry->path = xstrdup(path);
+        entry->next = NULL;
+        *slot = entry;
+    }
+    return path;
+}
+
+// The exported variables with the assignments over them
+static char **build_environ(char **assigns) {
+    char **env = posish_var_get_environ();
+    if (!assigns || !assigns[0]) return env;
+
+    size_t count = 0;
+    while (env[count]) count++;
+    size_t extra = 0;
+    while (assigns[extra]) extra++;
+    env = xrealloc(env, (count + extra + 1) * sizeof(char *));
+    for (char **a = assigns; *a; a++) {
+        size_t name_len = strcspn(*a, "=") + 1;
+        size_t i = 0;
+        while (i < count && strncmp(env[i], *a, name_len) != 0) i++;
+        if (i < count) {
+            free(env[i]);
+        } else {
+            count++;
+        }
+        env[i] = xstrdup(*a);
+    }
+    env[count] = NULL;
+    return env;
+}
+
+static void free_environ(char **env) {
+    for (size_t i = 0; env[i]; i++) free(env[i]);
+    free(env);
+}
+
+// Replace the process with the program at path. A file the kernel does
+// not run (ENOEXEC: no #! line) is a script for /bin/sh, as with
+// execvp(). Returns the status to exit with after reporting a failure.
+// Only makes system calls, so it is safe after vfork().
+static int exec_program(const char *path, char **argv, char **env) {
+    execve(path, argv, env);
+    int err = errno;
+    if (err == ENOEXEC) {
+        size_t argc = 0;
+        while (argv[argc]) argc++;
+        char *script_argv[argc + 2];
+        script_argv[0] = "sh";
+        script_argv[1] = (char *)path;
+        memcpy(script_argv + 2, argv + 1, argc * sizeof(char *));
+        execve("/bin/sh", script_argv, env);
+    }
+
+    if (err == ENOENT) {
+        dprintf(STDERR_FILENO, "%s: %s: not found\n", "posish", path);
+        return 127;
+    } else if (err == EACCES) {
+        dprintf(STDERR_FILENO, "%s: %s: Permission denied\n", "posish", path);
+        return 126;
+    }
+    dprintf(STDERR_FILENO, "%s: %s: %s\n", "posish", path, strerror(err));
+    return 126;
+}
+
+int launch_program(const char *path, char **argv, char **assigns,
+                   Redirection *redirs, size_t redir_count, const char *command) {
+    // Block SIGCHLD to prevent race condition where signal handler reaps process
+    // before job_wait() can.
+    sigset_t mask, oldmask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+
+    // Everything the child needs is made here: after vfork() it may only
+    // make system calls
+    char **env = build_environ(assigns);
+    int monitor = job_control_active();
+
+    // A process that exists only for this command becomes it, unless an
+    // EXIT trap has yet to run
+    pid_t pid = executor_no_fork && !signal_exit_trap_set() ? 0 : POSISH_FORK();
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &oldmask, NULL);
+        if (monitor) {
+            job_child_init(0, 1);
+        } else {
+            signal_child_defaults();
+        }
+        if (handle_redirections(redirs, redir_count) != 0) {
+            _exit(1);
+        }
+        // Under executor_no_fork this process ran shell code of its own
+        coverage_flush();
+        _exit(exec_program(path, argv, env));
+    }
+
+    free_environ(env);
+    if (pid < 0) {
+        sigprocmask(SIG_SETMASK, &oldmask, NULL);
+        error_sys("fork");
+        return 1;
+    }
+
+    // Only set process group if job control is enabled
+    // Otherwise external commands should share the shell's PGID
+    if (monitor) {
+        setpgid(pid, pid);
+    }
+
+    Job *j = job_add(pid, command, JOB_RUNNING);
+    int status = job_foreground(j, 0);
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
+    SIGNAL_POLL(); // Check for pending signals after wait
+    return status;
+}
+
+int launch_exec(char **argv, char **assigns) {
+    char *path = launch_find(argv[0], NULL);
+    if (!path) {
+        error_msg("exec: %s: not found", argv[0]);
+        return 127;
+    }
+    char **env = build_environ(assigns);
+    buf_out_flush_all();
+    coverage_flush();
+
+    // The program starts with the signals a child would; if it cannot
+    // be run, the shell carries on with its own
+    struct sigaction saved[NSIG];
+    int have_saved[NSIG];
+    for (int i = 1; i < NSIG; i++) have_saved[i] = sigaction(i, NULL, &saved[i]) == 0;
+    signal_child_defaults();
+    int status = exec_program(path, argv, env);
+    for (int i = 1; i < NSIG; i++) {
+        if (have_saved[i]) sigaction(i, &saved[i], NULL);
+    }
+
+    free_environ(env);
+    return status;
+}
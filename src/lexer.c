@@ -15,7 +15,8 @@
 static const char *NEWLINE_TOKEN = "\n";
 
 static const char *OPERATORS[] = {
-    "&&", "||", ";;", "<<", ">>", "<&", ">&", "<>", ">|", // 2-char ops first
+    "<<-", // 3-char ops first
+    "&&", "||", ";;", "<<", ">>", "<&", ">&", "<>", ">|", // then 2-char ops
     "|", "&", ";", "<", ">", "(", ")", "\n", NULL
 };
 
@@ -25,6 +26,30 @@ void lexer_init(Lexer *lexer, const char *input) {
     lexer->len = strlen(input);
     lexer->current_line = 1;
     lexer->last_token_type = TOKEN_NEWLINE; // Start as if after newline
+    lexer->no_alias = 0;
+    lexer->quiet = 0;
+    lexer->file = 0;
+    lexer->base_offset = 0;
+    lexer->line_start = 0;
+    lexer->splice_end = 0;
+    lexer->splice_origin = 0;
+    lexer->delta = 0;
+}
+
+// Offset in the original text of input position pos
+static size_t lexer_origin(const Lexer *lexer, size_t pos) {
+    if (pos < lexer->splice_end) return lexer->splice_origin;
+    return (size_t)((long)pos + lexer->delta);
+}
+
+SourcePos lexer_position(const Lexer *lexer) {
+    size_t origin = lexer_origin(lexer, lexer->pos);
+    SourcePos pos;
+    pos.file = lexer->file;
+    pos.line = lexer->current_line;
+    pos.column = origin >= lexer->line_start ? (int)(origin - lexer->line_start) + 1 : 1;
+    pos.offset = lexer->base_offset + origin;
+    return pos;
 }
 
 void free_token(Token token) {
@@ -63,17 +88,22 @@ static int match_operator(const char *str) {
     return 0;
 }
 
+static void lexer_newline(Lexer *lexer) {
+    lexer->current_line++;
+    lexer->line_start = lexer_origin(lexer, lexer->pos) + 1;
+}
+
 static void lexer_advance(Lexer *lexer) {
     if (lexer->pos < lexer->len) {
         if (lexer->input[lexer->pos] == '\n') {
-            lexer->current_line++;
+            lexer_newline(lexer);
         }
         lexer->pos++;
     }
 }
 
 Token lexer_next_token(Lexer *lexer) {
-    Token token = {TOKEN_EOF, NULL, lexer->current_line};
+    Token token = {TOKEN_EOF, NULL, {0, 0, 0, 0}};
     
     // Alias expansion check
     // Only expand if previous token was a separator that allows command start
@@ -85,6 +115,7 @@ Token lexer_next_token(Lexer *lexer) {
     while (lexer->pos < lexer->len && isspace(lexer->input[lexer->pos]) && lexer->input[lexer->pos] != '\n') {
         lexer_advance(lexer);
     }
+    token.pos = lexer_position(lexer);
 
     if (lexer->pos >= lexer->len) {
         return token;
@@ -340,7 +371,7 @@ Token lexer_next_token(Lexer *lexer) {
     token.value = buffer;
     
     
-    const char *keywords[] = {"if", "then", "else", "elif", "fi", "while", "until", "for", "in", "do", "done", "case", "esac", "{", "}", NULL};
+    const char *keywords[] = {"if", "then", "else", "elif", "fi", "while", "until", "for", "in", "do", "done", "case", "esac", "{", "}", "!", "time", NULL};
     for (int i = 0; keywords[i]; i++) {
         if (strcmp(buffer, keywords[i]) == 0) {
             token.type = TOKEN_KEYWORD;
@@ -365,7 +396,7 @@ Token lexer_next_token(Lexer *lexer) {
     }
 
     // Check for alias expansion if it's a simple word
-    if (allow_alias && token.type == TOKEN_WORD) {
+    if (allow_alias && !lexer->no_alias && token.type == TOKEN_WORD) {
         char *alias_val = alias_get(token.value);
         if (alias_val) {
             // Found alias!
@@ -387,7 +418,13 @@ Token lexer_next_token(Lexer *lexer) {
             new_input[offset++] = ' ';
             memcpy(new_input + offset, remaining, rem_len + 1); // +1 for null terminator
             
-            // Update lexer to point to new input
+            // Update lexer to point to new input. The alias text is
+            // reported at the aliased word, the rest where it was.
+            size_t splice = alias_len + 1;
+            size_t inside = lexer->pos < lexer->splice_end ? lexer->splice_end - lexer->pos : 0;
+            lexer->splice_origin = token.pos.offset - lexer->base_offset;
+            lexer->delta += (long)lexer->pos - (long)splice;
+            lexer->splice_end = splice + inside;
             lexer->input = new_input;
             lexer->len = strlen(new_input);
             lexer->pos = 0;
@@ -429,6 +466,7 @@ char *lexer_read_until_delimiter(Lexer *lexer, const char *delimiter, int strip_
         // Advance lexer past newline
         lexer->pos = end;
         if (lexer->pos < lexer->len && lexer->input[lexer->pos] == '\n') {
+            lexer_newline(lexer);
             lexer->pos++;
         }
         
@@ -465,83 +503,259 @@ char *lexer_read_until_delimiter(Lexer *lexer, const char *delimiter, int strip_
     return content;
 }
 // Check if input is incomplete (unclosed quotes, trailing backslash, open control structures)
-int lexer_check_incomplete(const char *input) {
-    // First check for unclosed quotes/backslashes using simple scan
-    int in_single = 0;
-    int in_double = 0;
-    int escaped = 0;
-    size_t len = strlen(input);
+char *lexer_heredoc_delimiter(const char *word) {
+    // Quote removal on the delimiter word: <<'EOF', <<"EOF" and <<\EOF
+    // all end at a line reading EOF.
+    char *delim = xmalloc(strlen(word) + 1);
+    size_t j = 0;
+    for (const char *p = word; *p; p++) {
+        if (*p == '\'' || *p == '"') continue;
+        if (*p == '\\' && p[1]) p++;
+        delim[j++] = *p;
+    }
+    delim[j] = '\0';
+    return delim;
+}
+
+void lexer_scan_init(LexerScan *scan) {
+    memset(scan, 0, sizeof(*scan));
+}
+
+void lexer_scan_free(LexerScan *scan) {
+    for (size_t i = 0; i < scan->heredoc_count; i++) {
+        free(scan->heredocs[i].delimiter);
+    }
+    free(scan->heredocs);
+    lexer_scan_init(scan);
+}
+
+static void scan_push_heredoc(LexerScan *scan, const char *word, int strip_tabs) {
+    if (scan->heredoc_count == scan->heredoc_cap) {
+        scan->heredoc_cap = scan->heredoc_cap ? scan->heredoc_cap * 2 : 4;
+        scan->heredocs = xrealloc(scan->heredocs, scan->heredoc_cap * sizeof(*scan->heredocs));
+    }
+    scan->heredocs[scan->heredoc_count].delimiter = lexer_heredoc_delimiter(word);
+    scan->heredocs[scan->heredoc_count].strip_tabs = strip_tabs;
+    scan->heredoc_count++;
+}
+
+static void scan_pop_heredoc(LexerScan *scan) {
+    free(scan->heredocs[0].delimiter);
+    memmove(scan->heredocs, scan->heredocs + 1, (scan->heredoc_count - 1) * sizeof(*scan->heredocs));
+    scan->heredoc_count--;
+}
 
-    for (size_t i = 0; i < len; i++) {
+// Find the end of the logical line starting at pos: the first newline
+// outside quotes and $(...) / ${...}, comments excepted. Returns the
+// offset just past it, or 0 with *open_quote set if the text ends inside
+// a quote, escape or substitution.
+static size_t scan_logical_line(const char *input, size_t pos, size_t len, int *open_quote) {
+    enum { CTX_TOP, CTX_SINGLE, CTX_DOUBLE, CTX_BACKQUOTE, CTX_PAREN, CTX_BRACE };
+    char stack[64];
+    int depth = 0;
+    stack[0] = CTX_TOP;
+    *open_quote = 0;
+
+    for (size_t i = pos; i < len; i++) {
         char c = input[i];
-        if (escaped) {
-            if (c == '\n' && i == len - 1) return 3; // Trailing backslash
-            escaped = 0;
+        int ctx = stack[depth];
+
+        if (ctx == CTX_SINGLE) {
+            if (c == '\'') depth--;
             continue;
         }
         if (c == '\\') {
-            if (!in_single) escaped = 1;
-        } else if (c == '\'') {
-            if (!in_double) in_single = !in_single;
-        } else if (c == '"') {
-            if (!in_single) in_double = !in_double;
+            if (i + 1 >= len) {
+                *open_quote = 3;
+                return 0;
+            }
+            i++; // Escaped character, including line continuations
+            continue;
+        }
+        if (c == '$' && i + 1 < len && (input[i + 1] == '(' || input[i + 1] == '{') &&
+            ctx != CTX_BACKQUOTE && depth < (int)sizeof(stack) - 1) {
+            stack[++depth] = (input[i + 1] == '(') ? CTX_PAREN : CTX_BRACE;
+            i++;
+            continue;
+        }
+        if (ctx == CTX_DOUBLE) {
+            if (c == '"') depth--;
+            continue;
+        }
+        if (ctx == CTX_BACKQUOTE) {
+            if (c == '`') depth--;
+            continue;
+        }
+        if (ctx == CTX_PAREN && c == ')') {
+            depth--;
+            continue;
+        }
+        if (ctx == CTX_BRACE && c == '}') {
+            depth--;
+            continue;
         }
+        if (depth >= (int)sizeof(stack) - 1) continue;
+
+        if (c == '\'') stack[++depth] = CTX_SINGLE;
+        else if (c == '"') stack[++depth] = CTX_DOUBLE;
+        else if (c == '`') stack[++depth] = CTX_BACKQUOTE;
+        else if (c == '(' && ctx == CTX_PAREN) stack[++depth] = CTX_PAREN;
+        else if (c == '#' && ctx != CTX_BRACE &&
+                 (i == pos || isspace((unsigned char)input[i - 1]) ||
+                  strchr(";&|()<>", input[i - 1]))) {
+            while (i < len && input[i] != '\n') i++;
+            if (depth == 0) return (i < len) ? i + 1 : len;
+        } else if (c == '\n' && depth == 0) {
+            return i + 1;
+        }
+    }
+
+    if (depth == 0) return len;
+    switch (stack[depth]) {
+        case CTX_SINGLE: *open_quote = 1; break;
+        case CTX_DOUBLE: case CTX_BACKQUOTE: *open_quote = 2; break;
+        default: *open_quote = 9; break;
     }
+    return 0;
+}
 
-    if (in_single) return 1;
-    if (in_double) return 2;
-    if (escaped) return 3;
+// Tokenize [pos, end) and update keyword nesting and pending heredocs
+static void scan_tokens(LexerScan *scan, const char *input, size_t pos, size_t end) {
+    Lexer lexer = {0};
+    lexer.input = input;
+    lexer.pos = pos;
+    lexer.len = end;
+    lexer.current_line = 1;
+    lexer.last_token_type = TOKEN_NEWLINE;
+    lexer.no_alias = 1;
 
-    // Now check for open control structures using the lexer
-    // We need to tokenize the input to properly handle keywords vs words
-    Lexer lexer;
-    lexer_init(&lexer, input);
-    
-    int if_count = 0;
-    int while_count = 0; // Tracks while/until
-    int for_count = 0;
-    int case_count = 0;
-    int brace_count = 0;
-    int paren_count = 0;
-    
+    int heredoc_op = 0; // 1 after <<, 2 after <<-
+    int command_start = 1; // Where a reserved word is one (not in echo done)
+    int fname_paren = 0;   // After the ( of f(), which the ) closes
     Token token;
     while ((token = lexer_next_token(&lexer)).type != TOKEN_EOF) {
         if (token.type == TOKEN_ERROR) {
-            // If we hit an error, it might be incomplete, but let the parser handle it
-            // unless it's specifically an incomplete error? 
-            // For now, assume complete so parser can error out.
-            return 0; 
+            free_token(token);
+            break;
         }
-        
-        if (token.type == TOKEN_KEYWORD) {
-            if (strcmp(token.value, "if") == 0) if_count++;
-            else if (strcmp(token.value, "fi") == 0) if_count--;
-            else if (strcmp(token.value, "while") == 0 || strcmp(token.value, "until") == 0) while_count++;
+
+        if (heredoc_op) {
+            if (token.type == TOKEN_WORD || token.type == TOKEN_KEYWORD) {
+                scan_push_heredoc(scan, token.value, heredoc_op == 2);
+            }
+            heredoc_op = 0;
+        } else if (token.type == TOKEN_KEYWORD && command_start) {
+            if (strcmp(token.value, "if") == 0) scan->if_count++;
+            else if (strcmp(token.value, "fi") == 0) scan->if_count--;
+            else if (strcmp(token.value, "while") == 0 || strcmp(token.value, "until") == 0) scan->while_count++;
             else if (strcmp(token.value, "done") == 0) {
                 // done closes for, while, until
-                if (for_count > 0) for_count--;
-                else if (while_count > 0) while_count--;
+                if (scan->for_count > 0) scan->for_count--;
+                else if (scan->while_count > 0) scan->while_count--;
             }
-            else if (strcmp(token.value, "for") == 0) for_count++;
-            else if (strcmp(token.value, "case") == 0) case_count++;
-            else if (strcmp(token.value, "esac") == 0) case_count--;
-            else if (strcmp(token.value, "{") == 0) brace_count++;
-            else if (strcmp(token.value, "}") == 0) brace_count--;
+            else if (strcmp(token.value, "for") == 0) scan->for_count++;
+            else if (strcmp(token.value, "case") == 0) scan->case_count++;
+            else if (strcmp(token.value, "esac") == 0) scan->case_count--;
+            else if (strcmp(token.value, "{") == 0) scan->brace_count++;
+            else if (strcmp(token.value, "}") == 0) scan->brace_count--;
         } else if (token.type == TOKEN_OPERATOR) {
-            if (strcmp(token.value, "(") == 0) paren_count++;
-            else if (strcmp(token.value, ")") == 0) paren_count--;
+            // Only a ( where a command starts opens a subshell; elsewhere
+            // it is f() or an error for the parser to report
+            if (strcmp(token.value, "(") == 0) {
+                if (command_start) scan->paren_count++;
+                else fname_paren = 2;
+            } else if (strcmp(token.value, ")") == 0) {
+                if (!fname_paren) scan->paren_count--;
+            } else if (strcmp(token.value, "<<") == 0) heredoc_op = 1;
+            else if (strcmp(token.value, "<<-") == 0) heredoc_op = 2;
         }
-        
+
+        if (token.type == TOKEN_KEYWORD && command_start) {
+            // The words after these are not commands
+            command_start = strcmp(token.value, "for") != 0 && strcmp(token.value, "case") != 0 &&
+                            strcmp(token.value, "in") != 0;
+        } else if (token.type == TOKEN_OPERATOR) {
+            command_start = !strchr("<>", token.value[0]);
+        } else {
+            command_start = token.type == TOKEN_NEWLINE;
+        }
+
+        if (fname_paren) fname_paren--;
+
+        if (token.type != TOKEN_NEWLINE) {
+            scan->pipe_open = token.type == TOKEN_OPERATOR &&
+                (strcmp(token.value, "|") == 0 || strcmp(token.value, "&&") == 0 ||
+                 strcmp(token.value, "||") == 0);
+        }
+
         // Free token value safely
         free_token(token);
     }
-    
-    if (if_count > 0) return 4;
-    if (while_count > 0) return 5;
-    if (for_count > 0) return 6;
-    if (case_count > 0) return 7;
-    if (brace_count > 0) return 8;
-    if (paren_count > 0) return 9;
-    
+}
+
+int lexer_scan_incomplete(LexerScan *scan, const char *input, size_t len) {
+    while (scan->pos < len) {
+        if (scan->heredoc_count > 0) {
+            // The next line belongs to a here-document body
+            // Only the last line of the input can lack a newline
+            const char *nl = memchr(input + scan->pos, '\n', len - scan->pos);
+            const char *line = input + scan->pos;
+            size_t line_len = nl ? (size_t)(nl - line) : len - scan->pos;
+            if (scan->heredocs[0].strip_tabs) {
+                while (line_len > 0 && *line == '\t') {
+                    line++;
+                    line_len--;
+                }
+            }
+            const char *delim = scan->heredocs[0].delimiter;
+            if (strlen(delim) == line_len && memcmp(line, delim, line_len) == 0) {
+                scan_pop_heredoc(scan);
+            } else if (!nl) {
+                return 10;
+            }
+            scan->pos = nl ? (size_t)(nl - input) + 1 : len;
+            continue;
+        }
+
+        int open_quote;
+        size_t end = scan_logical_line(input, scan->pos, len, &open_quote);
+        if (open_quote) return open_quote;
+
+        scan_tokens(scan, input, scan->pos, end);
+        scan->pos = end;
+    }
+
+    if (scan->heredoc_count > 0) return 10;
+    if (scan->if_count > 0) return 4;
+    if (scan->while_count > 0) return 5;
+    if (scan->for_count > 0) return 6;
+    if (scan->case_count > 0) return 7;
+    if (scan->brace_count > 0) return 8;
+    if (scan->paren_count > 0) return 9;
+    if (scan->pipe_open) return 11;
+
     return 0;
 }
+
+const char *lexer_incomplete_missing(int incomplete) {
+    switch (incomplete) {
+        case 1: return "'";
+        case 2: return "\"";
+        case 4: return "fi";
+        case 5: case 6: return "done";
+        case 7: return "esac";
+        case 8: return "}";
+        case 9: return ")";
+        case 10: return "here-document delimiter";
+        case 11: return "command";
+        default: return NULL;
+    }
+}
+
+int lexer_check_incomplete(const char *input) {
+    LexerScan scan;
+    lexer_scan_init(&scan);
+    int result = lexer_scan_incomplete(&scan, input, strlen(input));
+    lexer_scan_free(&scan);
+    return result;
+}
@@ -7,90 +7,49 @@
 #include <unistd.h>
 #include <termios.h>
 #include <ctype.h>
+#include <poll.h>
+#include <errno.h>
 #include "memalloc.h"
 #include "line_editor.h"
 #include "input.h"
 #include "output.h"
+#include "shell_options.h"
+#include "jobs.h"
 
 #define BUFFER_SIZE 1024
-#define HISTORY_SIZE 100
 
-static struct termios orig_termios;
-static int raw_mode_enabled = 0;
+// Time to wait for the rest of an escape sequence before treating
+// a lone ESC as a key of its own (vi command mode, cancel).
+#define ESC_TIMEOUT_MS 50
 
-static char *history[HISTORY_SIZE];
-static int history_count = 0;
-static char *history_file = NULL;
+#define CTRL_KEY(c) ((c) & 0x1f)
 
-void history_init(const char *filename) {
-    if (history_file) free(history_file);
-    history_file = xstrdup(filename);
-    
-    FILE *f = fopen(history_file, "r");
-    if (!f) return;
-    
-    char *line = NULL;
-    size_t len = 0;
-    while (getline(&line, &len, f) != -1) {
-        // Remove newline
-        size_t l = strlen(line);
-        if (l > 0 && line[l-1] == '\n') line[l-1] = '\0';
-        
-        if (history_count < HISTORY_SIZE) {
-            history[history_count++] = xstrdup(line);
-        } else {
-            free(history[0]);
-            memmove(history, history + 1, (HISTORY_SIZE - 1) * sizeof(char*));
-            history[HISTORY_SIZE - 1] = xstrdup(line);
-        }
-    }
-    free(line);
-    fclose(f);
-}
+// Key codes. Plain bytes are 0-255; decoded escape sequences and
+// meta (ESC-prefixed) keys live above that so one table covers all.
+enum {
+    KEY_ESC = 27,
+    KEY_DEL = 127,
+    KEY_UP = 256,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_META_BASE = 512,
+    KEY_MAX = 768
+};
+#define KEY_META(c) (KEY_META_BASE | (c))
 
-void history_add(const char *line) {
-    if (!line || !*line) return;
-    
-    // Create a copy to strip newline
-    char *line_copy = xstrdup(line);
-    size_t len = strlen(line_copy);
-    if (len > 0 && line_copy[len - 1] == '\n') {
-        line_copy[len - 1] = '\0';
-        len--;
-    }
-    
-    if (len == 0) {
-        free(line_copy);
-        return;
-    }
-    
-    // Don't add duplicates of the last command
-    if (history_count > 0 && strcmp(history[history_count - 1], line_copy) == 0) {
-        free(line_copy);
-        return;
-    }
-    
-    if (history_count < HISTORY_SIZE) {
-        history[history_count++] = line_copy;
-    } else {
-        free(history[0]);
-        memmove(history, history + 1, (HISTORY_SIZE - 1) * sizeof(char*));
-        history[HISTORY_SIZE - 1] = line_copy;
-    }
-    
-    if (history_file) {
-        FILE *f = fopen(history_file, "a");
-        if (f) {
-            fprintf(f, "%s\n", line_copy);
-            fclose(f);
-        }
-    }
-}
+// Editor function results
+enum {
+    ED_CONTINUE = 0,
+    ED_ACCEPT,
+    ED_EOF
+};
 
-const char *history_get(int index) {
-    if (index < 0 || index >= history_count) return NULL;
-    return history[index];
-}
+static struct termios orig_termios;
+static int raw_mode_enabled = 0;
 
 // Enable raw mode
 static void enable_raw_mode(void) {
@@ -136,60 +95,1290 @@ static int read_char(void) {
     return -1;
 }
 
-// Read escape sequence
+// Read a character if one arrives within timeout_ms, else -1
+static int read_char_timeout(int timeout_ms) {
+    struct pollfd pfd = { .fd = input_get_fd(), .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+    return read_char();
+}
+
+// Decode the rest of an escape sequence after ESC.
+// Returns KEY_ESC for a lone ESC, KEY_META(c) for ESC-prefixed
+// characters, a KEY_* code for known sequences, or -1 if unknown.
 static int read_escape_seq(void) {
-    char seq[3];
-    
-    if (input_read_char(&seq[0]) == -1) return -1;
-    if (input_read_char(&seq[1]) == -1) return -1;
-    
-    if (seq[0] == '[') {
-        if (seq[1] >= '0' && seq[1] <= '9') {
-            if (input_read_char(&seq[2]) == -1) return -1;
-            if (seq[2] == '~') {
-                switch (seq[1]) {
-                    case '1': return 1000; // Home
-                    case '3': return 1001; // Delete
-                    case '4': return 1002; // End
-                    case '7': return 1000; // Home (alternate)
-                    case '8': return 1002; // End (alternate)
+    int c0 = read_char_timeout(ESC_TIMEOUT_MS);
+    if (c0 == -1) return KEY_ESC;
+
+    if (c0 != '[' && c0 != 'O') return KEY_META(c0);
+
+    int c1 = read_char();
+    if (c1 == -1) return -1;
+
+    if (c0 == '[') {
+        if (c1 >= '0' && c1 <= '9') {
+            int c2 = read_char();
+            if (c2 == '~') {
+                switch (c1) {
+                    case '1': return KEY_HOME;
+                    case '3': return KEY_DELETE;
+                    case '4': return KEY_END;
+                    case '7': return KEY_HOME;
+                    case '8': return KEY_END;
                 }
             }
+            // Swallow the remainder of longer sequences (e.g. ESC[1;5C)
+            while (c2 != -1 && !(c2 >= '@' && c2 <= '~')) {
+                c2 = read_char();
+            }
         } else {
-            switch (seq[1]) {
-                case 'A': return 1003; // Up
-                case 'B': return 1004; // Down
-                case 'C': return 1005; // Right
-                case 'D': return 1006; // Left
-                case 'H': return 1000; // Home
-                case 'F': return 1002; // End
+            switch (c1) {
+                case 'A': return KEY_UP;
+                case 'B': return KEY_DOWN;
+                case 'C': return KEY_RIGHT;
+                case 'D': return KEY_LEFT;
+                case 'H': return KEY_HOME;
+                case 'F': return KEY_END;
             }
         }
-    } else if (seq[0] == 'O') {
-        switch (seq[1]) {
-            case 'H': return 1000; // Home
-            case 'F': return 1002; // End
+    } else {
+        switch (c1) {
+            case 'A': return KEY_UP;
+            case 'B': return KEY_DOWN;
+            case 'C': return KEY_RIGHT;
+            case 'D': return KEY_LEFT;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
         }
     }
-    
+
     return -1;
 }
 
-// Refresh the line display
-static void refresh_line(const char *prompt, const char *buf, size_t len, size_t pos) {
+static int read_key(void) {
+    for (;;) {
+        int c = read_char();
+        if (c != KEY_ESC) return c;
+        int key = read_escape_seq();
+        // Unknown sequences are dropped rather than inserted as text
+        if (key != -1) return key;
+    }
+}
+
+// The line is held in a gap buffer: text before the cursor sits at
+// buf[0, gap_start) and text after it at buf[gap_end, cap). Inserting or
+// deleting at the cursor is O(1) amortized; moving the cursor costs only
+// the distance moved. This keeps typing into multi-kilobyte lines cheap.
+
+struct editor;
+typedef int (*editor_fn)(struct editor *ed, int key);
+
+struct keymap {
+    editor_fn keys[KEY_MAX];
+    editor_fn fallback;  // Used for keys without a binding
+};
+
+// A recorded vi change, replayed by '.'
+struct vi_change {
+    int count;
+    int op;          // Pending operator (d, c) or 0
+    int key;         // Command or motion key
+    int arg;         // Character argument (f, t, r, ...) or 0
+    char *text;      // Text typed in insert mode, if any
+    size_t text_len;
+};
+
+struct editor {
+    const char *prompt;
+    size_t prompt_len;
+
+    char *buf;
+    size_t cap;
+    size_t gap_start;    // Cursor position
+    size_t gap_end;
+
+    const struct keymap *map;
+    int hist_index;
+    char *saved_line;    // Line being edited before history browsing
+
+    char *yank;          // Kill/yank buffer
+    size_t yank_len;
+
+    // vi state
+    int count;           // Count prefix being typed (0 = none)
+    int op;              // Pending operator key (d, c, y) or 0
+    int op_count;        // Count given before the operator
+    int find_key;        // Last f/F/t/T command, for ; and ,
+    int find_char;
+    int replay_arg;      // Character argument supplied by '.'
+    int replaying;
+    struct vi_change last_change;
+    struct vi_change pending_change;  // Change being built in insert mode
+    int insert_count;    // Repeat count for the text being inserted
+    char *undo;          // Snapshot for 'u'
+    size_t undo_len;
+    size_t undo_pos;
+    int has_undo;
+    char *search;        // Last history search pattern
+    int search_dir;      // -1 backward (/), +1 forward (?)
+};
+
+static const struct keymap emacs_map;
+static const struct keymap vi_insert_map;
+static const struct keymap vi_command_map;
+
+static size_t ed_len(const struct editor *ed) {
+    return ed->cap - (ed->gap_end - ed->gap_start);
+}
+
+static int ed_char_at(const struct editor *ed, size_t i) {
+    if (i < ed->gap_start) return (unsigned char)ed->buf[i];
+    return (unsigned char)ed->buf[i + (ed->gap_end - ed->gap_start)];
+}
+
+static void ed_move_to(struct editor *ed, size_t pos) {
+    size_t len = ed_len(ed);
+    if (pos > len) pos = len;
+    if (pos < ed->gap_start) {
+        size_t n = ed->gap_start - pos;
+        memmove(ed->buf + ed->gap_end - n, ed->buf + pos, n);
+        ed->gap_start -= n;
+        ed->gap_end -= n;
+    } else if (pos > ed->gap_start) {
+        size_t n = pos - ed->gap_start;
+        memmove(ed->buf + ed->gap_start, ed->buf + ed->gap_end, n);
+        ed->gap_start += n;
+        ed->gap_end += n;
+    }
+}
+
+static void ed_reserve(struct editor *ed, size_t n) {
+    if (ed->gap_end - ed->gap_start >= n) return;
+    size_t tail = ed->cap - ed->gap_end;
+    size_t new_cap = ed->cap * 2;
+    while (new_cap - ed_len(ed) < n) new_cap *= 2;
+    ed->buf = xrealloc(ed->buf, new_cap);
+    memmove(ed->buf + new_cap - tail, ed->buf + ed->gap_end, tail);
+    ed->gap_end = new_cap - tail;
+    ed->cap = new_cap;
+}
+
+static void ed_insert(struct editor *ed, const char *s, size_t n) {
+    ed_reserve(ed, n);
+    memcpy(ed->buf + ed->gap_start, s, n);
+    ed->gap_start += n;
+}
+
+// Delete the text in [from, to)
+static void ed_delete(struct editor *ed, size_t from, size_t to) {
+    size_t len = ed_len(ed);
+    if (to > len) to = len;
+    if (from >= to) return;
+    ed_move_to(ed, from);
+    ed->gap_end += to - from;
+}
+
+// Copy [from, to) into dst, which must hold to - from bytes
+static void ed_copy(const struct editor *ed, size_t from, size_t to, char *dst) {
+    for (size_t i = from; i < to && i < ed->gap_start; i++) {
+        *dst++ = ed->buf[i];
+    }
+    size_t gap = ed->gap_end - ed->gap_start;
+    size_t start = from > ed->gap_start ? from : ed->gap_start;
+    if (start < to) {
+        memcpy(dst, ed->buf + start + gap, to - start);
+    }
+}
+
+static void ed_set_text(struct editor *ed, const char *s, size_t pos) {
+    size_t n = strlen(s);
+    ed->gap_start = 0;
+    ed->gap_end = ed->cap;
+    ed_insert(ed, s, n);
+    ed_move_to(ed, pos);
+}
+
+// Return a heap copy of the whole line
+static char *ed_text(const struct editor *ed, size_t *out_len) {
+    size_t len = ed_len(ed);
+    char *s = xmalloc(len + 2);
+    ed_copy(ed, 0, len, s);
+    s[len] = '\0';
+    if (out_len) *out_len = len;
+    return s;
+}
+
+// Display
+
+static void ed_refresh(struct editor *ed) {
+    size_t gap = ed->gap_end - ed->gap_start;
+    size_t tail = ed->cap - ed->gap_end;
+    char seq[32];
+
     // Move cursor to start of line, clear it, and redraw
     output_write("\r", 1);
+    output_write(ed->prompt, ed->prompt_len);
+    output_write(ed->buf, ed->gap_start);
+    output_write(ed->buf + ed->gap_start + gap, tail);
     output_write("\x1b[K", 3); // Clear to end of line
-    output_write(prompt, strlen(prompt));
-    output_write(buf, len);
-    
+
     // Move cursor to correct position
-    size_t cursor_pos = strlen(prompt) + pos;
-    char seq[32];
-    snprintf(seq, sizeof(seq), "\r\x1b[%zuC", cursor_pos);
+    size_t cursor_pos = ed->prompt_len + ed->gap_start;
+    if (cursor_pos > 0) {
+        snprintf(seq, sizeof(seq), "\r\x1b[%zuC", cursor_pos);
+    } else {
+        snprintf(seq, sizeof(seq), "\r");
+    }
     output_write(seq, strlen(seq));
 }
 
+static void ed_beep(void) {
+    output_write("\a", 1);
+}
+
+// Shared editing functions
+
+static int ed_self_insert(struct editor *ed, int key) {
+    if (key < 32 || key >= 127) return ED_CONTINUE;
+    char c = (char)key;
+    int at_end = (ed->gap_start == ed_len(ed));
+    ed_insert(ed, &c, 1);
+    if (ed->map == &vi_insert_map && !ed->replaying) {
+        struct vi_change *pc = &ed->pending_change;
+        pc->text = xrealloc(pc->text, pc->text_len + 1);
+        pc->text[pc->text_len++] = c;
+    }
+    if (at_end) {
+        // Appending needs no redraw
+        output_write(&c, 1);
+    } else {
+        ed_refresh(ed);
+    }
+    return ED_CONTINUE;
+}
+
+static int ed_accept(struct editor *ed, int key) {
+    (void)ed; (void)key;
+    return ED_ACCEPT;
+}
+
+static int ed_interrupt(struct editor *ed, int key) {
+    (void)key;
+    output_write("^C\r\n", 4);
+    ed->gap_start = 0;
+    ed->gap_end = ed->cap;
+    ed->count = 0;
+    ed->op = 0;
+    ed->hist_index = history_length();
+    if (ed->map == &vi_command_map) ed->map = &vi_insert_map;
+    output_write(ed->prompt, ed->prompt_len);
+    return ED_CONTINUE;
+}
+
+static int ed_eof_or_delete(struct editor *ed, int key) {
+    (void)key;
+    size_t len = ed_len(ed);
+    if (len == 0) return ED_EOF;
+    if (ed->gap_start < len) {
+        ed_delete(ed, ed->gap_start, ed->gap_start + 1);
+        ed_refresh(ed);
+    }
+    return ED_CONTINUE;
+}
+
+static int ed_backward_delete(struct editor *ed, int key) {
+    (void)key;
+    if (ed->gap_start == 0) return ED_CONTINUE;
+    ed->gap_start--;
+    if (ed->map == &vi_insert_map && ed->pending_change.text_len > 0) {
+        ed->pending_change.text_len--;
+    }
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int ed_delete_char(struct editor *ed, int key) {
+    (void)key;
+    if (ed->gap_start < ed_len(ed)) {
+        ed_delete(ed, ed->gap_start, ed->gap_start + 1);
+        ed_refresh(ed);
+    }
+    return ED_CONTINUE;
+}
+
+static int ed_backward_char(struct editor *ed, int key) {
+    (void)key;
+    if (ed->gap_start > 0) {
+        ed_move_to(ed, ed->gap_start - 1);
+        ed_refresh(ed);
+    }
+    return ED_CONTINUE;
+}
+
+static int ed_forward_char(struct editor *ed, int key) {
+    (void)key;
+    if (ed->gap_start < ed_len(ed)) {
+        ed_move_to(ed, ed->gap_start + 1);
+        ed_refresh(ed);
+    }
+    return ED_CONTINUE;
+}
+
+static int ed_beginning_of_line(struct editor *ed, int key) {
+    (void)key;
+    ed_move_to(ed, 0);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int ed_end_of_line(struct editor *ed, int key) {
+    (void)key;
+    ed_move_to(ed, ed_len(ed));
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static void ed_set_yank(struct editor *ed, size_t from, size_t to) {
+    free(ed->yank);
+    ed->yank_len = to - from;
+    ed->yank = xmalloc(ed->yank_len + 1);
+    ed_copy(ed, from, to, ed->yank);
+}
+
+static void ed_kill(struct editor *ed, size_t from, size_t to) {
+    if (from >= to) return;
+    ed_set_yank(ed, from, to);
+    ed_delete(ed, from, to);
+    ed_refresh(ed);
+}
+
+static int ed_kill_line(struct editor *ed, int key) {
+    (void)key;
+    ed_kill(ed, ed->gap_start, ed_len(ed));
+    return ED_CONTINUE;
+}
+
+static int ed_kill_to_start(struct editor *ed, int key) {
+    (void)key;
+    ed_kill(ed, 0, ed->gap_start);
+    return ED_CONTINUE;
+}
+
+static int is_word_char(int c) {
+    return isalnum(c) || c == '_';
+}
+
+static size_t word_start_before(const struct editor *ed, size_t pos) {
+    while (pos > 0 && isspace(ed_char_at(ed, pos - 1))) pos--;
+    while (pos > 0 && !isspace(ed_char_at(ed, pos - 1))) pos--;
+    return pos;
+}
+
+static int ed_kill_word_back(struct editor *ed, int key) {
+    (void)key;
+    ed_kill(ed, word_start_before(ed, ed->gap_start), ed->gap_start);
+    return ED_CONTINUE;
+}
+
+static int ed_yank(struct editor *ed, int key) {
+    (void)key;
+    if (ed->yank_len > 0) {
+        ed_insert(ed, ed->yank, ed->yank_len);
+        ed_refresh(ed);
+    }
+    return ED_CONTINUE;
+}
+
+static int ed_clear_screen(struct editor *ed, int key) {
+    (void)key;
+    output_write("\x1b[H\x1b[2J", 7);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int ed_transpose(struct editor *ed, int key) {
+    (void)key;
+    size_t len = ed_len(ed);
+    if (len < 2 || ed->gap_start == 0) return ED_CONTINUE;
+    if (ed->gap_start == len) ed_move_to(ed, len - 1);
+    char t = ed->buf[ed->gap_start - 1];
+    ed->buf[ed->gap_start - 1] = ed->buf[ed->gap_end];
+    ed->buf[ed->gap_end] = t;
+    ed_move_to(ed, ed->gap_start + 1);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int ed_forward_word(struct editor *ed, int key) {
+    (void)key;
+    size_t pos = ed->gap_start, len = ed_len(ed);
+    while (pos < len && !is_word_char(ed_char_at(ed, pos))) pos++;
+    while (pos < len && is_word_char(ed_char_at(ed, pos))) pos++;
+    ed_move_to(ed, pos);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int ed_backward_word(struct editor *ed, int key) {
+    (void)key;
+    size_t pos = ed->gap_start;
+    while (pos > 0 && !is_word_char(ed_char_at(ed, pos - 1))) pos--;
+    while (pos > 0 && is_word_char(ed_char_at(ed, pos - 1))) pos--;
+    ed_move_to(ed, pos);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int ed_kill_word_forward(struct editor *ed, int key) {
+    (void)key;
+    size_t pos = ed->gap_start, len = ed_len(ed);
+    while (pos < len && !is_word_char(ed_char_at(ed, pos))) pos++;
+    while (pos < len && is_word_char(ed_char_at(ed, pos))) pos++;
+    ed_kill(ed, ed->gap_start, pos);
+    return ED_CONTINUE;
+}
+
+// Replace the line with history entry index (history_length() = the line
+// that was being typed before browsing started).
+static void ed_load_history(struct editor *ed, int index) {
+    if (ed->hist_index == history_length()) {
+        free(ed->saved_line);
+        ed->saved_line = ed_text(ed, NULL);
+    }
+    ed->hist_index = index;
+    const char *line = (index == history_length()) ? ed->saved_line : history_get(index);
+    if (!line) line = "";
+    size_t pos = (ed->map == &vi_command_map) ? 0 : strlen(line);
+    ed_set_text(ed, line, pos);
+    ed_refresh(ed);
+}
+
+static int ed_history_prev(struct editor *ed, int key) {
+    (void)key;
+    int n = ed->count ? ed->count : 1;
+    ed->count = 0;
+    if (ed->hist_index - n < 0) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    ed_load_history(ed, ed->hist_index - n);
+    return ED_CONTINUE;
+}
+
+static int ed_history_next(struct editor *ed, int key) {
+    (void)key;
+    int n = ed->count ? ed->count : 1;
+    ed->count = 0;
+    if (ed->hist_index + n > history_length()) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    ed_load_history(ed, ed->hist_index + n);
+    return ED_CONTINUE;
+}
+
+// Insert the next key literally
+static int ed_quoted_insert(struct editor *ed, int key) {
+    (void)key;
+    int c = read_char();
+    if (c == -1) return ED_EOF;
+    char ch = (char)c;
+    ed_insert(ed, &ch, 1);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+// vi mode
+
+static int vi_is_big_word_key(int key) {
+    return key == 'W' || key == 'B' || key == 'E';
+}
+
+// Character class for word motions: 0 blank, 1 word, 2 punctuation.
+// Big-word motions treat every non-blank as one class.
+static int vi_class(int c, int big) {
+    if (isspace(c)) return 0;
+    if (big || is_word_char(c)) return 1;
+    return 2;
+}
+
+static void vi_save_undo(struct editor *ed) {
+    if (ed->replaying) return;
+    free(ed->undo);
+    ed->undo = ed_text(ed, &ed->undo_len);
+    ed->undo_pos = ed->gap_start;
+    ed->has_undo = 1;
+}
+
+static void vi_enter_command_mode(struct editor *ed) {
+    ed->map = &vi_command_map;
+    ed->count = 0;
+    ed->op = 0;
+    if (ed->gap_start > 0) ed_move_to(ed, ed->gap_start - 1);
+}
+
+// Enter insert mode. repeat is how many times the typed text is
+// inserted; count, op, key and arg describe the command for '.'.
+static void vi_enter_insert_mode(struct editor *ed, int repeat, int count,
+                                 int op, int key, int arg) {
+    ed->map = &vi_insert_map;
+    ed->insert_count = repeat > 0 ? repeat : 1;
+    if (!ed->replaying) {
+        struct vi_change *pc = &ed->pending_change;
+        free(pc->text);
+        pc->text = NULL;
+        pc->text_len = 0;
+        pc->count = count;
+        pc->op = op;
+        pc->key = key;
+        pc->arg = arg;
+    }
+}
+
+static void vi_record_change(struct editor *ed, int count, int op, int key, int arg) {
+    if (ed->replaying) return;
+    free(ed->last_change.text);
+    ed->last_change.text = NULL;
+    ed->last_change.text_len = 0;
+    ed->last_change.count = count;
+    ed->last_change.op = op;
+    ed->last_change.key = key;
+    ed->last_change.arg = arg;
+}
+
+// Character argument for f, t, r and friends
+static int vi_arg_char(struct editor *ed) {
+    if (ed->replaying) return ed->replay_arg;
+    int c = read_char();
+    return (c == KEY_ESC) ? -1 : c;
+}
+
+// Take the effective count for the current command, combining a count
+// typed before an operator with one typed after it (2d3w deletes 6 words).
+static int vi_take_count(struct editor *ed) {
+    int n = ed->count ? ed->count : 1;
+    if (ed->op_count) n *= ed->op_count;
+    ed->count = 0;
+    ed->op_count = 0;
+    return n;
+}
+
+static size_t vi_next_word(const struct editor *ed, size_t pos, int big) {
+    size_t len = ed_len(ed);
+    if (pos >= len) return len;
+    int cls = vi_class(ed_char_at(ed, pos), big);
+    while (pos < len && cls != 0 && vi_class(ed_char_at(ed, pos), big) == cls) pos++;
+    while (pos < len && isspace(ed_char_at(ed, pos))) pos++;
+    return pos;
+}
+
+static size_t vi_word_end(const struct editor *ed, size_t pos, int big) {
+    size_t len = ed_len(ed);
+    if (pos + 1 >= len) return pos;
+    pos++;
+    while (pos < len && isspace(ed_char_at(ed, pos))) pos++;
+    if (pos >= len) return len - 1;
+    int cls = vi_class(ed_char_at(ed, pos), big);
+    while (pos + 1 < len && vi_class(ed_char_at(ed, pos + 1), big) == cls) pos++;
+    return pos;
+}
+
+static size_t vi_prev_word(const struct editor *ed, size_t pos, int big) {
+    while (pos > 0 && isspace(ed_char_at(ed, pos - 1))) pos--;
+    if (pos == 0) return 0;
+    int cls = vi_class(ed_char_at(ed, pos - 1), big);
+    while (pos > 0 && vi_class(ed_char_at(ed, pos - 1), big) == cls) pos--;
+    return pos;
+}
+
+static int vi_find(const struct editor *ed, int key, int ch, int count, size_t *target) {
+    size_t len = ed_len(ed);
+    size_t pos = ed->gap_start;
+    int forward = (key == 'f' || key == 't');
+
+    while (count-- > 0) {
+        size_t p = pos;
+        // Repeating t/T must step over the adjacent match
+        if (key == 't' && p + 1 < len && ed_char_at(ed, p + 1) == ch) p++;
+        if (key == 'T' && p > 0 && ed_char_at(ed, p - 1) == ch) p--;
+        for (;;) {
+            if (forward) {
+                if (p + 1 >= len) return 0;
+                p++;
+            } else {
+                if (p == 0) return 0;
+                p--;
+            }
+            if (ed_char_at(ed, p) == ch) break;
+        }
+        pos = p;
+    }
+    if (key == 't') pos--;
+    if (key == 'T') pos++;
+    *target = pos;
+    return 1;
+}
+
+// Compute the target of a motion. Returns 0 if the motion fails.
+// *inclusive is set when the character under the target belongs
+// to the range an operator acts on.
+static int vi_motion_target(struct editor *ed, int key, int count, int arg,
+                            size_t *target, int *inclusive) {
+    size_t len = ed_len(ed);
+    size_t pos = ed->gap_start;
+    int big = vi_is_big_word_key(key);
+    *inclusive = 0;
+
+    switch (key) {
+        case 'h': case KEY_LEFT: case CTRL_KEY('H'): case KEY_DEL:
+            if (pos == 0) return 0;
+            *target = pos > (size_t)count ? pos - count : 0;
+            return 1;
+        case 'l': case ' ': case KEY_RIGHT:
+            if (pos >= len) return 0;
+            *target = pos + count < len ? pos + count : len;
+            return 1;
+        case 'w': case 'W':
+            while (count-- > 0) pos = vi_next_word(ed, pos, big);
+            *target = pos;
+            return 1;
+        case 'b': case 'B':
+            if (pos == 0) return 0;
+            while (count-- > 0) pos = vi_prev_word(ed, pos, big);
+            *target = pos;
+            return 1;
+        case 'e': case 'E':
+            if (len == 0) return 0;
+            while (count-- > 0) pos = vi_word_end(ed, pos, big);
+            *target = pos;
+            *inclusive = 1;
+            return 1;
+        case '0': case KEY_HOME:
+            *target = 0;
+            return 1;
+        case '^':
+            pos = 0;
+            while (pos < len && isspace(ed_char_at(ed, pos))) pos++;
+            *target = pos;
+            return 1;
+        case '$': case KEY_END:
+            *target = len;
+            return 1;
+        case '|':
+            *target = (size_t)count - 1 < len ? (size_t)count - 1 : len;
+            return 1;
+        case 'f': case 'F': case 't': case 'T':
+            if (arg == -1) return 0;
+            ed->find_key = key;
+            ed->find_char = arg;
+            *inclusive = (key == 'f' || key == 't');
+            return vi_find(ed, key, arg, count, target);
+        case ';': case ',': {
+            int fk = ed->find_key;
+            if (!fk) return 0;
+            if (key == ',') {
+                // Reverse direction
+                if (fk == 'f') fk = 'F';
+                else if (fk == 'F') fk = 'f';
+                else if (fk == 't') fk = 'T';
+                else fk = 't';
+            }
+            *inclusive = (fk == 'f' || fk == 't');
+            return vi_find(ed, fk, ed->find_char, count, target);
+        }
+    }
+    return 0;
+}
+
+// Apply operator op to [from, to)
+static void vi_apply_op(struct editor *ed, int op, size_t from, size_t to) {
+    if (from > to) {
+        size_t t = from;
+        from = to;
+        to = t;
+    }
+    ed_set_yank(ed, from, to);
+    if (op == 'y') {
+        ed_move_to(ed, from);
+        ed_refresh(ed);
+        return;
+    }
+    ed_delete(ed, from, to);
+    ed_refresh(ed);
+}
+
+static int vi_clamp_cursor(struct editor *ed) {
+    // In command mode the cursor sits on a character, never past the end
+    size_t len = ed_len(ed);
+    if (ed->map == &vi_command_map && len > 0 && ed->gap_start >= len) {
+        ed_move_to(ed, len - 1);
+        ed_refresh(ed);
+    }
+    return ED_CONTINUE;
+}
+
+static int vi_motion(struct editor *ed, int key) {
+    int op = ed->op;
+    int count = vi_take_count(ed);
+    int arg = 0;
+    size_t target;
+    int inclusive;
+
+    ed->op = 0;
+    if (key == 'f' || key == 'F' || key == 't' || key == 'T') {
+        arg = vi_arg_char(ed);
+    }
+
+    // cw acts like ce when the cursor is on a word
+    int motion_key = key;
+    if (op == 'c' && (key == 'w' || key == 'W') &&
+        ed->gap_start < ed_len(ed) && !isspace(ed_char_at(ed, ed->gap_start))) {
+        motion_key = (key == 'w') ? 'e' : 'E';
+        // A single-character word: ce would jump to the next word
+        size_t p = ed->gap_start;
+        int big = (key == 'W');
+        if (count == 1 && (p + 1 >= ed_len(ed) ||
+            vi_class(ed_char_at(ed, p + 1), big) != vi_class(ed_char_at(ed, p), big))) {
+            vi_save_undo(ed);
+            vi_apply_op(ed, 'c', p, p + 1);
+            vi_enter_insert_mode(ed, 1, count, op, key, arg);
+            return ED_CONTINUE;
+        }
+    }
+
+    if (!vi_motion_target(ed, motion_key, count, arg, &target, &inclusive)) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+
+    if (!op) {
+        ed_move_to(ed, target);
+        ed_refresh(ed);
+        return vi_clamp_cursor(ed);
+    }
+
+    size_t from = ed->gap_start;
+    size_t to = target;
+    if (to < from) {
+        size_t t = from;
+        from = to;
+        to = t;
+    } else if (inclusive && to < ed_len(ed)) {
+        to++;
+    }
+
+    if (op != 'y') vi_save_undo(ed);
+    vi_apply_op(ed, op, from, to);
+    if (op == 'c') {
+        vi_enter_insert_mode(ed, 1, count, op, key, arg);
+        return ED_CONTINUE;
+    }
+    if (op == 'd') vi_record_change(ed, count, op, key, arg);
+    return vi_clamp_cursor(ed);
+}
+
+static int vi_digit(struct editor *ed, int key) {
+    if (key == '0' && ed->count == 0) return vi_motion(ed, key);
+    ed->count = ed->count * 10 + (key - '0');
+    return ED_CONTINUE;
+}
+
+static int vi_operator(struct editor *ed, int key) {
+    if (ed->op == 0) {
+        ed->op = key;
+        ed->op_count = ed->count;
+        ed->count = 0;
+        return ED_CONTINUE;
+    }
+    if (ed->op != key) {
+        // Mismatched operators (e.g. "dc") cancel the command
+        ed->op = 0;
+        ed->count = 0;
+        ed->op_count = 0;
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    // dd, cc, yy act on the whole line
+    int op = ed->op;
+    int count = vi_take_count(ed);
+    ed->op = 0;
+    if (op != 'y') vi_save_undo(ed);
+    vi_apply_op(ed, op, 0, ed_len(ed));
+    if (op == 'c') {
+        vi_enter_insert_mode(ed, 1, count, op, key, 0);
+        return ED_CONTINUE;
+    }
+    if (op == 'd') vi_record_change(ed, count, op, key, 0);
+    return vi_clamp_cursor(ed);
+}
+
+// Commands that take an operator with an implied motion: D C Y x X s S
+static int vi_shorthand(struct editor *ed, int key) {
+    static const struct { int key; int op; int motion; } table[] = {
+        {'D', 'd', '$'}, {'C', 'c', '$'}, {'Y', 'y', '$'},
+        {'x', 'd', 'l'}, {'X', 'd', 'h'}, {'s', 'c', 'l'},
+    };
+    if (key == 'S') {
+        ed->op = 'c';
+        return vi_operator(ed, 'c');
+    }
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (table[i].key == key) {
+            if (key == 'x' && ed->gap_start >= ed_len(ed)) {
+                ed_beep();
+                return ED_CONTINUE;
+            }
+            ed->op = table[i].op;
+            ed->op_count = 0;
+            return vi_motion(ed, table[i].motion);
+        }
+    }
+    return ED_CONTINUE;
+}
+
+static int vi_insert_cmd(struct editor *ed, int key) {
+    int count = vi_take_count(ed);
+    size_t len = ed_len(ed);
+    vi_save_undo(ed);
+    switch (key) {
+        case 'a':
+            if (ed->gap_start < len) ed_move_to(ed, ed->gap_start + 1);
+            break;
+        case 'A':
+            ed_move_to(ed, len);
+            break;
+        case 'I':
+            ed_move_to(ed, 0);
+            break;
+    }
+    ed_refresh(ed);
+    vi_enter_insert_mode(ed, count, count, 0, key, 0);
+    return ED_CONTINUE;
+}
+
+static int vi_escape(struct editor *ed, int key) {
+    (void)key;
+    struct vi_change *pc = &ed->pending_change;
+
+    // Repeat counted inserts (3ix<ESC> inserts xxx)
+    if (!ed->replaying && pc->text_len > 0) {
+        for (int i = 1; i < ed->insert_count; i++) {
+            ed_insert(ed, pc->text, pc->text_len);
+        }
+    }
+    ed->insert_count = 1;
+
+    if (!ed->replaying) {
+        // The finished insert becomes the change that '.' repeats
+        free(ed->last_change.text);
+        ed->last_change = *pc;
+        pc->text = NULL;
+        pc->text_len = 0;
+    }
+    vi_enter_command_mode(ed);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int vi_command_escape(struct editor *ed, int key) {
+    (void)key;
+    if (ed->count == 0 && ed->op == 0) ed_beep();
+    ed->count = 0;
+    ed->op = 0;
+    ed->op_count = 0;
+    return ED_CONTINUE;
+}
+
+static int vi_put(struct editor *ed, int key) {
+    int count = vi_take_count(ed);
+    if (ed->yank_len == 0) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    vi_save_undo(ed);
+    if (key == 'p' && ed->gap_start < ed_len(ed)) ed_move_to(ed, ed->gap_start + 1);
+    for (int i = 0; i < count; i++) ed_insert(ed, ed->yank, ed->yank_len);
+    ed_move_to(ed, ed->gap_start - 1);
+    vi_record_change(ed, count, 0, key, 0);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int vi_replace_char(struct editor *ed, int key) {
+    int count = vi_take_count(ed);
+    int c = vi_arg_char(ed);
+    size_t pos = ed->gap_start;
+    if (c < 0 || pos + count > ed_len(ed)) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    vi_save_undo(ed);
+    ed_delete(ed, pos, pos + count);
+    char ch = (char)c;
+    for (int i = 0; i < count; i++) ed_insert(ed, &ch, 1);
+    ed_move_to(ed, ed->gap_start - 1);
+    vi_record_change(ed, count, 0, key, c);
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+static int vi_toggle_case(struct editor *ed, int key) {
+    int count = vi_take_count(ed);
+    size_t len = ed_len(ed);
+    if (ed->gap_start >= len) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    vi_save_undo(ed);
+    for (int i = 0; i < count && ed->gap_start < len; i++) {
+        char *p = &ed->buf[ed->gap_end];
+        *p = islower((unsigned char)*p) ? toupper((unsigned char)*p) : tolower((unsigned char)*p);
+        ed_move_to(ed, ed->gap_start + 1);
+    }
+    vi_record_change(ed, count, 0, key, 0);
+    ed_refresh(ed);
+    return vi_clamp_cursor(ed);
+}
+
+static int vi_undo(struct editor *ed, int key) {
+    (void)key;
+    ed->count = 0;
+    if (!ed->has_undo) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    // Swap the snapshot with the current line so 'u' toggles
+    size_t cur_len;
+    char *cur = ed_text(ed, &cur_len);
+    size_t cur_pos = ed->gap_start;
+    ed_set_text(ed, ed->undo, ed->undo_pos);
+    free(ed->undo);
+    ed->undo = cur;
+    ed->undo_len = cur_len;
+    ed->undo_pos = cur_pos;
+    ed_refresh(ed);
+    return vi_clamp_cursor(ed);
+}
+
+static int vi_repeat(struct editor *ed, int key) {
+    (void)key;
+    struct vi_change ch = ed->last_change;
+    if (!ch.key) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    int count = ed->count ? ed->count : ch.count;
+
+    vi_save_undo(ed);
+    ed->replaying = 1;
+    ed->replay_arg = ch.arg;
+    ed->count = count;
+    ed->op_count = 0;
+    if (ch.op) {
+        ed->op = ch.op;
+        if (ch.key == ch.op) {
+            vi_operator(ed, ch.key);
+        } else {
+            vi_motion(ed, ch.key);
+        }
+    } else {
+        editor_fn fn = vi_command_map.keys[ch.key];
+        if (fn) fn(ed, ch.key);
+    }
+    // Replay any inserted text and return to command mode
+    if (ed->map == &vi_insert_map) {
+        if (ch.text_len > 0) {
+            int n = (!ch.op && count > 0) ? count : 1;
+            for (int i = 0; i < n; i++) ed_insert(ed, ch.text, ch.text_len);
+        }
+        vi_escape(ed, KEY_ESC);
+    }
+    ed->replaying = 0;
+    ed->count = 0;
+    ed->op = 0;
+    ed_refresh(ed);
+    return ED_CONTINUE;
+}
+
+// Read a search pattern on the command line after '/' or '?'
+static char *vi_read_pattern(struct editor *ed, int key) {
+    size_t cap = 64, len = 0;
+    char *pat = xmalloc(cap);
+    char lead = (char)key;
+
+    for (;;) {
+        output_write("\r\x1b[K", 4);
+        output_write(&lead, 1);
+        output_write(pat, len);
+        int c = read_char();
+        if (c == -1 || c == KEY_ESC || c == CTRL_KEY('C')) {
+            free(pat);
+            ed_refresh(ed);
+            return NULL;
+        }
+        if (c == '\r' || c == '\n') break;
+        if (c == KEY_DEL || c == CTRL_KEY('H')) {
+            if (len == 0) {
+                free(pat);
+                ed_refresh(ed);
+                return NULL;
+            }
+            len--;
+            continue;
+        }
+        if (c < 32) continue;
+        if (len + 1 >= cap) pat = xrealloc(pat, cap *= 2);
+        pat[len++] = (char)c;
+    }
+    pat[len] = '\0';
+    return pat;
+}
+
+static int history_matches(const char *line, const char *pat) {
+    if (pat[0] == '^') {
+        return strncmp(line, pat + 1, strlen(pat + 1)) == 0;
+    }
+    return strstr(line, pat) != NULL;
+}
+
+// Search history from the current entry; dir -1 goes to older entries
+static int vi_search_history(struct editor *ed, int dir) {
+    if (!ed->search) return 0;
+    for (int i = ed->hist_index + dir; i >= 0 && i < history_length(); i += dir) {
+        const char *line = history_get(i);
+        if (line && history_matches(line, ed->search)) {
+            ed_load_history(ed, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int vi_search(struct editor *ed, int key) {
+    ed->count = 0;
+    char *pat = vi_read_pattern(ed, key);
+    if (!pat) return ED_CONTINUE;
+    if (*pat) {
+        free(ed->search);
+        ed->search = pat;
+    } else {
+        free(pat);
+    }
+    // '/' searches backward (older), '?' forward, as in POSIX vi mode
+    ed->search_dir = (key == '/') ? -1 : 1;
+    if (!vi_search_history(ed, ed->search_dir)) {
+        ed_refresh(ed);
+        ed_beep();
+    }
+    return ED_CONTINUE;
+}
+
+static int vi_search_again(struct editor *ed, int key) {
+    ed->count = 0;
+    int dir = (key == 'n') ? ed->search_dir : -ed->search_dir;
+    if (!dir || !vi_search_history(ed, dir)) ed_beep();
+    return ED_CONTINUE;
+}
+
+static int vi_history_goto(struct editor *ed, int key) {
+    (void)key;
+    // G goes to the oldest entry, or to event number <count>
+    int target = ed->count ? ed->count - history_first_event() : 0;
+    ed->count = 0;
+    if (target < 0) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    if (history_length() == 0 || target >= history_length()) {
+        ed_beep();
+        return ED_CONTINUE;
+    }
+    ed_load_history(ed, target);
+    return ED_CONTINUE;
+}
+
+static int vi_comment_accept(struct editor *ed, int key) {
+    (void)key;
+    ed_move_to(ed, 0);
+    ed_insert(ed, "#", 1);
+    return ED_ACCEPT;
+}
+
+static int vi_history_key(struct editor *ed, int key) {
+    if (key == 'k' || key == '-') return ed_history_prev(ed, key);
+    return ed_history_next(ed, key);
+}
+
+static int vi_cancel_op(struct editor *ed, int key) {
+    // Keys that are not motions cancel a pending operator
+    (void)key;
+    if (ed->op) {
+        ed->op = 0;
+        ed->count = 0;
+        ed->op_count = 0;
+        ed_beep();
+    }
+    return ED_CONTINUE;
+}
+
+// Key maps
+
+static const struct keymap emacs_map = {
+    .keys = {
+        [CTRL_KEY('A')] = ed_beginning_of_line,
+        [CTRL_KEY('B')] = ed_backward_char,
+        [CTRL_KEY('C')] = ed_interrupt,
+        [CTRL_KEY('D')] = ed_eof_or_delete,
+        [CTRL_KEY('E')] = ed_end_of_line,
+        [CTRL_KEY('F')] = ed_forward_char,
+        [CTRL_KEY('H')] = ed_backward_delete,
+        [CTRL_KEY('J')] = ed_accept,
+        [CTRL_KEY('K')] = ed_kill_line,
+        [CTRL_KEY('L')] = ed_clear_screen,
+        [CTRL_KEY('M')] = ed_accept,
+        [CTRL_KEY('N')] = ed_history_next,
+        [CTRL_KEY('P')] = ed_history_prev,
+        [CTRL_KEY('T')] = ed_transpose,
+        [CTRL_KEY('U')] = ed_kill_to_start,
+        [CTRL_KEY('V')] = ed_quoted_insert,
+        [CTRL_KEY('W')] = ed_kill_word_back,
+        [CTRL_KEY('Y')] = ed_yank,
+        [KEY_DEL] = ed_backward_delete,
+        [KEY_UP] = ed_history_prev,
+        [KEY_DOWN] = ed_history_next,
+        [KEY_LEFT] = ed_backward_char,
+        [KEY_RIGHT] = ed_forward_char,
+        [KEY_HOME] = ed_beginning_of_line,
+        [KEY_END] = ed_end_of_line,
+        [KEY_DELETE] = ed_delete_char,
+        [KEY_META('b')] = ed_backward_word,
+        [KEY_META('f')] = ed_forward_word,
+        [KEY_META('d')] = ed_kill_word_forward,
+        [KEY_META(KEY_DEL)] = ed_kill_word_back,
+    },
+    .fallback = ed_self_insert,
+};
+
+static const struct keymap vi_insert_map = {
+    .keys = {
+        [CTRL_KEY('C')] = ed_interrupt,
+        [CTRL_KEY('D')] = ed_eof_or_delete,
+        [CTRL_KEY('H')] = ed_backward_delete,
+        [CTRL_KEY('J')] = ed_accept,
+        [CTRL_KEY('M')] = ed_accept,
+        [CTRL_KEY('U')] = ed_kill_to_start,
+        [CTRL_KEY('V')] = ed_quoted_insert,
+        [CTRL_KEY('W')] = ed_kill_word_back,
+        [KEY_ESC] = vi_escape,
+        [KEY_DEL] = ed_backward_delete,
+        [KEY_UP] = ed_history_prev,
+        [KEY_DOWN] = ed_history_next,
+        [KEY_LEFT] = ed_backward_char,
+        [KEY_RIGHT] = ed_forward_char,
+        [KEY_HOME] = ed_beginning_of_line,
+        [KEY_END] = ed_end_of_line,
+        [KEY_DELETE] = ed_delete_char,
+    },
+    .fallback = ed_self_insert,
+};
+
+static const struct keymap vi_command_map = {
+    .keys = {
+        [CTRL_KEY('C')] = ed_interrupt,
+        [CTRL_KEY('D')] = ed_eof_or_delete,
+        [CTRL_KEY('H')] = vi_motion,
+        [CTRL_KEY('J')] = ed_accept,
+        [CTRL_KEY('L')] = ed_clear_screen,
+        [CTRL_KEY('M')] = ed_accept,
+        [KEY_ESC] = vi_command_escape,
+        [KEY_DEL] = vi_motion,
+        ['1'] = vi_digit, ['2'] = vi_digit, ['3'] = vi_digit,
+        ['4'] = vi_digit, ['5'] = vi_digit, ['6'] = vi_digit,
+        ['7'] = vi_digit, ['8'] = vi_digit, ['9'] = vi_digit,
+        ['0'] = vi_digit,
+        ['h'] = vi_motion, ['l'] = vi_motion, [' '] = vi_motion,
+        ['w'] = vi_motion, ['W'] = vi_motion,
+        ['b'] = vi_motion, ['B'] = vi_motion,
+        ['e'] = vi_motion, ['E'] = vi_motion,
+        ['^'] = vi_motion, ['$'] = vi_motion, ['|'] = vi_motion,
+        ['f'] = vi_motion, ['F'] = vi_motion,
+        ['t'] = vi_motion, ['T'] = vi_motion,
+        [';'] = vi_motion, [','] = vi_motion,
+        ['d'] = vi_operator, ['c'] = vi_operator, ['y'] = vi_operator,
+        ['D'] = vi_shorthand, ['C'] = vi_shorthand, ['Y'] = vi_shorthand,
+        ['x'] = vi_shorthand, ['X'] = vi_shorthand,
+        ['s'] = vi_shorthand, ['S'] = vi_shorthand,
+        ['i'] = vi_insert_cmd, ['a'] = vi_insert_cmd,
+        ['I'] = vi_insert_cmd, ['A'] = vi_insert_cmd,
+        ['p'] = vi_put, ['P'] = vi_put,
+        ['r'] = vi_replace_char,
+        ['~'] = vi_toggle_case,
+        ['u'] = vi_undo,
+        ['.'] = vi_repeat,
+        ['k'] = vi_history_key, ['-'] = vi_history_key,
+        ['j'] = vi_history_key, ['+'] = vi_history_key,
+        ['G'] = vi_history_goto,
+        ['/'] = vi_search, ['?'] = vi_search,
+        ['n'] = vi_search_again, ['N'] = vi_search_again,
+        ['#'] = vi_comment_accept,
+        [KEY_UP] = ed_history_prev,
+        [KEY_DOWN] = ed_history_next,
+        [KEY_LEFT] = vi_motion,
+        [KEY_RIGHT] = vi_motion,
+        [KEY_HOME] = vi_motion,
+        [KEY_END] = vi_motion,
+        [KEY_DELETE] = ed_delete_char,
+    },
+    .fallback = vi_cancel_op,
+};
+
+// Look up and run the function bound to key in the active map
+static int editor_dispatch(struct editor *ed, int key) {
+    editor_fn fn = NULL;
+    if (key >= KEY_META_BASE && key < KEY_MAX && !ed->map->keys[key] &&
+        ed->map->keys[KEY_ESC]) {
+        // An unbound meta key is ESC typed quickly before another key
+        int result = editor_dispatch(ed, KEY_ESC);
+        if (result != ED_CONTINUE) return result;
+        key &= 0xff;
+    }
+    if (key >= 0 && key < KEY_MAX) fn = ed->map->keys[key];
+    if (!fn) fn = ed->map->fallback;
+    return fn(ed, key);
+}
+
+static void editor_free(struct editor *ed) {
+    free(ed->buf);
+    free(ed->saved_line);
+    free(ed->yank);
+    free(ed->undo);
+    free(ed->search);
+    free(ed->last_change.text);
+    free(ed->pending_change.text);
+}
+
+// Block until input is available. Under set -b, background jobs that
+// change state meanwhile are reported at once and the line is redrawn.
+static int wait_for_input(struct editor *ed) {
+    for (;;) {
+        int wake = shell_notify ? job_wakeup_fd() : -1;
+        struct pollfd pfd[2] = {
+            { .fd = input_get_fd(), .events = POLLIN },
+            { .fd = wake, .events = POLLIN },
+        };
+        int n = poll(pfd, 2, -1);
+        if (n < 0 && errno != EINTR) return -1;
+
+        if (shell_notify && job_notify_pending()) {
+            output_write("\r\n", 2);
+            disable_raw_mode();
+            job_notify();
+            enable_raw_mode();
+            ed_refresh(ed);
+        }
+        if (n > 0 && pfd[0].revents) return 0;
+    }
+}
+
 char *read_line(const char *prompt) {
     if (!input_is_tty()) {
         // Non-interactive: use getline
@@ -209,183 +1398,48 @@ char *read_line(const char *prompt) {
     }
     
     enable_raw_mode();
-    
-    char *buf = xmalloc(BUFFER_SIZE);
-    if (!buf) {
-        disable_raw_mode();
-        return NULL;
-    }
-    
-    size_t len = 0;
-    size_t pos = 0;
-    size_t capacity = BUFFER_SIZE;
-    buf[0] = '\0';
-    
-    int history_index = history_count;
-    
+
+    struct editor ed;
+    memset(&ed, 0, sizeof(ed));
+    ed.prompt = prompt ? prompt : "";
+    ed.prompt_len = strlen(ed.prompt);
+    ed.cap = BUFFER_SIZE;
+    ed.buf = xmalloc(ed.cap);
+    ed.gap_start = 0;
+    ed.gap_end = ed.cap;
+    ed.map = shell_vi_mode ? &vi_insert_map : &emacs_map;
+    ed.hist_index = history_length();
+
     // Display initial prompt
-    output_write(prompt, strlen(prompt));
-    
-    while (1) {
-        int c = read_char();
-        if (c == -1) {
-            disable_raw_mode();
-            free(buf);
-            return NULL;
+    output_write(ed.prompt, ed.prompt_len);
+
+    int result = ED_CONTINUE;
+    while (result == ED_CONTINUE) {
+        if (wait_for_input(&ed) < 0) {
+            result = ED_EOF;
+            break;
         }
-        
-        if (c == 27) { // ESC
-            int key = read_escape_seq();
-            if (key == 1003) { // Up arrow
-                if (history_index > 0) {
-                    history_index--;
-                    const char *hist_line = history_get(history_index);
-                    if (hist_line) {
-                        size_t hist_len = strlen(hist_line);
-                        if (hist_len < capacity) {
-                            strcpy(buf, hist_line);
-                            len = hist_len;
-                            pos = hist_len;
-                            refresh_line(prompt, buf, len, pos);
-                        }
-                    }
-                }
-            } else if (key == 1004) { // Down arrow
-                if (history_index < history_count) {
-                    history_index++;
-                    if (history_index == history_count) {
-                        // New empty line
-                        buf[0] = '\0';
-                        len = 0;
-                        pos = 0;
-                        refresh_line(prompt, buf, len, pos);
-                    } else {
-                        const char *hist_line = history_get(history_index);
-                        if (hist_line) {
-                            size_t hist_len = strlen(hist_line);
-                            if (hist_len < capacity) {
-                                strcpy(buf, hist_line);
-                                len = hist_len;
-                                pos = hist_len;
-                                refresh_line(prompt, buf, len, pos);
-                            }
-                        }
-                    }
-                }
-            } else if (key == 1003) { // Up arrow
-                if (history_index > 0) {
-                    history_index--;
-                    const char *hist_line = history_get(history_index);
-                    if (hist_line) {
-                        size_t hist_len = strlen(hist_line);
-                        if (hist_len < capacity) {
-                            strcpy(buf, hist_line);
-                            len = hist_len;
-                            pos = hist_len;
-                            refresh_line(prompt, buf, len, pos);
-                        }
-                    }
-                }
-            } else if (key == 1004) { // Down arrow
-                if (history_index < history_count) {
-                    history_index++;
-                    if (history_index == history_count) {
-                        // New empty line
-                        buf[0] = '\0';
-                        len = 0;
-                        pos = 0;
-                        refresh_line(prompt, buf, len, pos);
-                    } else {
-                        const char *hist_line = history_get(history_index);
-                        if (hist_line) {
-                            size_t hist_len = strlen(hist_line);
-                            if (hist_len < capacity) {
-                                strcpy(buf, hist_line);
-                                len = hist_len;
-                                pos = hist_len;
-                                refresh_line(prompt, buf, len, pos);
-                            }
-                        }
-                    }
-                }
-            } else if (key == 1006) { // Left arrow
-                if (pos > 0) {
-                    pos--;
-                    refresh_line(prompt, buf, len, pos);
-                }
-            } else if (key == 1005) { // Right arrow
-                if (pos < len) {
-                    pos++;
-                    refresh_line(prompt, buf, len, pos);
-                }
-            } else if (key == 1000) { // Home
-                pos = 0;
-                refresh_line(prompt, buf, len, pos);
-            } else if (key == 1002) { // End
-                pos = len;
-                refresh_line(prompt, buf, len, pos);
-            } else if (key == 1001) { // Delete
-                if (pos < len) {
-                    memmove(buf + pos, buf + pos + 1, len - pos);
-                    len--;
-                    buf[len] = '\0';
-                    refresh_line(prompt, buf, len, pos);
-                }
-            }
-        } else if (c == 127 || c == 8) { // Backspace
-            if (pos > 0) {
-                memmove(buf + pos - 1, buf + pos, len - pos + 1);
-                pos--;
-                len--;
-                refresh_line(prompt, buf, len, pos);
-            }
-        } else if (c == 4) { // Ctrl+D (EOF)
-            if (len == 0) {
-                disable_raw_mode();
-                free(buf);
-                output_write("\n", 1);
-                return NULL;
-            }
-        } else if (c == 3) { // Ctrl+C
-            disable_raw_mode();
-            output_write("^C\n", 3);
-            buf[0] = '\0';
-            len = 0;
-            pos = 0;
-            enable_raw_mode();
-            output_write(prompt, strlen(prompt));
-        } else if (c == '\r' || c == '\n') { // Enter
-            disable_raw_mode();
-            output_write("\r\n", 2);
-            buf[len] = '\n';
-            buf[len + 1] = '\0';
-            return buf;
-        } else if (c >= 32 && c < 127) { // Printable character
-            // Expand buffer if needed
-            if (len + 2 >= capacity) {
-                if (capacity >= 1024 * 1024) { // 1MB limit
-                    disable_raw_mode();
-                    free(buf);
-                    fprintf(stderr, "\r\nLine too long\n");
-                    return NULL;
-                }
-                capacity *= 2;
-                char *new_buf = xrealloc(buf, capacity);
-                if (!new_buf) {
-                    disable_raw_mode();
-                    free(buf);
-                    return NULL;
-                }
-                buf = new_buf;
-            }
-            
-            // Insert character
-            memmove(buf + pos + 1, buf + pos, len - pos + 1);
-            buf[pos] = c;
-            pos++;
-            len++;
-            buf[len] = '\0';
-            refresh_line(prompt, buf, len, pos);
+        int key = read_key();
+        if (key == -1) {
+            result = ED_EOF;
+            break;
         }
+        result = editor_dispatch(&ed, key);
     }
+
+    disable_raw_mode();
+
+    if (result == ED_EOF) {
+        output_write("\r\n", 2);
+        editor_free(&ed);
+        return NULL;
+    }
+
+    output_write("\r\n", 2);
+    size_t len;
+    char *line = ed_text(&ed, &len);
+    line[len] = '\n';
+    line[len + 1] = '\0';
+    editor_free(&ed);
+    return line;
 }
@@ -0,0 +1,984 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include "lint.h"
+#include "ast.h"
+#include "error.h"
+#include "input.h"
+#include "lexer.h"
+#include "memalloc.h"
+#include "parser.h"
+
+// The linter parses a whole file with parser_parse_all() and walks the
+// tree once. Findings that need the whole file (variables never set,
+// functions never called) are decided from two name tables at the end;
+// everything is then sorted by position, filtered through the
+// suppression comments and reported.
+
+// Codes are what suppression comments name, so they never change
+#define CODE_UNQUOTED    "unquoted-expansion"
+#define CODE_UNSET       "unset-variable"
+#define CODE_UNUSED_FUNC "unused-function"
+#define CODE_UNREACHABLE "unreachable"
+#define CODE_CD          "unchecked-cd"
+#define CODE_CAT         "useless-cat"
+#define CODE_NON_POSIX   "non-posix"
+
+#define SUPPRESS_MARK "posish-lint:"
+
+// How far past the previous word the next word of a command is looked
+// for in the source, to give it a column
+#define WORD_WINDOW 4096
+
+struct finding {
+    SourcePos pos;
+    const char *severity;
+    const char *code;
+    size_t seq; // Keeps findings at the same place in walk order
+    char message[192];
+};
+
+enum {
+    NAME_SET = 1,       // Assigned somewhere in the file
+    NAME_USED = 2,      // Expanded without a default
+    NAME_DEFINED = 4,   // Defined as a function
+    NAME_MENTIONED = 8  // Appears in some word, so may be called
+};
+
+struct name {
+    const char *name;
+    size_t len;
+    int flags;
+    SourcePos pos; // First use of a variable, definition of a function
+};
+
+// Open addressing; names are copied to the arena
+struct name_table {
+    struct name *slots;
+    size_t cap;
+    size_t count;
+};
+
+struct suppression {
+    int line;
+    const char *codes; // Comma separated, or NULL for all
+    size_t codes_len;
+};
+
+struct linter {
+    const char *text;
+    size_t len;
+    int file;
+    struct name_table vars;
+    struct name_table funcs;
+    struct finding *findings;
+    size_t count;
+    size_t cap;
+    int errexit;
+};
+
+// Where the words being scanned came from, for positions
+struct word_ctx {
+    SourcePos pos;      // Of word[0]
+    const char *word;   // NULL when the text is not in the source as is
+    int check_quoting;  // Report unquoted expansions (command arguments)
+};
+
+static void add_finding(struct linter *l, SourcePos pos, const char *severity,
+                        const char *code, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+
+static void add_finding(struct linter *l, SourcePos pos, const char *severity,
+                        const char *code, const char *fmt, ...) {
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 32;
+        l->findings = xrealloc(l->findings, l->cap * sizeof(*l->findings));
+    }
+    struct finding *f = &l->findings[l->count];
+    f->pos = pos;
+    f->severity = severity;
+    f->code = code;
+    f->seq = l->count++;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(f->message, sizeof(f->message), fmt, ap);
+    va_end(ap);
+}
+
+static uint32_t name_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static struct name *name_lookup(struct name_table *t, const char *s, size_t len) {
+    if ((t->count + 1) * 2 > t->cap) {
+        struct name_table grown = {NULL, t->cap ? t->cap * 2 : 64, 0};
+        grown.slots = xmalloc(grown.cap * sizeof(struct name));
+        memset(grown.slots, 0, grown.cap * sizeof(struct name));
+        for (size_t i = 0; i < t->cap; i++) {
+            struct name *old = &t->slots[i];
+            if (!old->name) continue;
+            size_t k = name_hash(old->name, old->len) & (grown.cap - 1);
+            while (grown.slots[k].name) k = (k + 1) & (grown.cap - 1);
+            grown.slots[k] = *old;
+        }
+        grown.count = t->count;
+        free(t->slots);
+        *t = grown;
+    }
+
+    size_t k = name_hash(s, len) & (t->cap - 1);
+    while (t->slots[k].name) {
+        struct name *n = &t->slots[k];
+        if (n->len == len && memcmp(n->name, s, len) == 0) return n;
+        k = (k + 1) & (t->cap - 1);
+    }
+    char *copy = mem_stack_alloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    t->slots[k] = (struct name){copy, len, 0, {0, 0, 0, 0}};
+    t->count++;
+    return &t->slots[k];
+}
+
+static int is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static size_t name_length(const char *s) {
+    if (!is_name_start(*s)) return 0;
+    size_t n = 1;
+    while (is_name_char(s[n])) n++;
+    return n;
+}
+
+// A whole word that is a plain variable name
+static int is_name(const char *s) {
+    size_t n = name_length(s);
+    return n > 0 && s[n] == '\0';
+}
+
+static void mark_set(struct linter *l, const char *s, size_t len) {
+    name_lookup(&l->vars, s, len)->flags |= NAME_SET;
+}
+
+// Advance a position over text, which must be the source from pos on
+static SourcePos advance(SourcePos pos, const char *from, const char *to) {
+    for (const char *p = from; p < to; p++) {
+        if (*p == '\n') {
+            pos.line++;
+            pos.column = 1;
+        } else {
+            pos.column++;
+        }
+        pos.offset++;
+    }
+    return pos;
+}
+
+static SourcePos pos_in_word(const struct word_ctx *ctx, const char *p) {
+    return ctx->word ? advance(ctx->pos, ctx->word, p) : ctx->pos;
+}
+
+// memmem() is not in POSIX
+static const char *find_bytes(const char *hay, size_t len, const char *needle, size_t n) {
+    const char *end = hay + len;
+    while (n > 0 && (size_t)(end - hay) >= n) {
+        const char *p = memchr(hay, needle[0], (size_t)(end - hay) - n + 1);
+        if (!p) break;
+        if (memcmp(p, needle, n) == 0) return p;
+        hay = p + 1;
+    }
+    return NULL;
+}
+
+// Find the next word of a command in the source after *cursor
+static int find_word(struct linter *l, SourcePos *cursor, const char *word, SourcePos *found) {
+    size_t wlen = strlen(word);
+    if (wlen == 0 || cursor->offset >= l->len) return 0;
+    size_t avail = l->len - cursor->offset;
+    if (avail > WORD_WINDOW + wlen) avail = WORD_WINDOW + wlen;
+
+    const char *from = l->text + cursor->offset;
+    const char *hit = find_bytes(from, avail, word, wlen);
+    if (!hit) return 0;
+    *found = advance(*cursor, from, hit);
+    *cursor = advance(*found, hit, hit + wlen);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Expansions inside words
+
+enum {
+    EXP_PARAM,   // $name, ${...}
+    EXP_COMMAND, // $(...), `...`
+    EXP_ARITH,   // $((...))
+    EXP_ANSI     // $'...'
+};
+
+struct expansion {
+    int kind;
+    const char *start;
+    const char *name;
+    size_t name_len;
+    char op;       // Operator inside ${...}, or 0
+    int colon;     // The operator followed ':'
+    int length;    // ${#name}
+    int indirect;  // ${!name}
+    int quoted;
+};
+
+enum {
+    SCAN_QUOTED = 1,  // Everything is as if double-quoted
+    SCAN_HEREDOC = 2  // Quote characters are ordinary (here-document body)
+};
+
+static void scan_word(struct linter *l, const char *p, const char *end, int flags,
+                      const struct word_ctx *ctx);
+
+static const char *skip_single(const char *p, const char *end) {
+    for (p++; p < end && *p != '\''; p++) {}
+    return p < end ? p + 1 : end;
+}
+
+// p is at '('; returns the character after the matching ')'
+static const char *match_paren(const char *p, const char *end) {
+    int depth = 0;
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        } else if (*p == '\'') {
+            p = skip_single(p, end) - 1;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return end;
+}
+
+// p is at '{'; returns the matching '}' (or end)
+static const char *match_brace(const char *p, const char *end) {
+    int depth = 0;
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            return p;
+        }
+    }
+    return end;
+}
+
+static int is_arith_assignment(const char *q, const char *end) {
+    static const char *const ops[] = {
+        "=", "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=", "<<=", ">>=", "++", "--", NULL
+    };
+    for (int i = 0; ops[i]; i++) {
+        size_t n = strlen(ops[i]);
+        if (q + n > end || strncmp(q, ops[i], n) != 0) continue;
+        if (n == 1 && q + 1 < end && q[1] == '=') return 0; // ==
+        return 1;
+    }
+    return 0;
+}
+
+// Names assigned inside $((...)): x=, x+=, x<<=, x++ and the like
+static void scan_arith_assignments(struct linter *l, const char *p, const char *end) {
+    const char *start = p;
+    while (p < end) {
+        if (!is_name_start(*p) || (p > start && (is_name_char(p[-1]) || p[-1] == '$'))) {
+            p++;
+            continue;
+        }
+        size_t n = 1;
+        while (p + n < end && is_name_char(p[n])) n++;
+        const char *q = p + n;
+        while (q < end && (*q == ' ' || *q == '\t')) q++;
+        if (is_arith_assignment(q, end)) mark_set(l, p, n);
+        p = q;
+    }
+}
+
+static void report_expansion(struct linter *l, const struct expansion *e,
+                             const struct word_ctx *ctx) {
+    SourcePos pos = pos_in_word(ctx, e->start);
+
+    if (e->kind == EXP_ANSI) {
+        add_finding(l, pos, "warning", CODE_NON_POSIX, "$'...' quoting is not POSIX");
+        return;
+    }
+
+    if (e->kind == EXP_PARAM) {
+        const char *what = NULL;
+        if (e->indirect) what = "indirect expansion";
+        else if (e->op == '/') what = "pattern substitution";
+        else if (e->op == '^' || e->op == ',') what = "case conversion";
+        else if (e->colon && !strchr("-=?+", e->op)) what = "substring expansion";
+        if (what) {
+            add_finding(l, pos, "warning", CODE_NON_POSIX, "%s ${%s%.*s...} is not POSIX", what,
+                        e->indirect ? "!" : "", (int)e->name_len, e->name);
+        }
+
+        if (e->name_len > 0 && is_name_start(e->name[0])) {
+            if (e->op == '=') {
+                mark_set(l, e->name, e->name_len);
+            } else if (!e->op || !strchr("-?+", e->op)) {
+                struct name *n = name_lookup(&l->vars, e->name, e->name_len);
+                if (!(n->flags & NAME_USED)) {
+                    n->flags |= NAME_USED;
+                    n->pos = pos;
+                }
+            }
+        }
+    }
+
+    if (!ctx->check_quoting || e->quoted || e->kind == EXP_ARITH) return;
+    if (e->kind == EXP_PARAM) {
+        // Lengths and these specials cannot produce more than one field
+        if (e->length) return;
+        if (e->name_len == 1 && strchr("?#$!-", e->name[0])) return;
+        // A default such as ${x+--flag} is usually meant to vanish or split
+        if (e->op == '+') return;
+    }
+
+    if (e->kind == EXP_COMMAND) {
+        add_finding(l, pos, "warning", CODE_UNQUOTED,
+                    "command substitution is not quoted; its output is split into fields and globbed");
+    } else {
+        add_finding(l, pos, "warning", CODE_UNQUOTED,
+                    "$%.*s is not quoted; its value is split into fields and globbed",
+                    (int)e->name_len, e->name);
+    }
+}
+
+// Find the expansions in a word: report them and scan what is nested
+// inside them. The text runs from p to end.
+static void scan_word(struct linter *l, const char *p, const char *end, int flags,
+                      const struct word_ctx *ctx) {
+    int in_double = 0;
+    int heredoc = (flags & SCAN_HEREDOC) != 0;
+
+    while (p < end) {
+        char c = *p;
+        int quoted = in_double || (flags & SCAN_QUOTED);
+
+        if (c == '\\') {
+            p += p + 1 < end ? 2 : 1;
+            continue;
+        }
+        if (!heredoc && c == '\'' && !quoted) {
+            p = skip_single(p, end);
+            continue;
+        }
+        if (!heredoc && c == '"') {
+            in_double = !in_double;
+            p++;
+            continue;
+        }
+        if (c == '`') {
+            const char *close = p + 1;
+            while (close < end && *close != '`') close += (*close == '\\' && close + 1 < end) ? 2 : 1;
+            struct expansion e = {.kind = EXP_COMMAND, .start = p, .quoted = quoted};
+            report_expansion(l, &e, ctx);
+            scan_word(l, p + 1, close, SCAN_QUOTED, ctx);
+            p = close < end ? close + 1 : end;
+            continue;
+        }
+        if (c != '$' || p + 1 >= end) {
+            p++;
+            continue;
+        }
+
+        const char *q = p + 1;
+        struct expansion e = {.kind = EXP_PARAM, .start = p, .quoted = quoted};
+
+        if (*q == '\'' && !quoted && !heredoc) {
+            e.kind = EXP_ANSI;
+            report_expansion(l, &e, ctx);
+            for (q++; q < end && *q != '\''; q++) {
+                if (*q == '\\' && q + 1 < end) q++;
+            }
+            p = q < end ? q + 1 : end;
+            continue;
+        }
+
+        if (*q == '(') {
+            const char *after = match_paren(q, end);
+            e.kind = q + 1 < end && q[1] == '(' ? EXP_ARITH : EXP_COMMAND;
+            report_expansion(l, &e, ctx);
+            const char *inner_end = after > q + 1 && after[-1] == ')' ? after - 1 : after;
+            if (e.kind == EXP_ARITH) scan_arith_assignments(l, q + 1, inner_end);
+            scan_word(l, q + 1, inner_end, SCAN_QUOTED, ctx);
+            p = after;
+            continue;
+        }
+
+        if (*q == '{') {
+            const char *close = match_brace(q, end);
+            const char *r = q + 1;
+            if (*r == '#' && r + 1 < close) {
+                e.length = 1;
+                r++;
+            } else if (*r == '!' && r + 1 < close) {
+                e.indirect = 1;
+                r++;
+            }
+            e.name = r;
+            if (is_name_start(*r)) {
+                while (r < close && is_name_char(*r)) r++;
+            } else if (isdigit((unsigned char)*r)) {
+                while (r < close && isdigit((unsigned char)*r)) r++;
+            } else if (r < close) {
+                r++;
+            }
+            e.name_len = (size_t)(r - e.name);
+            if (r < close && *r == ':') {
+                e.colon = 1;
+                r++;
+            }
+            if (r < close) {
+                e.op = *r++;
+                if ((e.op == '#' || e.op == '%' || e.op == '/') && r < close && *r == e.op) r++;
+            } else if (e.colon) {
+                e.op = ':';
+            }
+            report_expansion(l, &e, ctx);
+            if (r < close) scan_word(l, r, close, SCAN_QUOTED, ctx);
+            p = close < end ? close + 1 : end;
+            continue;
+        }
+
+        size_t n = name_length(q);
+        if (n > 0) {
+            if (q + n > end) n = (size_t)(end - q);
+            e.name = q;
+            e.name_len = n;
+            report_expansion(l, &e, ctx);
+            p = q + n;
+            continue;
+        }
+        if (isdigit((unsigned char)*q) || (*q && strchr("@*#?-$!", *q))) {
+            e.name = q;
+            e.name_len = 1;
+            report_expansion(l, &e, ctx);
+            p = q + 1;
+            continue;
+        }
+        p++;
+    }
+}
+
+// Every piece of a word that could be a command name might call a
+// function: "trap cleanup EXIT", "$(helper)", "cmd=helper"
+static void mention_words(struct linter *l, const char *word) {
+    const char *p = word;
+    while (*p) {
+        size_t n = strcspn(p, " \t\n'\"`$(){};|&<>=\\");
+        if (n > 0) name_lookup(&l->funcs, p, n)->flags |= NAME_MENTIONED;
+        p += n;
+        if (*p) p++;
+    }
+}
+
+static void scan_uses(struct linter *l, const char *word, SourcePos pos) {
+    struct word_ctx ctx = {pos, NULL, 0};
+    scan_word(l, word, word + strlen(word), 0, &ctx);
+}
+
+// ---------------------------------------------------------------------------
+// The tree walk
+
+static SourcePos node_pos(ASTNode *node) {
+    while (node && node->pos.line == 0) {
+        if (node->type == NODE_LIST) node = node->data.list.left;
+        else if (node->type == NODE_PIPELINE || node->type == NODE_AND || node->type == NODE_OR) {
+            node = node->data.pipeline.left;
+        } else {
+            break;
+        }
+    }
+    return node ? node->pos : (SourcePos){0, 0, 0, 0};
+}
+
+static const char *command_name(ASTNode *node) {
+    if (!node || node->type != NODE_COMMAND || node->data.command.arg_count == 0) return NULL;
+    return node->data.command.args[0];
+}
+
+// The command never lets the list go on to the next one
+static const char *ends_flow(ASTNode *node) {
+    const char *name = command_name(node);
+    if (!name) return NULL;
+    if (strcmp(name, "exit") == 0 || strcmp(name, "return") == 0 ||
+        strcmp(name, "break") == 0 || strcmp(name, "continue") == 0) {
+        return name;
+    }
+    if (strcmp(name, "exec") == 0 && node->data.command.arg_count > 1) return name;
+    return NULL;
+}
+
+static void mark_read_operands(struct linter *l, CommandNode *cmd) {
+    size_t i = 1;
+    for (; i < cmd->arg_count && cmd->args[i][0] == '-' && cmd->args[i][1]; i++) {
+        if (strcmp(cmd->args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        // -d, -n, -p, -t and -u take a value, attached or as the next word
+        const char *opts = cmd->args[i] + 1;
+        size_t k = strcspn(opts, "dnptu");
+        if (opts[k] && !opts[k + 1]) i++;
+    }
+    for (; i < cmd->arg_count; i++) {
+        if (is_name(cmd->args[i])) mark_set(l, cmd->args[i], strlen(cmd->args[i]));
+    }
+}
+
+static int is_declaration(const char *name) {
+    return strcmp(name, "export") == 0 || strcmp(name, "local") == 0 ||
+           strcmp(name, "readonly") == 0;
+}
+
+static void check_builtin_uses(struct linter *l, ASTNode *node, int statement) {
+    CommandNode *cmd = &node->data.command;
+    const char *name = cmd->args[0];
+
+    if (strcmp(name, "read") == 0) {
+        mark_read_operands(l, cmd);
+    } else if (strcmp(name, "getopts") == 0 && cmd->arg_count > 2 && is_name(cmd->args[2])) {
+        mark_set(l, cmd->args[2], strlen(cmd->args[2]));
+    } else if (strcmp(name, "printf") == 0 && cmd->arg_count > 2 &&
+               strcmp(cmd->args[1], "-v") == 0 && is_name(cmd->args[2])) {
+        mark_set(l, cmd->args[2], strlen(cmd->args[2]));
+    } else if (is_declaration(name)) {
+        for (size_t i = 1; i < cmd->arg_count; i++) {
+            size_t n = name_length(cmd->args[i]);
+            if (n > 0 && (cmd->args[i][n] == '\0' || cmd->args[i][n] == '=')) {
+                mark_set(l, cmd->args[i], n);
+            }
+        }
+    } else if (strcmp(name, "set") == 0) {
+        for (size_t i = 1; i < cmd->arg_count; i++) {
+            const char *a = cmd->args[i];
+            if (a[0] == '-' && a[1] != '-' && a[1] != 'o' && strchr(a, 'e')) l->errexit = 1;
+            if (strcmp(a, "-o") == 0 && i + 1 < cmd->arg_count &&
+                strcmp(cmd->args[i + 1], "errexit") == 0) {
+                l->errexit = 1;
+            }
+        }
+    } else if (strcmp(name, "cd") == 0 && statement) {
+        add_finding(l, node->pos, "warning", CODE_CD,
+                    "cd can fail and the script then runs in the wrong directory; "
+                    "use `cd ... || exit'");
+    }
+
+    static const char *const non_posix[] = {
+        "[[", "source", "declare", "typeset", "let", "shopt", "pushd", "popd", NULL
+    };
+    for (int i = 0; non_posix[i]; i++) {
+        if (strcmp(name, non_posix[i]) == 0) {
+            add_finding(l, node->pos, "warning", CODE_NON_POSIX, "`%s' is not POSIX%s",
+                        name, strcmp(name, "source") == 0 ? "; use `.'" : "");
+        }
+    }
+    if (strcmp(name, "test") == 0 || strcmp(name, "[") == 0) {
+        for (size_t i = 1; i < cmd->arg_count; i++) {
+            if (strcmp(cmd->args[i], "==") == 0) {
+                add_finding(l, node->pos, "warning", CODE_NON_POSIX,
+                            "`==' in %s is not POSIX; use `='", name);
+                break;
+            }
+        }
+    }
+    if (strcmp(name, "echo") == 0 && cmd->arg_count > 1 && cmd->args[1][0] == '-' &&
+        strchr(cmd->args[1], 'e') && strspn(cmd->args[1] + 1, "neE") == strlen(cmd->args[1] + 1)) {
+        add_finding(l, node->pos, "warning", CODE_NON_POSIX,
+                    "echo %s is not portable; use printf", cmd->args[1]);
+    }
+}
+
+static void lint_command(struct linter *l, ASTNode *node, int statement) {
+    CommandNode *cmd = &node->data.command;
+
+    for (size_t i = 0; i < cmd->assignment_count; i++) {
+        Assignment *a = &cmd->assignments[i];
+        mark_set(l, a->name, strlen(a->name));
+        if (a->value) {
+            scan_uses(l, a->value, node->pos);
+            mention_words(l, a->value);
+        }
+    }
+
+    int declaration = cmd->arg_count > 0 && is_declaration(cmd->args[0]);
+    SourcePos cursor = node->pos;
+    for (size_t i = 0; i < cmd->arg_count; i++) {
+        const char *arg = cmd->args[i];
+        struct word_ctx ctx = {node->pos, NULL, 1};
+        if (find_word(l, &cursor, arg, &ctx.pos)) ctx.word = arg;
+
+        // export x=$y does not split $y
+        size_t n = name_length(arg);
+        if (declaration && i > 0 && n > 0 && arg[n] == '=') ctx.check_quoting = 0;
+
+        scan_word(l, arg, arg + strlen(arg), 0, &ctx);
+        mention_words(l, arg);
+    }
+
+    for (size_t i = 0; i < cmd->redirection_count; i++) {
+        Redirection *r = &cmd->redirections[i];
+        if (r->filename && r->type != REDIR_HEREDOC && r->type != REDIR_HEREDOC_DASH) {
+            scan_uses(l, r->filename, node->pos);
+        }
+        // A body is expanded unless its delimiter was quoted
+        if (r->here_doc_content && r->filename && !strpbrk(r->filename, "'\"\\")) {
+            struct word_ctx ctx = {node->pos, NULL, 0};
+            const char *body = r->here_doc_content;
+            scan_word(l, body, body + strlen(body), SCAN_HEREDOC, &ctx);
+        }
+    }
+
+    if (cmd->arg_count > 0) check_builtin_uses(l, node, statement);
+}
+
+static void lint_node(struct linter *l, ASTNode *node, int statement);
+
+// A list runs its commands in turn; one after exit or return never runs
+static void lint_list(struct linter *l, ASTNode *node, int statement) {
+    const char *ended = NULL;
+    int reported = 0;
+    while (node) {
+        ASTNode *item = node;
+        ASTNode *next = NULL;
+        int async = 0;
+        if (node->type == NODE_LIST) {
+            item = node->data.list.left;
+            next = node->data.list.right;
+            async = node->data.list.async;
+        }
+
+        if (ended && item && !reported) {
+            add_finding(l, node_pos(item), "warning", CODE_UNREACHABLE,
+                        "this command never runs: `%s' comes before it", ended);
+            reported = 1;
+        }
+        lint_node(l, item, statement);
+        if (!async && !ended) ended = ends_flow(item);
+        node = next;
+    }
+}
+
+static void lint_node(struct linter *l, ASTNode *node, int statement) {
+    if (!node) return;
+
+    switch (node->type) {
+        case NODE_COMMAND:
+            lint_command(l, node, statement);
+            break;
+
+        case NODE_LIST:
+            lint_list(l, node, statement);
+            break;
+
+        case NODE_PIPELINE: {
+            ASTNode *first = node->data.pipeline.left;
+            const char *name = command_name(first);
+            if (name && strcmp(name, "cat") == 0 && first->data.command.arg_count == 2 &&
+                first->data.command.args[1][0] != '-' &&
+                first->data.command.redirection_count == 0 &&
+                first->data.command.assignment_count == 0) {
+                add_finding(l, first->pos, "style", CODE_CAT,
+                            "useless cat: redirect `%s' into the next command with <",
+                            first->data.command.args[1]);
+            }
+            lint_node(l, node->data.pipeline.left, 0);
+            lint_node(l, node->data.pipeline.right, 0);
+            break;
+        }
+
+        case NODE_AND:
+        case NODE_OR:
+            lint_node(l, node->data.pipeline.left, 0);
+            lint_node(l, node->data.pipeline.right, 0);
+            break;
+
+        case NODE_NOT:
+            lint_node(l, node->data.prefixed.pipeline, 0);
+            break;
+
+        case NODE_TIME:
+            lint_node(l, node->data.prefixed.pipeline, statement);
+            break;
+
+        case NODE_IF:
+            lint_node(l, node->data.if_stmt.condition, 0);
+            lint_node(l, node->data.if_stmt.then_branch, 1);
+            lint_node(l, node->data.if_stmt.else_branch, 1);
+            break;
+
+        case NODE_WHILE:
+            lint_node(l, node->data.while_loop.condition, 0);
+            lint_node(l, node->data.while_loop.body, 1);
+            break;
+
+        case NODE_UNTIL:
+            lint_node(l, node->data.until_loop.condition, 0);
+            lint_node(l, node->data.until_loop.body, 1);
+            break;
+
+        case NODE_FOR:
+            mark_set(l, node->data.for_loop.var_name, strlen(node->data.for_loop.var_name));
+            // "for x in $list" splits on purpose
+            for (size_t i = 0; i < node->data.for_loop.word_count; i++) {
+                scan_uses(l, node->data.for_loop.word_list[i], node->pos);
+                mention_words(l, node->data.for_loop.word_list[i]);
+            }
+            lint_node(l, node->data.for_loop.body, 1);
+            break;
+
+        case NODE_CASE:
+            scan_uses(l, node->data.case_stmt.word, node->pos);
+            for (size_t i = 0; i < node->data.case_stmt.item_count; i++) {
+                CaseItem *item = &node->data.case_stmt.items[i];
+                for (char **pat = item->patterns; pat && *pat; pat++) {
+                    scan_uses(l, *pat, node->pos);
+                }
+                lint_node(l, item->commands, 1);
+            }
+            break;
+
+        case NODE_SUBSHELL:
+            lint_node(l, node->data.subshell.body, 1);
+            break;
+
+        case NODE_GROUP:
+            lint_node(l, node->data.group.body, 1);
+            break;
+
+        case NODE_FUNCTION: {
+            const char *name = node->data.function.name;
+            struct name *n = name_lookup(&l->funcs, name, strlen(name));
+            if (!(n->flags & NAME_DEFINED)) {
+                n->flags |= NAME_DEFINED;
+                n->pos = node->pos;
+            }
+            const char *src = l->text + node->pos.offset;
+            if (node->pos.offset + 9 <= l->len && strncmp(src, "function", 8) == 0 &&
+                (src[8] == ' ' || src[8] == '\t')) {
+                add_finding(l, node->pos, "warning", CODE_NON_POSIX,
+                            "the `function' keyword is not POSIX; use `%s()'", name);
+            }
+            lint_node(l, node->data.function.body, 1);
+            break;
+        }
+    }
+}
+
+static void lint_visit(ASTNode *node, void *arg) {
+    lint_node(arg, node, 1);
+}
+
+// ---------------------------------------------------------------------------
+// Suppression comments and reporting
+
+// "# posish-lint: ignore=code,code" (or just "ignore" for every code)
+// covers its own line, or the next line when the comment is alone
+static struct suppression *find_suppressions(const struct linter *l, size_t *count) {
+    struct suppression *list = NULL;
+    size_t n = 0;
+    size_t mark_len = strlen(SUPPRESS_MARK);
+    const char *line_start = l->text;
+    int line = 1;
+    const char *p = l->text;
+    const char *end = l->text + l->len;
+
+    while ((p = find_bytes(p, (size_t)(end - p), SUPPRESS_MARK, mark_len)) != NULL) {
+        for (const char *q = line_start; q < p; q++) {
+            if (*q == '\n') {
+                line++;
+                line_start = q + 1;
+            }
+        }
+        const char *hash = p;
+        while (hash > line_start && (hash[-1] == ' ' || hash[-1] == '\t')) hash--;
+        if (hash == line_start || hash[-1] != '#') {
+            p += mark_len;
+            continue;
+        }
+        hash--;
+        const char *before = line_start;
+        while (before < hash && (*before == ' ' || *before == '\t')) before++;
+
+        const char *q = p + mark_len;
+        while (*q == ' ' || *q == '\t') q++;
+        if (strncmp(q, "ignore", 6) != 0) {
+            p = q;
+            continue;
+        }
+        q += 6;
+        struct suppression s = {before == hash ? line + 1 : line, NULL, 0};
+        if (*q == '=') {
+            s.codes = ++q;
+            s.codes_len = strcspn(q, " \t\n");
+        }
+        list = xrealloc(list, (n + 1) * sizeof(*list));
+        list[n++] = s;
+        p = q;
+    }
+    *count = n;
+    return list;
+}
+
+static int compare_suppressions(const void *a, const void *b) {
+    const struct suppression *x = a;
+    const struct suppression *y = b;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+// The list is sorted by line
+static int is_suppressed(const struct finding *f, const struct suppression *list, size_t count) {
+    size_t code_len = strlen(f->code);
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list[mid].line < f->pos.line) lo = mid + 1;
+        else hi = mid;
+    }
+    for (size_t i = lo; i < count && list[i].line == f->pos.line; i++) {
+        if (!list[i].codes) return 1;
+        const char *c = list[i].codes;
+        const char *end = c + list[i].codes_len;
+        while (c < end) {
+            size_t n = strcspn(c, ",");
+            if (c + n > end) n = (size_t)(end - c);
+            if (n == code_len && memcmp(c, f->code, n) == 0) return 1;
+            c += n + 1;
+        }
+    }
+    return 0;
+}
+
+static int compare_findings(const void *a, const void *b) {
+    const struct finding *x = a;
+    const struct finding *y = b;
+    if (x->pos.offset != y->pos.offset) return x->pos.offset < y->pos.offset ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+// Returns the number of findings reported
+static int report_findings(struct linter *l) {
+    for (size_t i = 0; i < l->vars.cap; i++) {
+        struct name *n = &l->vars.slots[i];
+        if (!n->name || (n->flags & (NAME_USED | NAME_SET)) != NAME_USED) continue;
+        // Upper-case names are normally set by the environment
+        int lower = 0;
+        for (size_t k = 0; k < n->len; k++) {
+            if (islower((unsigned char)n->name[k])) lower = 1;
+        }
+        if (lower) {
+            add_finding(l, n->pos, "warning", CODE_UNSET,
+                        "`%s' is used but never assigned", n->name);
+        }
+    }
+    for (size_t i = 0; i < l->funcs.cap; i++) {
+        struct name *n = &l->funcs.slots[i];
+        if (n->name && (n->flags & (NAME_DEFINED | NAME_MENTIONED)) == NAME_DEFINED) {
+            add_finding(l, n->pos, "warning", CODE_UNUSED_FUNC,
+                        "function `%s' is defined but never called", n->name);
+        }
+    }
+
+    if (l->count == 0) return 0;
+    qsort(l->findings, l->count, sizeof(*l->findings), compare_findings);
+
+    size_t nsupp;
+    struct suppression *supp = find_suppressions(l, &nsupp);
+    if (nsupp > 1) qsort(supp, nsupp, sizeof(*supp), compare_suppressions);
+    int reported = 0;
+    for (size_t i = 0; i < l->count; i++) {
+        struct finding *f = &l->findings[i];
+        // set -e already stops the script when cd fails
+        if (l->errexit && strcmp(f->code, CODE_CD) == 0) continue;
+        if (is_suppressed(f, supp, nsupp)) continue;
+        diag_report(&f->pos, f->severity, f->code, "%s", f->message);
+        reported++;
+    }
+    free(supp);
+    return reported;
+}
+
+static int lint_one(const char *path) {
+    int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        error_sys("%s", path);
+        return 2;
+    }
+    size_t len;
+    char *text = input_read_all(fd, &len);
+    if (path) close(fd);
+    if (!text) {
+        error_sys("%s", path ? path : "standard input");
+        return 2;
+    }
+
+    struct linter l = {.text = text, .len = len, .file = input_file_id(path ? path : "-")};
+    struct stackmark smark;
+    mem_stack_push_mark(&smark);
+
+    // "#!/bin/sh -e" counts as set -e
+    if (strncmp(text, "#!", 2) == 0) {
+        size_t first = strcspn(text, "\n");
+        const char *opt = find_bytes(text, first, " -", 2);
+        if (opt && opt[2] != '-' && memchr(opt + 2, 'e', strcspn(opt + 2, " \n"))) l.errexit = 1;
+    }
+
+    Lexer lexer;
+    lexer_init(&lexer, text);
+    lexer.file = l.file;
+    lexer.no_alias = 1;
+    int status = 0;
+    if (parser_parse_all(&lexer, lint_visit, &l) > 0) {
+        status = 2;
+    } else if (report_findings(&l) > 0) {
+        status = 1;
+    }
+
+    mem_stack_pop_mark(&smark);
+    free(l.vars.slots);
+    free(l.funcs.slots);
+    free(l.findings);
+    free(text);
+    return status;
+}
+
+int lint_files(char **paths) {
+    if (!paths[0]) return lint_one(NULL);
+
+    int status = 0;
+    for (char **p = paths; *p; p++) {
+        int s = lint_one(*p);
+        if (s > status) status = s;
+    }
+    return status;
+}
@@ -20,6 +20,11 @@
 #include "error.h" 
 #include "memalloc.h"
 #include "input.h"
+#include "coverage.h"
+#include "cstack.h"
+#include "debugger.h"
+#include "deparse.h"
+#include "lint.h"
 #include "signals.h"
 #include "shell_options.h"
 #include "buf_output.h"
@@ -30,30 +35,8 @@
 #define HOST_NAME_MAX 255
 #endif
 
-/* SA_RESTART may not be defined on all systems (e.g., QNX) */
-#ifndef SA_RESTART
-#define SA_RESTART 0
-#endif
-
 extern char **environ;
 
-void sigchld_handler(int sig) {
-    (void)sig;
-    int status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-        if (WIFEXITED(status) || WIFSIGNALED(status)) {
-            job_update_status(pid, JOB_DONE);
-            // Ideally remove it, but we might want to show "Done" once.
-            // For now, let's just update.
-        } else if (WIFSTOPPED(status)) {
-            job_update_status(pid, JOB_STOPPED);
-        } else if (WIFCONTINUED(status)) {
-            job_update_status(pid, JOB_RUNNING);
-        }
-    }
-}
-
 char *expand_prompt(const char *ps1) {
     if (!ps1) return strdup(geteuid() == 0 ? "# " : "$ ");
     
@@ -148,49 +131,18 @@ void print_prompt(void) {
 // Forward declaration
 
 static int run_script_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) return 0; // Silent fail for startup files? Or return error?
-    // For startup files we usually ignore if not found, but here we pass existing files.
-    // If called from main for script arg, we should error.
-    // Let's make it return status.
-    
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    char *content = malloc(file_size + 1);
-    if (!content) {
-        fclose(file);
-        return 1;
-    }
+    int fd = input_open_script(filename);
+    if (fd < 0) return 0; // Startup files are skipped silently if unreadable
 
-    size_t bytes_read = fread(content, 1, file_size, file);
-    content[bytes_read] = '\0';
-    fclose(file);
+    // Commands are read and run one at a time so that set -v echoes each
+    // line as it is consumed and earlier commands (aliases, set) can
+    // affect how later lines are read.
+    InputSource src;
+    input_source_fd(&src, fd);
+    src.file = input_file_id(filename);
+    int status = executor_run_source(&src);
 
-    Lexer lexer;
-    lexer_init(&lexer, content);
-    
-    // Fast-path: Skip parser for simple commands
-    if (parser_try_fast_path(content)) {
-        free(content);
-        return 0;
-    }
-    
-    struct stackmark smark;
-    mem_stack_push_mark(&smark);
-    
-    ASTNode *ast = parser_parse(&lexer);
-    
-    int status = 0;
-    if (ast) {
-        status = executor_execute(ast);
-        ast_free(ast);
-    }
-    
-    mem_stack_pop_mark(&smark);
-    
-    free(content);
+    input_source_close(&src);
     return status;
 }
 
@@ -200,7 +152,56 @@ static int run_script_file(const char *filename) {
 
 #include "buf_output.h" // Added
 
-int main(int argc, char **argv) {
+// Where the next command read by the REPL starts
+static int repl_line = 1;
+static size_t repl_offset = 0;
+
+// Set once "set -n" has found a syntax error in standard input
+static int check_failed = 0;
+
+// Run one complete command read by the REPL. In an interactive shell an
+// error abandons that command only; the shell goes on with the next one.
+static void run_command(const char *text, int interactive) {
+    struct jmploc jl;
+    if (interactive) {
+        if (setjmp(jl.loc)) {
+            executor_set_last_status(exception_status);
+            shell_ignore_errexit = 0;
+            return;
+        }
+        exception_push(&jl);
+    }
+
+    if (shell_no_exec && !interactive) {
+        Lexer lexer;
+        lexer_init(&lexer, text);
+        lexer.current_line = repl_line;
+        lexer.base_offset = repl_offset;
+        if (parser_check(&lexer) > 0) check_failed = 1;
+    } else if (parser_try_fast_path(text)) {
+        // Fast-path optimization: Skip parser for common trivial patterns
+        // Design inspired by FreeBSD sh architecture (BSD-3-Clause)
+        history_add(text);
+    } else {
+        // Normal path: use parser
+        Lexer lexer;
+        lexer_init(&lexer, text);
+        lexer.current_line = repl_line;
+        lexer.base_offset = repl_offset;
+        ASTNode *ast = parser_parse(&lexer);
+        if (ast) {
+            history_add(text);
+            executor_execute(ast);
+            ast_free(ast);
+        } else {
+            executor_set_last_status(2);
+        }
+    }
+
+    if (interactive) exception_pop(&jl);
+}
+
+static int shell_main(int argc, char **argv) {
     // Initialize buffered output system
     buf_out_init();
     atexit(buf_out_flush_all);
@@ -212,17 +213,63 @@ int main(int argc, char **argv) {
     posish_var_set_shell_name(argv[0]);
     
     int is_login_shell = (argv[0][0] == '-');
+    const char *base_name = strrchr(argv[0], '/');
+    base_name = base_name ? base_name + 1 : argv[0] + is_login_shell;
+    // Restrictions start once the startup files have been read
+    int restricted = strcmp(base_name, "rposish") == 0;
     int force_interactive = 0;
     int read_from_stdin = 0;
     const char *command_string = NULL;
     const char *command_name = NULL;
+    int lint = 0;
+    int format = 0;
+    const char *coverage = NULL;
+    int debug = 0;
     int arg_idx = 1;
     
-    // Check for --login flag
-    if (argc > 1 && strcmp(argv[1], "--login") == 0) {
-        is_login_shell = 1;
-        arg_idx++;
+    // Long options come before the POSIX ones
+    for (; arg_idx < argc && strncmp(argv[arg_idx], "--", 2) == 0 && argv[arg_idx][2]; arg_idx++) {
+        const char *opt = argv[arg_idx] + 2;
+        if (strcmp(opt, "login") == 0) {
+            is_login_shell = 1;
+        } else if (strcmp(opt, "diagnostics=json") == 0) {
+            diag_format = DIAG_JSON;
+        } else if (strcmp(opt, "diagnostics=text") == 0) {
+            diag_format = DIAG_TEXT;
+        } else if (strcmp(opt, "lint") == 0) {
+            lint = 1;
+        } else if (strcmp(opt, "format") == 0) {
+            format = 1;
+        } else if (strcmp(opt, "debug") == 0) {
+            debug = 1;
+        } else if (strncmp(opt, "coverage=", 9) == 0 && opt[9]) {
+            coverage = opt + 9;
+        } else {
+            fprintf(stderr, "%s: --%s: invalid option\n", argv[0], opt);
+            return 2;
+        }
+    }
+
+    // posish --lint [file...] checks scripts instead of running them
+    if (lint) return lint_files(&argv[arg_idx]);
+    // and posish --format [file...] prints them in canonical layout
+    if (format) return format_files(&argv[arg_idx]);
+
+    // --coverage=FILE is handed to every shell started from this one
+    // through the environment, so their counts end up in the same file
+    if (coverage) {
+        char cwd[PATH_MAX];
+        char *path = NULL;
+        if (coverage[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+            path = xmalloc(strlen(cwd) + strlen(coverage) + 2);
+            sprintf(path, "%s/%s", cwd, coverage);
+        }
+        posish_var_set("POSISH_COVERAGE", path ? path : coverage);
+        posish_var_export("POSISH_COVERAGE");
+        free(path);
     }
+    const char *coverage_path = posish_var_get_value("POSISH_COVERAGE");
+    if (coverage_path && *coverage_path) coverage_start(coverage_path);
     
     // Parse options following POSIX sh spec
     while (arg_idx < argc && argv[arg_idx][0] == '-' && argv[arg_idx][1] != '\0') {
@@ -271,14 +318,26 @@ int main(int argc, char **argv) {
                 case 's':
                     read_from_stdin = 1;
                     break;
+
+                case 'r':
+                    restricted = 1;
+                    break;
                     
                 case 'x':  // trace mode
                     shell_trace_mode = 1;
                     break;
                     
-                // Note: Other set options (e,f,v,n,u,a,m,b,C,h) would go here
+                case 'v':  // verbose mode
+                    shell_verbose = 1;
+                    break;
+                    
+                case 'n':  // read commands without running them
+                    shell_no_exec = 1;
+                    break;
+
+                // Note: Other set options (e,f,u,a,m,b,C,h) would go here
                 // For now we'll just accept and ignore them to avoid errors
-                case 'e': case 'f': case 'v': case 'n': case 'u':
+                case 'e': case 'f': case 'u':
                 case 'a': case 'm': case 'b': case 'C': case 'h':
                     // Accepted but not yet implemented
                     break;
@@ -318,34 +377,13 @@ done_parsing_options:
             }
         }
         
+        if (debug && debugger_start() != 0) return 2;
+        shell_restricted = restricted;
+
         // Execute command string
-        // FAST-PATH: Skip parser for simple commands
-        if (parser_try_fast_path(command_string)) {
-            signal_trigger_exit();
-            buf_out_flush_all();
-            return 0;
-        }
-        
-        // Full parse path
-        Lexer lexer;
-        lexer_init(&lexer, command_string);
-        
-        struct stackmark smark;
-        mem_stack_push_mark(&smark);
-        
-        ASTNode *ast = parser_parse(&lexer);
-        
-        int status = 0;
-        if (ast) {
-            status = executor_execute(ast);
-            ast_free(ast);
-        } else {
-            fprintf(stderr, "%s: parse error\n", argv[0]);
-            mem_stack_pop_mark(&smark);
-            return 2;
-        }
-        
-        mem_stack_pop_mark(&smark);
+        InputSource src;
+        input_source_string(&src, command_string);
+        int status = executor_run_source(&src);
         
         signal_trigger_exit();
         buf_out_flush_all();
@@ -366,12 +404,19 @@ done_parsing_options:
              fprintf(stderr, "%s: %s: No such file or directory\n", argv[0], filename);
              return 127;
         }
+        if (debug && debugger_start() != 0) return 2;
+        shell_restricted = restricted;
         int status = run_script_file(filename);
         signal_trigger_exit();
         buf_out_flush_all();
         return status;
     }
 
+    if (debug) {
+        fprintf(stderr, "%s: --debug: a script or -c command is required\n", argv[0]);
+        return 2;
+    }
+
     // Determine if this is an interactive shell
     // Interactive if: -i flag OR (stdin is terminal AND no -c or script file)
     int is_interactive = force_interactive || 
@@ -439,26 +484,14 @@ done_parsing_options:
         }
     }
 
+    shell_restricted = restricted;
+
     if (is_interactive) {
         // Interactive mode setup
+        shell_interactive = 1;
         
         // Only attempt job control if we are attached to a terminal
-        if (isatty(STDIN_FILENO)) {
-            // Put shell in its own process group
-            while (tcgetpgrp(STDIN_FILENO) != (getpgrp())) {
-                kill(-getpgrp(), SIGTTIN);
-            }
-            
-            signal(SIGINT, SIG_IGN);
-            signal(SIGQUIT, SIG_IGN);
-            signal(SIGTSTP, SIG_IGN);
-            signal(SIGTTIN, SIG_IGN);
-            signal(SIGTTOU, SIG_IGN);
-            
-            pid_t pid = getpid();
-            setpgid(pid, pid);
-            tcsetpgrp(STDIN_FILENO, pid);
-        }
+        job_control_init();
         
         // Initialize history
         const char *home = getenv("HOME");
@@ -469,23 +502,22 @@ done_parsing_options:
         }
     }
 
-    struct sigaction sa;
-    sa.sa_handler = sigchld_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGCHLD, &sa, NULL);
-
     // REPL Loop
     char *command_buffer = NULL;
 
     while (1) {
-        signal_check_pending();
+        // At the prompt a SIGINT has nothing left to interrupt
+        if (is_interactive) got_sigint = 0;
+        SIGNAL_POLL();
         
         // Flush buffered output before reading input
         buf_out_flush(&buf_stdout);
         
         char *prompt_str = NULL;
         if (is_interactive) {
+            // Report background jobs that finished or stopped
+            if (!command_buffer) job_notify();
+
             if (command_buffer) {
                 char *ps2_val = posish_var_get("PS2");
                 const char *ps2 = ps2_val ? ps2_val : "> ";
@@ -501,11 +533,21 @@ done_parsing_options:
         
         char *line = read_line(prompt_str);
         if (prompt_str) free(prompt_str);
+        input_echo_line(line);
         
         if (!line) {
             if (command_buffer) {
                 // EOF during incomplete command
-                fprintf(stderr, "\n%s: syntax error: unexpected end of file\n", argv[0]);
+                SourcePos pos = {0, repl_line, 1, repl_offset};
+                const char *missing = lexer_incomplete_missing(lexer_check_incomplete(command_buffer));
+                if (is_interactive) fputc('\n', stderr);
+                if (missing) {
+                    diag_report(&pos, "error", "syntax",
+                                "syntax error: unexpected end of file (expected `%s')", missing);
+                } else {
+                    diag_report(&pos, "error", "syntax", "syntax error: unexpected end of file");
+                }
+                executor_set_last_status(2);
                 free(command_buffer);
                 command_buffer = NULL;
             } else if (is_interactive) {
@@ -536,33 +578,16 @@ done_parsing_options:
         // Check if complete
         if (lexer_check_incomplete(command_buffer) == 0) {
             // Complete!
-            Lexer lexer;
-            lexer_init(&lexer, command_buffer);
-            
             struct stackmark smark;
             mem_stack_push_mark(&smark);
-            
-            
-            // Fast-path optimization: Skip parser for common trivial patterns
-            // Design inspired by FreeBSD sh architecture (BSD-3-Clause)
-            if (parser_try_fast_path(command_buffer)) {
-                history_add(command_buffer);
-                free(command_buffer);
-                command_buffer = NULL;
-                mem_stack_pop_mark(&smark);
-                continue;
-            }
-            
-            // Normal path: use parser
-            ASTNode *ast = parser_parse(&lexer);
 
-            if (ast) {
-                history_add(command_buffer);
-                executor_execute(ast);
-                ast_free(ast);
-            }
-            
+            run_command(command_buffer, is_interactive);
+
             mem_stack_pop_mark(&smark);
+            for (const char *p = command_buffer; *p; p++) {
+                if (*p == '\n') repl_line++;
+            }
+            repl_offset += strlen(command_buffer);
             
             free(command_buffer);
             command_buffer = NULL;
@@ -572,5 +597,9 @@ done_parsing_options:
 
     signal_trigger_exit();
     buf_out_flush_all();
-    return 0;
+    return check_failed ? 2 : executor_get_last_status();
+}
+
+int main(int argc, char **argv) {
+    return cstack_run(shell_main, argc, argv);
 }
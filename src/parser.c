@@ -6,6 +6,7 @@
 #include "ast.h"
 #include "error.h"
 #include "alias.h"
+#include "cstack.h"
 #include "variables.h"
 #include "memalloc.h"
 #include "memalloc.h"  // TODO: remove duplicate
@@ -16,10 +17,24 @@
 #include <ctype.h>
 
 // Forward declarations
+// A here-document whose body starts after the next newline token
+typedef struct {
+    ASTNode *cmd;
+    size_t index;       // Index into cmd's redirections
+    char *delimiter;
+    int strip_tabs;
+} PendingHeredoc;
+
 typedef struct {
     Lexer *lexer;
     Token current_token;
     int has_token;
+    PendingHeredoc *heredocs;
+    size_t heredoc_count;
+    int errors;         // Syntax errors reported so far
+    int failed;         // The command being parsed has an error
+    int depth;          // Compound commands open at the current token
+    int open_at_error;  // Compound commands left open by the error
 } Parser;
 
 // Fast-path handler - returns 1 if handled, 0 if needs full parse
@@ -78,7 +93,10 @@ int parser_try_fast_path(const char *cmd) {
                 strncpy(value, val_start, val_len);
                 value[val_len] = '\0';
                 
-                posish_var_set(name, value);
+                if (posish_var_set(name, value) != 0) {
+                    // Readonly variable, an error like in the executor
+                    exception_raise(1);
+                }
                 // Success status handled normally (return 0 usually)
                 return 1;
             }
@@ -101,10 +119,26 @@ static ASTNode *parse_simple_command(Parser *parser);
 
 
 
+// Read the bodies of here-documents queued on the line just finished
+static void parser_read_heredocs(Parser *parser) {
+    for (size_t i = 0; i < parser->heredoc_count; i++) {
+        PendingHeredoc *h = &parser->heredocs[i];
+        char *content = lexer_read_until_delimiter(parser->lexer, h->delimiter, h->strip_tabs);
+        h->cmd->data.command.redirections[h->index].here_doc_content = mem_stack_strdup(content);
+        free(content);
+        free(h->delimiter);
+    }
+    parser->heredoc_count = 0;
+}
+
 static Token parser_peek(Parser *parser) {
     if (!parser->has_token) {
         parser->current_token = lexer_next_token(parser->lexer);
         parser->has_token = 1;
+        if (parser->heredoc_count > 0 &&
+            (parser->current_token.type == TOKEN_NEWLINE || parser->current_token.type == TOKEN_EOF)) {
+            parser_read_heredocs(parser);
+        }
     }
     return parser->current_token;
 }
@@ -117,50 +151,103 @@ static Token parser_consume(Parser *parser) {
 
 static ASTNode *parse_list(Parser *parser);
 
+// Reserved words are only reserved where a command starts; anywhere a
+// word is expected they are ordinary words (echo done)
+static int is_word(Token token) {
+    return token.type == TOKEN_WORD || token.type == TOKEN_KEYWORD;
+}
+
+// Count a syntax error. Only the first error of a command is reported;
+// the callers above it just unwind. Returns whether to report this one.
+static int parser_fail(Parser *parser) {
+    if (parser->failed) return 0;
+    parser->failed = 1;
+    parser->errors++;
+    parser->open_at_error = parser->depth;
+    return !parser->lexer->quiet;
+}
+
+// Report a syntax error at token, naming what the grammar wanted there
+// if known
+static void parser_error_at(Parser *parser, Token token, const char *expected) {
+    if (!parser_fail(parser)) return;
+
+    char expectation[64] = "";
+    if (expected) snprintf(expectation, sizeof(expectation), " (expected `%s')", expected);
+
+    if (token.type == TOKEN_EOF) {
+        diag_report(&token.pos, "error", "syntax",
+                    "syntax error: unexpected end of file%s", expectation);
+    } else {
+        diag_report(&token.pos, "error", "syntax",
+                    "syntax error near unexpected token `%s'%s",
+                    token.type == TOKEN_NEWLINE ? "newline" : token.value, expectation);
+    }
+}
+
+// The same at the current token
+static void parser_error(Parser *parser, const char *expected) {
+    parser_error_at(parser, parser_peek(parser), expected);
+}
+
+static int is_closing_keyword(Token token) {
+    if (token.type == TOKEN_OPERATOR) {
+        return strcmp(token.value, ")") == 0 || strcmp(token.value, ";;") == 0;
+    }
+    if (token.type != TOKEN_KEYWORD) return 0;
+    static const char *const closers[] = {
+        "then", "else", "elif", "fi", "do", "done", "in", "esac", "}", NULL
+    };
+    for (int i = 0; closers[i]; i++) {
+        if (strcmp(token.value, closers[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// After an error, skip to the end of the line. The rest of a compound
+// command the error left open is skipped too, so that its closing "fi"
+// or "done" is not reported again.
+static void parser_synchronize(Parser *parser) {
+    int open = parser->open_at_error;
+    while (1) {
+        Token token = parser_peek(parser);
+        if (token.type == TOKEN_EOF) break;
+        parser_consume(parser);
+        if (token.type == TOKEN_KEYWORD) {
+            if (strcmp(token.value, "if") == 0 || strcmp(token.value, "while") == 0 ||
+                strcmp(token.value, "until") == 0 || strcmp(token.value, "for") == 0 ||
+                strcmp(token.value, "case") == 0 || strcmp(token.value, "{") == 0) {
+                open++;
+            } else if (open > 0 && (strcmp(token.value, "fi") == 0 ||
+                                    strcmp(token.value, "done") == 0 ||
+                                    strcmp(token.value, "esac") == 0 ||
+                                    strcmp(token.value, "}") == 0)) {
+                open--;
+            }
+        }
+        int newline = (token.type == TOKEN_NEWLINE);
+        free_token(token);
+        if (newline && (open == 0 || !is_closing_keyword(parser_peek(parser)))) break;
+    }
+    parser->failed = 0;
+    parser->depth = 0;
+}
+
 ASTNode *parser_parse(Lexer *lexer) {
-    Parser parser = {lexer, {0, NULL, 0}, 0};
+    Parser parser = {.lexer = lexer};
     
     // Parse a list (top level)
     ASTNode *node = parse_list(&parser);
     
-    // Check for unexpected tokens left over
-    if (parser.has_token) {
-        Token token = parser.current_token;
+    // Whatever stopped the list at the top level is out of place there
+    if (!parser.failed) {
+        Token token = parser_peek(&parser);
         if (token.type != TOKEN_EOF && token.type != TOKEN_NEWLINE) {
-            // If we have a node, we might have parsed "cmd; fi"
-            // If we don't have a node, we might have parsed "fi"
-            
-            // If it's a keyword that terminates a block, it's unexpected here
-            if (token.type == TOKEN_KEYWORD) {
-                if (strcmp(token.value, "then") == 0 || strcmp(token.value, "else") == 0 || 
-                    strcmp(token.value, "fi") == 0 || strcmp(token.value, "do") == 0 || 
-                    strcmp(token.value, "done") == 0 || strcmp(token.value, "esac") == 0 ||
-                    strcmp(token.value, "}") == 0) {
-                        
-                    char *shell_name = posish_var_get_shell_name();
-                    fprintf(stderr, "%s: syntax error near unexpected token `%s'\n", 
-                            shell_name ? shell_name : "posish", token.value);
-                    if (shell_name) free(shell_name);
-                    if (node) ast_free(node);
-                    free_token(token);
-                    return NULL;
-                }
-            }
-            // Also check for unexpected operators like ';;' or ')'
-            if (token.type == TOKEN_OPERATOR) {
-                if (strcmp(token.value, ";;") == 0 || strcmp(token.value, ")") == 0) {
-                    char *shell_name = posish_var_get_shell_name();
-                    fprintf(stderr, "%s: syntax error near unexpected token `%s'\n",
-                            shell_name ? shell_name : "posish", token.value);
-                    if (shell_name) free(shell_name);
-                    if (node) ast_free(node);
-                    free_token(token);
-                    return NULL;
-                }
-            }
+            parser_error(&parser, NULL);
         }
-        free_token(parser.current_token);
     }
+    if (parser.has_token) free_token(parser.current_token);
+    if (parser.failed) return NULL;
     
     // If parse_list returns NULL (empty input), return empty command
     if (!node) {
@@ -169,26 +256,62 @@ ASTNode *parser_parse(Lexer *lexer) {
     
     return node;
 }
+
+int parser_check(Lexer *lexer) {
+    return parser_parse_all(lexer, NULL, NULL);
+}
+
+int parser_parse_all(Lexer *lexer, void (*visit)(ASTNode *node, void *arg), void *arg) {
+    Parser parser = {.lexer = lexer};
+
+    while (1) {
+        Token token = parser_peek(&parser);
+        if (token.type == TOKEN_EOF) break;
+        if (token.type == TOKEN_NEWLINE) {
+            free_token(parser_consume(&parser));
+            continue;
+        }
+
+        ASTNode *node = parse_list(&parser);
+        if (!parser.failed) {
+            token = parser_peek(&parser);
+            if (token.type != TOKEN_EOF && token.type != TOKEN_NEWLINE) {
+                parser_error(&parser, NULL);
+            }
+        }
+        if (parser.failed) {
+            parser_synchronize(&parser);
+        } else if (node && visit) {
+            visit(node, arg);
+        }
+    }
+    if (parser.has_token) free_token(parser.current_token);
+    return parser.errors;
+}
 static ASTNode *parse_compound_list(Parser *parser, const char *terminator);
 
 static ASTNode *parse_if_tail(Parser *parser);
 
 static ASTNode *parse_if_statement(Parser *parser) {
     Token token = parser_consume(parser);
-    int lineno = token.lineno;
+    SourcePos pos = token.pos;
     free_token(token);
     
     ASTNode *node = parse_if_tail(parser);
-    if (node) node->lineno = lineno;
+    if (node) node->pos = pos;
     return node;
 }
 
 static ASTNode *parse_if_tail(Parser *parser) {
     ASTNode *condition = parse_compound_list(parser, "then");
-    if (!condition) return NULL;
+    if (!condition) {
+        parser_error(parser, NULL);
+        return NULL;
+    }
     
     Token token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "then") != 0) {
+        parser_error(parser, "then");
         ast_free(condition);
         return NULL;
     }
@@ -203,11 +326,11 @@ static ASTNode *parse_if_tail(Parser *parser) {
     if (token.type == TOKEN_KEYWORD) {
         if (strcmp(token.value, "elif") == 0) {
             token = parser_consume(parser);
-            int lineno = token.lineno;
+            SourcePos pos = token.pos;
             free_token(token);
             
             else_branch = parse_if_tail(parser);
-            if (else_branch) else_branch->lineno = lineno;
+            if (else_branch) else_branch->pos = pos;
             else {
                 ast_free(condition);
                 if (then_branch) ast_free(then_branch);
@@ -221,6 +344,7 @@ static ASTNode *parse_if_tail(Parser *parser) {
             
             token = parser_peek(parser);
             if (token.type != TOKEN_KEYWORD || strcmp(token.value, "fi") != 0) {
+                parser_error(parser, "fi");
                 ast_free(condition);
                 if (then_branch) ast_free(then_branch);
                 if (else_branch) ast_free(else_branch);
@@ -232,13 +356,13 @@ static ASTNode *parse_if_tail(Parser *parser) {
             token = parser_consume(parser);
             free_token(token);
         } else {
-            // Error
+            parser_error(parser, "fi");
             ast_free(condition);
             if (then_branch) ast_free(then_branch);
             return NULL;
         }
     } else {
-        // Error
+        parser_error(parser, "fi");
         ast_free(condition);
         if (then_branch) ast_free(then_branch);
         return NULL;
@@ -252,14 +376,18 @@ static int parse_redirection(Parser *parser, ASTNode *cmd);
 static ASTNode *parse_while_loop(Parser *parser) {
     // Expect 'while'
     Token token = parser_consume(parser);
-    int lineno = token.lineno;
+    SourcePos pos = token.pos;
     free_token(token);
     
     ASTNode *condition = parse_compound_list(parser, "do");
-    if (!condition) return NULL;
+    if (!condition) {
+        parser_error(parser, NULL);
+        return NULL;
+    }
     
     token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "do") != 0) {
+        parser_error(parser, "do");
         ast_free(condition);
         return NULL;
     }
@@ -270,6 +398,7 @@ static ASTNode *parse_while_loop(Parser *parser) {
     
     token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "done") != 0) {
+        parser_error(parser, "done");
         ast_free(condition);
         if (body) ast_free(body);
         return NULL;
@@ -278,20 +407,25 @@ static ASTNode *parse_while_loop(Parser *parser) {
     free_token(token);
     
     ASTNode *node = ast_new_while(condition, body);
-    node->lineno = lineno;
+    node->pos = pos;
     return node;
 }
 
 static ASTNode *parse_until_loop(Parser *parser) {
     // Expect 'until'
     Token token = parser_consume(parser);
+    SourcePos pos = token.pos;
     free_token(token);
     
     ASTNode *condition = parse_compound_list(parser, "do");
-    if (!condition) return NULL;
+    if (!condition) {
+        parser_error(parser, NULL);
+        return NULL;
+    }
     
     token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "do") != 0) {
+        parser_error(parser, "do");
         ast_free(condition);
         return NULL;
     }
@@ -302,6 +436,7 @@ static ASTNode *parse_until_loop(Parser *parser) {
     
     token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "done") != 0) {
+        parser_error(parser, "done");
         ast_free(condition);
         if (body) ast_free(body);
         return NULL;
@@ -309,18 +444,21 @@ static ASTNode *parse_until_loop(Parser *parser) {
     token = parser_consume(parser);
     free_token(token);
     
-    return ast_new_until(condition, body);
+    ASTNode *node = ast_new_until(condition, body);
+    node->pos = pos;
+    return node;
 }
 
 static ASTNode *parse_for_loop(Parser *parser) {
     // Expect 'for'
     Token token = parser_consume(parser);
-    int lineno = token.lineno;
+    SourcePos pos = token.pos;
     free_token(token);
     
     // Expect variable name
     token = parser_peek(parser);
     if (token.type != TOKEN_WORD) {
+        parser_error(parser, "name");
         return NULL;
     }
     char *var_name = mem_stack_strdup(token.value); // Copy before freeing
@@ -338,19 +476,9 @@ static ASTNode *parse_for_loop(Parser *parser) {
         token = parser_consume(parser);
         free_token(token);
         
-        // Collect words until we hit ';' or 'do'
-        while (1) {
-            token = parser_peek(parser);
-            if (token.type == TOKEN_EOF || token.type == TOKEN_NEWLINE) {
-                break;
-            }
-            if (token.type == TOKEN_OPERATOR && strcmp(token.value, ";") == 0) {
-                break;
-            }
-            if (token.type == TOKEN_KEYWORD && strcmp(token.value, "do") == 0) {
-                break;
-            }
-            
+        // Collect words until the ';' or newline before 'do'. Reserved
+        // words are words here too (for i in do done)
+        while (is_word(token = parser_peek(parser))) {
             // Add word to list
             word_list = mem_stack_realloc_array(word_list, word_count, word_count + 1, sizeof(char*));
             word_list[word_count++] = mem_stack_strdup(token.value);
@@ -384,6 +512,7 @@ static ASTNode *parse_for_loop(Parser *parser) {
     token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "do") != 0) {
         // Stack cleanup handles word_list
+        parser_error(parser, "do");
         return NULL;
     }
     token = parser_consume(parser);
@@ -395,6 +524,7 @@ static ASTNode *parse_for_loop(Parser *parser) {
     // Expect 'done'
     token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "done") != 0) {
+        parser_error(parser, "done");
         if (body) ast_free(body);
         return NULL;
     }
@@ -402,18 +532,22 @@ static ASTNode *parse_for_loop(Parser *parser) {
     free_token(token);
     
     ASTNode *node = ast_new_for(var_name, word_list, word_count, body);
-    node->lineno = lineno;
+    node->pos = pos;
     return node;
 }
 
 static ASTNode *parse_case_statement(Parser *parser) {
     // Expect 'case'
     Token token = parser_consume(parser);
+    SourcePos pos = token.pos;
     free_token(token);
 
     // Expect word
     token = parser_peek(parser);
-    if (token.type != TOKEN_WORD) return NULL;
+    if (!is_word(token)) {
+        parser_error(parser, "word");
+        return NULL;
+    }
     char *word = mem_stack_strdup(token.value); // Copy before freeing token
     token = parser_consume(parser);
     free_token(token);
@@ -424,12 +558,12 @@ static ASTNode *parse_case_statement(Parser *parser) {
         free_token(nl);
     }
     
-    token = parser_consume(parser);
+    token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "in") != 0) {
-        free_token(token);
+        parser_error(parser, "in");
         return NULL;
     }
-    free_token(token);
+    free_token(parser_consume(parser));
 
     // Parse items
     CaseItem *items = NULL;
@@ -461,12 +595,12 @@ static ASTNode *parse_case_statement(Parser *parser) {
         char **patterns = NULL;
         size_t pat_count = 0;
         
-        if (token.type != TOKEN_WORD) {
+        if (!is_word(token)) {
             break; 
         }
 
         while (1) {
-            if (token.type == TOKEN_WORD) {
+            if (is_word(token)) {
                 patterns = mem_stack_realloc_array(patterns, pat_count, pat_count + 2, sizeof(char*));
                 patterns[pat_count++] = mem_stack_strdup(token.value);
                 patterns[pat_count] = NULL;
@@ -487,7 +621,8 @@ static ASTNode *parse_case_statement(Parser *parser) {
 
         // Expect ')'
         if (token.type != TOKEN_OPERATOR || strcmp(token.value, ")") != 0) {
-            break;
+            parser_error(parser, ")");
+            return NULL;
         }
         Token t = parser_consume(parser);
         free_token(t);
@@ -518,19 +653,22 @@ static ASTNode *parse_case_statement(Parser *parser) {
     }
 
     // Expect 'esac'
-    token = parser_consume(parser);
+    token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "esac") != 0) {
-        free_token(token);
+        parser_error(parser, "esac");
         return NULL;
     }
-    free_token(token);
+    free_token(parser_consume(parser));
 
-    return ast_new_case(word, items, item_count);
+    ASTNode *node = ast_new_case(word, items, item_count);
+    node->pos = pos;
+    return node;
 }
 
 static ASTNode *parse_group_command(Parser *parser) {
     // Expect '{'
     Token token = parser_consume(parser);
+    SourcePos pos = token.pos;
     free_token(token);
     
     // Parse body (compound list terminated by '}')
@@ -539,13 +677,16 @@ static ASTNode *parse_group_command(Parser *parser) {
     // Expect '}'
     token = parser_peek(parser);
     if (token.type != TOKEN_KEYWORD || strcmp(token.value, "}") != 0) {
+        parser_error(parser, "}");
         if (body) ast_free(body);
         return NULL;
     }
     token = parser_consume(parser);
     free_token(token);
     
-    return ast_new_group(body);
+    ASTNode *node = ast_new_group(body);
+    node->pos = pos;
+    return node;
 }
 
 // Helper to parse a list of commands terminated by a keyword
@@ -612,7 +753,7 @@ static ASTNode *parse_and_or(Parser *parser) {
             
             ASTNode *right = parse_pipeline(parser);
             if (!right) {
-                // Error: expected command after &&/||
+                parser_error(parser, NULL);
                 ast_free(left);
                 return NULL;
             }
@@ -626,100 +767,79 @@ static ASTNode *parse_and_or(Parser *parser) {
     return left;
 }
 
-static ASTNode *parse_list(Parser *parser) {
-    // Skip newlines
-    Token token = parser_peek(parser);
-    while (token.type == TOKEN_NEWLINE) {
-        parser_consume(parser);
-        free_token(token);
-        token = parser_peek(parser);
+static int is_list_terminator(Token token) {
+    if (token.type == TOKEN_KEYWORD) {
+        return strcmp(token.value, "then") == 0 || strcmp(token.value, "else") == 0 ||
+               strcmp(token.value, "fi") == 0 || strcmp(token.value, "do") == 0 ||
+               strcmp(token.value, "done") == 0 || strcmp(token.value, "esac") == 0 ||
+               strcmp(token.value, "}") == 0;
     }
+    return token.type == TOKEN_OPERATOR && strcmp(token.value, ";;") == 0;
+}
 
-    // Check for keywords that terminate a list (in compound list context)
-    if (token.type == TOKEN_KEYWORD) {
-        if (strcmp(token.value, "then") == 0 || strcmp(token.value, "else") == 0 || 
-            strcmp(token.value, "fi") == 0 || strcmp(token.value, "do") == 0 || 
-            strcmp(token.value, "done") == 0 || strcmp(token.value, "esac") == 0 ||
-            strcmp(token.value, "}") == 0) {
-            return NULL;
+// The list is built in a loop rather than by recursing once per command,
+// so a script or function body of any length parses in constant stack.
+// As before, "a; b" gives list(a, list(b, ...)). A command ended by ";"
+// or a newline with nothing after it is not wrapped in a list, so
+// "if a; then" and "if a<newline>then" give the same tree.
+static ASTNode *parse_list(Parser *parser) {
+    ASTNode *head = NULL;
+    ASTNode **tail = &head;
+    ASTNode **open_slot = NULL; // Sequential list still waiting for its right side
+
+    while (1) {
+        // Skip newlines
+        Token token = parser_peek(parser);
+        while (token.type == TOKEN_NEWLINE) {
+            free_token(parser_consume(parser));
+            token = parser_peek(parser);
         }
-    }
-    // Check for operators that terminate a list (specifically ;;)
-    if (token.type == TOKEN_OPERATOR && strcmp(token.value, ";;") == 0) {
-        return NULL;
-    }
+        if (is_list_terminator(token)) break;
 
-    ASTNode *left = parse_and_or(parser);
-    if (!left) return NULL;
-    
-    token = parser_peek(parser);
-    if (token.type == TOKEN_OPERATOR) {
-        if (strcmp(token.value, ";") == 0 || strcmp(token.value, "&") == 0) {
+        ASTNode *left = parse_and_or(parser);
+        if (!left) break;
+        open_slot = NULL;
+
+        token = parser_peek(parser);
+        if (token.type == TOKEN_OPERATOR &&
+            (strcmp(token.value, ";") == 0 || strcmp(token.value, "&") == 0)) {
             int async = (strcmp(token.value, "&") == 0);
-            parser_consume(parser); // consume separator
-            free_token(token);
-            
-            // Skip newlines
+            free_token(parser_consume(parser)); // consume separator
+
             while (parser_peek(parser).type == TOKEN_NEWLINE) {
-                Token nl = parser_consume(parser);
-                free_token(nl);
+                free_token(parser_consume(parser));
             }
-            
+
+            ASTNode *list = ast_new_list(left, NULL, async);
+            open_slot = async ? NULL : tail;
+            *tail = list;
+            tail = &list->data.list.right;
+
             // Check if list ends here (e.g. "cmd;")
             Token next = parser_peek(parser);
-            if (next.type == TOKEN_EOF) {
-                return ast_new_list(left, NULL, async);
-            }
-             if (next.type == TOKEN_KEYWORD) {
-                if (strcmp(next.value, "then") == 0 || strcmp(next.value, "else") == 0 || 
-                    strcmp(next.value, "fi") == 0 || strcmp(next.value, "do") == 0 || 
-                    strcmp(next.value, "done") == 0 || strcmp(next.value, "esac") == 0 ||
-                    strcmp(next.value, "}") == 0) {
-                    return ast_new_list(left, NULL, async);
-                }
-            }
-            if (next.type == TOKEN_OPERATOR && strcmp(next.value, ";;") == 0) {
-                return ast_new_list(left, NULL, async);
-            }
-            
-            ASTNode *right = parse_list(parser);
-            return ast_new_list(left, right, async);
-        }
-        
-        if (strcmp(token.value, ";;") == 0) {
-            return left;
-        }
-    }
-    
-    if (token.type == TOKEN_NEWLINE) {
-        parser_consume(parser);
-        free_token(token);
-        
-        // Check if next token is terminator
-        Token next = parser_peek(parser);
-        if (next.type == TOKEN_KEYWORD) {
-             if (strcmp(next.value, "then") == 0 || strcmp(next.value, "else") == 0 || 
-                strcmp(next.value, "fi") == 0 || strcmp(next.value, "do") == 0 || 
-                strcmp(next.value, "done") == 0 || strcmp(next.value, "esac") == 0 ||
-                strcmp(next.value, "}") == 0) {
-                return left;
-            }
-        }
-        if (next.type == TOKEN_OPERATOR && strcmp(next.value, ";;") == 0) {
-            return left;
+            if (next.type == TOKEN_EOF || is_list_terminator(next)) break;
+            continue;
         }
 
-        ASTNode *right = parse_list(parser);
-        if (right) {
-            return ast_new_list(left, right, 0);
+        if (token.type == TOKEN_NEWLINE) {
+            free_token(parser_consume(parser));
+            ASTNode *list = ast_new_list(left, NULL, 0);
+            open_slot = tail;
+            *tail = list;
+            tail = &list->data.list.right;
+            continue;
         }
-        return left;
+
+        *tail = left;
+        return head;
     }
-    
-    return left;
+
+    // Nothing followed the last separator: that command stands alone
+    if (open_slot) *open_slot = (*open_slot)->data.list.left;
+    return head;
 }
 
-static ASTNode *parse_pipeline(Parser *parser) {
+static ASTNode *parse_pipe_sequence(Parser *parser) {
     ASTNode *left = parse_simple_command(parser);
     if (!left) return NULL;
     
@@ -728,9 +848,14 @@ static ASTNode *parse_pipeline(Parser *parser) {
         parser_consume(parser); // consume '|'
         free_token(token); // free the operator token
         
-        ASTNode *right = parse_pipeline(parser); // Recursive for multiple pipes
+        // A newline may follow the operator
+        while (parser_peek(parser).type == TOKEN_NEWLINE) {
+            free_token(parser_consume(parser));
+        }
+
+        ASTNode *right = parse_pipe_sequence(parser); // Recursive for multiple pipes
         if (!right) {
-            // Error: expected command after pipe
+            parser_error(parser, NULL);
             ast_free(left);
             return NULL;
         }
@@ -740,15 +865,64 @@ static ASTNode *parse_pipeline(Parser *parser) {
     return left;
 }
 
+static int is_keyword(Token token, const char *word) {
+    return token.type == TOKEN_KEYWORD && strcmp(token.value, word) == 0;
+}
+
+// [time [-p]] [!] pipe_sequence, in either order. time alone times
+// nothing.
+static ASTNode *parse_pipeline(Parser *parser) {
+    Token token = parser_peek(parser);
+    // Every level of nesting comes back through here
+    if (CSTACK_LOW()) {
+        if (parser_fail(parser)) {
+            diag_report(&token.pos, "error", "syntax", "syntax error: nested too deeply");
+        }
+        return NULL;
+    }
+    if (is_keyword(token, "time")) {
+        SourcePos pos = token.pos;
+        free_token(parser_consume(parser));
+        int posix = 0;
+        token = parser_peek(parser);
+        if (token.type == TOKEN_WORD && strcmp(token.value, "-p") == 0) {
+            free_token(parser_consume(parser));
+            posix = 1;
+        }
+        ASTNode *pipeline = parse_pipeline(parser);
+        if (parser->failed) return NULL;
+        ASTNode *node = ast_new_prefixed(NODE_TIME, pipeline, posix);
+        node->pos = pos;
+        return node;
+    }
+    if (is_keyword(token, "!")) {
+        SourcePos pos = token.pos;
+        free_token(parser_consume(parser));
+        ASTNode *pipeline = parse_pipeline(parser);
+        if (!pipeline) {
+            parser_error(parser, "command");
+            return NULL;
+        }
+        ASTNode *node = ast_new_prefixed(NODE_NOT, pipeline, 0);
+        node->pos = pos;
+        return node;
+    }
+    return parse_pipe_sequence(parser);
+}
+
 static ASTNode *parse_function_definition(Parser *parser) {
     // Consumed 'function'
     Token token = parser_consume(parser);
+    SourcePos pos = token.pos;
     free_token(token);
     
     // Expect name
     token = parser_peek(parser);
-    if (token.type != TOKEN_WORD) return NULL;
-    char *name = token.value; // Will be copied by ast_new_function
+    if (token.type != TOKEN_WORD) {
+        parser_error(parser, "name");
+        return NULL;
+    }
+    char *name = mem_stack_strdup(token.value);
     token = parser_consume(parser);
     free_token(token);
     
@@ -762,7 +936,7 @@ static ASTNode *parse_function_definition(Parser *parser) {
             token = parser_consume(parser);
             free_token(token);
         } else {
-            // Error
+            parser_error(parser, ")");
             return NULL;
         }
     }
@@ -776,10 +950,13 @@ static ASTNode *parse_function_definition(Parser *parser) {
     
     ASTNode *body = parse_simple_command(parser); // Should parse compound command
     if (!body) {
+        parser_error(parser, NULL);
         return NULL;
     }
     
-    return ast_new_function(name, body);
+    ASTNode *node = ast_new_function(name, body);
+    node->pos = pos;
+    return node;
 }
 
 static int parse_redirection(Parser *parser, ASTNode *cmd);
@@ -792,33 +969,47 @@ static ASTNode *parse_simple_command(Parser *parser) {
     else if (token.type == TOKEN_OPERATOR && strcmp(token.value, "(") == 0) {
         // Subshell grouping: ( command_list )
         token = parser_consume(parser); // consume '('
+        SourcePos pos = token.pos;
         free_token(token);
         
+        parser->depth++;
         ASTNode *body = parse_list(parser);
         
         token = parser_peek(parser);
         if (token.type != TOKEN_OPERATOR || strcmp(token.value, ")") != 0) {
             // if (body) ast_free(body); // No-op
+            parser_error(parser, ")");
             return NULL;
         }
+        parser->depth--;
         token = parser_consume(parser); // consume ')'
         free_token(token);
         
-        return ast_new_subshell(body);
+        ASTNode *node = ast_new_subshell(body);
+        node->pos = pos;
+        return node;
     }
     else if (token.type == TOKEN_KEYWORD) {
-        if (strcmp(token.value, "if") == 0) return parse_if_statement(parser);
-        if (strcmp(token.value, "while") == 0) return parse_while_loop(parser);
-        if (strcmp(token.value, "until") == 0) return parse_until_loop(parser);
-        if (strcmp(token.value, "for") == 0) return parse_for_loop(parser);
-        if (strcmp(token.value, "case") == 0) return parse_case_statement(parser);
-        if (strcmp(token.value, "{") == 0) return parse_group_command(parser);
-        return NULL; 
+        ASTNode *(*parse_compound)(Parser *) = NULL;
+        if (strcmp(token.value, "if") == 0) parse_compound = parse_if_statement;
+        else if (strcmp(token.value, "while") == 0) parse_compound = parse_while_loop;
+        else if (strcmp(token.value, "until") == 0) parse_compound = parse_until_loop;
+        else if (strcmp(token.value, "for") == 0) parse_compound = parse_for_loop;
+        else if (strcmp(token.value, "case") == 0) parse_compound = parse_case_statement;
+        else if (strcmp(token.value, "{") == 0) parse_compound = parse_group_command;
+        if (!parse_compound) return NULL;
+
+        // The depth is left raised on failure: it is what the error left open
+        parser->depth++;
+        ASTNode *node = parse_compound(parser);
+        if (node) parser->depth--;
+        return node;
     }
     else if (token.type == TOKEN_IO_NUMBER) is_cmd = 1;
     else if (token.type == TOKEN_OPERATOR) {
         if (strcmp(token.value, "<") == 0 || strcmp(token.value, ">") == 0 ||
             strcmp(token.value, ">>") == 0 || strcmp(token.value, "<<") == 0 ||
+            strcmp(token.value, "<<-") == 0 ||
             strcmp(token.value, "<&") == 0 || strcmp(token.value, ">&") == 0 ||
             strcmp(token.value, "<>") == 0 || strcmp(token.value, ">|") == 0) {
             is_cmd = 1;
@@ -828,7 +1019,7 @@ static ASTNode *parse_simple_command(Parser *parser) {
     if (!is_cmd) return NULL;
     
     ASTNode *cmd = ast_new_command();
-    cmd->lineno = token.lineno;
+    cmd->pos = token.pos;
     int seen_command_name = 0;
     
     if (token.type == TOKEN_WORD) {
@@ -858,31 +1049,34 @@ static ASTNode *parse_simple_command(Parser *parser) {
         Token next = parser_peek(parser);
         if (next.type == TOKEN_OPERATOR && strcmp(next.value, "(") == 0) {
             Token lparen = parser_consume(parser);
+            Token rparen = parser_peek(parser);
+            if (rparen.type != TOKEN_OPERATOR || strcmp(rparen.value, ")") != 0) {
+                // Not a function definition: the ( itself is out of place
+                parser_error_at(parser, lparen, NULL);
+                free_token(lparen);
+                return NULL;
+            }
             free_token(lparen);
+            Token t = parser_consume(parser);
+            free_token(t);
             
-            Token rparen = parser_peek(parser);
-            if (rparen.type == TOKEN_OPERATOR && strcmp(rparen.value, ")") == 0) {
-                Token t = parser_consume(parser);
-                free_token(t);
-                
-                while (parser_peek(parser).type == TOKEN_NEWLINE) {
-                    Token nl = parser_consume(parser);
-                    free_token(nl);
-                }
-                
-                // ast_free(cmd); // No-op
-                
-                ASTNode *body = parse_simple_command(parser);
-                if (!body) {
-                    // name is on stack, no free needed
-                    return NULL;
-                }
-                
-                return ast_new_function(name, body);
-            } else {
-                // name on stack, cmd on stack
+            while (parser_peek(parser).type == TOKEN_NEWLINE) {
+                Token nl = parser_consume(parser);
+                free_token(nl);
+            }
+            
+            // ast_free(cmd); // No-op
+            
+            ASTNode *body = parse_simple_command(parser);
+            if (!body) {
+                // name is on stack, no free needed
+                parser_error(parser, NULL);
                 return NULL;
             }
+            
+            ASTNode *node = ast_new_function(name, body);
+            node->pos = cmd->pos;
+            return node;
         }
         
         char *alias_val = alias_get(name);
@@ -909,9 +1103,13 @@ static ASTNode *parse_simple_command(Parser *parser) {
     while (1) {
         token = parser_peek(parser);
         
-        if (token.type == TOKEN_WORD) {
+        // Past the first word, reserved words are arguments; after
+        // assignments or redirections they are the command name
+        int started = seen_command_name || cmd->data.command.assignment_count ||
+                      cmd->data.command.redirection_count;
+        if (token.type == TOKEN_WORD || (started && token.type == TOKEN_KEYWORD)) {
             char *eq = strchr(token.value, '=');
-            if (!seen_command_name && eq != NULL && eq != token.value) {
+            if (!seen_command_name && token.type == TOKEN_WORD && eq != NULL && eq != token.value) {
                 *eq = '\0';
                 char *name = token.value;
                 char *value = eq + 1;
@@ -986,27 +1184,26 @@ static int parse_redirection(Parser *parser, ASTNode *cmd) {
     parser_consume(parser);
     free_token(token);
     
-    Token filename = parser_consume(parser);
-    if (filename.type != TOKEN_WORD) {
-        // Error
-        free_token(filename);
+    if (!is_word(parser_peek(parser))) {
+        parser_error(parser, "word");
         return 0;
     }
+    Token filename = parser_consume(parser);
     
-    char *here_doc_content = NULL;
+    ast_command_add_redirection(cmd, type, io_number, filename.value, NULL);
+
     if (type == REDIR_HEREDOC || type == REDIR_HEREDOC_DASH) {
-        Token next = parser_peek(parser);
-        if (next.type == TOKEN_NEWLINE) {
-            parser_consume(parser); // Consume newline
-            free_token(next);
-            here_doc_content = lexer_read_until_delimiter(parser->lexer, filename.value, (type == REDIR_HEREDOC_DASH));
-        } else {
-             here_doc_content = lexer_read_until_delimiter(parser->lexer, filename.value, (type == REDIR_HEREDOC_DASH));
-        }
+        // The body follows the end of the current line, which may hold
+        // more of the command (cat <<EOF | tr a-z A-Z)
+        parser->heredocs = mem_stack_realloc_array(parser->heredocs, parser->heredoc_count,
+                                                   parser->heredoc_count + 1, sizeof(PendingHeredoc));
+        PendingHeredoc *h = &parser->heredocs[parser->heredoc_count++];
+        h->cmd = cmd;
+        h->index = cmd->data.command.redirection_count - 1;
+        h->delimiter = lexer_heredoc_delimiter(filename.value);
+        h->strip_tabs = (type == REDIR_HEREDOC_DASH);
     }
-    
-    ast_command_add_redirection(cmd, type, io_number, filename.value, here_doc_content);
-    if (here_doc_content) free(here_doc_content);
+
     free_token(filename);
     return 1;
 }
@@ -0,0 +1,342 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <wchar.h>
+#include <wctype.h>
+#include "memalloc.h"
+#include "pattern.h"
+
+// In a multibyte locale a byte that is not a valid character decodes to
+// a value past the end of Unicode, so it matches only the same byte
+#define BAD_BYTE 0x110000
+
+// Decode the character at s, looking at most max bytes; returns its length
+static inline size_t decode(const char *s, size_t max, wchar_t *wc) {
+    unsigned char c = *s;
+    if (c < 0x80) {
+        *wc = c;
+        return 1;
+    }
+    mbstate_t st;
+    memset(&st, 0, sizeof(st));
+    size_t n = mbrtowc(wc, s, max, &st);
+    if (n == (size_t)-1 || n == (size_t)-2 || n == 0) {
+        *wc = MB_CUR_MAX == 1 ? (wchar_t)c : (wchar_t)(BAD_BYTE + c);
+        return 1;
+    }
+    return n;
+}
+
+// One character of a bracket expression: a character, possibly quoted
+// with a backslash, or a collating symbol [.c.]. Returns the position
+// after it, or NULL if the expression ends or is not understood.
+static const char *bracket_char(const char *p, wchar_t *wc) {
+    if (p[0] == '[' && p[1] == '.') {
+        const char *close = strstr(p + 2, ".]");
+        if (!close) return NULL;
+        // Only single characters are collating elements here
+        if (close == p + 2 || p + 2 + decode(p + 2, MB_LEN_MAX, wc) != close) return NULL;
+        return close + 2;
+    }
+    if (*p == '\\' && p[1]) p++;
+    if (*p == '\0') return NULL;
+    return p + decode(p, MB_LEN_MAX, wc);
+}
+
+// Match wc against the bracket expression whose '[' is at p. Returns the
+// position after the closing ']' and sets *matched, or returns NULL if
+// the expression is not terminated and the '[' is an ordinary character.
+// Ranges are in code point order, as they are in glibc's locales.
+static const char *match_bracket(const char *p, wchar_t wc, int *matched) {
+    int negate = 0;
+    int found = 0;
+
+    p++;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    const char *first = p;
+    while (*p != ']' || p == first) {
+        if (*p == '\0') return NULL;
+
+        if (p[0] == '[' && (p[1] == ':' || p[1] == '=')) {
+            char kind = p[1];
+            const char *name = p + 2;
+            const char *close = name;
+            while (*close && !(close[0] == kind && close[1] == ']')) close++;
+            if (!*close) return NULL;
+            p = close + 2;
+
+            if (kind == ':') {
+                char class_name[32];
+                size_t n = close - name;
+                if (n < sizeof(class_name)) {
+                    memcpy(class_name, name, n);
+                    class_name[n] = '\0';
+                    wctype_t type = wctype(class_name);
+                    if (type && iswctype(wc, type)) found = 1;
+                }
+            } else {
+                // An equivalence class is its one character
+                wchar_t eq;
+                if (close > name && name + decode(name, MB_LEN_MAX, &eq) == close && eq == wc) {
+                    found = 1;
+                }
+            }
+            continue;
+        }
+
+        wchar_t lo, hi;
+        p = bracket_char(p, &lo);
+        if (!p) return NULL;
+        hi = lo;
+        if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+            p = bracket_char(p + 1, &hi);
+            if (!p) return NULL;
+        }
+        if (lo <= wc && wc <= hi) found = 1;
+    }
+
+    *matched = found != negate;
+    return p + 1;
+}
+
+// Where a * can stop, at or after s: if an ordinary ASCII character
+// follows it in the pattern, only where that character is. NULL if it
+// can stop nowhere.
+static const char *star_stop(const char *p, const char *s, const char *end) {
+    unsigned char c = *p;
+    if (c == '\\') c = p[1];
+    else if (c == '?' || c == '[') return s;
+    if (c == '\0' || c >= 0x80) return s;
+    return memchr(s, c, end - s);
+}
+
+int pattern_match(const char *pattern, const char *string, size_t len) {
+    const char *p = pattern;
+    const char *s = string;
+    const char *end = string + len;
+    // After a mismatch, the last * takes one more character and matching
+    // resumes after it. Earlier stars never need to take more, so this
+    // is linear in the string for each star rather than exponential.
+    const char *star_p = NULL;
+    const char *star_s = NULL;
+
+    for (;;) {
+        if (*p == '*') {
+            while (*p == '*') p++;
+            if (*p == '\0') return 1;
+            star_p = p;
+            star_s = star_stop(p, s, end);
+            if (!star_s) return 0;
+            s = star_s;
+            continue;
+        }
+        if (*p == '\0') {
+            if (s == end) return 1;
+        } else if (s < end) {
+            wchar_t sc;
+            size_t sn = decode(s, end - s, &sc);
+
+            if (*p == '?') {
+                p++;
+                s += sn;
+                continue;
+            }
+            if (*p == '[') {
+                int matched;
+                const char *next = match_bracket(p, sc, &matched);
+                if (next) {
+                    if (matched) {
+                        p = next;
+                        s += sn;
+                        continue;
+                    }
+                    goto mismatch;
+                }
+            }
+
+            if (*p == '\\' && p[1]) p++;
+            wchar_t pc;
+            size_t pn = decode(p, MB_LEN_MAX, &pc);
+            if (pc == sc) {
+                p += pn;
+                s += sn;
+                continue;
+            }
+        }
+
+    mismatch:
+        if (!star_p || star_s == end) return 0;
+        wchar_t skipped;
+        star_s += decode(star_s, end - star_s, &skipped);
+        star_s = star_stop(star_p, star_s, end);
+        if (!star_s) return 0;
+        p = star_p;
+        s = star_s;
+    }
+}
+
+size_t mb_len(const char *s) {
+    if ((unsigned char)*s < 0x80) return *s != '\0';
+    mbstate_t st;
+    memset(&st, 0, sizeof(st));
+    size_t n = mbrlen(s, MB_LEN_MAX, &st);
+    return n == (size_t)-1 || n == (size_t)-2 ? 1 : n;
+}
+
+size_t mb_strlen(const char *s) {
+    size_t count = 0;
+    while (*s) {
+        s += (unsigned char)*s < 0x80 ? 1 : mb_len(s);
+        count++;
+    }
+    return count;
+}
+
+size_t mb_in_set(const char *s, const char *set) {
+    unsigned char c = *s;
+    if (c < 0x80) return c && strchr(set, c) ? 1 : 0;
+
+    size_t n = mb_len(s);
+    for (const char *p = set; *p; p += mb_len(p)) {
+        if (mb_len(p) == n && memcmp(p, s, n) == 0) return n;
+    }
+    return 0;
+}
+
+// Pathname expansion is done here rather than by glob(), whose matching
+// need not agree with pattern_match() on multibyte names
+struct name_list {
+    char **names;
+    size_t count;
+    size_t cap;
+};
+
+static void add_name(struct name_list *list, char *name) {
+    if (list->count + 1 >= list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->names = xrealloc(list->names, list->cap * sizeof(char *));
+    }
+    list->names[list->count++] = name;
+}
+
+static int has_magic(const char *p, const char *end) {
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) p++;
+        else if (*p == '*' || *p == '?' || *p == '[') return 1;
+    }
+    return 0;
+}
+
+// Copy p..end to dst without the quoting backslashes; returns the length
+static size_t unescape(char *dst, const char *p, const char *end) {
+    char *start = dst;
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end) p++;
+        *dst++ = *p++;
+    }
+    return dst - start;
+}
+
+// dir + name + the slashes that follow the component
+static char *join(const char *dir, size_t dir_len, const char *name, size_t name_len,
+                  const char *slashes, size_t slash_len) {
+    char *path = xmalloc(dir_len + name_len + slash_len + 1);
+    memcpy(path, dir, dir_len);
+    memcpy(path + dir_len, name, name_len);
+    memcpy(path + dir_len + name_len, slashes, slash_len);
+    path[dir_len + name_len + slash_len] = '\0';
+    return path;
+}
+
+// Expand the components from rest on below dir, which is "" or ends in
+// a slash
+static void glob_dir(struct name_list *list, const char *dir, const char *rest) {
+    const char *end = strchr(rest, '/');
+    if (!end) end = rest + strlen(rest);
+    const char *next = end;
+    while (*next == '/') next++;
+    size_t dir_len = strlen(dir);
+
+    // A component without pattern characters is not listed, only checked
+    // for at the end
+    if (!has_magic(rest, end)) {
+        char *name = xmalloc(end - rest + 1);
+        size_t name_len = unescape(name, rest, end);
+        char *path = join(dir, dir_len, name, name_len, end, next - end);
+        free(name);
+        struct stat st;
+        if (*next) {
+            glob_dir(list, path, next);
+        } else if (lstat(path, &st) == 0) {
+            add_name(list, path);
+            return;
+        }
+        free(path);
+        return;
+    }
+
+    char *component = xmalloc(end - rest + 1);
+    memcpy(component, rest, end - rest);
+    component[end - rest] = '\0';
+    // A leading period must be matched by a period
+    int dot_ok = component[0] == '.' || (component[0] == '\\' && component[1] == '.');
+
+    DIR *d = opendir(dir_len ? dir : ".");
+    struct dirent *entry;
+    while (d && (entry = readdir(d))) {
+        if (entry->d_name[0] == '.' && !dot_ok) continue;
+        size_t name_len = strlen(entry->d_name);
+        if (!pattern_match(component, entry->d_name, name_len)) continue;
+
+        char *path = join(dir, dir_len, entry->d_name, name_len, end, next - end);
+        struct stat st;
+        if (*next) {
+            glob_dir(list, path, next);
+        } else if (next == end || (stat(path, &st) == 0 && S_ISDIR(st.st_mode))) {
+            // A trailing slash matches only directories
+            add_name(list, path);
+            continue;
+        }
+        free(path);
+    }
+    if (d) closedir(d);
+    free(component);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcoll(*(char *const *)a, *(char *const *)b);
+}
+
+char **pattern_glob(const char *pattern, size_t *count) {
+    struct name_list list = {NULL, 0, 0};
+    const char *rest = pattern;
+    while (*rest == '/') rest++;
+
+    char *root = xmalloc(rest - pattern + 1);
+    memcpy(root, pattern, rest - pattern);
+    root[rest - pattern] = '\0';
+    glob_dir(&list, root, rest);
+    free(root);
+
+    if (list.count == 0) {
+        add_name(&list, xstrdup(pattern));
+    } else {
+        qsort(list.names, list.count, sizeof(char *), compare_names);
+    }
+    list.names[list.count] = NULL;
+    *count = list.count;
+    return list.names;
+}
+
+void pattern_glob_free(char **names) {
+    for (char **p = names; *p; p++) free(*p);
+    free(names);
+}
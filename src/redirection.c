@@ -3,16 +3,30 @@
 #include "redirection.h"
 #include "buf_output.h"
 #include "error.h"
+#include "restricted.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
+
+// Put the open file fd at target, where open() or pipe() may already
+// have put it
+static int move_fd(int fd, int target) {
+    if (fd == target) return 0;
+    int result = dup2(fd, target);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return result;
+}
 
 int handle_redirections(Redirection *redirs, size_t count) {
     for (size_t i = 0; i < count; i++) {
         Redirection *r = &redirs[i];
+        if (shell_restricted && restrict_redirection(r)) return 1;
         
         // Flush buffered output if redirecting stdout
         if (r->io_number == STDOUT_FILENO) {
@@ -29,12 +43,10 @@ int handle_redirections(Redirection *redirs, size_t count) {
                 error_sys("open: %s", r->filename);
                 return 1;
             }
-            if (dup2(fd, r->io_number) < 0) {
+            if (move_fd(fd, r->io_number) < 0) {
                 error_sys("dup2");
-                close(fd);
                 return 1;
             }
-            close(fd);
         } else if (r->type == REDIR_OUT || r->type == REDIR_OUT_CLOBBER) {
             flags = O_WRONLY | O_CREAT | O_TRUNC;
             fd = open(r->filename, flags, mode);
@@ -42,12 +54,10 @@ int handle_redirections(Redirection *redirs, size_t count) {
                 error_sys("open: %s", r->filename);
                 return 1;
             }
-            if (dup2(fd, r->io_number) < 0) {
+            if (move_fd(fd, r->io_number) < 0) {
                 error_sys("dup2");
-                close(fd);
                 return 1;
             }
-            close(fd);
         } else if (r->type == REDIR_APPEND) {
             flags = O_WRONLY | O_CREAT | O_APPEND;
             fd = open(r->filename, flags, mode);
@@ -55,12 +65,10 @@ int handle_redirections(Redirection *redirs, size_t count) {
                 error_sys("open: %s", r->filename);
                 return 1;
             }
-            if (dup2(fd, r->io_number) < 0) {
+            if (move_fd(fd, r->io_number) < 0) {
                 error_sys("dup2");
-                close(fd);
                 return 1;
             }
-            close(fd);
         } else if (r->type == REDIR_IN_DUP || r->type == REDIR_OUT_DUP) {
             if (r->filename[0] == '-' && r->filename[1] == '\0') {
                 close(r->io_number);
@@ -78,12 +86,10 @@ int handle_redirections(Redirection *redirs, size_t count) {
                 error_sys("open: %s", r->filename);
                 return 1;
             }
-            if (dup2(fd, r->io_number) < 0) {
+            if (move_fd(fd, r->io_number) < 0) {
                 error_sys("dup2");
-                close(fd);
                 return 1;
             }
-            close(fd);
         } else if (r->type == REDIR_HEREDOC || r->type == REDIR_HEREDOC_DASH) {
             // OPTIMIZATION: Use pipe for small heredocs to avoid disk I/O
             // PIPE_BUF is usually 4096 bytes on Linux
@@ -107,12 +113,10 @@ int handle_redirections(Redirection *redirs, size_t count) {
                 }
                 close(pipefd[1]); // Close write end
                 
-                if (dup2(pipefd[0], r->io_number) < 0) { // Use requested FD (default 0)
+                if (move_fd(pipefd[0], r->io_number) < 0) { // Use requested FD (default 0)
                      perror("posish: dup2 failed");
-                     close(pipefd[0]);
                      return 1;
                 }
-                close(pipefd[0]);
             } else {
                 // Fallback to mkstemp for large heredocs
                 char template[] = "/tmp/posish_heredoc_XXXXXX";
@@ -130,12 +134,10 @@ int handle_redirections(Redirection *redirs, size_t count) {
                 }
                 lseek(fd, 0, SEEK_SET); // Rewind
 
-                if (dup2(fd, r->io_number) < 0) {
+                if (move_fd(fd, r->io_number) < 0) {
                     perror("posish: dup2 failed");
-                    close(fd);
                     return 1;
                 }
-                close(fd);
             }
         }
     }
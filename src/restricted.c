@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <string.h>
+#include "error.h"
+#include "restricted.h"
+
+// Variables that decide what runs or where the shell writes
+static const char *const protected_variables[] = {
+    "PATH", "SHELL", "ENV", "POSISH_COVERAGE", NULL
+};
+
+int restrict_variable(const char *name) {
+    for (int i = 0; protected_variables[i]; i++) {
+        if (strcmp(name, protected_variables[i]) == 0) {
+            error_msg("%s: restricted variable", name);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int restrict_command_name(const char *name) {
+    if (!strchr(name, '/')) return 0;
+    error_msg("%s: restricted: cannot name a command by its path", name);
+    return 1;
+}
+
+int restrict_redirection(const Redirection *r) {
+    switch (r->type) {
+    case REDIR_OUT:
+    case REDIR_OUT_CLOBBER:
+    case REDIR_APPEND:
+    case REDIR_RDWR:
+        error_msg("%s: restricted: cannot redirect output", r->filename);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int restrict_builtin(const char *what) {
+    error_msg("%s: restricted", what);
+    return 1;
+}
+
+int restrict_source(const char *path) {
+    if (!strchr(path, '/')) return 0;
+    error_msg(".: %s: restricted: only files found in PATH can be sourced", path);
+    return 1;
+}
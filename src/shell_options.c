@@ -16,8 +16,13 @@ int shell_hash_all = 0;
 int shell_notify = 0;
 int shell_ignore_eof = 0;
 int shell_nolog = 0;
+int shell_backtrace = 0;
+int shell_pipefail = 0;
 int shell_vi_mode = 0;
+int shell_emacs_mode = 0;
 int shell_ignore_errexit = 0;
+int shell_interactive = 0;
+int shell_restricted = 0;
 
 void shell_options_init(void) {
     shell_trace_mode = 0;
@@ -33,6 +38,9 @@ void shell_options_init(void) {
     shell_notify = 0;
     shell_ignore_eof = 0;
     shell_nolog = 0;
+    shell_backtrace = 0;
+    shell_pipefail = 0;
     shell_vi_mode = 0;
+    shell_emacs_mode = 0;
     shell_ignore_errexit = 0;
 }
@@ -2,18 +2,22 @@
 
 
 #include "signals.h"
+#include "error.h"
 #include "executor.h"
 #include "memalloc.h"
 #include "buf_output.h"
+#include "callstack.h"
 #include "lexer.h"
 #include "parser.h"
 #include "variables.h"
+#include "shell_options.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <sys/wait.h>
 
 #include <strings.h>
 
@@ -26,9 +30,20 @@
 
 static char *trap_commands[MAX_SIGNALS];
 static volatile sig_atomic_t pending_signals[MAX_SIGNALS];
-static volatile sig_atomic_t any_pending_signal = 0;
+volatile sig_atomic_t any_pending_signal = 0;
 static int signals_ignored_on_entry[MAX_SIGNALS];
 
+// The caught traps of the parent shell. A subshell resets them but still
+// lists them, so "saved=$(trap)" works, until it changes a trap itself.
+static char *inherited_traps[MAX_SIGNALS];
+
+static void forget_inherited_traps(void) {
+    for (int i = 0; i < MAX_SIGNALS; i++) {
+        free(inherited_traps[i]);
+        inherited_traps[i] = NULL;
+    }
+}
+
 // For interactive mode SIGINT handling
 volatile sig_atomic_t got_sigint = 0;
 
@@ -84,6 +99,13 @@ static void handler(int signum) {
     }
 }
 
+void signal_note(int signum) {
+    if (signum > 0 && signum < MAX_SIGNALS && trap_commands[signum]) {
+        pending_signals[signum] = 1;
+        any_pending_signal = 1;
+    }
+}
+
 void signal_init(void) {
     struct sigaction sa;
     
@@ -112,12 +134,15 @@ void signal_init(void) {
         }
     }
     
-    // Install SIGINT handler for interactive mode
-    struct sigaction sigint_sa;
-    sigint_sa.sa_handler = handler;
-    sigemptyset(&sigint_sa.sa_mask);
-    sigint_sa.sa_flags = 0;  // No SA_RESTART - we want to interrupt syscalls
-    sigaction(SIGINT, &sigint_sa, NULL);
+    // Catch SIGINT so that it interrupts commands rather than the shell,
+    // unless it was ignored on entry (e.g. a script run with &)
+    if (!signals_ignored_on_entry[SIGINT]) {
+        struct sigaction sigint_sa;
+        sigint_sa.sa_handler = handler;
+        sigemptyset(&sigint_sa.sa_mask);
+        sigint_sa.sa_flags = 0;  // No SA_RESTART - we want to interrupt syscalls
+        sigaction(SIGINT, &sigint_sa, NULL);
+    }
 }
 
 int signal_get_number(const char *name) {
@@ -156,6 +181,7 @@ const char *signal_get_name(int signum) {
 
 int signal_trap(int signum, const char *command) {
     if (signum < 0 || signum >= MAX_SIGNALS) return -1;
+    forget_inherited_traps();
     
     // POSIX: Signals ignored on entry cannot be trapped in non-interactive shell
     // But we are mostly interactive or simulating it.
@@ -169,7 +195,8 @@ int signal_trap(int signum, const char *command) {
     if (command && *command) {
         trap_commands[signum] = xstrdup(command);
         
-        if (signum > 0) {
+        // SIGCHLD stays with the job table's handler, which forwards to us
+        if (signum > 0 && signum != SIGCHLD) {
             struct sigaction sa;
             sa.sa_handler = handler;
             sigemptyset(&sa.sa_mask);
@@ -177,11 +204,11 @@ int signal_trap(int signum, const char *command) {
             sigaction(signum, &sa, NULL);
         }
     } else {
-        // Empty command means ignore
-        trap_commands[signum] = NULL; // Or empty string?
+        // Empty command means ignore; it is kept so "trap" lists it
+        trap_commands[signum] = xstrdup("");
         // POSIX: "If action is null (""), the shell shall ignore each specified condition"
         // So we should set handler to SIG_IGN.
-        if (signum > 0) {
+        if (signum > 0 && signum != SIGCHLD) {
             struct sigaction sa;
             sa.sa_handler = SIG_IGN;
             sigemptyset(&sa.sa_mask);
@@ -194,13 +221,14 @@ int signal_trap(int signum, const char *command) {
 
 int signal_reset(int signum) {
     if (signum < 0 || signum >= MAX_SIGNALS) return -1;
+    forget_inherited_traps();
 
     if (trap_commands[signum]) {
         free(trap_commands[signum]);
         trap_commands[signum] = NULL;
     }
 
-    if (signum > 0) {
+    if (signum > 0 && signum != SIGCHLD) {
         struct sigaction sa;
         sa.sa_handler = SIG_DFL;
         sigemptyset(&sa.sa_mask);
@@ -211,47 +239,92 @@ int signal_reset(int signum) {
 }
 
 void signal_reset_all(void) {
+    char *parent[MAX_SIGNALS];
+    for (int i = 0; i < MAX_SIGNALS; i++) {
+        parent[i] = inherited_traps[i];
+        inherited_traps[i] = NULL;
+    }
+
     for (int i = 1; i < MAX_SIGNALS; i++) {
-        if (trap_commands[i]) {
-            if (signals_ignored_on_entry[i]) {
-                signal_ignore(i);
-            } else {
-                signal_reset(i);
-            }
+        char *command = trap_commands[i];
+        // Ignored signals stay ignored; caught ones revert
+        if (!command || !*command) continue;
+        trap_commands[i] = NULL;
+        free(parent[i]);
+        parent[i] = command;
+        if (signals_ignored_on_entry[i]) {
+            signal_ignore(i);
+        } else {
+            signal_reset(i);
         }
     }
+    memcpy(inherited_traps, parent, sizeof(parent));
 }
 
 int signal_ignore(int signum) {
     return signal_trap(signum, "");
 }
 
+void signal_child_defaults(void) {
+    static const int job_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, 0 };
+    for (int i = 0; job_signals[i]; i++) {
+        int signum = job_signals[i];
+        if (signals_ignored_on_entry[signum]) continue;
+        if (trap_commands[signum] && !*trap_commands[signum]) continue;
+        signal(signum, SIG_DFL);
+    }
+}
+
+int signal_exit_trap_set(void) {
+    return trap_commands[0] && *trap_commands[0];
+}
+
 void signal_list_traps(void) {
     for (int i = 0; i < MAX_SIGNALS; i++) {
-        if (trap_commands[i]) {
+        const char *command = trap_commands[i] ? trap_commands[i] : inherited_traps[i];
+        if (command) {
             const char *name = signal_get_name(i);
             if (name) {
-                // Ensure proper quoting for reinput
-                printf("trap -- '");
-                for (const char *p = trap_commands[i]; *p; p++) {
-                    if (*p == '\'') printf("'\\''");
-                    else putchar(*p);
-                }
-                printf("' %s\n", name);
+                OUT_PUTS("trap -- ");
+                OUT_QUOTED(command);
+                OUT_PRINTF(" %s\n", name);
             }
         }
     }
 }
 
+static void interrupt(void) {
+    got_sigint = 0;
+    buf_out_flush_all();
+    // The shell's own line after ^C; children leave it to the shell
+    if (shell_interactive && exception_handler) fputc('\n', stderr);
+    exception_raise(128 + SIGINT);
+}
+
+int signal_pending_action(void) {
+    if (!any_pending_signal) return 0;
+    for (int i = 1; i < MAX_SIGNALS; i++) {
+        if (!pending_signals[i]) continue;
+        if ((i == SIGINT && got_sigint) || (trap_commands[i] && *trap_commands[i])) {
+            return i;
+        }
+    }
+    return 0;
+}
+
 void signal_check_pending(void) {
     if (!any_pending_signal) return;
     
     any_pending_signal = 0;
+    int interrupted = 0;
 
     for (int i = 0; i < MAX_SIGNALS; i++) {
         if (pending_signals[i]) {
             pending_signals[i] = 0;
-            if (trap_commands[i]) {
+            if (i == SIGINT && got_sigint) {
+                // Acted on after the traps of other pending signals
+                interrupted = 1;
+            } else if (trap_commands[i] && *trap_commands[i]) {
                 // Flush buffers before executing trap to ensure output integrity
                 buf_out_flush_all();
 
@@ -278,7 +351,14 @@ void signal_check_pending(void) {
                 lexer_init(&lexer, cmd_to_run);
                 ASTNode *node = parser_parse(&lexer);
                 if (node) {
+                    // The action is not the command the process runs last
+                    int saved_no_fork = executor_no_fork;
+                    executor_no_fork = 0;
+                    callstack_push("trap");
+                    cleanup_push(callstack_pop, NULL);
                     executor_execute(node);
+                    cleanup_pop(1);
+                    executor_no_fork = saved_no_fork;
                     ast_free(node);
                 }
                 
@@ -288,6 +368,8 @@ void signal_check_pending(void) {
             }
         }
     }
+
+    if (interrupted) interrupt();
 }
 
 void signal_trigger_exit(void) {
@@ -299,10 +381,13 @@ void signal_trigger_exit(void) {
     signal_check_pending();
 }
 
-int signal_check_sigint(void) {
-    if (got_sigint) {
+void signal_foreground_status(int wait_status) {
+    if (WIFSIGNALED(wait_status) && WTERMSIG(wait_status) == SIGINT) {
+        if (!trap_commands[SIGINT]) got_sigint = 1;
+        pending_signals[SIGINT] = 1;
+        any_pending_signal = 1;
+    } else if (got_sigint) {
         got_sigint = 0;
-        return 1;
+        pending_signals[SIGINT] = 0;
     }
-    return 0;
 }
@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "buf_output.h"
+#include "error.h"
+#include "memalloc.h"
+#include "stub.h"
+#include "variables.h"
+
+typedef struct Stub {
+    char *name;
+    ASTNode *body;
+    char *definition;
+    int depth;          // Function nesting it was defined at
+    char id[48];        // "pid.serial", naming its calls in the log
+    struct Stub *next;  // Newest first, so by depth, deepest first
+} Stub;
+
+static Stub *stubs = NULL;
+int stub_count = 0;
+static int stub_depth = 0;
+static unsigned long stub_serial = 0;
+
+// The call log holds one record per call, "id argv...", with the
+// arguments quoted and a NUL at the end. Each record is one write() to a
+// file opened O_APPEND, so processes writing at once do not interleave.
+static int log_fd = -1;
+
+static void open_log(void) {
+    if (log_fd >= 0) return;
+
+    const char *tmpdir = posish_var_get_value("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/posish-stubXXXXXX",
+             tmpdir && *tmpdir ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        error_sys("stub: cannot create the call log");
+        return;
+    }
+    unlink(path);
+    fcntl(fd, F_SETFL, O_APPEND);
+    log_fd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    close(fd);
+}
+
+static Stub *find_stub(const char *name) {
+    for (Stub *s = stubs; s; s = s->next) {
+        if (strcmp(s->name, name) == 0) return s;
+    }
+    return NULL;
+}
+
+static void remove_stub(Stub *stub) {
+    Stub **slot = &stubs;
+    while (*slot != stub) slot = &(*slot)->next;
+    *slot = stub->next;
+    free(stub->name);
+    ast_free_heap(stub->body);
+    free(stub->definition);
+    free(stub);
+    stub_count--;
+}
+
+void stub_define(const char *name, ASTNode *body, const char *definition) {
+    open_log();
+
+    // Defining it again in the same function starts it afresh
+    Stub *old = find_stub(name);
+    if (old && old->depth == stub_depth) remove_stub(old);
+
+    Stub *s = xmalloc(sizeof(Stub));
+    s->name = xstrdup(name);
+    s->body = body;
+    s->definition = xstrdup(definition);
+    s->depth = stub_depth;
+    snprintf(s->id, sizeof(s->id), "%ld.%lu", (long)getpid(), ++stub_serial);
+    s->next = stubs;
+    stubs = s;
+    stub_count++;
+}
+
+int stub_remove(const char *name) {
+    Stub *s = find_stub(name);
+    if (!s) return -1;
+    remove_stub(s);
+    return 0;
+}
+
+ASTNode *stub_lookup(const char *name) {
+    Stub *s = find_stub(name);
+    return s ? s->body : NULL;
+}
+
+ASTNode *stub_call(char **argv) {
+    Stub *s = find_stub(argv[0]);
+    if (!s) return NULL;
+
+    if (log_fd >= 0) {
+        struct buf_out record = {0};
+        struct buf_capture cap;
+        buf_out_capture_begin(&cap, &record);
+        buf_out_puts(s->id, &record);
+        for (char **arg = argv; *arg; arg++) {
+            BUF_PUTC(' ', &record);
+            buf_out_quoted(*arg, &record);
+        }
+        size_t len;
+        char *text = buf_out_capture_end(&cap, &len);
+        if (write(log_fd, text, len + 1) < 0) {
+            // The call still runs; it just goes unrecorded
+        }
+        free(text);
+    }
+    return s->body;
+}
+
+void stub_push_scope(void) {
+    stub_depth++;
+}
+
+void stub_pop_scope(void) {
+    stub_depth--;
+    while (stubs && stubs->depth > stub_depth) remove_stub(stubs);
+}
+
+static void print_definitions(Stub *s) {
+    if (!s) return;
+    print_definitions(s->next);
+    OUT_PUTS(s->definition);
+    OUT_PUTC('\n');
+}
+
+void stub_print_all(void) {
+    // Oldest first, so that reading them back shadows the same way
+    print_definitions(stubs);
+}
+
+static int is_counted(const char *id, Stub *only) {
+    if (only) return strcmp(only->id, id) == 0;
+    for (Stub *s = stubs; s; s = s->next) {
+        if (strcmp(s->id, id) == 0) return 1;
+    }
+    return 0;
+}
+
+int stub_print_calls(const char *name, int count_only) {
+    Stub *only = NULL;
+    if (name && !(only = find_stub(name))) return -1;
+
+    char *log = NULL;
+    size_t size = 0;
+    struct stat st;
+    if (log_fd >= 0 && fstat(log_fd, &st) == 0 && st.st_size > 0) {
+        log = xmalloc(st.st_size);
+        ssize_t n = pread(log_fd, log, st.st_size, 0);
+        size = n > 0 ? (size_t)n : 0;
+    }
+
+    long count = 0;
+    for (size_t pos = 0; pos < size;) {
+        char *record = log + pos;
+        size_t len = strnlen(record, size - pos);
+        pos += len + 1;
+        char *space = memchr(record, ' ', len);
+        if (!space) continue;
+        *space = '\0';
+        if (!is_counted(record, only)) continue;
+        count++;
+        if (!count_only) {
+            OUT_PUTS(space + 1);
+            OUT_PUTC('\n');
+        }
+    }
+    free(log);
+
+    if (count_only) OUT_PRINTF("%ld\n", count);
+    return 0;
+}
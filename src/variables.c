@@ -5,8 +5,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <unistd.h>
+#include <locale.h>
+#include "buf_output.h"
+#include "launch.h"
 #include "memalloc.h"
+#include "restricted.h"
 
 #define HASH_SIZE 1024
 
@@ -54,6 +59,54 @@ static unsigned long hash_djb2(const char *str, size_t *len_out) {
     return hash % HASH_SIZE;
 }
 
+// The shell's LC_CTYPE (characters in expansions and patterns) and
+// LC_COLLATE (sorted listings) follow these variables as they change, as
+// a command started with them would. The other categories stay "C" so
+// parsing is unaffected.
+static int locale_tracking = 0;
+
+static void update_locale(void) {
+    static const struct {
+        int category;
+        const char *name;
+    } categories[] = {
+        {LC_CTYPE, "LC_CTYPE"},
+        {LC_COLLATE, "LC_COLLATE"},
+    };
+    const char *all = posish_var_get_value("LC_ALL");
+    const char *lang = posish_var_get_value("LANG");
+    for (size_t i = 0; i < sizeof(categories) / sizeof(categories[0]); i++) {
+        const char *value = all && *all ? all : posish_var_get_value(categories[i].name);
+        if (!value || !*value) value = lang && *lang ? lang : "C";
+        // A locale that is not installed leaves the category "C"
+        if (!setlocale(categories[i].category, value)) setlocale(categories[i].category, "C");
+    }
+}
+
+int var_funcnest = 0;
+
+// Called whenever a variable is set, unset or restored, for the ones
+// the shell itself depends on
+static void var_changed(const char *name) {
+    if (locale_tracking && name[0] == 'L' &&
+        (strcmp(name, "LANG") == 0 || strcmp(name, "LC_ALL") == 0 ||
+         strcmp(name, "LC_CTYPE") == 0 || strcmp(name, "LC_COLLATE") == 0)) {
+        update_locale();
+    } else if (name[0] == 'P' && strcmp(name, "PATH") == 0) {
+        // Remembered command paths were found in the old PATH
+        launch_hash_forget(NULL);
+    } else if (name[0] == 'F' && strcmp(name, "FUNCNEST") == 0) {
+        // Like bash, a value that is not a positive number means no
+        // limit rather than an error: FUNCNEST may come in from the
+        // environment, and a bad one must not stop every function
+        const char *value = posish_var_get_value(name);
+        char *end;
+        long n = value ? strtol(value, &end, 10) : 0;
+        if (!value || end == value || *end || n < 0 || n > INT_MAX) n = 0;
+        var_funcnest = (int)n;
+    }
+}
+
 static void init_special_var(struct var *v, const char *name, const char *val) {
     v->name = xstrdup(name);
     v->name_len = strlen(name);
@@ -115,9 +168,43 @@ void posish_var_init(char **envp) {
             vps1.value = xstrdup("\\u@\\h:\\w\\$ ");
         }
     }
+    locale_tracking = 1;
+    update_locale();
+}
+
+// PIPESTATUS is kept as numbers, set after every command, and only
+// written out as the variable when something looks at it
+static int *pipestatus;
+static size_t pipestatus_count, pipestatus_cap;
+static int pipestatus_pending;
+
+static void flush_pipestatus(void) {
+    pipestatus_pending = 0;
+    char *text = xmalloc(pipestatus_count * 12 + 1);
+    char *p = text;
+    for (size_t i = 0; i < pipestatus_count; i++) {
+        if (i > 0) *p++ = ' ';
+        p += sprintf(p, "%d", pipestatus[i]);
+    }
+    *p = '\0';
+    posish_var_set("PIPESTATUS", text);
+    free(text);
+}
+
+void posish_var_set_pipestatus(const int *statuses, size_t count) {
+    if (count > pipestatus_cap) {
+        pipestatus_cap = count < 8 ? 8 : count;
+        pipestatus = xrealloc(pipestatus, pipestatus_cap * sizeof(int));
+    }
+    memcpy(pipestatus, statuses, count * sizeof(int));
+    pipestatus_count = count;
+    pipestatus_pending = 1;
 }
 
 static struct var *find_var(const char *name) {
+    if (pipestatus_pending && name[0] == 'P' && strcmp(name, "PIPESTATUS") == 0) {
+        flush_pipestatus();
+    }
     size_t len;
     unsigned long h = hash_djb2(name, &len);
     struct var *v = vartab[h];
@@ -132,6 +219,7 @@ static struct var *find_var(const char *name) {
 
 int posish_var_set(const char *name, const char *value) {
     if (!value) value = ""; // Safety fallback
+    if (shell_restricted && restrict_variable(name)) return 1;
     size_t len;
     unsigned long h = hash_djb2(name, &len);
     
@@ -156,6 +244,7 @@ int posish_var_set(const char *name, const char *value) {
                  }
             }
             v->flags &= ~VUNSET;
+            var_changed(name);
             return 0;
         }
         v = v->next;
@@ -171,6 +260,7 @@ int posish_var_set(const char *name, const char *value) {
     v->func = NULL;
     v->next = vartab[h];
     vartab[h] = v;
+    var_changed(name);
     return 0;
 }
 
@@ -230,7 +320,7 @@ const char *posish_var_get_value(const char *name) {
     return NULL;
 }
 
-void posish_var_unset(const char *name) {
+int posish_var_unset(const char *name) {
     // Invalidate cache
     /*
     for (int i = 0; i < VAR_CACHE_SIZE; i++) {
@@ -243,6 +333,8 @@ void posish_var_unset(const char *name) {
     }
     */
 
+    if (shell_restricted && restrict_variable(name)) return 1;
+
     unsigned long h = hash_djb2(name, NULL);
     struct var **curr = &vartab[h];
     while (*curr) {
@@ -250,7 +342,7 @@ void posish_var_unset(const char *name) {
             struct var *v = *curr;
             if (v->flags & VREADONLY) {
                 fprintf(stderr, "%s: readonly variable\n", name);
-                return;
+                return 1;
             }
             
             if (v->flags & VSTRUCTFIXED) {
@@ -263,24 +355,40 @@ void posish_var_unset(const char *name) {
                 free(v->value);
                 free(v);
             }
-            return;
+            var_changed(name);
+            return 0;
         }
         curr = &(*curr)->next;
     }
+    return 0;
 }
 
-void posish_var_export(const char *name) {
+// The entry for name, made unset if there is none, so that export and
+// readonly can mark a name before it is assigned
+static struct var *find_or_add_var(const char *name) {
     struct var *v = find_var(name);
-    if (v) {
-        v->flags |= VEXPORT;
-    }
+    if (!v) {
+        size_t len;
+        unsigned long h = hash_djb2(name, &len);
+        v = xmalloc(sizeof(struct var));
+        v->name = xstrdup(name);
+        v->name_len = len;
+        v->value = NULL;
+        v->flags = VUNSET;
+        v->is_local = 0;
+        v->func = NULL;
+        v->next = vartab[h];
+        vartab[h] = v;
+    }
+    return v;
+}
+
+void posish_var_export(const char *name) {
+    find_or_add_var(name)->flags |= VEXPORT;
 }
 
 void posish_var_set_readonly(const char *name) {
-    struct var *v = find_var(name);
-    if (v) {
-        v->flags |= VREADONLY;
-    }
+    find_or_add_var(name)->flags |= VREADONLY;
 }
 
 int posish_var_is_readonly(const char *name) {
@@ -288,7 +396,17 @@ int posish_var_is_readonly(const char *name) {
     return v && (v->flags & VREADONLY);
 }
 
+int posish_var_check_assign(const char *name) {
+    if (shell_restricted && restrict_variable(name)) return 1;
+    if (posish_var_is_readonly(name)) {
+        fprintf(stderr, "%s: readonly variable\n", name);
+        return 1;
+    }
+    return 0;
+}
+
 char **posish_var_get_environ(void) {
+    if (pipestatus_pending) flush_pipestatus();
     size_t count = 0;
     for (int i = 0; i < HASH_SIZE; i++) {
         struct var *v = vartab[i];
@@ -316,32 +434,57 @@ char **posish_var_get_environ(void) {
     return env;
 }
 
-char **posish_var_get_all(void) {
-    size_t count = 0;
+static int compare_var_names(const void *a, const void *b) {
+    const struct var *va = *(struct var *const *)a;
+    const struct var *vb = *(struct var *const *)b;
+    return strcoll(va->name, vb->name);
+}
+
+// Variables having all of the given flags, sorted by name in the
+// collation order; the array points at the live entries. Unset ones are
+// only included when flags asks for an attribute they may have.
+static struct var **sorted_vars(int flags, size_t *count) {
+    if (pipestatus_pending) flush_pipestatus();
+    int skip = flags ? 0 : VUNSET;
+    size_t n = 0;
     for (int i = 0; i < HASH_SIZE; i++) {
-        struct var *v = vartab[i];
-        while (v) {
-            if (!(v->flags & VUNSET)) count++;
-            v = v->next;
+        for (struct var *v = vartab[i]; v; v = v->next) {
+            if (!(v->flags & skip) && (v->flags & flags) == flags) n++;
         }
     }
-    
-    char **env = xmalloc(sizeof(char *) * (count + 1));
+
+    struct var **list = mem_stack_alloc((n + 1) * sizeof(*list));
     size_t idx = 0;
     for (int i = 0; i < HASH_SIZE; i++) {
-        struct var *v = vartab[i];
-        while (v) {
-            if (!(v->flags & VUNSET)) {
-                size_t len = strlen(v->name) + strlen(v->value) + 2;
-                env[idx] = xmalloc(len);
-                snprintf(env[idx], len, "%s=%s", v->name, v->value);
-                idx++;
-            }
-            v = v->next;
+        for (struct var *v = vartab[i]; v; v = v->next) {
+            if (!(v->flags & skip) && (v->flags & flags) == flags) list[idx++] = v;
         }
     }
-    env[idx] = NULL;
-    return env;
+    list[idx] = NULL;
+    qsort(list, n, sizeof(*list), compare_var_names);
+    *count = n;
+    return list;
+}
+
+void posish_var_list(int flags, const char *prefix) {
+    struct stackmark mark;
+    mem_stack_push_mark(&mark);
+    size_t count;
+    struct var **list = sorted_vars(flags, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (prefix) {
+            OUT_PUTS(prefix);
+            OUT_PUTC(' ');
+        }
+        OUT_PUTS(list[i]->name);
+        // A name given the attribute but no value is listed bare
+        if (!(list[i]->flags & VUNSET)) {
+            OUT_PUTC('=');
+            OUT_QUOTED(list[i]->value);
+        }
+        OUT_PUTC('\n');
+    }
+    mem_stack_pop_mark(&mark);
 }
 
 // Scope Management
@@ -384,6 +527,7 @@ void posish_var_pop_scope(void) {
             free(v->value);
             v->value = lv->value; // Take ownership back
             v->flags = lv->flags;
+            var_changed(v->name);
         }
         
         free(lv);
@@ -411,11 +555,9 @@ void posish_var_pop_scope(void) {
     */
 }
 
-void posish_var_declare_local(const char *name, const char *value) {
-    if (!current_scope) {
-        posish_var_set(name, value);
-        return;
-    }
+int posish_var_declare_local(const char *name, const char *value) {
+    if (shell_restricted && restrict_variable(name)) return 1;
+    if (!current_scope) return posish_var_set(name, value);
     
     struct var *v = find_var(name);
     struct localvar *lv = xmalloc(sizeof(struct localvar));
@@ -438,6 +580,8 @@ void posish_var_declare_local(const char *name, const char *value) {
         // Set new value
         free(v->value);
         v->value = xstrdup(value ? value : "");
+        v->flags &= ~VUNSET;
+        var_changed(name);
     } else {
         // Create new variable
         posish_var_set(name, value ? value : "");
@@ -451,6 +595,7 @@ void posish_var_declare_local(const char *name, const char *value) {
     
     lv->next = current_scope->locals;
     current_scope->locals = lv;
+    return 0;
 }
 
 // Positional parameters implementation (unchanged)
@@ -504,6 +649,10 @@ int posish_var_shift_positional(int n) {
     for (int i = 0; i < n; i++) {
         free(positional_args[i]);
     }
+    // Spare buffers past the count are dropped with the old array
+    for (size_t i = positional_count; i < positional_capacity; i++) {
+        free(positional_args[i]);
+    }
 
     int new_count = positional_count - n;
     if (new_count > 0) {
@@ -518,6 +667,7 @@ int posish_var_shift_positional(int n) {
         positional_args = NULL;
     }
     positional_count = new_count;
+    positional_capacity = new_count;
     return 0;
 }
 
@@ -565,12 +715,23 @@ PositionalSave posish_var_save_positional_fast(void) {
     PositionalSave save;
     save.args = positional_args;
     save.count = positional_count;
+    save.capacity = positional_capacity;
+    positional_args = NULL;
+    positional_count = 0;
+    positional_capacity = 0;
     return save;
 }
 
 void posish_var_restore_positional_fast(PositionalSave save) {
+    if (positional_args) {
+        for (size_t i = 0; i < positional_capacity; i++) {
+            free(positional_args[i]);
+        }
+        free(positional_args);
+    }
     positional_args = save.args;
     positional_count = save.count;
+    positional_capacity = save.capacity;
 }
 
 static pid_t last_bg_pid = -1;
@@ -602,34 +763,6 @@ int posish_var_is_valid_name(const char *name) {
     return 1;
 }
 
-char **posish_var_get_all_readonly(void) {
-    size_t count = 0;
-    for (int i = 0; i < HASH_SIZE; i++) {
-        struct var *v = vartab[i];
-        while (v) {
-            if (v->flags & VREADONLY) count++;
-            v = v->next;
-        }
-    }
-    
-    char **result = xmalloc(sizeof(char *) * (count + 1));
-    size_t idx = 0;
-    for (int i = 0; i < HASH_SIZE; i++) {
-        struct var *v = vartab[i];
-        while (v) {
-            if (v->flags & VREADONLY) {
-                size_t len = strlen(v->name) + strlen(v->value) + 2;
-                result[idx] = xmalloc(len);
-                snprintf(result[idx], len, "%s=%s", v->name, v->value);
-                idx++;
-            }
-            v = v->next;
-        }
-    }
-    result[idx] = NULL;
-    return result;
-}
-
 static void int_to_str(int n, char *buf) {
     char temp[32];
     int i = 0;
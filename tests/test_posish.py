@@ -3,6 +3,11 @@ import os
 import pytest
 import shutil
 import tempfile
+import time
+import pty
+import select
+import re
+import json
 
 import platform
 
@@ -36,6 +41,53 @@ def run_posish_script(script_content):
     )
     return process.stdout.strip()
 
+def run_posish_pty(keys, args=None, env=None, timeout=3):
+    """Runs posish on a pseudo-terminal, typing each string in keys with a
+    short pause between them. Returns everything written to the terminal."""
+    child_env = dict(os.environ)
+    child_env["PS1"] = "$ "
+    child_env["TERM"] = "dumb"
+    if env:
+        child_env.update(env)
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.execve(POSISH_PATH, [POSISH_PATH] + (args or ["-i"]), child_env)
+    output = b""
+    deadline = time.time() + timeout
+
+    def drain(wait):
+        nonlocal output
+        end = time.time() + wait
+        while time.time() < end:
+            ready, _, _ = select.select([fd], [], [], max(0, end - time.time()))
+            if not ready:
+                break
+            try:
+                data = os.read(fd, 4096)
+            except OSError:
+                return False
+            if not data:
+                return False
+            output += data
+        return True
+
+    for chunk in keys:
+        drain(0.15)
+        os.write(fd, chunk.encode() if isinstance(chunk, str) else chunk)
+    while time.time() < deadline and drain(0.2):
+        pass
+    try:
+        os.kill(pid, 9)
+    except ProcessLookupError:
+        pass
+    os.waitpid(pid, 0)
+    os.close(fd)
+    return output.decode(errors="replace")
+
+def pty_lines(output):
+    """Lines of terminal output with carriage returns removed."""
+    return [line.rstrip("\r") for line in output.split("\n")]
+
 # ============================================================================
 # CATEGORY: Basic Commands
 # ============================================================================
@@ -83,6 +135,37 @@ def test_readonly_variables():
 def test_export_variables():
    assert run_posish("export VAR=exported; echo $VAR")[0] == "exported"
 
+def test_state_listings_round_trip():
+    # Values with quotes, newlines and expansions read back unchanged
+    script = r"""
+    qa="it's
+two"; qb='$x \ `y`'; qc=
+    export qb qa qc
+    readonly qr='a b'
+    alias qz='echo "z"' qy="it's"
+    trap 'echo '"'"'done'"'"'' USR1
+    saved=$(export -p; readonly -p; alias; trap)
+    unset qa qb qc; unalias qz qy; trap - USR1
+    eval "$saved" 2>/dev/null
+    printf '[%s]\n' "$qa" "$qb" "$qc" "$qr"
+    alias qz qy
+    trap
+    export -p | grep -c '^export q'
+    """
+    assert run_posish_script(script).split("\n") == [
+        "[it's", "two]", "[$x \\ `y`]", "[]", "[a b]",
+        "alias qz='echo \"z\"'", "alias qy='it'\\''s'",
+        "trap -- 'echo '\\''done'\\''' USR1", "3"]
+    stdout = run_posish("qb=1 qa=2 qc=3; set | grep '^q.='")[0]
+    assert stdout == "qa=2\nqb=1\nqc=3"
+
+    # Names marked before they have a value are listed bare, and keep
+    # the attribute once assigned
+    stdout = run_posish(
+        "export qe; readonly qr; export -p | grep ' q'; readonly -p | grep ' q'; "
+        "set | grep -c '^q'; qe=1; sh -c 'echo $qe'")[0]
+    assert stdout == "export qe\nreadonly qr\n0\n1"
+
 #  ============================================================================
 # CATEGORY: Parameter Expansion
 # ============================================================================
@@ -280,6 +363,12 @@ EOF
     """
     assert run_posish(script)[0] == "line1\nline2"
 
+def test_here_document_variants():
+    assert run_posish("cat <<EOF | tr a-z A-Z\nhello\nEOF")[0] == "HELLO"
+    assert run_posish("cat <<-EOF\n\tindented\n\tEOF")[0] == "indented"
+    assert run_posish("cat <<'EOF'\n$HOME\nEOF")[0] == "$HOME"
+    assert run_posish("cat <<A; cat <<B\none\nA\ntwo\nB")[0] == "one\ntwo"
+
 # ============================================================================
 # CATEGORY: Pipes and Command Substitution
 # ============================================================================
@@ -372,6 +461,9 @@ def test_test_empty_string_quoted():
     # Regression test for empty quoted variable
     assert run_posish('s=""; [ "$s" = "$s" ] \u0026\u0026 echo PASS')[0] == "PASS"
 
+def test_test_usage_error_does_not_exit():
+    assert run_posish("[ 1 -eq ]; echo $?")[0] == "2"
+
 # ============================================================================
 # CATEGORY: Builtins
 # ============================================================================
@@ -411,6 +503,33 @@ def test_set_options():
     _, stderr, _ = run_posish("set -x; echo test")
     assert "+ echo test" in stderr or "echo test" in stderr
 
+def test_set_verbose(tmp_path):
+    # Lines are echoed as they are read, heredoc bodies included; the
+    # toggle takes effect from the line after "set -v"
+    script = tmp_path / "verbose.sh"
+    script.write_text(
+        "echo quiet\n"
+        "set -v\n"
+        "for i in a b\n"
+        "do\n"
+        "  echo $i\n"
+        "done\n"
+        "cat <<END\n"
+        "body\n"
+        "END\n"
+        "set +v\n"
+        "echo finished\n"
+    )
+    process = subprocess.run([POSISH_PATH, str(script)], capture_output=True,
+                             text=True, timeout=2)
+    assert process.stdout == "quiet\na\nb\nbody\nfinished\n"
+    assert process.stderr == ("for i in a b\ndo\n  echo $i\ndone\n"
+                              "cat <<END\nbody\nEND\nset +v\n")
+
+def test_set_verbose_option():
+    _, stderr, _ = run_posish("set -o verbose\necho x\n")
+    assert stderr == "echo x\n"
+
 def test_set_positional():
     assert run_posish("set -- x y z; echo $1 $2 $3")[0] == "x y z"
     assert run_posish("set -- a; echo $#")[0] == "1"
@@ -433,10 +552,55 @@ def test_printf():
     assert run_posish("printf '%s\\n' test")[0] == "test"
     assert run_posish("printf '%d\\n' 42")[0] == "42"
 
+def test_printf_to_variable():
+    assert run_posish("printf -v x '%05d' 42; echo \"[$x]\"")[0] == "[00042]"
+    # The value keeps trailing newlines, unlike $(...)
+    assert run_posish("printf -v x 'a\\n\\n'; echo \"[$x]\"")[0] == "[a\n\n]"
+    assert run_posish("readonly r=1; printf -v r 2; echo $?")[0] == "1"
+    assert run_posish("printf -v 1x a")[2] == 2
+    # Captured output of builtins and functions stays in the subshell
+    script = "f() { printf -v x inner; g=1; }; y=$(f); z=$(printf '%s' ${u:=1}); echo \"[$x$g$u]\""
+    assert run_posish(script)[0] == "[]"
+    # So does an assignment in a (...) subshell
+    assert run_posish("(printf -v x leaked); o=-v; (printf $o x leaked); echo \"[$x]\"")[0] == "[]"
+
 def test_read():
     stdout, _, _ = run_posish("read VAR; echo $VAR", input_data="input\n")
     assert stdout == "input"
 
+def test_read_delimiter_count_and_timeout(tmp_path):
+    script = 'while read -r -d "" f; do echo "<$f>"; done'
+    assert run_posish(script, input_data="a b\0c\\d\0")[0] == "<a b>\n<c\\d>"
+    assert run_posish("read -n 3 x; read -rn2 y; echo $x $y", input_data="abcdef\n")[0] == "abc de"
+    assert run_posish("read -d : x; echo $x", input_data="one:two\n")[0] == "one"
+    # Expiry keeps what arrived and returns a status above 128
+    process = subprocess.Popen([POSISH_PATH, "-c", "read -t 0.2 v; echo $? $v"],
+                               stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+    process.stdin.write("part")
+    process.stdin.flush()
+    out = process.stdout.read()
+    process.stdin.close()
+    process.wait(timeout=2)
+    assert out.strip() == "142 part"
+    # Nothing past the delimiter is consumed, so commands run next see it
+    data = tmp_path / "data"
+    data.write_text("l1\nl2\nl3\n")
+    script = tmp_path / "s.sh"
+    script.write_text('read a; head -n 1; read b; echo "$a/$b"\n')
+    with open(data) as f:
+        out = subprocess.run([POSISH_PATH, str(script)], stdin=f,
+                             capture_output=True, text=True, timeout=2).stdout
+    assert out == "l2\nl1/l3\n"
+
+def test_ulimit():
+    # Limits set in a subshell or command substitution stay there
+    stdout, _, _ = run_posish("a=$(ulimit -n); (ulimit -n 64; ulimit -n); b=$(ulimit -n 50; ulimit -n); echo $b; [ \"$a\" = \"$(ulimit -n)\" ] && echo kept")
+    assert stdout.split() == ["64", "50", "kept"]
+    assert "open files" in run_posish("ulimit -a")[0]
+    assert run_posish("ulimit -S -f 100; ulimit -Sf")[0] == "100"
+    _, stderr, rc = run_posish("ulimit -n lots")
+    assert rc == 1 and "bad number" in stderr
+
 # ============================================================================
 # CATEGORY: Quoting and Escaping
 # ============================================================================
@@ -543,6 +707,531 @@ def test_special_chars_in_strings():
     assert run_posish("echo 'test!@#$%^&*()'")[0] == "test!@#$%^&*()"
     assert run_posish('echo "test<>\u003e|"')[0] == "test<>\u003e|"
 
+def test_error_in_function_exits_shell():
+    stdout, stderr, code = run_posish("f() { : ${x:?gone}; }; f; echo no")
+    assert code == 1
+    assert stdout == ""
+    assert "x: gone" in stderr
+
+def test_error_without_colon_only_for_unset():
+    # ${x?msg} fails only when x is unset, ${x:?msg} also when it is null
+    stdout, stderr, code = run_posish("f() { : ${x?gone}; }; f; echo no")
+    assert (stdout, code) == ("", 1)
+    assert "x: gone" in stderr
+    stdout, _, code = run_posish("x=; : ${x?gone}; echo \"[${x-a}][${y-a}][${x+b}][${y=c}]\"")
+    assert (stdout, code) == ("[][a][b][c]", 0)
+    # An assignment in a (...) subshell stays there
+    stdout, _, _ = run_posish("(echo ${x=v}); (echo ${y:=w}); echo \"[$x$y]\"")
+    assert stdout == "v\nw\n[]"
+
+def test_error_unwinds_interactive_state():
+    # An error inside a function with redirections and locals returns to
+    # the prompt with fds, positional parameters and scopes restored
+    script = """
+x=outer
+f() { local x=inner; set -- a b c; : ${missing:?boom}; }
+fds() { set -- /proc/$$/fd/*; echo $#; }
+set -- 1 2
+fds
+f >/dev/null 2>&1
+echo "status=$? x=$x #=$# *=$*"
+f 2>/dev/null
+fds
+"""
+    process = subprocess.run(
+        [POSISH_PATH, "-i"], input=script, capture_output=True, text=True,
+        timeout=2, env={"HOME": "/tmp", "PS1": "", "PATH": os.environ["PATH"]}
+    )
+    counts = [l.strip() for l in process.stdout.splitlines() if l.strip().isdigit()]
+    assert "status=1 x=outer #=2 *=1 2" in process.stdout
+    assert len(counts) == 2 and counts[0] == counts[1]
+
+def test_syntax_errors_positions_and_check_mode(tmp_path):
+    # -n reads the whole script and reports every syntax error it holds
+    # with its file:line:column, running nothing
+    script = tmp_path / "broken.sh"
+    script.write_text(
+        "echo start\n"
+        "if true; echo x; fi\n"
+        "for i in a b; do\n"
+        "  echo $i\n"
+        "done\n"
+        "case y in\n"
+        "  z echo no ;;\n"
+        "esac\n"
+        "echo >\n"
+        "echo (\n"
+    )
+    process = subprocess.run([POSISH_PATH, "-n", str(script)], capture_output=True,
+                             text=True, timeout=2)
+    assert process.returncode == 2
+    assert process.stdout == ""
+    assert process.stderr.splitlines() == [
+        f"{script}:2:18: syntax error near unexpected token `fi' (expected `then')",
+        f"{script}:7:5: syntax error near unexpected token `echo' (expected `)')",
+        f"{script}:9:7: syntax error near unexpected token `newline' (expected `word')",
+        f"{script}:10:6: syntax error near unexpected token `('",
+    ]
+
+    process = subprocess.run([POSISH_PATH, "--diagnostics=json", "-n", str(script)],
+                             capture_output=True, text=True, timeout=2)
+    first = json.loads(process.stderr.splitlines()[0])
+    assert first == {"file": str(script), "line": 2, "column": 18, "offset": 28,
+                     "severity": "error", "code": "syntax",
+                     "message": "syntax error near unexpected token `fi' (expected `then')"}
+
+    # Without -n the first error stops the script; an unfinished command
+    # names what it still lacks
+    _, stderr, code = run_posish("echo a\nwhile :; do\n  echo b")
+    assert code == 2
+    assert stderr.endswith(":2:1: syntax error: unexpected end of file (expected `done')\n")
+    assert run_posish('eval "if x"; echo $?')[0] == "2"
+
+def test_lint(tmp_path):
+    script = tmp_path / "lint.sh"
+    script.write_text(
+        "greet() { echo \"hello $1\"; }\n"
+        "unused() { :; }\n"
+        "name=world\n"
+        "greet $name\n"
+        "cd /tmp\n"
+        "cd /tmp || exit 1\n"
+        "cat notes | grep x\n"
+        "echo \"$typo\" \"${maybe:-none}\"\n"
+        "[ \"$name\" == x ] && source ./lib\n"
+        "rm $name # posish-lint: ignore=unquoted-expansion\n"
+        "# posish-lint: ignore\n"
+        "rm $name\n"
+        "exit 0\n"
+        "echo never\n"
+    )
+    process = subprocess.run([POSISH_PATH, "--lint", str(script)], capture_output=True,
+                             text=True, timeout=2)
+    assert process.returncode == 1
+    assert process.stderr.splitlines() == [
+        f"{script}:2:1: warning: function `unused' is defined but never called [unused-function]",
+        f"{script}:4:7: warning: $name is not quoted; its value is split into fields and globbed [unquoted-expansion]",
+        f"{script}:5:1: warning: cd can fail and the script then runs in the wrong directory; use `cd ... || exit' [unchecked-cd]",
+        f"{script}:7:1: style: useless cat: redirect `notes' into the next command with < [useless-cat]",
+        f"{script}:8:7: warning: `typo' is used but never assigned [unset-variable]",
+        f"{script}:9:1: warning: `==' in [ is not POSIX; use `=' [non-posix]",
+        f"{script}:9:21: warning: `source' is not POSIX; use `.' [non-posix]",
+        f"{script}:14:1: warning: this command never runs: `exit' comes before it [unreachable]",
+    ]
+
+    clean = tmp_path / "clean.sh"
+    clean.write_text("set -e\ncd /tmp\nfor f in *; do printf '%s\\n' \"$f\"; done\n")
+    process = subprocess.run([POSISH_PATH, "--diagnostics=json", "--lint", str(clean), str(script)],
+                             capture_output=True, text=True, timeout=2)
+    assert process.returncode == 1
+    first = json.loads(process.stderr.splitlines()[0])
+    assert (first["file"], first["line"], first["severity"], first["code"]) == \
+        (str(script), 2, "warning", "unused-function")
+
+def test_type_and_set_show_function_source():
+    script = (
+        "f() {\n"
+        "  cat <<-EOF\n"
+        "\thello $1\n"
+        "\tEOF\n"
+        "  case $1 in a|b) if [ -n \"$2\" ]; then echo two; else echo one; fi;; *) ;; esac\n"
+        "}\n"
+        "type f\n"
+        "set | sed -n '/^f()/,$p'\n"
+    )
+    expected = (
+        "f() {\n"
+        "    cat <<-EOF\n"
+        "hello $1\n"
+        "EOF\n"
+        "    case $1 in\n"
+        "        a | b)\n"
+        "            if [ -n \"$2\" ]; then\n"
+        "                echo two\n"
+        "            else\n"
+        "                echo one\n"
+        "            fi\n"
+        "            ;;\n"
+        "        *)\n"
+        "            ;;\n"
+        "    esac\n"
+        "}\n"
+    )
+    stdout, stderr, returncode = run_posish(script)
+    assert returncode == 0
+    assert stdout == ("f is a function\n" + expected + expected).strip()
+
+def _shell_snippets():
+    # Every constant script in this file: the first argument of the run
+    # helpers and the text of write_text() calls
+    import ast
+    with open(__file__) as f:
+        tree = ast.parse(f.read())
+    snippets = []
+    for node in ast.walk(tree):
+        if not isinstance(node, ast.Call) or not node.args:
+            continue
+        func = node.func
+        name = func.attr if isinstance(func, ast.Attribute) else getattr(func, "id", "")
+        arg = node.args[0]
+        if name in ("run_posish", "run_posish_script", "write_text") and \
+                isinstance(arg, ast.Constant) and isinstance(arg.value, str):
+            snippets.append(arg.value)
+    return snippets
+
+def test_command_substitution_calls_function_with_own_parameters():
+    # A function whose body is one output-only builtin is run in the shell
+    # for $(...), but still gets positional parameters of its own
+    stdout, _, _ = run_posish(
+        'set -- outer a; f() { echo "<$1>" $# $@; }; x=$(f); echo "$x"; echo "$1"')
+    assert stdout.split("\n") == ["<> 0", "outer"]
+
+def test_format_round_trip():
+    # --format checks that its output parses back to the same tree and
+    # fails if not, so exit status 0 is the round-trip property
+    checked = 0
+    for snippet in _shell_snippets():
+        process = subprocess.run([POSISH_PATH, "--format"], input=snippet, capture_output=True,
+                                 text=True, timeout=2)
+        if process.returncode == 2:
+            continue  # Deliberate syntax errors
+        assert process.returncode == 0, (snippet, process.stderr)
+        again = subprocess.run([POSISH_PATH, "--format"], input=process.stdout,
+                               capture_output=True, text=True, timeout=2)
+        assert again.stdout == process.stdout, snippet
+        checked += 1
+    assert checked > 100
+
+def test_caller_and_backtrace(tmp_path):
+    lib = tmp_path / "lib.sh"
+    lib.write_text(
+        "check() {\n"
+        "    : \"${1:?value required}\"\n"
+        "}\n"
+        "trace() { i=0; while caller $i; do i=$((i + 1)); done; }\n"
+    )
+    script = tmp_path / "main.sh"
+    script.write_text(
+        f". {lib}\n"
+        "where() { caller; }\n"
+        "outer() {\n"
+        "    where\n"
+        "    trace\n"
+        "    check \"$1\"\n"
+        "}\n"
+        "outer x\n"
+        "caller || echo top\n"
+        "set -o backtrace\n"
+        "outer\n"
+        "echo not reached\n"
+    )
+    process = subprocess.run([POSISH_PATH, str(script)], capture_output=True, text=True, timeout=2)
+    assert process.returncode == 1
+    assert process.stdout.splitlines() == [
+        f"4 {script}",
+        f"5 outer {script}",
+        f"8 main {script}",
+        "top",
+        f"4 {script}",
+        f"5 outer {script}",
+        f"11 main {script}",
+    ]
+    assert process.stderr.splitlines()[1:] == [
+        "backtrace:",
+        f"  at {lib}:2 in check",
+        f"  at {script}:6 in outer",
+        f"  at {script}:11 in main",
+    ]
+
+    stdout, stderr, returncode = run_posish(
+        "set -e -o backtrace\nf() {\n  false\n}\nf\necho no\n")
+    assert returncode == 1
+    assert stdout == ""
+    assert re.fullmatch(r"backtrace:\n  at .*:3 in f\n  at .*:5 in main\n", stderr)
+
+def test_coverage_lcov(tmp_path):
+    child = tmp_path / "child.sh"
+    child.write_text(
+        "if false; then\n"
+        "    echo unreached\n"
+        "fi\n"
+    )
+    script = tmp_path / "main.sh"
+    script.write_text(
+        "f() {\n"
+        "    if [ \"$1\" = a ]; then\n"
+        "        echo a\n"
+        "    else\n"
+        "        echo other\n"
+        "    fi\n"
+        "}\n"
+        "f a; f a\n"
+        "case x in\n"
+        "    y) echo y ;;\n"
+        "esac\n"
+        "true && echo yes\n"
+        "( echo sub; x=1 )\n"
+        f"{POSISH_PATH} {child} & {POSISH_PATH} {child}; wait\n"
+    )
+    info = tmp_path / "out.info"
+    process = subprocess.run([POSISH_PATH, f"--coverage={info}", str(script)],
+                             capture_output=True, text=True, timeout=5)
+    assert process.returncode == 0
+    records = {}
+    for block in info.read_text().split("end_of_record\n")[:-1]:
+        lines = block.splitlines()
+        name = next(l[3:] for l in lines if l.startswith("SF:"))
+        records[name] = lines
+    main = records[str(script.resolve())]
+    assert [l for l in main if l.startswith("DA:")] == [
+        "DA:1,2", "DA:2,2", "DA:3,2", "DA:5,0", "DA:8,1", "DA:9,1", "DA:10,0",
+        "DA:12,1", "DA:13,2", "DA:14,2",
+    ]
+    branches = [l.rsplit(",", 1)[1] for l in main if l.startswith("BRDA:")]
+    assert branches == ["2", "0", "0", "1", "1", "0"]
+    assert "LH:8" in main and "BRH:3" in main
+    assert [l for l in records[str(child.resolve())] if l.startswith(("DA:", "BRDA:"))][2:] == [
+        "DA:1,2", "DA:2,0",
+    ]
+
+def test_coverage_survives_vfork_subshell(tmp_path):
+    # A subshell simple enough to run in a vfork child must not use up
+    # the parent's atexit handlers, which write the lcov file, nor leave
+    # later children unable to flush their output
+    script = tmp_path / "sub.sh"
+    script.write_text("(echo sub)\n(echo ${x:?oops})\necho $? | cat\n")
+    info = tmp_path / "out.info"
+    process = subprocess.run([POSISH_PATH, f"--coverage={info}", str(script)],
+                             capture_output=True, text=True, timeout=5)
+    assert process.stdout == "sub\n1\n"
+    assert [l for l in info.read_text().splitlines() if l.startswith("DA:")][:2] == [
+        "DA:1,1", "DA:2,1",
+    ]
+
+def test_debugger_breakpoints_and_stepping(tmp_path):
+    script = tmp_path / "dbg.sh"
+    script.write_text(
+        "greet() {\n"
+        "    msg=\"hello $1\"\n"
+        "    echo \"$msg\"\n"
+        "}\n"
+        "greet world\n"
+        "x=1\n"
+        "echo x=$x\n"
+    )
+    out = run_posish_pty(["b greet\r", "c\r", "n\r", "p msg 1\r", "bt\r", "finish\r",
+                          "b dbg.sh:7\r", "c\r", "set x=5\r", "e echo eval $x\r", "c\r"],
+                         args=["--debug", str(script)])
+    lines = [l for l in pty_lines(out) if l]
+    assert lines[:2] == [f"stopped at {script}:5 in main", "5\tgreet world"]
+    assert f"breakpoint 1 at {script}:2 in greet" in lines
+    assert f"stopped at {script}:3 in greet" in lines
+    assert "(debug) p msg 1" in lines and "msg=hello world" in lines and "1=world" in lines
+    assert f"  at {script}:3 in greet" in lines and f"  at {script}:5 in main" in lines
+    assert lines.index("hello world") < lines.index(f"stopped at {script}:6 in main")
+    assert f"breakpoint 2 at {script}:7 in main" in lines
+    assert lines[-3:] == ["eval 5", "(debug) c", "x=5"]
+
+def test_restricted_mode_blocks_escapes(tmp_path):
+    target = tmp_path / "written"
+    attempts = [
+        "cd /",
+        "PATH=/tmp",
+        "export PATH=/tmp",
+        "unset PATH",
+        "f() { local PATH=/tmp; }; f",
+        "SHELL=/bin/sh true",
+        "ENV=/tmp/x",
+        "for PATH in /tmp; do :; done",
+        "/bin/echo escaped",
+        "command /bin/echo escaped",
+        "command -p echo escaped",
+        f"echo escaped > {target}",
+        f"echo escaped >> {target}",
+        f"echo escaped 1<> {target}",
+        "exec /bin/sh",
+        ". /dev/null",
+        "eval cd /",
+        f"(echo escaped > {target})",
+        f"echo escaped | cat > {target}",
+    ]
+    for attempt in attempts:
+        process = subprocess.run([POSISH_PATH, "-r", "-c", attempt + "; echo rc=$?"],
+                                 capture_output=True, text=True, timeout=2)
+        assert "escaped" not in process.stdout, attempt
+        assert "rc=0" not in process.stdout, attempt
+        assert "restricted" in process.stderr, attempt
+    assert not target.exists()
+
+    # Allowed: plain commands, pipelines, descriptor duplication, ordinary variables
+    stdout, stderr, rc = run_posish("echo ok 2>&1 | cat; x=1; echo $x")
+    assert (stdout, rc) == ("ok\n1", 0)
+    process = subprocess.run([POSISH_PATH, "-r", "-c", "echo ok 2>&1 | cat; x=1; echo $x"],
+                             capture_output=True, text=True, timeout=2)
+    assert (process.stdout, process.returncode) == ("ok\n1\n", 0)
+
+def test_restricted_mode_starts_after_startup_files(tmp_path):
+    rc = tmp_path / "rc.sh"
+    rc.write_text("PATH=/usr/bin:/bin\ncd /\n")
+    link = tmp_path / "rposish"
+    link.symlink_to(POSISH_PATH)
+    for argv in ([POSISH_PATH, "-r", "-i"], [str(link), "-i"]):
+        process = subprocess.run(argv, input="echo $PATH; pwd; cd /tmp; PATH=/tmp\n",
+                                 capture_output=True, text=True, timeout=2,
+                                 env={**os.environ, "ENV": str(rc), "PS1": ""})
+        assert process.stdout.splitlines()[:2] == ["/usr/bin:/bin", "/"]
+        assert "cd: restricted" in process.stderr
+        assert "PATH: restricted variable" in process.stderr
+
+def test_multibyte_characters(tmp_path):
+    # Lengths, patterns, globbing and splitting count characters, not bytes
+    (tmp_path / "\u00e9.txt").write_text("")
+    (tmp_path / "ab.txt").write_text("")
+    script = f"""
+    LC_ALL=C.UTF-8
+    x=h\u00e9llo
+    echo ${{#x}} ${{x%?}} ${{x#h?}} ${{x%%l*}} ${{x##*l}}
+    case \u00e9 in ?) echo one;; esac
+    case \u00e9 in [[:alpha:]]) echo alpha;; esac
+    case \u00e9 in [\u00e0-\u00eb]) echo range;; esac
+    case \u00df in [!a-z]) echo negated;; esac
+    cd {tmp_path}; echo ?.txt; echo ??.txt
+    IFS=\u00e9; set -- a\u00e8b\u00e9c; echo $#:$1:$2
+    echo "x\u00e9y\u00e8z" | {{ read a b; echo $a/$b; }}
+    printf '\u00f1a\u00f1b' | {{ read -n 2 v; echo $v; }}
+    LC_ALL=C; echo ${{#x}}
+    """
+    assert run_posish_script(script).split("\n") == [
+        "5 h\u00e9ll llo h\u00e9 o", "one", "alpha", "range", "negated",
+        "\u00e9.txt", "ab.txt", "2:a\u00e8b:c", "x/y\u00e8z", "\u00f1a", "6"]
+
+def test_stub_commands():
+    # Stubs replace external commands, record their calls (subshells
+    # included) and go out of scope with the function that made them
+    script = """
+    stub curl 'echo "fetched $*"'
+    curl -s 'http://a b'
+    stub -o 'ok: done' -s 3 git
+    echo "[$(git status)]"; git push; echo "status $?"
+    echo x | curl -X | cat
+    f() { stub git 'echo inner'; git; }
+    f; git log
+    ( stub date 'echo fake' ); date +%Y | grep -c fake
+    command -v curl; type git
+    stub -l curl; stub -c git
+    stub deploy; stub -d deploy; command -v deploy || echo gone
+    """
+    assert run_posish_script(script).split("\n") == [
+        "fetched -s http://a b", "[ok: done]", "ok: done", "status 3",
+        "fetched -X", "inner", "ok: done", "0", "curl", "git is a stub",
+        "curl -s 'http://a b'", "curl -X", "3", "gone"]
+
+def test_launching_programs(tmp_path):
+    # Every way of starting a program sees the shell's exported variables,
+    # prefix assignments, lookup and ignored signals, and only the last
+    # command of a forked child replaces it
+    (tmp_path / "noshebang").write_text("echo script $1\n")
+    (tmp_path / "noshebang").chmod(0o755)
+    script = f"""
+    cd {tmp_path}
+    (/bin/echo a; /bin/echo b); x=$(/bin/echo c; /bin/echo d); echo $x
+    /bin/echo e | {{ /bin/cat; /bin/echo f; }}
+    v=old; v=new sh -c 'echo $v' $v; echo $v
+    export EXPORTED=1; (exec sh -c 'echo $EXPORTED')
+    (ONLY=2 exec sh -c 'echo $ONLY'); echo "[$ONLY]"
+    VIA=3 command printenv VIA; (VIA=4 command exec printenv VIA); echo "[$VIA]"
+    PATH=/nonexistent ls; echo $?
+    trap '' INT; sh -c 'kill -INT $$; echo survived'; trap - INT
+    hash -r; hash sh; hash; PATH=$PATH; hash; hash nonexistent-cmd; echo $?
+    exec 3>out; echo kept >&3; cat out
+    ./noshebang arg
+    """
+    stdout = run_posish_script(script)
+    assert stdout.split("\n") == [
+        "a", "b", "c d", "e", "f", "new", "old", "1", "2", "[]", "3", "4", "[]", "127",
+        "survived", shutil.which("sh"), "1", "kept", "script arg"]
+
+def test_pipefail_and_pipestatus():
+    # PIPESTATUS has every stage's status; pipefail makes the pipeline's
+    # status the last failing one
+    script = """
+    false | (exit 3) | true; echo "$? $PIPESTATUS"
+    true; echo $PIPESTATUS
+    set -o pipefail
+    (exit 2) | false | true; echo "$? $PIPESTATUS"
+    true | true; echo $?
+    if false | true; then echo passed; else echo failed; fi
+    set +o pipefail
+    false | true; echo $?
+    """
+    stdout = run_posish_script(script)
+    assert stdout.split("\n") == ["0 1 3 0", "0", "1 2 1 0", "0", "failed", "0"]
+
+def test_pipeline_negation_and_time():
+    # ! inverts a pipeline's status; time reports on stderr; reserved
+    # words past the start of a command are plain words
+    script = """
+    if ! grep -q x /dev/null; then echo absent; fi
+    ! true | false; echo $?
+    set -e; ! true; set +e
+    echo done time !
+    case fi in fi) echo matched;; esac
+    for i in do done; do echo $i; done
+    f() { ! time -p true; }; f; echo $?
+    """
+    stdout, stderr, rc = run_posish(script)
+    assert stdout.split("\n") == ["absent", "0", "done time !", "matched", "do", "done", "1"]
+    assert re.fullmatch(r"real \d+\.\d\d\nuser \d+\.\d\d\nsys \d+\.\d\d\n", stderr)
+
+    _, stderr, _ = run_posish("time sleep 0.1")
+    real = re.search(r"real\t0m(\d+\.\d{3})s", stderr)
+    assert real and float(real.group(1)) >= 0.1
+
+def test_recursion_depth_limits():
+    # FUNCNEST bounds function calls with a backtrace; without it deep
+    # recursion runs on the shell's own stack, and input nested past it
+    # is a syntax error rather than a crash
+    stdout, stderr, rc = run_posish("FUNCNEST=5; f() { f; }; f; echo not reached")
+    assert rc == 1 and stdout == ""
+    assert "f: maximum function nesting level exceeded (5)" in stderr
+    assert stderr.count(" in f\n") == 5
+
+    stdout, _, rc = run_posish("FUNCNEST=x; f() { [ $1 -gt 0 ] && f $(($1-1)); }; f 20; echo $?")
+    assert (stdout, rc) == ("1", 0)
+
+    stdout, stderr, rc = run_posish(
+        "f() { [ $1 -gt 0 ] && f $(($1-1)); }; f 100000; echo done")
+    assert (stdout, stderr, rc) == ("done", "", 0)
+
+    stdout, stderr, rc = run_posish("trap 'echo trap' EXIT; f() { f; }; f 2>/dev/null")
+    assert (stdout, rc) == ("trap", 2)
+
+    depth = 300000
+    process = subprocess.run([POSISH_PATH], input="{ " * depth + "echo hi; " + "} " * depth,
+                             capture_output=True, text=True, timeout=5)
+    assert process.returncode == 2 and process.stdout == ""
+    assert "syntax error: nested too deeply" in process.stderr
+
+def test_trap_interrupts_wait():
+    # A trapped signal ends the wait builtin at once with 128+signo and
+    # runs the trap; a foreground command is still waited for. $$ in a
+    # subshell is the shell's pid.
+    start = time.time()
+    stdout, _, _ = run_posish(
+        "trap 'echo t' TERM; sleep 2 >/dev/null 2>&1 & (sleep 0.2; kill -TERM $$) & wait; echo $?")
+    assert stdout.split("\n") == ["t", "143"]
+    assert time.time() - start < 1.5
+
+    stdout, _, _ = run_posish(
+        "trap 'echo t' USR1; sleep 0.5 & p=$!; (sleep 0.2; kill -USR1 $$) & wait $p; echo $?; wait $p; echo $?")
+    assert stdout.split("\n") == ["t", "138", "0"]
+
+    stdout, _, _ = run_posish("trap 'echo t' TERM; (sleep 0.1; kill -TERM $$) & sleep 0.5; echo $?")
+    assert stdout.split("\n") == ["t", "0"]
+
+    stdout, _, _ = run_posish("echo $$; (echo $$); (echo $$) & wait")
+    assert len(set(stdout.split("\n"))) == 1
+
 # ============================================================================
 # CATEGORY: Regression Tests (Recent Fixes)
 # ============================================================================
@@ -578,3 +1267,161 @@ def test_regression_positional_set_optimization():
     """
     expected = "start\nchanged\nlonger_string\ns"
     assert run_posish(script)[0] == expected
+
+# ============================================================================
+# CATEGORY: Line Editing
+# ============================================================================
+
+def test_emacs_editing_keys():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["echo wrld\x02\x02\x02o\r", "\x01\x0b", "exit\r"],
+                             env={"HOME": home})
+    assert "world" in pty_lines(out)
+
+def test_vi_mode_change_word():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["set -o vi\r", "echo hello world\x1b0wcwthere\x1b\r",
+                              "exit\r"], env={"HOME": home})
+    assert "there world" in pty_lines(out)
+
+def test_vi_mode_counts_undo_and_repeat():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["set -o vi\r",
+                              "echo a b c d e\x1b0w2dw\r",
+                              "echo one two three\x1b0wdwu.\r",
+                              "echo abcabc\x1b0fc;x\r",
+                              "exit\r"], env={"HOME": home})
+    lines = pty_lines(out)
+    assert "c d e" in lines
+    assert "two three" in lines
+    assert "ababc" in lines
+
+def test_vi_mode_history_search():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["set -o vi\r", "echo first\r", "echo second\r",
+                              "\x1b/fir\r", "\r", "exit\r"], env={"HOME": home})
+    assert pty_lines(out).count("first") == 2
+
+def test_fc_list_and_substitute():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["echo one\r", "echo two\r", "fc -l -2\r",
+                              "fc -s two=three 2\r", "fc -ln -1\r", "exit\r"],
+                             env={"HOME": home})
+    lines = pty_lines(out)
+    assert "1\techo one" in lines
+    assert "2\techo two" in lines
+    assert "three" in lines
+    # The re-executed command replaced "fc -s" in the history
+    assert "\techo three" in lines
+
+def test_fc_edit_multiline_command():
+    with tempfile.TemporaryDirectory() as home:
+        # The temporary file's path reaches the editor intact
+        tmpdir = os.path.join(home, "it's $HOME")
+        os.mkdir(tmpdir)
+        out = run_posish_pty(["for i in a b\r", "do echo x$i\r", "done\r",
+                              "fc\r", "exit\r"],
+                             env={"HOME": home, "FCEDIT": "sed -i s/x/y/",
+                                  "TMPDIR": tmpdir})
+        with open(os.path.join(home, ".sh_history")) as f:
+            saved = f.read()
+    lines = pty_lines(out)
+    assert "ya" in lines and "yb" in lines
+    # Multi-line entries keep their line structure in the history file
+    assert "#\t3\nfor i in a b\ndo echo y$i\ndone\n" in saved
+
+# ============================================================================
+# CATEGORY: Job Control
+# ============================================================================
+
+def test_wait_collects_background_status():
+    script = 'sh -c "exit 3" & p=$!; sleep 0.2; wait $p; echo $?; (exit 4) & wait $!; echo $?'
+    assert run_posish(script)[0] == "3\n4"
+
+def test_job_done_reported_before_prompt():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["sleep 0.1 &\r", "sleep 0.3\r", "exit\r"],
+                             env={"HOME": home})
+    assert re.search(r"\[1\][+-]?\s+Done\s+sleep 0\.1", out)
+
+def test_notify_redraws_input_line():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["set -b\r", "sleep 0.1 &\r", "echo pa", "", "",
+                              "rtial\r", "exit\r"], env={"HOME": home})
+    done = out.find("Done")
+    assert done != -1
+    # The partly typed line is shown again after the report and completes
+    assert "echo pa" in out[done:]
+    assert "partial" in pty_lines(out)
+
+def test_stop_and_resume_pipeline_job():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["sleep 5 | cat\r", "\x1a", "jobs -l\r", "fg %?cat\r",
+                              "\x03", "echo back\r", "exit\r"],
+                             env={"HOME": home}, timeout=4)
+    lines = pty_lines(out)
+    # Both processes of the pipeline stop and are listed with their pids
+    assert re.search(r"\[1\]\+ \d+\s+Stopped\s+sleep 5", out)
+    assert re.search(r"\d+\s+Stopped\s+\| cat", out)
+    assert "sleep 5 | cat" in lines
+    assert "back" in lines
+
+def test_interrupt_builtin_loops():
+    # ^C must stop builtin-only work within the pause between keys and
+    # leave the shell at its prompt with status 130
+    loops = ["while :; do :; done",
+             "i=0; until false; do i=$((i+1)); done",
+             "while :; do for i in $(seq 1000); do i=${i%0}; done; done",
+             "x=$(while :; do :; done)",
+             "f() { while :; do :; done; }; f > /dev/null",
+             "read line"]
+    keys = []
+    for n, loop in enumerate(loops):
+        keys += [loop + "\r", "\x03", "echo st%d=$?\r" % n]
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(keys + ["exit\r"], env={"HOME": home}, timeout=6)
+    lines = pty_lines(out)
+    for n in range(len(loops)):
+        assert "st%d=130" % n in lines
+
+def test_interrupt_ends_script():
+    script = 'trap "echo cleanup" EXIT; while :; do :; done; echo after'
+    process = subprocess.Popen([POSISH_PATH, "-c", script], stdout=subprocess.PIPE, text=True)
+    time.sleep(0.3)
+    process.send_signal(2)
+    out, _ = process.communicate(timeout=2)
+    assert process.returncode == 130
+    assert out.strip() == "cleanup"
+    # A trapped SIGINT runs the trap and the loop carries on
+    script = 'n=0; trap "n=$((n+1))" INT; while [ $n -lt 1 ]; do :; done; echo after'
+    process = subprocess.Popen([POSISH_PATH, "-c", script], stdout=subprocess.PIPE, text=True)
+    time.sleep(0.3)
+    process.send_signal(2)
+    out, _ = process.communicate(timeout=2)
+    assert out.strip() == "after"
+
+def test_status_130_is_not_an_interrupt():
+    # Only a child killed by SIGINT interrupts the shell, not one that
+    # exits with the status such a child would have
+    stdout, _, rc = run_posish('(exit 130); echo $?; sh -c "exit 130"; echo $?')
+    assert stdout == "130\n130"
+    assert rc == 0
+    stdout, _, rc = run_posish('sh -c "kill -INT \\$\\$"; echo after')
+    assert stdout == ""
+    assert rc == 130
+
+def test_pipeline_shares_process_group():
+    with tempfile.TemporaryDirectory() as home:
+        out = run_posish_pty(["sleep 2 | sleep 2 &\r",
+                              "[ $(ps -o pgid= -p $!) = $(jobs -p) ] && echo same\r",
+                              "kill %1\r", "exit\r"], env={"HOME": home})
+    assert "same" in pty_lines(out)
+
+def test_job_specs():
+    script = "sleep 3 & sleep 4 & jobs %?3; jobs %-; jobs %+; jobs %sl; kill %1 %2"
+    stdout, stderr, _ = run_posish(script)
+    lines = stdout.split("\n")
+    assert re.match(r"\[1\]- +Running +sleep 3$", lines[0])
+    assert lines[1] == lines[0]
+    assert re.match(r"\[2\]\+ +Running +sleep 4$", lines[2])
+    assert "ambiguous" in stderr